@@ -16,8 +16,21 @@ void *ast_dup(const void *src, size_t size) {
     return ptr;
 }
 
+// Moves a stretchy buffer built by the parser into the arena.
+void *ast_buf(void *buf, size_t elem_size) {
+    void *ptr = ast_dup(buf, buf_len(buf) * elem_size);
+    if (buf) {
+        free(buf__hdr(buf));
+    }
+    return ptr;
+}
+
 #define AST_DUP(x) ast_dup(x, num_##x * sizeof(*x))
 
+Note note(SrcPos pos, const char *name, Expr **args, size_t num_args) {
+    return (Note){pos, name, AST_DUP(args), num_args};
+}
+
 NoteList note_list(Note *notes, size_t num_notes) {
     return (NoteList){AST_DUP(notes), num_notes};
 }
@@ -40,6 +53,13 @@ Typespec *typespec_name(SrcPos pos, const char *name) {
 
 }
 
+Typespec *typespec_generic(SrcPos pos, const char *name, Typespec **type_args, size_t num_type_args) {
+    Typespec *t = typespec_name(pos, name);
+    t->type_args = AST_DUP(type_args);
+    t->num_type_args = num_type_args;
+    return t;
+}
+
 Typespec *typespec_ptr(SrcPos pos, Typespec *base) {
     Typespec *t = typespec_new(TYPESPEC_PTR, pos);
     t->base = base;
@@ -59,6 +79,13 @@ Typespec *typespec_array(SrcPos pos, Typespec *elem, Expr *size) {
     return t;
 }
 
+Typespec *typespec_vector(SrcPos pos, Typespec *elem, Expr *num_lanes) {
+    Typespec *t = typespec_new(TYPESPEC_VECTOR, pos);
+    t->base = elem;
+    t->num_elems = num_lanes;
+    return t;
+}
+
 Typespec *typespec_func(SrcPos pos, Typespec **args, size_t num_args, Typespec *ret, bool has_varargs) {
     Typespec *t = typespec_new(TYPESPEC_FUNC, pos);
     t->func.args = AST_DUP(args);
@@ -83,9 +110,9 @@ Decl *decl_new(DeclKind kind, SrcPos pos, const char *name) {
     return d;
 }
 
-Note *get_decl_note(Decl *decl, const char *name) {
-    for (size_t i = 0; i < decl->notes.num_notes; i++) {
-        Note *note = decl->notes.notes + i;
+Note *get_note(NoteList notes, const char *name) {
+    for (size_t i = 0; i < notes.num_notes; i++) {
+        Note *note = notes.notes + i;
         if (note->name == name) {
             return note;
         }
@@ -93,10 +120,18 @@ Note *get_decl_note(Decl *decl, const char *name) {
     return NULL;
 }
 
+Note *get_decl_note(Decl *decl, const char *name) {
+    return get_note(decl->notes, name);
+}
+
 bool is_decl_foreign(Decl *decl) {
     return get_decl_note(decl, foreign_name) != NULL;
 }
 
+bool is_decl_soa(Decl *decl) {
+    return get_decl_note(decl, soa_name) != NULL;
+}
+
 Decl *decl_enum(SrcPos pos, const char *name, EnumItem *items, size_t num_items) {
     Decl *d = decl_new(DECL_ENUM, pos, name);
     d->enum_decl.items = AST_DUP(items);
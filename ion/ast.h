@@ -6,6 +6,8 @@ typedef struct Typespec Typespec;
 typedef struct Note {
     SrcPos pos;
     const char *name;
+    Expr **args;
+    size_t num_args;
 } Note;
 
 typedef struct NoteList {
@@ -28,6 +30,7 @@ typedef enum TypespecKind {
     TYPESPEC_ARRAY,
     TYPESPEC_PTR,
     TYPESPEC_CONST,
+    TYPESPEC_VECTOR,
 } TypespecKind;
 
 struct Typespec {
@@ -35,6 +38,9 @@ struct Typespec {
     SrcPos pos;
     struct Type *type;
     Typespec *base;
+    // Type arguments of a generic struct name like Pair<int, float>.
+    Typespec **type_args;
+    size_t num_type_args;
     union {
         const char *name;
         struct {
@@ -58,6 +64,7 @@ typedef struct AggregateItem {
     const char **names;
     size_t num_names;
     Typespec *type;
+    NoteList notes;
 } AggregateItem;
 
 typedef struct EnumItem {
@@ -83,6 +90,11 @@ struct Decl {
     const char *name;
     struct Sym *sym;
     NoteList notes;
+    // Generic declarations keep their source so each instance can be parsed afresh with its type_args bound.
+    const char **type_params;
+    size_t num_type_params;
+    struct Type **type_args;
+    const char *generic_src;
     union {
         struct {
             EnumItem *items;
@@ -135,6 +147,20 @@ typedef enum ExprKind {
     EXPR_SIZEOF_TYPE,
 } ExprKind;
 
+typedef enum BuiltinFunc {
+    BUILTIN_NONE,
+    BUILTIN_POPCOUNT,
+    BUILTIN_CLZ,
+    BUILTIN_CTZ,
+    BUILTIN_BSWAP,
+    BUILTIN_ROTL,
+    BUILTIN_ROTR,
+    BUILTIN_PREFETCH,
+    BUILTIN_EXPECT,
+    BUILTIN_LIKELY,
+    BUILTIN_UNLIKELY,
+} BuiltinFunc;
+
 typedef enum CompoundFieldKind {
     FIELD_DEFAULT,
     FIELD_NAME,
@@ -155,6 +181,9 @@ struct Expr {
     ExprKind kind;
     SrcPos pos;
     struct Type *type;
+    // Set by the resolver for integer and pointer constant expressions.
+    bool is_const;
+    Val val;
     union {
         struct {
             unsigned long long val;
@@ -199,6 +228,10 @@ struct Expr {
             Expr *expr;
             Expr **args;
             size_t num_args;            
+            BuiltinFunc builtin;
+            bool is_folded;
+            unsigned long long folded_val;
+            const void *folded_data;
         } call;
         struct {
             Expr *expr;
@@ -218,11 +251,22 @@ typedef struct ElseIf {
 
 typedef struct SwitchCase {
     Expr **exprs;
+    // Upper bounds of case ranges like 'a'...'z', parallel to exprs and NULL for single values.
+    Expr **ends;
     size_t num_exprs;
     bool is_default;
     StmtList block;
 } SwitchCase;
 
+// A run of consecutive values that select the same case of an integer switch. Values are ordered as unsigned
+// keys, with signed values biased by 2^63, and the runs are sorted and disjoint.
+typedef struct SwitchRange {
+    unsigned long long lo;
+    unsigned long long hi;
+    size_t case_index;
+    SrcPos pos;
+} SwitchRange;
+
 typedef enum StmtKind {
     STMT_NONE,
     STMT_DECL,
@@ -267,6 +311,10 @@ struct Stmt {
             Expr *expr;
             SwitchCase *cases;
             size_t num_cases;            
+            struct StrSwitch *str_switch;
+            struct SwitchRange *ranges;
+            size_t num_ranges;
+            bool is_sparse;
         } switch_stmt;
         StmtList block;
         struct {
@@ -0,0 +1,549 @@
+// Benchmarks, run with `ion bench <benchmark> [args...]`. Inputs can be made with generate_test.py, and bench.py
+// runs `ion bench phases` over generated inputs of several styles and sizes.
+
+double bench_now(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct ArenaBenchPolicy {
+    const char *name;
+    unsigned policy;
+    bool presized;
+} ArenaBenchPolicy;
+
+// Parses the file with ast_arena under each block policy and reports the best of a few runs. A warm-up parse
+// interns every name first, so the runs differ only in how the AST arena gets its memory.
+void arena_bench(const char *path) {
+    char *str = read_file(path);
+    if (!str) {
+        fatal("Can't read %s", path);
+    }
+    size_t len = strlen(str);
+    ArenaBenchPolicy policies[] = {
+        {"fixed malloc", 0, false},
+        {"geometric malloc", ARENA_GROW_GEOMETRIC, false},
+        {"presized malloc", ARENA_GROW_GEOMETRIC, true},
+        {"fixed mmap", ARENA_USE_MMAP, false},
+        {"geometric mmap", ARENA_GROW_GEOMETRIC | ARENA_USE_MMAP, false},
+        {"presized mmap", ARENA_GROW_GEOMETRIC | ARENA_USE_MMAP, true},
+        {"geometric mmap huge", ARENA_GROW_GEOMETRIC | ARENA_USE_MMAP | ARENA_HUGE_PAGES, false},
+        {"presized mmap huge", ARENA_GROW_GEOMETRIC | ARENA_USE_MMAP | ARENA_HUGE_PAGES, true},
+    };
+    enum { NUM_RUNS = 3 };
+    unsigned saved_policy = arena_policy;
+    init_stream(path, str);
+    parse_file();
+    printf("%-22s %10s %8s %10s\n", "policy", "parse ms", "blocks", "MB/s");
+    for (size_t i = 0; i < sizeof(policies)/sizeof(*policies); i++) {
+        ArenaBenchPolicy *it = &policies[i];
+        double best = 0;
+        size_t num_blocks = 0;
+        for (int run = 0; run < NUM_RUNS; run++) {
+            arena_free(&ast_arena);
+            arena_policy = it->policy;
+            double start = bench_now();
+            if (it->presized) {
+                arena_reserve(&ast_arena, len * AST_BYTES_PER_SOURCE_BYTE);
+            }
+            init_stream(path, str);
+            parse_file();
+            double time = bench_now() - start;
+            if (run == 0 || time < best) {
+                best = time;
+            }
+            num_blocks = buf_len(ast_arena.blocks);
+        }
+        printf("%-22s %10.1f %8zu %10.1f\n", it->name, best * 1000, num_blocks, len / best / (1024 * 1024));
+    }
+    arena_free(&ast_arena);
+    arena_policy = saved_policy;
+    free(str);
+}
+
+// The linear-probing map that Map replaced, kept as a baseline: separate key and value arrays at 50% max load.
+typedef struct LinearMap {
+    void **keys;
+    void **vals;
+    size_t len;
+    size_t cap;
+} LinearMap;
+
+void *linear_map_get(LinearMap *map, void *key) {
+    if (map->len == 0) {
+        return NULL;
+    }
+    size_t i = (size_t)hash_ptr(key);
+    for (;;) {
+        i &= map->cap - 1;
+        if (map->keys[i] == key) {
+            return map->vals[i];
+        } else if (!map->keys[i]) {
+            return NULL;
+        }
+        i++;
+    }
+}
+
+void linear_map_put(LinearMap *map, void *key, void *val);
+
+void linear_map_grow(LinearMap *map, size_t new_cap) {
+    new_cap = MAX(16, new_cap);
+    LinearMap new_map = {
+        .keys = xcalloc(new_cap, sizeof(void *)),
+        .vals = xmalloc(new_cap * sizeof(void *)),
+        .cap = new_cap,
+    };
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->keys[i]) {
+            linear_map_put(&new_map, map->keys[i], map->vals[i]);
+        }
+    }
+    free(map->keys);
+    free(map->vals);
+    *map = new_map;
+}
+
+void linear_map_put(LinearMap *map, void *key, void *val) {
+    if (2*map->len >= map->cap) {
+        linear_map_grow(map, 2*map->cap);
+    }
+    size_t i = (size_t)hash_ptr(key);
+    for (;;) {
+        i &= map->cap - 1;
+        if (!map->keys[i]) {
+            map->len++;
+            map->keys[i] = key;
+            map->vals[i] = val;
+            return;
+        } else if (map->keys[i] == key) {
+            map->vals[i] = val;
+            return;
+        }
+        i++;
+    }
+}
+
+void linear_map_free(LinearMap *map) {
+    free(map->keys);
+    free(map->vals);
+    *map = (LinearMap){0};
+}
+
+uint64_t bench_rand_state = 0x9e3779b97f4a7c15;
+
+uint64_t bench_rand(void) {
+    uint64_t x = bench_rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return bench_rand_state = x;
+}
+
+void bench_shuffle(void **items, size_t len) {
+    for (size_t i = len; i > 1; i--) {
+        size_t j = bench_rand() % i;
+        void *tmp = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = tmp;
+    }
+}
+
+typedef struct MapBenchResult {
+    double insert_ns;
+    double hit_ns;
+    double miss_ns;
+    double bytes_per_key;
+} MapBenchResult;
+
+// Keys look like arena-allocated Sym pointers: a fixed stride from a common base. Misses use addresses between
+// keys, which share their high bits with the hits. volatile sinks keep the lookups from being optimized away.
+void **map_bench_keys(size_t len, size_t offset) {
+    void **keys = xmalloc(len * sizeof(void *));
+    for (size_t i = 0; i < len; i++) {
+        keys[i] = (void *)(uintptr_t)(0x10000000 + i*48 + offset);
+    }
+    bench_shuffle(keys, len);
+    return keys;
+}
+
+volatile uintptr_t map_bench_sink;
+
+MapBenchResult map_bench_new(void **keys, void **misses, size_t len, int rounds) {
+    MapBenchResult result = {0};
+    double start = bench_now();
+    Map map = {0};
+    for (int round = 0; round < rounds; round++) {
+        map_free(&map);
+        for (size_t i = 0; i < len; i++) {
+            map_put(&map, keys[i], keys[i]);
+        }
+    }
+    result.insert_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    uintptr_t sum = 0;
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < len; i++) {
+            sum += (uintptr_t)map_get(&map, keys[i]);
+        }
+    }
+    result.hit_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < len; i++) {
+            sum += (uintptr_t)map_get(&map, misses[i]);
+        }
+    }
+    result.miss_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    result.bytes_per_key = (double)map.cap * (sizeof(MapEntry) + 1) / len;
+    map_bench_sink = sum;
+    map_free(&map);
+    return result;
+}
+
+MapBenchResult map_bench_old(void **keys, void **misses, size_t len, int rounds) {
+    MapBenchResult result = {0};
+    double start = bench_now();
+    LinearMap map = {0};
+    for (int round = 0; round < rounds; round++) {
+        linear_map_free(&map);
+        for (size_t i = 0; i < len; i++) {
+            linear_map_put(&map, keys[i], keys[i]);
+        }
+    }
+    result.insert_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    uintptr_t sum = 0;
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < len; i++) {
+            sum += (uintptr_t)linear_map_get(&map, keys[i]);
+        }
+    }
+    result.hit_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < len; i++) {
+            sum += (uintptr_t)linear_map_get(&map, misses[i]);
+        }
+    }
+    result.miss_ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    result.bytes_per_key = (double)map.cap * 2 * sizeof(void *) / len;
+    map_bench_sink = sum;
+    linear_map_free(&map);
+    return result;
+}
+
+// Put/remove churn at a steady size, which only Map supports. Measures tombstone reuse and in-place rehashing.
+double map_bench_churn(void **keys, size_t len, int rounds) {
+    Map map = {0};
+    size_t live = len / 2;
+    for (size_t i = 0; i < live; i++) {
+        map_put(&map, keys[i], keys[i]);
+    }
+    double start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < len; i++) {
+            map_remove(&map, keys[i]);
+            map_put(&map, keys[(i + live) % len], keys[i]);
+        }
+    }
+    double ns = (bench_now() - start) * 1e9 / ((double)len * rounds);
+    map_free(&map);
+    return ns;
+}
+
+// Compares Map with the old linear-probing map on insert, hit and miss workloads over a range of sizes.
+void map_bench(size_t max_len) {
+    printf("%-8s %9s %8s %8s %8s %8s %10s\n", "map", "keys", "insert", "hit", "miss", "churn", "bytes/key");
+    for (size_t len = 800; len <= max_len; len *= 8) {
+        int rounds = (int)MAX(1, (8 << 20) / len);
+        void **keys = map_bench_keys(len, 0);
+        void **misses = map_bench_keys(len, 24);
+        MapBenchResult old = map_bench_old(keys, misses, len, rounds);
+        MapBenchResult new = map_bench_new(keys, misses, len, rounds);
+        double churn = map_bench_churn(keys, len, rounds);
+        printf("%-8s %9zu %8.1f %8.1f %8.1f %8s %10.1f\n", "linear", len, old.insert_ns, old.hit_ns, old.miss_ns, "-",
+            old.bytes_per_key);
+        printf("%-8s %9zu %8.1f %8.1f %8.1f %8.1f %10.1f\n", "swiss", len, new.insert_ns, new.hit_ns, new.miss_ns, churn,
+            new.bytes_per_key);
+        free(keys);
+        free(misses);
+    }
+    printf("(times in ns per operation)\n");
+}
+
+typedef enum LexBenchPhase {
+    LEX_BENCH_SCAN,
+    LEX_BENCH_TOKEN_ARRAY,
+    LEX_BENCH_PARSE_STREAM,
+    LEX_BENCH_PARSE_TOKEN_ARRAY,
+    NUM_LEX_BENCH_PHASES,
+} LexBenchPhase;
+
+const char *lex_bench_phase_names[] = {
+    [LEX_BENCH_SCAN] = "scan tokens",
+    [LEX_BENCH_TOKEN_ARRAY] = "fill token array",
+    [LEX_BENCH_PARSE_STREAM] = "lex+parse",
+    [LEX_BENCH_PARSE_TOKEN_ARRAY] = "parse token array",
+};
+
+// Lexes the file repeated copies times, back to back in one buffer, and reports token throughput: scanning one
+// token at a time, filling a token array, and parsing from either. The first pass of each interns every name,
+// so the timed passes measure steady-state work.
+void lex_bench(const char *path, int copies) {
+    char *src = read_file(path);
+    if (!src) {
+        fatal("Can't read %s", path);
+    }
+    char *str = NULL;
+    for (int i = 0; i < copies; i++) {
+        buf_printf(str, "%s\n", src);
+    }
+    size_t len = buf_len(str);
+    enum { NUM_RUNS = 5 };
+    TokenArray tokens = {0};
+    size_t num_tokens = 0;
+    size_t num_keywords = 0;
+    printf("%-20s %10s %14s %10s\n", "phase", "ms", "M tokens/s", "MB/s");
+    for (LexBenchPhase phase = 0; phase < NUM_LEX_BENCH_PHASES; phase++) {
+        double best = 0;
+        for (int run = 0; run <= NUM_RUNS; run++) {
+            if (phase == LEX_BENCH_PARSE_TOKEN_ARRAY) {
+                init_token_array(&tokens, path, str);
+            }
+            arena_reset(&ast_arena);
+            double start = bench_now();
+            switch (phase) {
+            case LEX_BENCH_SCAN:
+                num_tokens = 0;
+                num_keywords = 0;
+                init_stream(path, str);
+                while (!is_token(TOKEN_EOF)) {
+                    num_keywords += is_token(TOKEN_KEYWORD);
+                    num_tokens++;
+                    next_token();
+                }
+                break;
+            case LEX_BENCH_TOKEN_ARRAY:
+                init_token_array(&tokens, path, str);
+                break;
+            case LEX_BENCH_PARSE_STREAM:
+                init_stream(path, str);
+                parse_file();
+                break;
+            case LEX_BENCH_PARSE_TOKEN_ARRAY:
+                parse_file();
+                break;
+            default:
+                assert(0);
+                break;
+            }
+            double time = bench_now() - start;
+            if (run == 1 || (run > 1 && time < best)) {
+                best = time;
+            }
+        }
+        printf("%-20s %10.1f %14.1f %10.1f\n", lex_bench_phase_names[phase], best * 1000, num_tokens / best / 1e6,
+            len / best / (1024 * 1024));
+    }
+    size_t array_size = buf_sizeof(tokens.kinds) + buf_sizeof(tokens.mods) + buf_sizeof(tokens.offsets) +
+        buf_sizeof(tokens.lines) + buf_sizeof(tokens.vals) + buf_sizeof(tokens.matches);
+    printf("%zu tokens (%zu keywords) in %.1f MB, token array %.1f MB\n", num_tokens, num_keywords,
+        len / (1024.0 * 1024), array_size / (1024.0 * 1024));
+    free_token_array(&tokens);
+    arena_reset(&ast_arena);
+    buf_free(str);
+    free(src);
+}
+
+const char *expr_bench_binary_ops[] = {
+    "*", "/", "%", "&", "<<", ">>", "+", "-", "^", "|", "==", "!=", "<", ">", "<=", ">=", "&&", "||",
+};
+
+// Appends a random expression over a, b and c, in the style of generated numeric code: mostly binary operators of
+// every precedence, with some unary operators, parentheses, calls, ternaries and literals.
+void expr_bench_gen(char **buf, int depth) {
+    uint64_t r = bench_rand();
+    if (depth == 0 || r % 16 == 0) {
+        switch (r / 16 % 5) {
+        case 0: buf_printf(*buf, "a"); break;
+        case 1: buf_printf(*buf, "b"); break;
+        case 2: buf_printf(*buf, "c[%d]", (int)(r >> 8) % 4); break;
+        case 3: buf_printf(*buf, "%d", (int)(r >> 8) % 1000); break;
+        default: buf_printf(*buf, "p.x"); break;
+        }
+        return;
+    }
+    switch (r / 16 % 16) {
+    case 0:
+        // Unary minus always gets parentheses so two in a row can't lex as --.
+        buf_printf(*buf, r & 0x100 ? "~" : "-(");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, r & 0x100 ? "" : ")");
+        break;
+    case 1:
+        buf_printf(*buf, "(");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, ")");
+        break;
+    case 2:
+        buf_printf(*buf, "f(");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, ", ");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, ")");
+        break;
+    case 3:
+        buf_printf(*buf, "(");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, " ? ");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, " : ");
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, ")");
+        break;
+    default: {
+        size_t num_ops = sizeof(expr_bench_binary_ops) / sizeof(*expr_bench_binary_ops);
+        expr_bench_gen(buf, depth - 1);
+        buf_printf(*buf, " %s ", expr_bench_binary_ops[(r >> 8) % num_ops]);
+        expr_bench_gen(buf, depth - 1);
+        break;
+    }
+    }
+}
+
+// Parses generated functions whose bodies are long expressions. The source is lexed into a token array first so
+// only the parser is timed.
+void expr_bench(int num_funcs) {
+    char *str = NULL;
+    bench_rand_state = 0x9e3779b97f4a7c15;
+    for (int i = 0; i < num_funcs; i++) {
+        buf_printf(str, "func f%d(a: int, b: int, c: int*, p: P): int {\n", i);
+        for (int j = 0; j < 4; j++) {
+            buf_printf(str, "    x%d := ", j);
+            expr_bench_gen(&str, 6);
+            buf_printf(str, ";\n");
+        }
+        buf_printf(str, "    return ");
+        expr_bench_gen(&str, 8);
+        buf_printf(str, ";\n}\n\n");
+    }
+    size_t len = buf_len(str);
+    TokenArray tokens = {0};
+    init_token_array(&tokens, "<expr bench>", str);
+    // A warm-up parse sizes the AST. Later runs reuse one pre-faulted block, so page faults stay out of the timing.
+    arena_free(&ast_arena);
+    parse_file();
+    size_t ast_size = 0;
+    for (size_t i = 0; i < buf_len(ast_arena.blocks); i++) {
+        ast_size += ast_arena.blocks[i].size;
+    }
+    ast_size -= ast_arena.end - ast_arena.ptr;
+    arena_free(&ast_arena);
+    arena_reserve(&ast_arena, ast_size + ast_size/8);
+    enum { NUM_RUNS = 5 };
+    double best = 0;
+    for (int run = 0; run <= NUM_RUNS; run++) {
+        load_token(0);
+        arena_reset(&ast_arena);
+        double start = bench_now();
+        parse_file();
+        double time = bench_now() - start;
+        if (run == 1 || (run > 1 && time < best)) {
+            best = time;
+        }
+    }
+    size_t num_tokens = buf_len(tokens.kinds);
+    printf("%d functions, %.1f MB, %zu tokens, %.1f MB of AST\n", num_funcs, len / (1024.0 * 1024), num_tokens,
+        ast_size / (1024.0 * 1024));
+    printf("parse %.1f ms, %.1f M tokens/s, %.1f MB/s\n", best * 1000, num_tokens / best / 1e6,
+        len / best / (1024 * 1024));
+    free_token_array(&tokens);
+    arena_free(&ast_arena);
+    buf_free(str);
+}
+
+long bench_peak_rss_kb(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Compiles one file to C the way the driver does with --token-array, so that lexing can be timed on its own, and
+// prints one line of key=value pairs for bench.py. Run it in a fresh process per input so the peak RSS belongs to
+// that input alone.
+void phases_bench(const char *path) {
+    double start = bench_now();
+    char *str = read_file(path);
+    if (!str) {
+        fatal("Can't read %s", path);
+    }
+    size_t len = strlen(str);
+    size_t num_lines = 1;
+    for (const char *ptr = str; *ptr; ptr++) {
+        num_lines += *ptr == '\n';
+    }
+    ion_reserve_arenas(len);
+    double read_time = bench_now() - start;
+    start = bench_now();
+    init_token_array(&ion_tokens, path, str);
+    double lex_time = bench_now() - start;
+    start = bench_now();
+    init_builtins();
+    double builtins_time = bench_now() - start;
+    start = bench_now();
+    DeclSet *declset = parse_file();
+    double parse_time = bench_now() - start;
+    start = bench_now();
+    sym_global_decls(declset);
+    finalize_syms();
+    double resolve_time = builtins_time + bench_now() - start;
+    start = bench_now();
+    gen_all();
+    double gen_time = bench_now() - start;
+    printf("lines=%zu bytes=%zu tokens=%zu decls=%zu read_ms=%.3f lex_ms=%.3f parse_ms=%.3f resolve_ms=%.3f "
+        "gen_ms=%.3f peak_rss_kb=%ld\n", num_lines, len, buf_len(ion_tokens.kinds), declset->num_decls,
+        read_time * 1000, lex_time * 1000, parse_time * 1000, resolve_time * 1000, gen_time * 1000,
+        bench_peak_rss_kb());
+    free(str);
+}
+
+int bench_main(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[0], "arena") == 0) {
+        arena_bench(argv[1]);
+        return 0;
+    }
+    if (argc == 2 && strcmp(argv[0], "phases") == 0) {
+        phases_bench(argv[1]);
+        return 0;
+    }
+    if (argc >= 2 && argc <= 3 && strcmp(argv[0], "lex") == 0) {
+        lex_bench(argv[1], argc == 3 ? atoi(argv[2]) : 100);
+        return 0;
+    }
+    if (argc >= 1 && argc <= 2 && strcmp(argv[0], "expr") == 0) {
+        expr_bench(argc == 2 ? atoi(argv[1]) : 2000);
+        return 0;
+    }
+    if (argc >= 1 && argc <= 2 && strcmp(argv[0], "map") == 0) {
+        map_bench(argc == 2 ? strtoull(argv[1], NULL, 10) : 1 << 20);
+        return 0;
+    }
+    printf("Usage: ion bench phases <ion-source-file>\n");
+    printf("       ion bench arena <ion-source-file>\n");
+    printf("       ion bench lex <ion-source-file> [copies]\n");
+    printf("       ion bench expr [functions]\n");
+    printf("       ion bench map [max-keys]\n");
+    return 1;
+}
@@ -0,0 +1,156 @@
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+sys.dont_write_bytecode = True
+import generate_test
+
+# Runs `ion bench phases` over generate_test.py inputs of every style and size, one process per input so peak RSS
+# is per input. Reports per-phase times, fits how each phase scales with input size, and compares against a
+# stored baseline. Exits non-zero on a regression or on superlinear scaling.
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_ION = os.path.join(SCRIPT_DIR, "ion_mac" if sys.platform == "darwin" else "ion_linux",
+                           "ion_mac" if sys.platform == "darwin" else "ion_linux")
+DEFAULT_BASELINE = os.path.join(SCRIPT_DIR, "bench_baseline.json")
+PHASES = ["lex", "parse", "resolve", "gen"]
+
+def parse_size(text):
+    text = text.strip().upper()
+    if text.endswith("K"):
+        return int(text[:-1]) * 1024
+    return int(text)
+
+def size_name(size):
+    return "%dK" % (size // 1024) if size % 1024 == 0 else str(size)
+
+def run_phases(ion, path, repeat):
+    best = None
+    for _ in range(repeat):
+        out = subprocess.run([ion, "bench", "phases", path], check=True, stdout=subprocess.PIPE,
+                             universal_newlines=True).stdout
+        line = out.strip().splitlines()[-1]
+        result = {}
+        for field in line.split():
+            key, val = field.split("=")
+            result[key] = float(val) if "." in val else int(val)
+        # Phases are noisy upward, so keep the fastest run of each.
+        if best is None:
+            best = result
+        else:
+            for phase in PHASES:
+                best[phase + "_ms"] = min(best[phase + "_ms"], result[phase + "_ms"])
+            best["peak_rss_kb"] = min(best["peak_rss_kb"], result["peak_rss_kb"])
+    best["total_ms"] = round(sum(best[phase + "_ms"] for phase in PHASES), 3)
+    return best
+
+# Least-squares slope of log(ms) against log(tokens): 1 is linear, 2 is quadratic.
+def fit_exponent(points):
+    xs = [math.log(x) for x, _ in points]
+    ys = [math.log(y) for _, y in points]
+    mx = sum(xs) / len(xs)
+    my = sum(ys) / len(ys)
+    num = sum((x - mx) * (y - my) for x, y in zip(xs, ys))
+    den = sum((x - mx) ** 2 for x in xs)
+    return num / den if den else 0.0
+
+def print_results(results):
+    print("%-9s %6s %9s %9s %9s %10s %9s %9s %12s %9s" %
+          ("style", "size", "lines", "lex_ms", "parse_ms", "resolve_ms", "gen_ms", "total_ms", "lines/s", "rss_mb"))
+    for key, r in results.items():
+        style, size = key.split("/")
+        lines_per_sec = r["lines"] / (r["total_ms"] / 1000) if r["total_ms"] > 0 else 0
+        print("%-9s %6s %9d %9.1f %9.1f %10.1f %9.1f %9.1f %12.0f %9.1f" %
+              (style, size, r["lines"], r["lex_ms"], r["parse_ms"], r["resolve_ms"], r["gen_ms"], r["total_ms"],
+               lines_per_sec, r["peak_rss_kb"] / 1024))
+
+# Points below min_ms are mostly timer and startup noise, so they're left out of the fit.
+def check_scaling(results, styles, max_exponent, min_ms):
+    failures = []
+    print("\nscaling exponents (time vs tokens, fitted over phases above %g ms):" % min_ms)
+    for style in styles:
+        runs = [r for key, r in results.items() if key.split("/")[0] == style]
+        fits = []
+        for phase in PHASES + ["total"]:
+            points = [(r["tokens"], r[phase + "_ms"]) for r in runs if r[phase + "_ms"] >= min_ms]
+            if len(points) < 2:
+                fits.append("%s=-" % phase)
+                continue
+            exponent = fit_exponent(points)
+            fits.append("%s=%.2f" % (phase, exponent))
+            if exponent > max_exponent:
+                failures.append("%s %s scales as n^%.2f" % (style, phase, exponent))
+        print("%-9s %s" % (style, " ".join(fits)))
+    return failures
+
+# Phases under min_ms in the baseline are too short to compare reliably.
+def check_baseline(results, baseline, tolerance, min_ms):
+    failures = []
+    for key, r in results.items():
+        base = baseline.get(key)
+        if not base:
+            continue
+        for field in [phase + "_ms" for phase in PHASES] + ["peak_rss_kb"]:
+            if field.endswith("_ms") and base[field] < min_ms:
+                continue
+            if r[field] > base[field] * (1 + tolerance):
+                failures.append("%s %s: %g vs baseline %g" % (key, field, r[field], base[field]))
+    return failures
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the Ion compiler on generated inputs.")
+    parser.add_argument("--ion", default=DEFAULT_ION, help="path to the ion executable")
+    parser.add_argument("--styles", default=",".join(sorted(generate_test.STYLES)))
+    parser.add_argument("--sizes", default="1K,8K,64K,512K", help="declaration counts, e.g. 1K,8K,64K")
+    parser.add_argument("--repeat", type=int, default=1, help="runs per input; the fastest is kept")
+    parser.add_argument("--baseline", default=DEFAULT_BASELINE)
+    parser.add_argument("--update-baseline", action="store_true", help="write the results as the new baseline")
+    parser.add_argument("--tolerance", type=float, default=0.5, help="allowed slowdown against the baseline")
+    # Cache and page-fault effects at the largest sizes push linear phases to about 1.2; quadratic ones fit near 2.
+    parser.add_argument("--max-exponent", type=float, default=1.3, help="largest acceptable scaling exponent")
+    parser.add_argument("--min-ms", type=float, default=10.0, help="ignore phases faster than this")
+    args = parser.parse_args()
+
+    styles = args.styles.split(",")
+    sizes = [parse_size(size) for size in args.sizes.split(",")]
+    for style in styles:
+        if style not in generate_test.STYLES:
+            parser.error("unknown style %s" % style)
+
+    results = {}
+    with tempfile.TemporaryDirectory(prefix="ion-bench-") as temp_dir:
+        for style in styles:
+            for size in sizes:
+                path = os.path.join(temp_dir, "%s_%s.ion" % (style, size_name(size)))
+                with open(path, "w") as out:
+                    generate_test.generate(out, style, size)
+                results["%s/%s" % (style, size_name(size))] = run_phases(args.ion, path, args.repeat)
+                os.remove(path)
+
+    print_results(results)
+    failures = check_scaling(results, styles, args.max_exponent, args.min_ms)
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as out:
+            json.dump(results, out, indent=4, sort_keys=True)
+            out.write("\n")
+        print("\nwrote %s" % args.baseline)
+    elif os.path.exists(args.baseline):
+        with open(args.baseline) as file:
+            baseline = json.load(file)
+        regressions = check_baseline(results, baseline, args.tolerance, args.min_ms)
+        print("\n%d regressions against %s" % (len(regressions), args.baseline))
+        failures += regressions
+    else:
+        print("\nno baseline at %s; run with --update-baseline to record one" % args.baseline)
+
+    for failure in failures:
+        print("FAIL: " + failure)
+    return 1 if failures else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,323 @@
+// Compiles generated C to object files through a content-addressed cache. The key hashes the preprocessed C text
+// together with the compiler's identity and flags, so an unchanged program is never handed to the C compiler twice,
+// while an edit to any header it includes, directly or through --cflags, still forces a recompile. Entries are
+// written under a temporary name and renamed into place, which keeps concurrent -j workers from reading a partial
+// object.
+
+enum {
+    CC_CACHE_VERSION = 3,
+};
+
+// The C compiler to run on generated code, or NULL to only write the .c file.
+const char *cc_path;
+const char *cc_flags = "-O2";
+const char *cc_cache_dir = ".ion-cache";
+
+size_t cc_cache_hits;
+size_t cc_cache_misses;
+
+uint64_t cc_rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t cc_fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccd;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3 x64_128. Bytes are read in host order, which is fine for a cache that never leaves the machine.
+void cc_hash128(const char *buf, size_t len, uint64_t out[2]) {
+    const uint64_t c1 = 0x87c37b91114253d5;
+    const uint64_t c2 = 0x4cf5ad432745937f;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+    size_t num_blocks = len / 16;
+    for (size_t i = 0; i < num_blocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, buf + 16*i, 8);
+        memcpy(&k2, buf + 16*i + 8, 8);
+        k1 *= c1;
+        k1 = cc_rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = cc_rotl64(h1, 27);
+        h1 += h2;
+        h1 = h1*5 + 0x52dce729;
+        k2 *= c2;
+        k2 = cc_rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = cc_rotl64(h2, 31);
+        h2 += h1;
+        h2 = h2*5 + 0x38495ab5;
+    }
+    const uint8_t *tail = (const uint8_t *)buf + 16*num_blocks;
+    size_t tail_len = len & 15;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (size_t i = 0; i < tail_len; i++) {
+        if (i < 8) {
+            k1 |= (uint64_t)tail[i] << (8*i);
+        } else {
+            k2 |= (uint64_t)tail[i] << (8*(i - 8));
+        }
+    }
+    if (tail_len > 8) {
+        k2 *= c2;
+        k2 = cc_rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+    }
+    if (tail_len > 0) {
+        k1 *= c1;
+        k1 = cc_rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = cc_fmix64(h1);
+    h2 = cc_fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+// Appends cc_flags to argv, split on whitespace. There is no quoting.
+void cc_push_flags(char ***argv) {
+    const char *ptr = cc_flags;
+    for (;;) {
+        while (isspace(*ptr)) {
+            ptr++;
+        }
+        if (!*ptr) {
+            break;
+        }
+        const char *start = ptr;
+        while (*ptr && !isspace(*ptr)) {
+            ptr++;
+        }
+        buf_push(*argv, strf("%.*s", (int)(ptr - start), start));
+    }
+}
+
+// The compiler's command line for one mode, such as -c or -E, on c_path. obj_path may be NULL.
+char **cc_argv(const char *mode, const char *c_path, const char *obj_path) {
+    char **argv = NULL;
+    buf_push(argv, strf("%s", cc_path));
+    cc_push_flags(&argv);
+    buf_push(argv, strf("%s", mode));
+    buf_push(argv, strf("%s", c_path));
+    if (obj_path) {
+        buf_push(argv, strf("-o"));
+        buf_push(argv, strf("%s", obj_path));
+    }
+    buf_push(argv, NULL);
+    return argv;
+}
+
+void cc_free_argv(char **argv) {
+    for (char **it = argv; *it; it++) {
+        free(*it);
+    }
+    buf_free(argv);
+}
+
+// Runs argv[0] directly rather than through a shell, so file names are never interpreted. If out is non-NULL the
+// program's stdout is appended to it. Returns the exit status, or -1 if the program couldn't be run.
+int cc_run(char **argv, char **out) {
+    fflush(stdout);
+#ifdef _WIN32
+    (void)out;
+    return (int)_spawnvp(_P_WAIT, argv[0], (const char *const *)argv);
+#else
+    int fds[2] = {-1, -1};
+    if (out && pipe(fds) != 0) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (out) {
+            dup2(fds[1], STDOUT_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+        }
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    if (out) {
+        close(fds[1]);
+        char chunk[4096];
+        ssize_t n;
+        while (pid > 0 && (n = read(fds[0], chunk, sizeof(chunk))) > 0) {
+            for (ssize_t i = 0; i < n; i++) {
+                buf_push(*out, chunk[i]);
+            }
+        }
+        close(fds[0]);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+#endif
+}
+
+// The compiler's path, its --version output, and the size and modification time of its binary, so that upgrading
+// the toolchain behind the same path invalidates the cache. Computed once per process.
+const char *cc_identity(void) {
+    static char *identity;
+    if (identity) {
+        return identity;
+    }
+    buf_printf(identity, "%s\n", cc_path);
+    char *version_argv[] = {(char *)cc_path, "--version", NULL};
+    char *version = NULL;
+    cc_run(version_argv, &version);
+    buf_printf(identity, "%.*s\n", (int)buf_len(version), version);
+    buf_free(version);
+#ifndef _WIN32
+    char *binary = NULL;
+    if (strchr(cc_path, '/')) {
+        binary = strf("%s", cc_path);
+    } else {
+        const char *dirs = getenv("PATH");
+        while (dirs && *dirs && !binary) {
+            const char *end = strchr(dirs, ':');
+            size_t len = end ? (size_t)(end - dirs) : strlen(dirs);
+            char *candidate = strf("%.*s/%s", (int)len, len ? dirs : ".", cc_path);
+            if (access(candidate, X_OK) == 0) {
+                binary = candidate;
+            } else {
+                free(candidate);
+            }
+            dirs = end ? end + 1 : NULL;
+        }
+    }
+    struct stat st;
+    if (binary && stat(binary, &st) == 0) {
+        buf_printf(identity, "%lld %lld\n", (long long)st.st_size, (long long)st.st_mtime);
+    }
+    free(binary);
+#endif
+    return identity;
+}
+
+// The key is a 128-bit hash of a header naming the compiler and flags followed by the C text, as 32 hex digits.
+// cc_compile passes the preprocessed text where it can get it.
+char *cc_cache_key(const char *c_code, size_t len) {
+    char *text = NULL;
+    buf_printf(text, "ion cc cache %d\n%s%s\n", CC_CACHE_VERSION, cc_identity(), cc_flags);
+    buf_fit(text, buf_len(text) + len);
+    memcpy(text + buf_len(text), c_code, len);
+    uint64_t hash[2];
+    cc_hash128(text, buf_len(text) + len, hash);
+    buf_free(text);
+    return strf("%016" PRIx64 "%016" PRIx64, hash[0], hash[1]);
+}
+
+bool copy_file(const char *src_path, const char *dest_path) {
+    FILE *src = fopen(src_path, "rb");
+    if (!src) {
+        return false;
+    }
+    FILE *dest = fopen(dest_path, "wb");
+    if (!dest) {
+        fclose(src);
+        return false;
+    }
+    char buf[64 * 1024];
+    bool ok = true;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), src)) > 0) {
+        if (fwrite(buf, 1, n, dest) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && !ferror(src);
+    fclose(src);
+    ok = fclose(dest) == 0 && ok;
+    return ok;
+}
+
+bool file_exists(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file) {
+        fclose(file);
+    }
+    return file != NULL;
+}
+
+void make_dir(const char *path) {
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0777);
+#endif
+}
+
+// Produces obj_path from the C file at c_path, whose contents are c_code. A cache hit copies the stored object;
+// a miss runs the compiler and stores its output. On Windows cc_run can't capture the preprocessor's output, so
+// the key covers only the generated C and a changed header needs --cc-cache pointed at a fresh directory.
+bool cc_compile(const char *c_path, const char *c_code, size_t len, const char *obj_path) {
+    make_dir(cc_cache_dir);
+    char *preprocessed = NULL;
+#ifndef _WIN32
+    // The generated C only names its headers, so hash what the preprocessor makes of them as well.
+    char **pp_argv = cc_argv("-E", c_path, NULL);
+    int pp_status = cc_run(pp_argv, &preprocessed);
+    cc_free_argv(pp_argv);
+    if (pp_status != 0) {
+        buf_free(preprocessed);
+        printf("%s: C compiler failed: %s\n", c_path, cc_path);
+        return false;
+    }
+    c_code = preprocessed;
+    len = buf_len(preprocessed);
+#endif
+    char *key = cc_cache_key(c_code, len);
+    buf_free(preprocessed);
+    char *cache_path = strf("%s/%s.o", cc_cache_dir, key);
+    bool ok;
+    if (file_exists(cache_path)) {
+        cc_cache_hits++;
+        ok = copy_file(cache_path, obj_path);
+    } else {
+        cc_cache_misses++;
+        char **argv = cc_argv("-c", c_path, obj_path);
+        ok = cc_run(argv, NULL) == 0;
+        cc_free_argv(argv);
+        if (ok) {
+#ifdef _WIN32
+            char *temp_path = strf("%s.tmp", cache_path);
+#else
+            char *temp_path = strf("%s.%d.tmp", cache_path, (int)getpid());
+#endif
+            if (!copy_file(obj_path, temp_path) || rename(temp_path, cache_path) != 0) {
+                remove(temp_path);
+            }
+            free(temp_path);
+        } else {
+            printf("%s: C compiler failed: %s\n", c_path, cc_path);
+        }
+    }
+    free(cache_path);
+    free(key);
+    return ok;
+}
+
+void cc_print_stats(void) {
+    if (cc_path && cc_cache_hits + cc_cache_misses) {
+        printf("C object cache: %zu hits, %zu misses.\n", cc_cache_hits, cc_cache_misses);
+        fflush(stdout);
+    }
+}
@@ -1,3 +1,4 @@
+#define MIN(x, y) ((x) <= (y) ? (x) : (y))
 #define MAX(x, y) ((x) >= (y) ? (x) : (y))
 #define IS_POW2(x) (((x) != 0) && ((x) & ((x)-1)) == 0)
 #define ALIGN_DOWN(n, a) ((n) & ~((a) - 1))
@@ -5,6 +6,16 @@
 #define ALIGN_DOWN_PTR(p, a) ((void *)ALIGN_DOWN((uintptr_t)(p), (a)))
 #define ALIGN_UP_PTR(p, a) ((void *)ALIGN_UP((uintptr_t)(p), (a)))
 
+// A host embedding the compiler points this at a jmp_buf so fatal errors unwind to it instead of exiting.
+jmp_buf *fatal_jmp;
+
+void fatal_exit(void) {
+    if (fatal_jmp) {
+        longjmp(*fatal_jmp, 1);
+    }
+    exit(1);
+}
+
 void fatal(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
@@ -12,10 +23,14 @@ void fatal(const char *fmt, ...) {
     vprintf(fmt, args);
     printf("\n");
     va_end(args);
-    exit(1);
+    fatal_exit();
 }
 
+// Number of heap allocations made through the x* wrappers, for tracking allocation counts per phase.
+size_t num_allocs;
+
 void *xcalloc(size_t num_elems, size_t elem_size) {
+    num_allocs++;
     void *ptr = calloc(num_elems, elem_size);
     if (!ptr) {
         perror("xcalloc failed");
@@ -25,6 +40,7 @@ void *xcalloc(size_t num_elems, size_t elem_size) {
 }
 
 void *xrealloc(void *ptr, size_t num_bytes) {
+    num_allocs++;
     ptr = realloc(ptr, num_bytes);
     if (!ptr) {
         perror("xrealloc failed");
@@ -34,6 +50,7 @@ void *xrealloc(void *ptr, size_t num_bytes) {
 }
 
 void *xmalloc(size_t num_bytes) {
+    num_allocs++;
     void *ptr = malloc(num_bytes);
     if (!ptr) {
         perror("xmalloc failed");
@@ -152,24 +169,30 @@ void *buf__grow(const void *buf, size_t new_len, size_t elem_size) {
     return new_hdr->buf;
 }
 
-char *buf__printf(char *buf, const char *fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+char *buf__vprintf(char *buf, const char *fmt, va_list args) {
+    va_list copy;
+    va_copy(copy, args);
     size_t cap = buf_cap(buf) - buf_len(buf);
-    size_t n = 1 + vsnprintf(buf_end(buf), cap, fmt, args);
-    va_end(args);
+    size_t n = 1 + vsnprintf(buf_end(buf), cap, fmt, copy);
+    va_end(copy);
     if (n > cap) {
         buf_fit(buf, n + buf_len(buf));
-        va_start(args, fmt);
         size_t new_cap = buf_cap(buf) - buf_len(buf);
         n = 1 + vsnprintf(buf_end(buf), new_cap, fmt, args);
         assert(n <= new_cap);
-        va_end(args);
     }
     buf__hdr(buf)->len += n - 1;
     return buf;
 }
 
+char *buf__printf(char *buf, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    buf = buf__vprintf(buf, fmt, args);
+    va_end(args);
+    return buf;
+}
+
 void buf_test(void) {
     int *buf = NULL;
     assert(buf_len(buf) == 0);
@@ -193,22 +216,93 @@ void buf_test(void) {
 
 // Arena allocator
 
+typedef struct ArenaBlock {
+    char *base;
+    size_t size;
+    bool is_mapped;
+} ArenaBlock;
+
 typedef struct Arena {
     char *ptr;
     char *end;
-    char **blocks;
+    ArenaBlock *blocks;
 } Arena;
 
 #define ARENA_ALIGNMENT 8
 #define ARENA_BLOCK_SIZE (1024 * 1024)
 // #define ARENA_BLOCK_SIZE 1024
+#define ARENA_MAX_BLOCK_SIZE (256 * 1024 * 1024)
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// Where arena blocks come from and how big they get. With geometric growth each new block is twice the size of
+// the previous one, up to ARENA_MAX_BLOCK_SIZE, so a large arena needs only a handful of blocks. Mapped blocks
+// come straight from mmap and can ask for transparent huge pages to cut TLB misses on big ASTs.
+typedef enum ArenaPolicy {
+    ARENA_GROW_GEOMETRIC = 1 << 0,
+    ARENA_USE_MMAP = 1 << 1,
+    ARENA_HUGE_PAGES = 1 << 2,
+} ArenaPolicy;
+
+#ifdef _WIN32
+unsigned arena_policy = ARENA_GROW_GEOMETRIC;
+#else
+unsigned arena_policy = ARENA_GROW_GEOMETRIC | ARENA_USE_MMAP;
+#endif
+
+void arena_push_block(Arena *arena, size_t size) {
+    ArenaBlock block = {.size = size};
+#ifndef _WIN32
+    if (arena_policy & ARENA_USE_MMAP) {
+        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            perror("mmap failed");
+            exit(1);
+        }
+#ifdef MADV_HUGEPAGE
+        if (arena_policy & ARENA_HUGE_PAGES) {
+            madvise(ptr, size, MADV_HUGEPAGE);
+        }
+#endif
+        block.base = ptr;
+        block.is_mapped = true;
+    }
+#endif
+    if (!block.base) {
+        block.base = xmalloc(size);
+    }
+    assert(block.base == ALIGN_DOWN_PTR(block.base, ARENA_ALIGNMENT));
+    buf_push(arena->blocks, block);
+    arena->ptr = block.base;
+    arena->end = block.base + size;
+}
+
+void arena_free_block(ArenaBlock *block) {
+#ifndef _WIN32
+    if (block->is_mapped) {
+        munmap(block->base, block->size);
+        return;
+    }
+#endif
+    free(block->base);
+}
 
 void arena_grow(Arena *arena, size_t min_size) {
-    size_t size = ALIGN_UP(MAX(ARENA_BLOCK_SIZE, min_size), ARENA_ALIGNMENT);
-    arena->ptr = xmalloc(size);
-    assert(arena->ptr == ALIGN_DOWN_PTR(arena->ptr, ARENA_ALIGNMENT));
-    arena->end = arena->ptr + size;
-    buf_push(arena->blocks, arena->ptr);
+    size_t size = ARENA_BLOCK_SIZE;
+    if ((arena_policy & ARENA_GROW_GEOMETRIC) && arena->blocks) {
+        size = MIN(2 * arena->blocks[buf_len(arena->blocks) - 1].size, ARENA_MAX_BLOCK_SIZE);
+    }
+    size = ALIGN_UP(MAX(size, min_size), ARENA_ALIGNMENT);
+    if (arena_policy & ARENA_HUGE_PAGES) {
+        size = ALIGN_UP(size, ARENA_HUGE_PAGE_SIZE);
+    }
+    arena_push_block(arena, size);
+}
+
+// Makes sure the next size bytes can be allocated without growing, e.g. to pre-size an arena from the input size.
+void arena_reserve(Arena *arena, size_t size) {
+    if (size > (size_t)(arena->end - arena->ptr)) {
+        arena_grow(arena, size);
+    }
 }
 
 void *arena_alloc(Arena *arena, size_t size) {
@@ -224,10 +318,25 @@ void *arena_alloc(Arena *arena, size_t size) {
 }
 
 void arena_free(Arena *arena) {
-    for (char **it = arena->blocks; it != buf_end(arena->blocks); it++) {
-        free(*it);
+    for (ArenaBlock *it = arena->blocks; it != buf_end(arena->blocks); it++) {
+        arena_free_block(it);
     }
     buf_free(arena->blocks);
+    arena->ptr = NULL;
+    arena->end = NULL;
+}
+
+// Frees everything but the first block and rewinds into it, so a reset arena can be refilled without mallocs.
+void arena_reset(Arena *arena) {
+    if (!arena->blocks) {
+        return;
+    }
+    for (size_t i = 1; i < buf_len(arena->blocks); i++) {
+        arena_free_block(&arena->blocks[i]);
+    }
+    buf__hdr(arena->blocks)->len = 1;
+    arena->ptr = arena->blocks[0].base;
+    arena->end = arena->blocks[0].base + arena->blocks[0].size;
 }
 
 // Hash map
@@ -252,73 +361,236 @@ uint64_t hash_bytes(const char *buf, size_t len) {
     return x;
 }
 
+// Open-addressed map in the style of a Swiss table. Each slot has a control byte: EMPTY, DELETED, or the top 7
+// bits of the key's hash (h2) when full. Lookups probe aligned groups of MAP_GROUP_SIZE control bytes at once,
+// comparing h2 against the whole group, and only touch an entry when its control byte matches. Probing stops at
+// the first group with an EMPTY byte, so deletions leave DELETED tombstones unless the group already had one.
+// Keys and values share one entry so a hit touches a single entry cache line. Tables grow at 7/8 load.
+
+#define MAP_GROUP_SIZE 16
+
+enum {
+    MAP_EMPTY = -128,
+    MAP_DELETED = -2,
+};
+
+typedef struct MapEntry {
+    void *key;
+    void *val;
+} MapEntry;
+
 typedef struct Map {
-    void **keys;
-    void **vals;
+    MapEntry *entries;
+    int8_t *ctrl;
     size_t len;
     size_t cap;
+    size_t tombstones;
 } Map;
 
-void *map_get(Map *map, void *key) {
+// Bit i is set when control byte i of the group matches.
+typedef uint32_t MapMask;
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+MapMask map_group_match(const int8_t *group, int8_t h2) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (MapMask)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+}
+
+// EMPTY and DELETED are the only control bytes with the sign bit set.
+MapMask map_group_match_free(const int8_t *group) {
+    return (MapMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+
+#else
+
+MapMask map_group_match(const int8_t *group, int8_t h2) {
+    MapMask mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++) {
+        mask |= (MapMask)(group[i] == h2) << i;
+    }
+    return mask;
+}
+
+MapMask map_group_match_free(const int8_t *group) {
+    MapMask mask = 0;
+    for (int i = 0; i < MAP_GROUP_SIZE; i++) {
+        mask |= (MapMask)(group[i] < 0) << i;
+    }
+    return mask;
+}
+
+#endif
+
+MapMask map_group_match_empty(const int8_t *group) {
+    return map_group_match(group, MAP_EMPTY);
+}
+
+int map_mask_first(MapMask mask) {
+    assert(mask);
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+int8_t map_h2(uint64_t hash) {
+    return (int8_t)(hash >> 57);
+}
+
+size_t map_max_load(size_t cap) {
+    return cap - cap/8;
+}
+
+bool map_slot_full(Map *map, size_t i) {
+    return map->ctrl[i] >= 0;
+}
+
+// Returns the index of key's entry, or -1. Groups are visited in triangular order, which reaches every group
+// exactly once because the group count is a power of two.
+ptrdiff_t map_find(Map *map, void *key, uint64_t hash) {
     if (map->len == 0) {
-        return NULL;
+        return -1;
     }
-    assert(IS_POW2(map->cap));
-    size_t i = (size_t)hash_ptr(key);
-    assert(map->len < map->cap);
-    for (;;) {
-        i &= map->cap - 1;
-        if (map->keys[i] == key) {
-            return map->vals[i];
-        } else if (!map->keys[i]) {
-            return NULL;
+    size_t mask = map->cap - 1;
+    size_t pos = (size_t)hash & mask & ~(size_t)(MAP_GROUP_SIZE - 1);
+    int8_t h2 = map_h2(hash);
+    for (size_t step = MAP_GROUP_SIZE;; step += MAP_GROUP_SIZE) {
+        const int8_t *group = map->ctrl + pos;
+        for (MapMask match = map_group_match(group, h2); match; match &= match - 1) {
+            size_t i = pos + map_mask_first(match);
+            if (map->entries[i].key == key) {
+                return (ptrdiff_t)i;
+            }
         }
-        i++;
+        if (map_group_match_empty(group)) {
+            return -1;
+        }
+        pos = (pos + step) & mask;
     }
-    return NULL;
 }
 
-void map_put(Map *map, void *key, void *val);
+// Returns the first EMPTY or DELETED slot on key's probe sequence.
+size_t map_find_free(Map *map, uint64_t hash) {
+    size_t mask = map->cap - 1;
+    size_t pos = (size_t)hash & mask & ~(size_t)(MAP_GROUP_SIZE - 1);
+    for (size_t step = MAP_GROUP_SIZE;; step += MAP_GROUP_SIZE) {
+        MapMask match = map_group_match_free(map->ctrl + pos);
+        if (match) {
+            return pos + map_mask_first(match);
+        }
+        pos = (pos + step) & mask;
+    }
+}
+
+void *map_get(Map *map, void *key) {
+    ptrdiff_t i = map_find(map, key, hash_ptr(key));
+    return i >= 0 ? map->entries[i].val : NULL;
+}
 
- void map_grow(Map *map, size_t new_cap) {
-    new_cap = MAX(16, new_cap);
-    Map new_map = {
-        .keys = xcalloc(new_cap, sizeof(void *)),
-        .vals = xmalloc(new_cap * sizeof(void *)),
-        .cap = new_cap,
-    };
+// Entries and control bytes share one allocation; cap*sizeof(MapEntry) keeps the control bytes 16-byte aligned.
+void map_alloc(Map *map, size_t cap) {
+    assert(IS_POW2(cap) && cap >= MAP_GROUP_SIZE);
+    map->entries = xmalloc(cap * (sizeof(MapEntry) + 1));
+    map->ctrl = (int8_t *)(map->entries + cap);
+    memset(map->ctrl, MAP_EMPTY, cap);
+    map->cap = cap;
+    map->len = 0;
+    map->tombstones = 0;
+}
+
+// Rehashes into a table of new_cap slots, which also drops all tombstones.
+void map_grow(Map *map, size_t new_cap) {
+    new_cap = MAX(MAP_GROUP_SIZE, new_cap);
+    Map new_map;
+    map_alloc(&new_map, new_cap);
     for (size_t i = 0; i < map->cap; i++) {
-        if (map->keys[i]) {
-            map_put(&new_map, map->keys[i], map->vals[i]);
+        if (map_slot_full(map, i)) {
+            uint64_t hash = hash_ptr(map->entries[i].key);
+            size_t j = map_find_free(&new_map, hash);
+            new_map.ctrl[j] = map_h2(hash);
+            new_map.entries[j] = map->entries[i];
         }
     }
-    free(map->keys);
-    free(map->vals);
+    new_map.len = map->len;
+    free(map->entries);
     *map = new_map;
 }
 
+// Probes once: an existing key is updated in place, otherwise the key goes into the first EMPTY or DELETED slot
+// seen before the probe sequence ends.
 void map_put(Map *map, void *key, void *val) {
     assert(key);
     assert(val);
-    if (2*map->len >= map->cap) {
-        map_grow(map, 2*map->cap);
-    }
-    assert(2*map->len < map->cap);
-    assert(IS_POW2(map->cap));
-    size_t i = (size_t)hash_ptr(key);
-    for (;;) {
-        i &= map->cap - 1;
-        if (!map->keys[i]) {
-            map->len++;
-            map->keys[i] = key;
-            map->vals[i] = val;
-            return;
-        } else if (map->keys[i] == key) {
-            map->vals[i] = val;
-            return;
+    if (map->len + map->tombstones + 1 > map_max_load(map->cap)) {
+        // Mostly tombstones: rehash in place instead of doubling.
+        map_grow(map, map->len + 1 <= map_max_load(map->cap) / 2 ? map->cap : 2*map->cap);
+    }
+    uint64_t hash = hash_ptr(key);
+    int8_t h2 = map_h2(hash);
+    size_t mask = map->cap - 1;
+    size_t pos = (size_t)hash & mask & ~(size_t)(MAP_GROUP_SIZE - 1);
+    ptrdiff_t slot = -1;
+    for (size_t step = MAP_GROUP_SIZE;; step += MAP_GROUP_SIZE) {
+        const int8_t *group = map->ctrl + pos;
+        for (MapMask match = map_group_match(group, h2); match; match &= match - 1) {
+            size_t i = pos + map_mask_first(match);
+            if (map->entries[i].key == key) {
+                map->entries[i].val = val;
+                return;
+            }
         }
-        i++;
+        MapMask free_match = map_group_match_free(group);
+        if (slot < 0 && free_match) {
+            slot = (ptrdiff_t)(pos + map_mask_first(free_match));
+        }
+        if (map_group_match_empty(group)) {
+            break;
+        }
+        pos = (pos + step) & mask;
+    }
+    if (map->ctrl[slot] == MAP_DELETED) {
+        map->tombstones--;
     }
+    map->ctrl[slot] = h2;
+    map->entries[slot] = (MapEntry){key, val};
+    map->len++;
+}
+
+// Removes key and returns its value, or NULL if it wasn't present. A slot whose group still has an EMPTY byte
+// can go straight back to EMPTY: any probe reaching that group stops there anyway.
+void *map_remove(Map *map, void *key) {
+    ptrdiff_t i = map_find(map, key, hash_ptr(key));
+    if (i < 0) {
+        return NULL;
+    }
+    void *val = map->entries[i].val;
+    const int8_t *group = map->ctrl + ALIGN_DOWN((size_t)i, MAP_GROUP_SIZE);
+    if (map_group_match_empty(group)) {
+        map->ctrl[i] = MAP_EMPTY;
+    } else {
+        map->ctrl[i] = MAP_DELETED;
+        map->tombstones++;
+    }
+    map->len--;
+    return val;
+}
+
+// Empties the map but keeps its table for reuse.
+void map_clear(Map *map) {
+    if (map->ctrl) {
+        memset(map->ctrl, MAP_EMPTY, map->cap);
+    }
+    map->len = 0;
+    map->tombstones = 0;
+}
+
+void map_free(Map *map) {
+    free(map->entries);
+    *map = (Map){0};
 }
 
 void map_test(void) {
@@ -327,10 +599,33 @@ void map_test(void) {
     for (size_t i = 1; i < N; i++) {
         map_put(&map, (void *)i, (void *)(i+1));
     }
+    assert(map.len == N - 1);
+    assert(map.cap == 2048);
     for (size_t i = 1; i < N; i++) {
         void *val = map_get(&map, (void *)i);
         assert(val == (void *)(i+1));
     }
+    assert(!map_get(&map, (void *)N));
+    for (size_t i = 1; i < N; i += 2) {
+        assert(map_remove(&map, (void *)i) == (void *)(i+1));
+    }
+    assert(!map_remove(&map, (void *)1));
+    for (size_t i = 1; i < N; i++) {
+        void *val = map_get(&map, (void *)i);
+        assert(val == (i % 2 ? NULL : (void *)(i+1)));
+    }
+    // Churn through many more keys than the table holds; tombstones must get recycled, not grow the table.
+    for (size_t i = N; i < 64*N; i++) {
+        map_put(&map, (void *)i, (void *)(i+1));
+        assert(map_remove(&map, (void *)i) == (void *)(i+1));
+    }
+    assert(map.cap == 2048);
+    for (size_t i = 2; i < N; i += 2) {
+        assert(map_get(&map, (void *)i) == (void *)(i+1));
+    }
+    map_clear(&map);
+    assert(!map_get(&map, (void *)2));
+    map_free(&map);
 }
 
 // String interning
@@ -344,29 +639,47 @@ typedef struct Intern {
 Arena intern_arena;
 Map interns;
 
-const char *str_intern_range(const char *start, const char *end) {
+// String literals are interned per compilation, in an arena that str_lit_reset rewinds, so a long-running host
+// doesn't keep the literals of every snippet it ever compiled.
+Arena str_lit_arena;
+Map str_lits;
+
+const char *intern_range(Arena *arena, Map *map, const char *start, const char *end) {
     size_t len = end - start;
     uint64_t hash = hash_bytes(start, len);
     void *key = (void *)(uintptr_t)(hash ? hash : 1);
-    Intern *intern = map_get(&interns, key);
+    Intern *intern = map_get(map, key);
     for (Intern *it = intern; it; it = it->next) {
-        if (it->len == len && strncmp(it->str, start, len) == 0) {
+        if (it->len == len && memcmp(it->str, start, len) == 0) {
             return it->str;
         }
     }
-    Intern *new_intern = arena_alloc(&intern_arena, offsetof(Intern, str) + len + 1);
+    Intern *new_intern = arena_alloc(arena, offsetof(Intern, str) + len + 1);
     new_intern->len = len;
     new_intern->next = intern;
     memcpy(new_intern->str, start, len);
     new_intern->str[len] = 0;
-    map_put(&interns, key, new_intern);
+    map_put(map, key, new_intern);
     return new_intern->str;
 }
 
+const char *str_intern_range(const char *start, const char *end) {
+    return intern_range(&intern_arena, &interns, start, end);
+}
+
 const char *str_intern(const char *str) {
     return str_intern_range(str, str + strlen(str));
 }
 
+const char *str_lit_intern_range(const char *start, const char *end) {
+    return intern_range(&str_lit_arena, &str_lits, start, end);
+}
+
+void str_lit_reset(void) {
+    map_clear(&str_lits);
+    arena_reset(&str_lit_arena);
+}
+
 // Value union
 
 typedef union Val {
@@ -0,0 +1,267 @@
+// Writes the sections, symbols and relocations produced by x64.c as an ELF64 relocatable object.
+// The structures mirror <elf.h> so the writer also builds on hosts without that header.
+
+typedef struct ElfHeader {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint64_t entry;
+    uint64_t phoff;
+    uint64_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} ElfHeader;
+
+typedef struct ElfSectionHeader {
+    uint32_t name;
+    uint32_t type;
+    uint64_t flags;
+    uint64_t addr;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t link;
+    uint32_t info;
+    uint64_t addralign;
+    uint64_t entsize;
+} ElfSectionHeader;
+
+typedef struct ElfSym {
+    uint32_t name;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+    uint64_t value;
+    uint64_t size;
+} ElfSym;
+
+typedef struct ElfRela {
+    uint64_t offset;
+    uint64_t info;
+    int64_t addend;
+} ElfRela;
+
+enum {
+    ELF_ET_REL = 1,
+    ELF_EM_X86_64 = 62,
+    ELF_SHT_PROGBITS = 1,
+    ELF_SHT_SYMTAB = 2,
+    ELF_SHT_STRTAB = 3,
+    ELF_SHT_RELA = 4,
+    ELF_SHT_NOBITS = 8,
+    ELF_SHF_WRITE = 1,
+    ELF_SHF_ALLOC = 2,
+    ELF_SHF_EXECINSTR = 4,
+    ELF_SHF_INFO_LINK = 0x40,
+    ELF_STB_LOCAL = 0,
+    ELF_STB_GLOBAL = 1,
+    ELF_STT_NOTYPE = 0,
+    ELF_STT_OBJECT = 1,
+    ELF_STT_FUNC = 2,
+};
+
+typedef enum ElfSection {
+    ELF_NULL,
+    ELF_TEXT,
+    ELF_DATA,
+    ELF_BSS,
+    ELF_RODATA,
+    ELF_RELA_TEXT,
+    ELF_RELA_DATA,
+    ELF_SYMTAB,
+    ELF_STRTAB,
+    ELF_SHSTRTAB,
+    ELF_NOTE_GNU_STACK,
+    NUM_ELF_SECTIONS,
+} ElfSection;
+
+const char *elf_section_names[NUM_ELF_SECTIONS] = {
+    [ELF_NULL] = "",
+    [ELF_TEXT] = ".text",
+    [ELF_DATA] = ".data",
+    [ELF_BSS] = ".bss",
+    [ELF_RODATA] = ".rodata",
+    [ELF_RELA_TEXT] = ".rela.text",
+    [ELF_RELA_DATA] = ".rela.data",
+    [ELF_SYMTAB] = ".symtab",
+    [ELF_STRTAB] = ".strtab",
+    [ELF_SHSTRTAB] = ".shstrtab",
+    [ELF_NOTE_GNU_STACK] = ".note.GNU-stack",
+};
+
+ElfSection x64_section_to_elf[NUM_X64_SECTIONS] = {
+    [X64_TEXT] = ELF_TEXT,
+    [X64_DATA] = ELF_DATA,
+    [X64_BSS] = ELF_BSS,
+    [X64_RODATA] = ELF_RODATA,
+};
+
+uint32_t x64_reloc_to_elf[] = {
+    [X64_RELOC_ABS64] = 1,
+    [X64_RELOC_PC32] = 2,
+    [X64_RELOC_PLT32] = 4,
+    [X64_RELOC_GOTPCREL] = 9,
+};
+
+size_t elf_add_str(char **strtab, const char *str) {
+    size_t offset = buf_len(*strtab);
+    for (const char *c = str; *c; c++) {
+        buf_push(*strtab, *c);
+    }
+    buf_push(*strtab, 0);
+    return offset;
+}
+
+void elf_append(char **buf, const void *data, size_t size) {
+    buf_fit(*buf, buf_len(*buf) + size);
+    memcpy(*buf + buf_len(*buf), data, size);
+    buf__hdr(*buf)->len += size;
+}
+
+size_t elf_align(char **buf, size_t align) {
+    while (buf_len(*buf) % align) {
+        buf_push(*buf, 0);
+    }
+    return buf_len(*buf);
+}
+
+char *elf_rela_section(X64Section section, uint32_t *sym_to_elf) {
+    char *rela = NULL;
+    for (X64Reloc *it = x64_relocs; it != buf_end(x64_relocs); it++) {
+        if (it->section == section) {
+            ElfRela entry = {
+                .offset = it->offset,
+                .info = ((uint64_t)sym_to_elf[it->sym] << 32) | x64_reloc_to_elf[it->kind],
+                .addend = it->addend,
+            };
+            elf_append(&rela, &entry, sizeof(entry));
+        }
+    }
+    return rela;
+}
+
+bool elf_write(const char *path) {
+    ElfSectionHeader headers[NUM_ELF_SECTIONS] = {0};
+    char *shstrtab = NULL;
+    for (int i = 0; i < NUM_ELF_SECTIONS; i++) {
+        headers[i].name = (uint32_t)elf_add_str(&shstrtab, elf_section_names[i]);
+    }
+
+    // Local symbols must come before global ones.
+    char *strtab = NULL;
+    buf_push(strtab, 0);
+    ElfSym *symtab = NULL;
+    buf_push(symtab, (ElfSym){0});
+    uint32_t *sym_to_elf = NULL;
+    buf_fit(sym_to_elf, buf_len(x64_syms));
+    for (int pass = 0; pass < 2; pass++) {
+        bool is_local = pass == 0;
+        if (!is_local) {
+            headers[ELF_SYMTAB].info = (uint32_t)buf_len(symtab);
+        }
+        for (size_t i = 0; i < buf_len(x64_syms); i++) {
+            X64Sym *sym = x64_syms + i;
+            if (sym->is_local != is_local) {
+                continue;
+            }
+            uint8_t kind = !sym->is_defined ? ELF_STT_NOTYPE : sym->is_func ? ELF_STT_FUNC : ELF_STT_OBJECT;
+            sym_to_elf[i] = (uint32_t)buf_len(symtab);
+            buf_push(symtab, (ElfSym){
+                .name = (uint32_t)elf_add_str(&strtab, sym->name),
+                .info = (uint8_t)(((is_local ? ELF_STB_LOCAL : ELF_STB_GLOBAL) << 4) | kind),
+                .shndx = sym->is_defined ? (uint16_t)x64_section_to_elf[sym->section] : 0,
+                .value = sym->offset,
+                .size = sym->size,
+            });
+        }
+    }
+    char *rela_text = elf_rela_section(X64_TEXT, sym_to_elf);
+    char *rela_data = elf_rela_section(X64_DATA, sym_to_elf);
+
+    char *buf = NULL;
+    ElfHeader header = {
+        .ident = {0x7F, 'E', 'L', 'F', 2, 1, 1},
+        .type = ELF_ET_REL,
+        .machine = ELF_EM_X86_64,
+        .version = 1,
+        .ehsize = sizeof(ElfHeader),
+        .shentsize = sizeof(ElfSectionHeader),
+        .shnum = NUM_ELF_SECTIONS,
+        .shstrndx = ELF_SHSTRTAB,
+    };
+    elf_append(&buf, &header, sizeof(header));
+    struct {
+        ElfSection section;
+        const void *data;
+        size_t size;
+    } contents[] = {
+        {ELF_TEXT, x64_sections[X64_TEXT], buf_len(x64_sections[X64_TEXT])},
+        {ELF_DATA, x64_sections[X64_DATA], buf_len(x64_sections[X64_DATA])},
+        {ELF_RODATA, x64_sections[X64_RODATA], buf_len(x64_sections[X64_RODATA])},
+        {ELF_RELA_TEXT, rela_text, buf_len(rela_text)},
+        {ELF_RELA_DATA, rela_data, buf_len(rela_data)},
+        {ELF_SYMTAB, symtab, buf_sizeof(symtab)},
+        {ELF_STRTAB, strtab, buf_len(strtab)},
+        {ELF_SHSTRTAB, shstrtab, buf_len(shstrtab)},
+    };
+    for (size_t i = 0; i < sizeof(contents)/sizeof(*contents); i++) {
+        ElfSectionHeader *section = headers + contents[i].section;
+        section->offset = elf_align(&buf, 16);
+        section->size = contents[i].size;
+        if (contents[i].size) {
+            elf_append(&buf, contents[i].data, contents[i].size);
+        }
+    }
+
+    headers[ELF_TEXT].type = ELF_SHT_PROGBITS;
+    headers[ELF_TEXT].flags = ELF_SHF_ALLOC | ELF_SHF_EXECINSTR;
+    headers[ELF_TEXT].addralign = x64_section_aligns[X64_TEXT];
+    headers[ELF_DATA].type = ELF_SHT_PROGBITS;
+    headers[ELF_DATA].flags = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    headers[ELF_DATA].addralign = x64_section_aligns[X64_DATA];
+    headers[ELF_BSS].type = ELF_SHT_NOBITS;
+    headers[ELF_BSS].flags = ELF_SHF_ALLOC | ELF_SHF_WRITE;
+    headers[ELF_BSS].offset = buf_len(buf);
+    headers[ELF_BSS].size = x64_bss_size;
+    headers[ELF_BSS].addralign = x64_section_aligns[X64_BSS];
+    headers[ELF_RODATA].type = ELF_SHT_PROGBITS;
+    headers[ELF_RODATA].flags = ELF_SHF_ALLOC;
+    headers[ELF_RODATA].addralign = x64_section_aligns[X64_RODATA];
+    for (ElfSection rela = ELF_RELA_TEXT; rela <= ELF_RELA_DATA; rela++) {
+        headers[rela].type = ELF_SHT_RELA;
+        headers[rela].flags = ELF_SHF_INFO_LINK;
+        headers[rela].link = ELF_SYMTAB;
+        headers[rela].info = rela == ELF_RELA_TEXT ? ELF_TEXT : ELF_DATA;
+        headers[rela].addralign = 8;
+        headers[rela].entsize = sizeof(ElfRela);
+    }
+    headers[ELF_SYMTAB].type = ELF_SHT_SYMTAB;
+    headers[ELF_SYMTAB].link = ELF_STRTAB;
+    headers[ELF_SYMTAB].addralign = 8;
+    headers[ELF_SYMTAB].entsize = sizeof(ElfSym);
+    headers[ELF_STRTAB].type = ELF_SHT_STRTAB;
+    headers[ELF_STRTAB].addralign = 1;
+    headers[ELF_SHSTRTAB].type = ELF_SHT_STRTAB;
+    headers[ELF_SHSTRTAB].addralign = 1;
+    headers[ELF_NOTE_GNU_STACK].type = ELF_SHT_PROGBITS;
+    headers[ELF_NOTE_GNU_STACK].offset = buf_len(buf);
+    headers[ELF_NOTE_GNU_STACK].addralign = 1;
+
+    size_t shoff = elf_align(&buf, 16);
+    elf_append(&buf, headers, sizeof(headers));
+    ((ElfHeader *)buf)->shoff = shoff;
+    bool result = write_file(path, buf, buf_len(buf));
+    buf_free(buf);
+    buf_free(shstrtab);
+    buf_free(strtab);
+    buf_free(symtab);
+    buf_free(sym_to_elf);
+    buf_free(rela_text);
+    buf_free(rela_data);
+    return result;
+}
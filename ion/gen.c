@@ -8,6 +8,29 @@ char *gen_buf = NULL;
 int gen_indent;
 SrcPos gen_pos;
 
+// Scratch strings for C declarators. They are only needed while the output is built and are dropped by gen_reset.
+Arena gen_arena;
+
+char *gen_strf(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    size_t n = 1 + vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    char *str = arena_alloc(&gen_arena, n);
+    va_start(args, fmt);
+    vsnprintf(str, n, fmt, args);
+    va_end(args);
+    return str;
+}
+
+// Moves a string built in a stretchy buffer into the scratch arena.
+char *gen_arena_str(char *buf) {
+    char *str = arena_alloc(&gen_arena, buf_len(buf) + 1);
+    memcpy(str, buf ? buf : "", buf_len(buf) + 1);
+    buf_free(buf);
+    return str;
+}
+
 const char *gen_preamble =
     "// Preamble\n"
     "#include <stdio.h>\n"
@@ -111,7 +134,7 @@ void gen_sync_pos(SrcPos pos) {
 }
 
 const char *cdecl_paren(const char *str, bool b) {
-    return b ? strf("(%s)", str) : str;
+    return b ? gen_strf("(%s)", str) : str;
 }
 
 const char *cdecl_name(Type *type) {
@@ -124,21 +147,35 @@ const char *cdecl_name(Type *type) {
     }
 }
 
+const char *soa_array_name(Type *type) {
+    assert(is_soa_array_type(type));
+    return gen_strf("%s_soa%llu", type->base->sym->name, type->num_elems);
+}
+
+const char *vector_type_name(Type *type) {
+    assert(is_vector_type(type));
+    return gen_strf("%s_x%llu", type_names[type->base->kind], type->num_elems);
+}
+
 char *type_to_cdecl(Type *type, const char *str) {
     switch (type->kind) {
     case TYPE_PTR:
-        return type_to_cdecl(type->base, cdecl_paren(strf("*%s", str), *str));
+        return type_to_cdecl(type->base, cdecl_paren(gen_strf("*%s", str), *str));
     case TYPE_CONST:
-        return type_to_cdecl(type->base, strf("const %s", cdecl_paren(str, *str)));
+        return type_to_cdecl(type->base, gen_strf("const %s", cdecl_paren(str, *str)));
     case TYPE_ARRAY:
-        if (type->num_elems == 0) {
-            return type_to_cdecl(type->base, cdecl_paren(strf("%s[]", str), *str));
+        if (is_soa_array_type(type)) {
+            return gen_strf("%s%s%s", soa_array_name(type), *str ? " " : "", str);
+        } else if (type->num_elems == 0) {
+            return type_to_cdecl(type->base, cdecl_paren(gen_strf("%s[]", str), *str));
         } else {
-            return type_to_cdecl(type->base, cdecl_paren(strf("%s[%llu]", str, type->num_elems), *str));
+            return type_to_cdecl(type->base, cdecl_paren(gen_strf("%s[%llu]", str, type->num_elems), *str));
         }
+    case TYPE_VECTOR:
+        return gen_strf("%s%s%s", vector_type_name(type), *str ? " " : "", str);
     case TYPE_FUNC: {
         char *result = NULL;
-        buf_printf(result, "%s(", cdecl_paren(strf("*%s", str), *str));
+        buf_printf(result, "%s(", cdecl_paren(gen_strf("*%s", str), *str));
         if (type->func.num_params == 0) {
             buf_printf(result, "void");
         } else {
@@ -150,10 +187,10 @@ char *type_to_cdecl(Type *type, const char *str) {
             buf_printf(result, ", ...");
         }
         buf_printf(result, ")");
-        return type_to_cdecl(type->func.ret, result);
+        return type_to_cdecl(type->func.ret, gen_arena_str(result));
     }
     default:
-        return strf("%s%s%s", cdecl_name(type), *str ? " " : "", str);
+        return gen_strf("%s%s%s", cdecl_name(type), *str ? " " : "", str);
     }
 }
 
@@ -163,29 +200,39 @@ const char *gen_expr_str(Expr *expr) {
     char *temp = gen_buf;
     gen_buf = NULL;
     gen_expr(expr);
-    const char *result = gen_buf;
+    char *result = gen_buf;
     gen_buf = temp;
-    return result;
+    return gen_arena_str(result);
 }
 
 char *typespec_to_cdecl(Typespec *typespec, const char *str) {
     // TODO: Figure out how to handle type vs typespec in C gen for inferred types. How to prevent "flattened" const values?
     switch (typespec->kind) {
-    case TYPESPEC_NAME:
-        return strf("%s%s%s", typespec->name, *str ? " " : "", str);
+    case TYPESPEC_NAME: {
+        // Type parameters and generic instances are spelled by the type they were bound to.
+        Sym *sym = map_get(&global_syms_map, (void *)typespec->name);
+        if (typespec->type && (!sym || sym->type != typespec->type)) {
+            return type_to_cdecl(typespec->type, str);
+        }
+        return gen_strf("%s%s%s", typespec->name, *str ? " " : "", str);
+    }
     case TYPESPEC_PTR:
-        return typespec_to_cdecl(typespec->base, cdecl_paren(strf("*%s", str), *str));
+        return typespec_to_cdecl(typespec->base, cdecl_paren(gen_strf("*%s", str), *str));
     case TYPESPEC_CONST:
-        return typespec_to_cdecl(typespec->base, strf("const %s", cdecl_paren(str, *str)));
+        return typespec_to_cdecl(typespec->base, gen_strf("const %s", cdecl_paren(str, *str)));
     case TYPESPEC_ARRAY:
-        if (typespec->num_elems == 0) {
-            return typespec_to_cdecl(typespec->base, cdecl_paren(strf("%s[]", str), *str));
+        if (typespec->type && is_soa_array_type(typespec->type)) {
+            return type_to_cdecl(typespec->type, str);
+        } else if (typespec->num_elems == 0) {
+            return typespec_to_cdecl(typespec->base, cdecl_paren(gen_strf("%s[]", str), *str));
         } else {
-            return typespec_to_cdecl(typespec->base, cdecl_paren(strf("%s[%s]", str, gen_expr_str(typespec->num_elems)), *str));
+            return typespec_to_cdecl(typespec->base, cdecl_paren(gen_strf("%s[%s]", str, gen_expr_str(typespec->num_elems)), *str));
         }
+    case TYPESPEC_VECTOR:
+        return type_to_cdecl(typespec->type, str);
     case TYPESPEC_FUNC: {
         char *result = NULL;
-        buf_printf(result, "%s(", cdecl_paren(strf("*%s", str), *str));
+        buf_printf(result, "%s(", cdecl_paren(gen_strf("*%s", str), *str));
         if (typespec->func.num_args == 0) {
             buf_printf(result, "void");
         } else {
@@ -197,7 +244,7 @@ char *typespec_to_cdecl(Typespec *typespec, const char *str) {
             buf_printf(result, ", ...");
         }
         buf_printf(result, ")");
-        return typespec_to_cdecl(typespec->func.ret, result);
+        return typespec_to_cdecl(typespec->func.ret, gen_arena_str(result));
     }
     default:
         assert(0);
@@ -230,6 +277,192 @@ void gen_func_decl(Decl *decl) {
     genf(")");
 }
 
+const char *builtin_uint_names[] = {
+    [1] = "unsigned char",
+    [2] = "unsigned short",
+    [4] = "unsigned int",
+    [8] = "unsigned long long",
+};
+
+void gen_builtin_helpers(void) {
+    for (size_t size = 1; size <= 8; size *= 2) {
+        if (!(rotate_builtin_sizes & size)) {
+            continue;
+        }
+        const char *name = builtin_uint_names[size];
+        size_t bits = 8*size;
+        genlnf("static inline %s ion_rotl%zu(%s x, unsigned int n) { n &= %zu; return (%s)(n ? (x << n) | (x >> (%zu - n)) : x); }",
+               name, bits, name, bits - 1, name, bits);
+        genlnf("static inline %s ion_rotr%zu(%s x, unsigned int n) { n &= %zu; return (%s)(n ? (x >> n) | (x << (%zu - n)) : x); }",
+               name, bits, name, bits - 1, name, bits);
+    }
+}
+
+void gen_str_switch_helpers(void) {
+    genlnf("#include <string.h>");
+    genlnf("static inline uint32 ion_str_switch_hash(const char *str, size_t *len, uint32 seed) {");
+    genlnf("    uint32 hash = 2166136261u ^ seed;");
+    genlnf("    const char *ptr = str;");
+    genlnf("    for (; *ptr; ptr++) hash = (hash ^ (uint8)*ptr) * 16777619u;");
+    genlnf("    *len = ptr - str;");
+    genlnf("    return hash;");
+    genlnf("}");
+    genlnf("static inline uint32 ion_str_switch_mix(uint32 hash) {");
+    genlnf("    hash ^= hash >> 16; hash *= 0x7feb352du; hash ^= hash >> 15; hash *= 0x846ca68bu; hash ^= hash >> 16;");
+    genlnf("    return hash;");
+    genlnf("}");
+}
+
+// Emits compile-time evaluated data as an initializer. Floats use hex literals so they round-trip exactly.
+void gen_const_data(Type *type, const char *data) {
+    type = unqualify_type(type);
+    switch (type->kind) {
+    case TYPE_FLOAT:
+    case TYPE_DOUBLE: {
+        double val;
+        if (type->kind == TYPE_FLOAT) {
+            float f;
+            memcpy(&f, data, sizeof(f));
+            val = f;
+        } else {
+            memcpy(&val, data, sizeof(val));
+        }
+        const char *suffix = type->kind == TYPE_FLOAT ? "f" : "";
+        if (isnan(val)) {
+            genf("(0.0%s/0.0%s)", suffix, suffix);
+        } else if (isinf(val)) {
+            genf("(%s1.0%s/0.0%s)", val < 0 ? "-" : "", suffix, suffix);
+        } else {
+            genf("%a%s", val, suffix);
+        }
+        break;
+    }
+    case TYPE_ARRAY:
+    case TYPE_VECTOR: {
+        size_t elem_size = type_sizeof(type->base);
+        genf("{");
+        for (size_t i = 0; i < type->num_elems; i++) {
+            genf(i == 0 ? "" : ", ");
+            gen_const_data(type->base, data + i*elem_size);
+        }
+        genf("}");
+        break;
+    }
+    case TYPE_STRUCT:
+        genf("{");
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            genf(i == 0 ? "" : ", ");
+            gen_const_data(type->aggregate.fields[i].type, data + type->aggregate.fields[i].offset);
+        }
+        genf("}");
+        break;
+    default: {
+        assert(is_integer_type(type));
+        Val val = {0};
+        memcpy(&val, data, type_sizeof(type));
+        Operand operand = operand_const(type, val);
+        const char *suffix = type_sizeof(type) == 8 ? "ll" : "";
+        if (is_signed_type(type) || (type->kind == TYPE_CHAR && CHAR_MIN < 0)) {
+            cast_operand(&operand, type_llong);
+            if (operand.val.ll == LLONG_MIN) {
+                genf("(-0x7fffffffffffffffll - 1)");
+            } else {
+                genf("%lld%s", operand.val.ll, suffix);
+            }
+        } else {
+            cast_operand(&operand, type_ullong);
+            genf("%lluu%s", operand.val.ull, suffix);
+        }
+        break;
+    }
+    }
+}
+
+void gen_builtin_call(Expr *expr) {
+    Expr **args = expr->call.args;
+    if (expr->call.is_folded) {
+        genf("((%s)0x%llxull)", type_to_cdecl(expr->type, ""), expr->call.folded_val);
+        return;
+    }
+    size_t size = 0;
+    if (expr->call.builtin != BUILTIN_PREFETCH && expr->call.builtin != BUILTIN_LIKELY && expr->call.builtin != BUILTIN_UNLIKELY) {
+        size = type_sizeof(args[0]->type);
+    }
+    const char *suffix = size == 8 ? "ll" : "";
+    switch (expr->call.builtin) {
+    case BUILTIN_POPCOUNT:
+    case BUILTIN_CTZ:
+        genf("__builtin_%s%s((%s)(", expr->call.builtin == BUILTIN_POPCOUNT ? "popcount" : "ctz", suffix, builtin_uint_names[size]);
+        gen_expr(args[0]);
+        genf("))");
+        break;
+    case BUILTIN_CLZ:
+        // The narrow variants count the zero-extended bits above the operand, so subtract them back out.
+        if (size < 4) {
+            genf("(__builtin_clz((%s)(", builtin_uint_names[size]);
+            gen_expr(args[0]);
+            genf(")) - %zu)", 8*(4 - size));
+        } else {
+            genf("__builtin_clz%s((%s)(", suffix, builtin_uint_names[size]);
+            gen_expr(args[0]);
+            genf("))");
+        }
+        break;
+    case BUILTIN_BSWAP:
+        if (size == 1) {
+            genf("(%s)(", type_to_cdecl(expr->type, ""));
+            gen_expr(args[0]);
+            genf(")");
+        } else {
+            genf("(%s)__builtin_bswap%zu((%s)(", type_to_cdecl(expr->type, ""), 8*size, builtin_uint_names[size]);
+            gen_expr(args[0]);
+            genf("))");
+        }
+        break;
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR:
+        genf("(%s)ion_rot%s%zu((%s)(", type_to_cdecl(expr->type, ""), expr->call.builtin == BUILTIN_ROTL ? "l" : "r", 8*size, builtin_uint_names[size]);
+        gen_expr(args[0]);
+        genf("), (unsigned int)(");
+        gen_expr(args[1]);
+        genf("))");
+        break;
+    case BUILTIN_PREFETCH:
+        genf("__builtin_prefetch(");
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            if (i != 0) {
+                genf(", ");
+            }
+            gen_expr(args[i]);
+        }
+        genf(")");
+        break;
+    case BUILTIN_EXPECT:
+        genf("(%s)__builtin_expect(", type_to_cdecl(expr->type, ""));
+        gen_expr(args[0]);
+        genf(", ");
+        gen_expr(args[1]);
+        genf(")");
+        break;
+    case BUILTIN_LIKELY:
+    case BUILTIN_UNLIKELY:
+        genf("(int)__builtin_expect(!!(");
+        gen_expr(args[0]);
+        genf("), %d)", expr->call.builtin == BUILTIN_LIKELY);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void gen_vector_types(void) {
+    for (CachedVectorType *it = cached_vector_types; it != buf_end(cached_vector_types); it++) {
+        Type *type = it->vector;
+        genlnf("typedef %s %s __attribute__((vector_size(%zu)));", type_names[type->base->kind], vector_type_name(type), type_sizeof(type));
+    }
+}
+
 void gen_forward_decls(void) {
     for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
         Sym *sym = *it;
@@ -237,7 +470,7 @@ void gen_forward_decls(void) {
         if (!decl) {
             continue;
         }
-        if (is_decl_foreign(decl)) {
+        if (is_decl_foreign(decl) || is_generic_decl(decl)) {
             continue;
         }
         switch (decl->kind) {
@@ -254,6 +487,38 @@ void gen_forward_decls(void) {
     }
 }
 
+// An @align on the struct also aligns its SoA arrays, so the first member array carries it like in gen_aggregate.
+void gen_soa_arrays(Decl *decl) {
+    Type *type = decl->sym->type;
+    bool has_align = get_decl_note(decl, align_name) != NULL;
+    for (CachedArrayType *it = cached_array_types; it != buf_end(cached_array_types); it++) {
+        if (it->elem != type || it->num_elems == 0) {
+            continue;
+        }
+        const char *name = soa_array_name(it->array);
+        genlnf("typedef struct %s {", name);
+        gen_indent++;
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            TypeField field = type->aggregate.fields[i];
+            genln();
+            if (i == 0 && has_align) {
+                genf("_Alignas(%zu) ", type_alignof(it->array));
+            }
+            genf("%s;", type_to_cdecl(field.type, gen_strf("%s[%llu]", field.name, it->num_elems)));
+        }
+        gen_indent--;
+        genlnf("} %s;", name);
+    }
+}
+
+void gen_align_note(Note *note) {
+    if (note) {
+        genf("_Alignas(");
+        gen_expr(note->args[0]);
+        genf(") ");
+    }
+}
+
 void gen_aggregate(Decl *decl) {
     assert(decl->kind == DECL_STRUCT || decl->kind == DECL_UNION);
     genlnf("%s %s {", decl->kind == DECL_STRUCT ? "struct" : "union", decl->name);
@@ -262,11 +527,20 @@ void gen_aggregate(Decl *decl) {
         AggregateItem item = decl->aggregate.items[i];
         for (size_t j = 0; j < item.num_names; j++) {
             gen_sync_pos(item.pos);
-            genlnf("%s;", typespec_to_cdecl(item.type, item.names[j]));
+            genln();
+            if (i == 0 && j == 0) {
+                // C has no aggregate-level _Alignas, but aligning the first member raises the alignment of the whole aggregate.
+                gen_align_note(get_decl_note(decl, align_name));
+            }
+            gen_align_note(get_note(item.notes, align_name));
+            genf("%s;", typespec_to_cdecl(item.type, item.names[j]));
         }
     }
     gen_indent--;
     genlnf("};");
+    if (decl->kind == DECL_STRUCT && is_decl_soa(decl)) {
+        gen_soa_arrays(decl);
+    }
 }
 
 void gen_expr_compound(Expr *expr, bool is_init) {
@@ -297,6 +571,59 @@ void gen_expr_compound(Expr *expr, bool is_init) {
     genf("}");
 }
 
+bool is_soa_elem_expr(Expr *expr) {
+    return expr->kind == EXPR_INDEX && is_soa_array_type(unqualify_type(expr->index.expr->type));
+}
+
+// Scalars mixed with vectors are converted to the lane type first, since GCC rejects implicitly narrowing broadcasts.
+void gen_vector_operand(Expr *expr, Type *other) {
+    if (is_vector_type(other) && !is_vector_type(expr->type)) {
+        genf("(%s)(", type_to_cdecl(other->base, ""));
+        gen_expr(expr);
+        genf(")");
+    } else {
+        gen_expr(expr);
+    }
+}
+
+// Inlining state. Frames are pushed while the body of an inlined callee is being emitted.
+
+bool gen_inline;
+
+enum { GEN_INLINE_MAX_COST = 24 };
+
+typedef struct GenInlineInfo {
+    bool is_inlinable;
+    BodyScan scan;
+    const char **globals;
+} GenInlineInfo;
+
+typedef struct GenInlineFrame {
+    Sym *sym;
+    int id;
+    GenInlineInfo *info;
+} GenInlineFrame;
+
+Map gen_inline_infos;
+GenInlineFrame *gen_inline_frames;
+int gen_inline_count;
+Sym *gen_func_sym;
+BodyScan gen_func_scan;
+
+// Locals of an inlined callee get a per-expansion prefix so they can't clash with the caller's.
+const char *gen_local_name(const char *name) {
+    if (!buf_len(gen_inline_frames)) {
+        return name;
+    }
+    GenInlineFrame *frame = buf_end(gen_inline_frames) - 1;
+    if (is_scanned_local(&frame->info->scan, name)) {
+        return gen_strf("ion_inl%d_%s", frame->id, name);
+    }
+    return name;
+}
+
+bool gen_inline_call(Expr *expr);
+
 void gen_expr(Expr *expr) {
     switch (expr->kind) {
     case EXPR_INT: {
@@ -325,7 +652,7 @@ void gen_expr(Expr *expr) {
         gen_str(expr->str_lit.val, expr->str_lit.mod == MOD_MULTILINE);
         break;
     case EXPR_NAME:
-        genf("%s", expr->name);
+        genf("%s", gen_local_name(expr->name));
         break;
     case EXPR_CAST:
         genf("(%s)(", type_to_cdecl(expr->cast.type->type, ""));
@@ -333,6 +660,25 @@ void gen_expr(Expr *expr) {
         genf(")");
         break;
     case EXPR_CALL:
+        if (expr->call.folded_data) {
+            genf("((%s)", type_to_cdecl(expr->type, ""));
+            gen_const_data(expr->type, expr->call.folded_data);
+            genf(")");
+            break;
+        } else if (expr->call.builtin) {
+            gen_builtin_call(expr);
+            break;
+        }
+        if (!expr->call.expr->type && is_vector_type(expr->type) && !is_vector_type(expr->call.args[0]->type)) {
+            // Broadcast conversion like float4(x).
+            genf("((%s){0} + ", type_to_cdecl(expr->type, ""));
+            gen_vector_operand(expr->call.args[0], expr->type);
+            genf(")");
+            break;
+        }
+        if (gen_inline && gen_inline_call(expr)) {
+            break;
+        }
         genf("(");
         gen_expr(expr->call.expr);
         genf(")");
@@ -352,8 +698,17 @@ void gen_expr(Expr *expr) {
         genf("]");
         break;
     case EXPR_FIELD:
-        gen_expr(expr->field.expr);
-        genf("%s%s", expr->field.expr->type->kind == TYPE_PTR ? "->" : ".", expr->field.name);
+        if (is_soa_elem_expr(expr->field.expr)) {
+            Expr *elem = expr->field.expr;
+            genf("(");
+            gen_expr(elem->index.expr);
+            genf(").%s[", expr->field.name);
+            gen_expr(elem->index.index);
+            genf("]");
+        } else {
+            gen_expr(expr->field.expr);
+            genf("%s%s", expr->field.expr->type->kind == TYPE_PTR ? "->" : ".", expr->field.name);
+        }
         break;
     case EXPR_COMPOUND:
         gen_expr_compound(expr, false);
@@ -365,9 +720,9 @@ void gen_expr(Expr *expr) {
         break;
     case EXPR_BINARY:
         genf("(");
-        gen_expr(expr->binary.left);
+        gen_vector_operand(expr->binary.left, expr->binary.right->type);
         genf(") %s (", token_kind_name(expr->binary.op));
-        gen_expr(expr->binary.right);
+        gen_vector_operand(expr->binary.right, expr->binary.left->type);
         genf(")");
         break;
     case EXPR_TERNARY:
@@ -380,9 +735,13 @@ void gen_expr(Expr *expr) {
         genf(")");
         break;
     case EXPR_SIZEOF_EXPR:
-        genf("sizeof(");
-        gen_expr(expr->sizeof_expr);
-        genf(")");
+        if (is_soa_elem_expr(expr->sizeof_expr)) {
+            genf("sizeof(%s)", type_to_cdecl(expr->sizeof_expr->type, ""));
+        } else {
+            genf("sizeof(");
+            gen_expr(expr->sizeof_expr);
+            genf(")");
+        }
         break;
     case EXPR_SIZEOF_TYPE:
         genf("sizeof(%s)", type_to_cdecl(expr->sizeof_type->type, ""));
@@ -417,27 +776,29 @@ void gen_simple_stmt(Stmt *stmt) {
     case STMT_EXPR:
         gen_expr(stmt->expr);
         break;
-    case STMT_INIT:
+    case STMT_INIT: {
+        const char *name = gen_local_name(stmt->init.name);
         if (stmt->init.type) {
             if (is_incomplete_array_typespec(stmt->init.type)) {
-                genf("%s", type_to_cdecl(stmt->init.expr->type, stmt->init.name));
+                genf("%s", type_to_cdecl(stmt->init.expr->type, name));
             } else {
-                genf("%s", typespec_to_cdecl(stmt->init.type, stmt->init.name));
+                genf("%s", typespec_to_cdecl(stmt->init.type, name));
             }
             if (stmt->init.expr) {
                 genf(" = ");
                 gen_init_expr(stmt->init.expr);
             }
         } else {
-            genf("%s = ", type_to_cdecl(unqualify_type(stmt->init.expr->type), stmt->init.name));
+            genf("%s = ", type_to_cdecl(unqualify_type(stmt->init.expr->type), name));
             gen_init_expr(stmt->init.expr);
         }
         break;
+    }
     case STMT_ASSIGN:
         gen_expr(stmt->assign.left);
         if (stmt->assign.right) {
             genf(" %s ", token_kind_name(stmt->assign.op));
-            gen_expr(stmt->assign.right);
+            gen_vector_operand(stmt->assign.right, stmt->assign.left->type);
         } else {
             genf("%s", token_kind_name(stmt->assign.op));
         }
@@ -447,10 +808,101 @@ void gen_simple_stmt(Stmt *stmt) {
     }
 }
 
+// Opens a block that maps the selector to the index of its case in ion_sw_case, or -1 for the default. The slot
+// switch is dense, so the C compiler lowers it to a jump table.
+void gen_str_switch_dispatch(Stmt *stmt) {
+    StrSwitch *sw = stmt->switch_stmt.str_switch;
+    genlnf("{");
+    gen_indent++;
+    genlnf("static const uint32 ion_sw_disps[%u] = {", sw->mask + 1);
+    for (uint32_t i = 0; i <= sw->mask; i++) {
+        genf("%s%u", i ? ", " : "", sw->disps[i]);
+    }
+    genf("};");
+    genlnf("const char *ion_sw_str = ");
+    gen_expr(stmt->switch_stmt.expr);
+    genf(";");
+    genlnf("size_t ion_sw_len;");
+    genlnf("uint32 ion_sw_hash = ion_str_switch_hash(ion_sw_str, &ion_sw_len, %uu);", sw->seed);
+    genlnf("int ion_sw_case = -1;");
+    genlnf("switch (ion_str_switch_mix(ion_sw_hash ^ ion_sw_disps[ion_sw_hash & %u]) & %u) {", sw->mask, sw->mask);
+    for (uint32_t slot = 0; slot <= sw->mask; slot++) {
+        const char *str = sw->strs[slot];
+        if (str) {
+            size_t len = strlen(str);
+            genlnf("case %u: if (ion_sw_len == %zu && memcmp(ion_sw_str, ", slot, len);
+            gen_str(str, false);
+            genf(", %zu) == 0) ion_sw_case = %d; break;", len, sw->cases[slot]);
+        }
+    }
+    genlnf("}");
+}
+
+void gen_switch_value(Type *type, unsigned long long key) {
+    if (!is_signed_switch_type(type)) {
+        genf("%lluull", key);
+    } else if (key == 0) {
+        genf("(%lldll - 1)", -LLONG_MAX);
+    } else {
+        genf("%lldll", (long long)switch_key_value(type, key));
+    }
+}
+
+void gen_switch_search(Type *type, SwitchRange *ranges, size_t num_ranges) {
+    if (num_ranges == 1) {
+        if (ranges->lo == ranges->hi) {
+            genlnf("if (ion_sw_val == ");
+            gen_switch_value(type, ranges->lo);
+        } else {
+            genlnf("if (ion_sw_val >= ");
+            gen_switch_value(type, ranges->lo);
+            genf(" && ion_sw_val <= ");
+            gen_switch_value(type, ranges->hi);
+        }
+        genf(") ion_sw_case = %zu;", ranges->case_index);
+        return;
+    }
+    size_t mid = num_ranges / 2;
+    genlnf("if (ion_sw_val < ");
+    gen_switch_value(type, ranges[mid].lo);
+    genf(") {");
+    gen_indent++;
+    gen_switch_search(type, ranges, mid);
+    gen_indent--;
+    genlnf("} else {");
+    gen_indent++;
+    gen_switch_search(type, ranges + mid, num_ranges - mid);
+    gen_indent--;
+    genlnf("}");
+}
+
+// Opens a block that finds the case of a sparse switch by binary search over its sorted case ranges.
+void gen_switch_search_dispatch(Stmt *stmt) {
+    Type *type = unqualify_type(stmt->switch_stmt.expr->type);
+    genlnf("{");
+    gen_indent++;
+    const char *val_type = is_signed_switch_type(type) ? "llong" : "ullong";
+    genlnf("%s ion_sw_val = (%s)(", val_type, val_type);
+    gen_expr(stmt->switch_stmt.expr);
+    genf(");");
+    genlnf("int ion_sw_case = -1;");
+    gen_switch_search(type, stmt->switch_stmt.ranges, stmt->switch_stmt.num_ranges);
+}
+
 void gen_stmt(Stmt *stmt) {
     gen_sync_pos(stmt->pos);
     switch (stmt->kind) {
     case STMT_RETURN:
+        if (buf_len(gen_inline_frames)) {
+            int id = buf_end(gen_inline_frames)[-1].id;
+            if (stmt->expr) {
+                genlnf("ion_inl%d_ret = ", id);
+                gen_expr(stmt->expr);
+                genf(";");
+            }
+            genlnf("goto ion_inl%d_done;", id);
+            break;
+        }
         genlnf("return");
         if (stmt->expr) {
             genf(" ");
@@ -516,15 +968,32 @@ void gen_stmt(Stmt *stmt) {
         genf(") ");
         gen_stmt_block(stmt->for_stmt.block);
         break;
-    case STMT_SWITCH:
-        genlnf("switch (");
-        gen_expr(stmt->switch_stmt.expr);
-        genf(") {");
+    case STMT_SWITCH: {
+        // String and sparse switches first map the selector to a case index in ion_sw_case.
+        bool by_case_index = stmt->switch_stmt.str_switch || stmt->switch_stmt.is_sparse;
+        if (stmt->switch_stmt.str_switch) {
+            gen_str_switch_dispatch(stmt);
+            genlnf("switch (ion_sw_case) {");
+        } else if (stmt->switch_stmt.is_sparse) {
+            gen_switch_search_dispatch(stmt);
+            genlnf("switch (ion_sw_case) {");
+        } else {
+            genlnf("switch (");
+            gen_expr(stmt->switch_stmt.expr);
+            genf(") {");
+        }
         for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
             SwitchCase switch_case = stmt->switch_stmt.cases[i];
-            for (size_t j = 0; j < switch_case.num_exprs; j++) {
+            if (by_case_index && switch_case.num_exprs) {
+                genlnf("case %zu:", i);
+            }
+            for (size_t j = 0; j < switch_case.num_exprs && !by_case_index; j++) {
                 genlnf("case ");
                 gen_expr(switch_case.exprs[j]);
+                if (switch_case.ends[j]) {
+                    genf(" ... ");
+                    gen_expr(switch_case.ends[j]);
+                }
                 genf(":");
 
             }
@@ -543,7 +1012,12 @@ void gen_stmt(Stmt *stmt) {
             genlnf("}");
         }
         genlnf("}");
+        if (by_case_index) {
+            gen_indent--;
+            genlnf("}");
+        }
         break;
+    }
     default:
         genln();
         gen_simple_stmt(stmt);
@@ -552,6 +1026,112 @@ void gen_stmt(Stmt *stmt) {
     }
 }
 
+// Small non-recursive functions are expanded at call sites as GNU statement expressions. The cost is the number
+// of statements and expressions in the body. Callees whose locals share a name with a global are skipped, since
+// names are renamed by spelling rather than by binding.
+GenInlineInfo *gen_inline_info(Sym *sym) {
+    GenInlineInfo *info = map_get(&gen_inline_infos, sym);
+    if (info) {
+        return info;
+    }
+    info = xcalloc(1, sizeof(GenInlineInfo));
+    Decl *decl = sym->decl;
+    scan_func_body(&info->scan, decl);
+    info->is_inlinable = !decl->func.has_varargs && info->scan.num_stmts + info->scan.num_exprs <= GEN_INLINE_MAX_COST;
+    for (const char **it = info->scan.refs; it != buf_end(info->scan.refs); it++) {
+        if (!is_scanned_local(&info->scan, *it)) {
+            buf_push(info->globals, *it);
+        }
+        if (*it == decl->name || (is_scanned_local(&info->scan, *it) && sym_get(*it))) {
+            info->is_inlinable = false;
+        }
+    }
+    for (const char **it = info->scan.locals; it != buf_end(info->scan.locals); it++) {
+        if (sym_get(*it)) {
+            info->is_inlinable = false;
+        }
+    }
+    map_put(&gen_inline_infos, sym, info);
+    return info;
+}
+
+bool gen_inline_call(Expr *expr) {
+    Expr *callee = expr->call.expr;
+    if (!gen_func_sym || callee->kind != EXPR_NAME || gen_local_name(callee->name) != callee->name || is_scanned_local(&gen_func_scan, callee->name)) {
+        return false;
+    }
+    Sym *sym = sym_get(callee->name);
+    if (!sym || sym->kind != SYM_FUNC || !sym->decl || sym->builtin || is_decl_foreign(sym->decl) || sym == gen_func_sym) {
+        return false;
+    }
+    GenInlineInfo *info = gen_inline_info(sym);
+    if (!info->is_inlinable) {
+        return false;
+    }
+    for (GenInlineFrame *it = gen_inline_frames; it != buf_end(gen_inline_frames); it++) {
+        if (it->sym == sym) {
+            return false;
+        }
+    }
+    // The callee's references to globals must not be captured by locals of the function being emitted.
+    for (const char **it = info->globals; it != buf_end(info->globals); it++) {
+        if (is_scanned_local(&gen_func_scan, *it)) {
+            return false;
+        }
+    }
+    int id = ++gen_inline_count;
+    Decl *decl = sym->decl;
+    Type *ret_type = sym->type->func.ret;
+    genf("({");
+    gen_indent++;
+    for (size_t i = 0; i < decl->func.num_params; i++) {
+        Type *param_type = sym->type->func.params[i];
+        if (is_array_type(param_type)) {
+            param_type = type_ptr(param_type->base);
+        }
+        genlnf("%s = ", type_to_cdecl(param_type, gen_strf("ion_inl%d_%s", id, decl->func.params[i].name)));
+        gen_init_expr(expr->call.args[i]);
+        genf(";");
+    }
+    // A body whose only return is its last statement needs no result variable or jump.
+    StmtList block = decl->func.block;
+    Stmt *last = block.num_stmts ? block.stmts[block.num_stmts - 1] : NULL;
+    size_t num_returns = info->scan.num_returns;
+    bool is_direct = num_returns == 0 || (num_returns == 1 && last->kind == STMT_RETURN);
+    if (!is_direct && ret_type != type_void) {
+        genlnf("%s;", type_to_cdecl(ret_type, gen_strf("ion_inl%d_ret", id)));
+    }
+    buf_push(gen_inline_frames, (GenInlineFrame){sym, id, info});
+    bool ends_with_return = last && last->kind == STMT_RETURN;
+    size_t num_stmts = ends_with_return ? block.num_stmts - 1 : block.num_stmts;
+    for (size_t i = 0; i < num_stmts; i++) {
+        gen_stmt(block.stmts[i]);
+    }
+    if (ends_with_return && last->expr) {
+        if (is_direct) {
+            genln();
+            if (is_scalar_type(ret_type) && unqualify_type(last->expr->type) != ret_type) {
+                genf("(%s)", type_to_cdecl(ret_type, ""));
+            }
+        } else {
+            genlnf("ion_inl%d_ret = ", id);
+        }
+        genf("(");
+        gen_expr(last->expr);
+        genf(");");
+    }
+    buf__hdr(gen_inline_frames)->len--;
+    if (!is_direct) {
+        genlnf("ion_inl%d_done:;", id);
+        if (ret_type != type_void) {
+            genlnf("ion_inl%d_ret;", id);
+        }
+    }
+    gen_indent--;
+    genlnf("})");
+    return true;
+}
+
 void gen_enum(Decl *decl) {
     assert(decl->kind == DECL_ENUM);
     genlnf("typedef enum %s {", decl->name);
@@ -571,15 +1151,23 @@ void gen_decl(Sym *sym) {
     gen_sync_pos(decl->pos);
     switch (decl->kind) {
     case DECL_CONST:
+        if (!is_scalar_type(sym->type)) {
+            genlnf("%s = ", type_to_cdecl(type_const(sym->type), sym->name));
+            gen_const_data(sym->type, decl->const_decl.expr->call.folded_data);
+            genf(";");
+            break;
+        }
         genlnf("#define %s (", sym->name);
         gen_expr(decl->const_decl.expr);
         genf(")");
         break;
     case DECL_VAR:
+        genln();
+        gen_align_note(get_decl_note(decl, align_name));
         if (decl->var.type && !is_incomplete_array_typespec(decl->var.type)) {
-            genlnf("%s", typespec_to_cdecl(decl->var.type, sym->name));
+            genf("%s", typespec_to_cdecl(decl->var.type, sym->name));
         } else {
-            genlnf("%s", type_to_cdecl(sym->type, sym->name));
+            genf("%s", type_to_cdecl(sym->type, sym->name));
         }
         if (decl->var.expr) {
             genf(" = ");
@@ -618,21 +1206,59 @@ void gen_func_defs(void) {
     for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
         Sym *sym = *it;
         Decl *decl = sym->decl;
-        if (decl && decl->kind == DECL_FUNC && !is_decl_foreign(decl)) {
+        if (decl && decl->kind == DECL_FUNC && !is_decl_foreign(decl) && sym->state == SYM_RESOLVED) {
+            if (gen_inline) {
+                scan_func_body(&gen_func_scan, decl);
+                gen_func_sym = sym;
+            }
             gen_func_decl(decl);
             genf(" ");
             gen_stmt_block(decl->func.block);
             genln();
         }
     }
+    gen_func_sym = NULL;
+}
+
+void gen_reset(void) {
+    for (size_t i = 0; i < gen_inline_infos.cap; i++) {
+        if (map_slot_full(&gen_inline_infos, i)) {
+            GenInlineInfo *info = gen_inline_infos.entries[i].val;
+            free_body_scan(&info->scan);
+            buf_free(info->globals);
+            free(info);
+        }
+    }
+    map_clear(&gen_inline_infos);
+    buf_clear(gen_inline_frames);
+    gen_inline_count = 0;
+    gen_func_sym = NULL;
+    free_body_scan(&gen_func_scan);
+    gen_indent = 0;
+    arena_reset(&gen_arena);
 }
 
 void gen_all(void) {
-    gen_buf = NULL;
+    buf_clear(gen_buf);
     genf("%s", gen_preamble);
     genf("// Forward declarations");
     gen_forward_decls();
     genln();
+    if (buf_len(cached_vector_types)) {
+        genlnf("// Vector types");
+        gen_vector_types();
+        genln();
+    }
+    if (rotate_builtin_sizes) {
+        genlnf("// Builtin helpers");
+        gen_builtin_helpers();
+        genln();
+    }
+    if (uses_str_switch) {
+        genlnf("// String switch helpers");
+        gen_str_switch_helpers();
+        genln();
+    }
     genlnf("// Sorted declarations");
     gen_sorted_decls();
     genlnf("// Function definitions");
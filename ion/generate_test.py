@@ -1,3 +1,6 @@
+import argparse
+import sys
+
 template = """
 func example_test(?)(): int {
     return fact_rec(?)(10) == fact_iter(?)(10);
@@ -15,7 +18,7 @@ union IntOrPtr(?) {
 //    u2.p = (:int*)0;
 // }
 
-var i(?): int
+var i(?): int;
 
 struct Vector(?) {
     x, y: int;
@@ -37,16 +40,132 @@ func fact_rec(?)(n: int): int {
     }
 }
 
-const n(?) = 1 + sizeof(p(?))
+const n(?) = 1 + sizeof(p(?));
 
-var p(?): T(?)*
+var p(?): T(?)*;
 
 struct T(?) {
     a: int[n(?)];
 }
 """
 
-print("func main(argc: int, argv: char**): int { return 0; }")
+TEMPLATE_DECLS = 9
+
+# Each style writes about `count` declarations. Locals count as declarations in the locals style, and nested
+# statements in the nested style.
+
+def gen_template(out, count):
+    for i in range((count + TEMPLATE_DECLS - 1) // TEMPLATE_DECLS):
+        out.write(template.replace("(?)", str(i)) + "\n")
+
+# Many small top-level declarations of every kind.
+def gen_decls(out, count):
+    for i in range(count):
+        kind = i % 5
+        if kind == 0:
+            out.write("const c%d = %d;\n" % (i, i))
+        elif kind == 1:
+            out.write("var g%d: int = c%d;\n" % (i, i - 1))
+        elif kind == 2:
+            out.write("struct S%d { a: int; b: char*; }\n" % i)
+        elif kind == 3:
+            out.write("typedef T%d = S%d*;\n" % (i, i - 1))
+        else:
+            out.write("func f%d(x: int): int { return x + g%d; }\n" % (i, i - 3))
+
+OPS = ["+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>", "==", "!=", "<", ">", "<=", ">=", "&&", "||"]
+
+def gen_expr(rand, depth):
+    if depth == 0 or rand() % 8 == 0:
+        return ["a", "b", "c", str(rand() % 100)][rand() % 4]
+    kind = rand() % 8
+    if kind == 0:
+        return "-(" + gen_expr(rand, depth - 1) + ")"
+    if kind == 1:
+        return "(" + gen_expr(rand, depth - 1) + " ? " + gen_expr(rand, depth - 1) + " : " + gen_expr(rand, depth - 1) + ")"
+    if kind == 2:
+        return "(" + gen_expr(rand, depth - 1) + ")"
+    return gen_expr(rand, depth - 1) + " " + OPS[rand() % len(OPS)] + " " + gen_expr(rand, depth - 1)
+
+def make_rand(seed):
+    state = [seed]
+    def rand():
+        state[0] = (state[0] * 6364136223846793005 + 1442695040888963407) & ((1 << 64) - 1)
+        return state[0] >> 33
+    return rand
+
+# Functions whose bodies are one long expression.
+def gen_exprs(out, count):
+    rand = make_rand(1)
+    for i in range(count):
+        out.write("func e%d(a: int, b: int, c: int): int { return %s; }\n" % (i, gen_expr(rand, 4)))
+
+NEST_DEPTH = 16
+
+# Functions with statements nested NEST_DEPTH deep.
+def gen_nested(out, count):
+    for i in range((count + NEST_DEPTH - 1) // NEST_DEPTH):
+        out.write("func n%d(x: int): int {\n" % i)
+        closers = []
+        level = 1
+        for d in range(NEST_DEPTH):
+            indent = "    " * level
+            kind = d % 4
+            if kind == 0:
+                out.write("%sif (x > %d) {\n" % (indent, d))
+            elif kind == 1:
+                out.write("%swhile (x < %d) {\n" % (indent, 1000 + d))
+            elif kind == 2:
+                out.write("%sfor (j%d := 0; j%d < x; j%d++) {\n" % (indent, d, d, d))
+            else:
+                out.write("%sswitch (x) {\n%s    case %d: {\n" % (indent, indent, d))
+                closers.append(indent + "}\n")
+                indent += "    "
+                level += 1
+            closers.append(indent + "}\n")
+            level += 1
+        out.write("%sx++;\n" % ("    " * level))
+        for closer in reversed(closers):
+            out.write(closer)
+        out.write("    return x;\n}\n")
+
+LOCALS_PER_FUNC = 512
+
+# Functions with many locals, each referring to earlier ones.
+def gen_locals(out, count):
+    for i in range((count + LOCALS_PER_FUNC - 1) // LOCALS_PER_FUNC):
+        out.write("func l%d(x: int): int {\n    v0 := x;\n" % i)
+        for j in range(1, LOCALS_PER_FUNC):
+            out.write("    v%d := v%d + v%d;\n" % (j, j - 1, j // 2))
+        out.write("    return v%d;\n}\n" % (LOCALS_PER_FUNC - 1))
+
+# Many distinct struct types, each built from earlier types through pointers, arrays and const.
+def gen_types(out, count):
+    out.write("struct D0 { a: int; }\n")
+    for i in range(1, count):
+        out.write("struct D%d { p: D%d*; q: D%d const*; r: D%d*[%d]; s: D%d**; }\n" %
+                  (i, i - 1, i // 2, i // 3, i % 4 + 1, i // 5))
+
+STYLES = {
+    "template": gen_template,
+    "decls": gen_decls,
+    "exprs": gen_exprs,
+    "nested": gen_nested,
+    "locals": gen_locals,
+    "types": gen_types,
+}
+
+def generate(out, style, count):
+    out.write("func main(argc: int, argv: char**): int { return 0; }\n")
+    STYLES[style](out, count)
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate Ion source for tests and benchmarks.")
+    parser.add_argument("--style", choices=sorted(STYLES), default="template")
+    parser.add_argument("--count", type=int, default=32 * 1024 * TEMPLATE_DECLS,
+                        help="approximate number of declarations")
+    args = parser.parse_args()
+    generate(sys.stdout, args.style, args.count)
 
-for i in range(32 * 1024):
-    print(template.replace("(?)", str(i)))
+if __name__ == "__main__":
+    main()
@@ -1,45 +1,425 @@
-bool ion_compile_file(const char *path) {
+typedef enum Backend {
+    BACKEND_C,
+    BACKEND_X64,
+} Backend;
+
+Backend ion_backend = BACKEND_C;
+
+// On generate_test.py output the AST takes about 11 bytes per byte of source and interned names about half a byte.
+enum {
+    AST_BYTES_PER_SOURCE_BYTE = 12,
+};
+
+// Sizes the arenas for the input up front so that a large AST lands in one block.
+void ion_reserve_arenas(size_t source_size) {
+    arena_reserve(&ast_arena, source_size * AST_BYTES_PER_SOURCE_BYTE);
+    arena_reserve(&intern_arena, source_size / 2);
+}
+
+// With --token-array the input is lexed in full before parsing, which gives the parser cheap lookahead and
+// re-parsing at the cost of about six bytes of tokens per byte of source. Otherwise the parser lexes as it goes.
+bool ion_token_array;
+
+// Storage for --token-array, reused across compilations.
+TokenArray ion_tokens;
+
+void ion_init_lexer(const char *path, const char *str) {
+    if (ion_token_array) {
+        init_token_array(&ion_tokens, path, str);
+    } else {
+        init_stream(path, str);
+    }
+}
+
+// The AST points into the source text, so the last file read stays alive until the next one replaces it.
+char *ion_source;
+
+bool ion_resolve_file(const char *path) {
     char *str = read_file(path);
     if (!str) {
         return false;
     }
-    init_stream(path, str);
+    free(ion_source);
+    ion_source = str;
+    ion_reserve_arenas(strlen(str));
+    ion_init_lexer(path, str);
     init_builtins();
     DeclSet *declset = parse_file();
     sym_global_decls(declset);
     finalize_syms();
-    gen_all();
-    const char *c_code = gen_buf;
-    gen_buf = NULL;
-    const char *c_path = replace_ext(path, "c");
-    if (!c_path) {
-        return false;
+    return true;
+}
+
+// With --emit-deps each compiled file also gets a .d depfile for make and ninja, and a .deps.json file with the
+// declaration dependency graph recorded by the resolver.
+bool ion_emit_deps;
+
+// Escapes a path for a make rule. Ninja reads depfiles with the same rules.
+void buf_make_path(char **buf, const char *path) {
+    for (const char *ptr = path; *ptr; ptr++) {
+        if (*ptr == ' ' || *ptr == '#' || *ptr == '\\') {
+            buf_printf(*buf, "\\%c", *ptr);
+        } else if (*ptr == '$') {
+            buf_printf(*buf, "$$");
+        } else {
+            buf_printf(*buf, "%c", *ptr);
+        }
+    }
+}
+
+void buf_json_str(char **buf, const char *str) {
+    buf_printf(*buf, "\"");
+    for (const char *ptr = str; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\') {
+            buf_printf(*buf, "\\%c", *ptr);
+        } else if ((unsigned char)*ptr < 0x20) {
+            buf_printf(*buf, "\\u%04x", *ptr);
+        } else {
+            buf_printf(*buf, "%c", *ptr);
+        }
     }
-    if (!write_file(c_path, c_code, buf_len(c_code))) {
+    buf_printf(*buf, "\"");
+}
+
+const char *sym_kind_names[] = {
+    [SYM_NONE] = "none",
+    [SYM_VAR] = "var",
+    [SYM_CONST] = "const",
+    [SYM_FUNC] = "func",
+    [SYM_TYPE] = "type",
+};
+
+bool write_deps(const char *path, char **outputs, size_t num_outputs) {
+    char *buf = NULL;
+    for (size_t i = 0; i < num_outputs; i++) {
+        buf_make_path(&buf, outputs[i]);
+        buf_printf(buf, i + 1 < num_outputs ? " " : ": ");
+    }
+    buf_make_path(&buf, path);
+    buf_printf(buf, "\n");
+    char *dep_path = replace_ext(path, "d");
+    bool ok = dep_path && write_file(dep_path, buf, buf_len(buf));
+    free(dep_path);
+    buf_clear(buf);
+    buf_printf(buf, "{\n  \"source\": ");
+    buf_json_str(&buf, path);
+    buf_printf(buf, ",\n  \"outputs\": [");
+    for (size_t i = 0; i < num_outputs; i++) {
+        buf_printf(buf, i ? ", " : "");
+        buf_json_str(&buf, outputs[i]);
+    }
+    buf_printf(buf, "],\n  \"decls\": [");
+    const char *sep = "\n";
+    for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
+        Sym *sym = *it;
+        if (!is_source_sym(sym)) {
+            continue;
+        }
+        buf_printf(buf, "%s    {\"name\": ", sep);
+        buf_json_str(&buf, sym->name);
+        buf_printf(buf, ", \"kind\": \"%s\", \"line\": %d", sym_kind_names[sym->kind], sym->decl->pos.line);
+        if (is_generic_decl(sym->decl)) {
+            buf_printf(buf, ", \"generic\": true");
+        }
+        buf_printf(buf, ", \"deps\": [");
+        for (SymDep *dep = sym->deps; dep; dep = dep->next) {
+            buf_printf(buf, dep != sym->deps ? ", " : "");
+            buf_json_str(&buf, dep->sym->name);
+        }
+        buf_printf(buf, "]}");
+        sep = ",\n";
+    }
+    buf_printf(buf, "\n  ]\n}\n");
+    char *json_path = replace_ext(path, "deps.json");
+    ok = ok && json_path && write_file(json_path, buf, buf_len(buf));
+    free(json_path);
+    buf_free(buf);
+    return ok;
+}
+
+bool ion_compile_file(const char *path) {
+    record_sym_deps = ion_emit_deps;
+    if (!ion_resolve_file(path)) {
         return false;
     }
-    return true;
+    char *outputs[2] = {0};
+    size_t num_outputs = 0;
+    bool ok;
+    if (ion_backend == BACKEND_X64) {
+        x64_gen_all();
+        char *obj_path = outputs[num_outputs++] = replace_ext(path, "o");
+        ok = obj_path && elf_write(obj_path);
+    } else {
+        gen_all();
+        char *c_path = outputs[num_outputs++] = replace_ext(path, "c");
+        ok = c_path && write_file(c_path, gen_buf, buf_len(gen_buf));
+        if (ok && cc_path) {
+            char *obj_path = outputs[num_outputs++] = replace_ext(path, "o");
+            ok = obj_path && cc_compile(c_path, gen_buf, buf_len(gen_buf), obj_path);
+        }
+    }
+    if (ok && ion_emit_deps) {
+        ok = write_deps(path, outputs, num_outputs);
+    }
+    for (size_t i = 0; i < num_outputs; i++) {
+        free(outputs[i]);
+    }
+    return ok;
+}
+
+// Returns the compiler to its initial state so another program can be compiled in the same process.
+// Arenas keep their first block and tables keep their storage, so a reset is cheap. Interned strings are kept.
+void ion_reset(void) {
+    resolve_reset();
+    type_reset();
+    gen_reset();
+    vm_reset();
+    x64_reset();
+    rv_reset();
+    arena_reset(&ast_arena);
+    str_lit_reset();
 }
 
+// Compiles a program to C for a host process. The result stays valid until the next call. On failure it
+// returns NULL and the error messages are in error_buf instead of being printed.
 const char *ion_compile_str(const char *str) {
-    init_stream(NULL, str);
-    init_builtins();
-    sym_global_decls(parse_file());
-    finalize_syms();
-    gen_all();
-    const char *result = gen_buf;
-    gen_buf = NULL;
+    init_keywords();
+    ion_reset();
+    buf_clear(error_buf);
+    use_error_buf = true;
+    jmp_buf jmp;
+    fatal_jmp = &jmp;
+    const char *result = NULL;
+    if (!setjmp(jmp)) {
+        ion_reserve_arenas(strlen(str));
+        ion_init_lexer(NULL, str);
+        init_builtins();
+        sym_global_decls(parse_file());
+        finalize_syms();
+        gen_all();
+        result = gen_buf;
+    }
+    fatal_jmp = NULL;
+    use_error_buf = false;
     return result;
 }
+#ifndef _WIN32
+// Runs main in-process. The program sees the source path as argv[0] followed by the remaining arguments.
+int ion_run_file(int argc, char **argv) {
+    const char *path = argv[0];
+    if (!ion_resolve_file(path)) {
+        printf("Compilation failed.\n");
+        return 1;
+    }
+    x64_gen_all();
+    return jit_run(argc, argv);
+}
+#endif
+
+// Runs main on the bytecode VM, compiling functions as they are first called.
+int ion_vm_file(int argc, char **argv) {
+    if (!ion_resolve_file(argv[0])) {
+        printf("Compilation failed.\n");
+        return 1;
+    }
+    return vm_run_main(argc, argv);
+}
+
+// Compiles to RV64IM and runs main on the built-in simulator, printing execution statistics to stderr.
+int ion_rv64_file(int argc, char **argv) {
+    if (!ion_resolve_file(argv[0])) {
+        printf("Compilation failed.\n");
+        return 1;
+    }
+    rv_gen_all();
+    return rv_run(argc, argv);
+}
+
+int bench_main(int argc, char **argv);
+
+// Splits a response file into arguments at whitespace. Double quotes group an argument that contains spaces.
+bool read_response_file(const char *path, const char ***args) {
+    char *str = read_file(path);
+    if (!str) {
+        return false;
+    }
+    char *ptr = str;
+    for (;;) {
+        while (isspace(*ptr)) {
+            ptr++;
+        }
+        if (!*ptr) {
+            break;
+        }
+        char *arg = ptr;
+        char *out = ptr;
+        bool quoted = false;
+        while (*ptr && (quoted || !isspace(*ptr))) {
+            if (*ptr == '"') {
+                quoted = !quoted;
+                ptr++;
+            } else {
+                *out++ = *ptr++;
+            }
+        }
+        if (*ptr) {
+            ptr++;
+        }
+        *out = 0;
+        buf_push(*args, str_intern(arg));
+    }
+    free(str);
+    return true;
+}
+
+// Compiles one file of a batch. A fatal error abandons only this file, and the next one starts from a reset
+// compiler that still has the interned names from the files before it.
+bool ion_compile_batch_file(const char *path) {
+    ion_reset();
+    jmp_buf jmp;
+    fatal_jmp = &jmp;
+    volatile bool ok = false;
+    if (!setjmp(jmp)) {
+        ok = ion_compile_file(path);
+    }
+    fatal_jmp = NULL;
+    if (!ok) {
+        printf("%s: compilation failed.\n", path);
+    }
+    fflush(stdout);
+    return ok;
+}
+
+// Compiles every path and returns the number that failed. With num_jobs > 1 the paths are dealt out round-robin
+// to forked workers, which start with the parent's keywords and interned names.
+size_t ion_compile_files(const char **paths, size_t num_jobs) {
+    size_t num_failed = 0;
+#ifndef _WIN32
+    if (num_jobs > 1 && buf_len(paths) > 1) {
+        num_jobs = MIN(num_jobs, buf_len(paths));
+        fflush(stdout);
+        pid_t *pids = NULL;
+        for (size_t job = 0; job < num_jobs; job++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                size_t failed = 0;
+                for (size_t i = job; i < buf_len(paths); i += num_jobs) {
+                    failed += !ion_compile_batch_file(paths[i]);
+                }
+                cc_print_stats();
+                exit((int)MIN(failed, 255));
+            } else if (pid < 0) {
+                perror("fork");
+                num_failed += (buf_len(paths) - job + num_jobs - 1) / num_jobs;
+            } else {
+                buf_push(pids, pid);
+            }
+        }
+        for (size_t i = 0; i < buf_len(pids); i++) {
+            int status;
+            if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status)) {
+                num_failed++;
+            } else {
+                num_failed += WEXITSTATUS(status);
+            }
+        }
+        buf_free(pids);
+        return num_failed;
+    }
+#endif
+    for (size_t i = 0; i < buf_len(paths); i++) {
+        num_failed += !ion_compile_batch_file(paths[i]);
+    }
+    cc_print_stats();
+    return num_failed;
+}
+
 int ion_main(int argc, char **argv) {
-    if (argc < 2) {
-        printf("Usage: %s <ion-source-file>\n", argv[0]);
+    if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+        init_keywords();
+        return bench_main(argc - 2, argv + 2);
+    }
+#ifndef _WIN32
+    if (argc >= 3 && strcmp(argv[1], "run") == 0) {
+        init_keywords();
+        return ion_run_file(argc - 2, argv + 2);
+    }
+#endif
+    if (argc >= 3 && strcmp(argv[1], "vm") == 0) {
+        init_keywords();
+        return ion_vm_file(argc - 2, argv + 2);
+    }
+    if (argc >= 3 && strcmp(argv[1], "rv64") == 0) {
+        init_keywords();
+        return ion_rv64_file(argc - 2, argv + 2);
+    }
+    const char **args = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '@') {
+            if (!read_response_file(argv[i] + 1, &args)) {
+                printf("Can't read response file %s\n", argv[i] + 1);
+                return 1;
+            }
+        } else {
+            buf_push(args, argv[i]);
+        }
+    }
+    const char **paths = NULL;
+    size_t num_jobs = 1;
+    bool usage = false;
+    for (size_t i = 0; i < buf_len(args); i++) {
+        const char *arg = args[i];
+        if (strcmp(arg, "--backend=c") == 0) {
+            ion_backend = BACKEND_C;
+        } else if (strcmp(arg, "--backend=x64") == 0) {
+            ion_backend = BACKEND_X64;
+        } else if (strcmp(arg, "--inline") == 0) {
+            gen_inline = true;
+        } else if (strcmp(arg, "--huge-pages") == 0) {
+            arena_policy |= ARENA_HUGE_PAGES;
+        } else if (strcmp(arg, "--emit-deps") == 0) {
+            ion_emit_deps = true;
+        } else if (strcmp(arg, "--token-array") == 0) {
+            ion_token_array = true;
+        } else if (strncmp(arg, "--cc=", 5) == 0) {
+            cc_path = arg + 5;
+        } else if (strncmp(arg, "--cflags=", 9) == 0) {
+            cc_flags = arg + 9;
+        } else if (strncmp(arg, "--cc-cache=", 11) == 0) {
+            cc_cache_dir = arg + 11;
+        } else if (strncmp(arg, "-j", 2) == 0) {
+            const char *count = arg[2] ? arg + 2 : i + 1 < buf_len(args) ? args[++i] : "";
+            num_jobs = strtoul(count, NULL, 10);
+            usage |= num_jobs == 0;
+        } else if (arg[0] != '-') {
+            buf_push(paths, arg);
+        } else {
+            usage = true;
+        }
+    }
+    buf_free(args);
+    usage |= cc_path && ion_backend != BACKEND_C;
+    if (usage || !buf_len(paths)) {
+        printf("Usage: %s [--backend=c|x64] [--inline] [--huge-pages] [--emit-deps] [--token-array] [-j jobs] "
+            "<ion-source-file>... [@response-file]\n", argv[0]);
+        printf("       C backend options: [--cc=compiler] [--cflags=flags] [--cc-cache=dir]\n");
+        printf("       %s run <ion-source-file> [args...]\n", argv[0]);
+        printf("       %s vm <ion-source-file> [args...]\n", argv[0]);
+        printf("       %s rv64 <ion-source-file> [args...]\n", argv[0]);
+        printf("       %s bench <benchmark> [args...]\n", argv[0]);
+        buf_free(paths);
         return 1;
     }
     init_keywords();
-    const char *path = argv[1];
-    if (!ion_compile_file(path)) {
-        printf("Compilation failed.\n");
+    size_t num_failed = ion_compile_files(paths, num_jobs);
+    size_t num_paths = buf_len(paths);
+    buf_free(paths);
+    if (num_failed) {
+        if (num_paths > 1) {
+            printf("Compilation failed for %zu of %zu files.\n", num_failed, num_paths);
+        } else {
+            printf("Compilation failed.\n");
+        }
         return 1;
     }
     printf("Compilation succeeded.\n");
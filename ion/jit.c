@@ -0,0 +1,140 @@
+// Loads the output of the x64 backend into executable memory and runs it in-process.
+// The image is mapped read-write while relocations are applied and the code pages are then switched to read-execute.
+// @foreign symbols are looked up in the running process with dlsym and reached through GOT slots and jump stubs.
+
+enum {
+    JIT_STUB_SIZE = 8,
+};
+
+typedef int (*JitMain)(int argc, char **argv);
+
+typedef struct JitImage {
+    char *base;
+    size_t size;
+    size_t code_size;
+    char *sections[NUM_X64_SECTIONS];
+    char *stubs;
+    void **got;
+} JitImage;
+
+// libm is searched after the process because the linker drops it from ion when ion itself calls nothing in it.
+void *host_sym_addr(const char *name) {
+    static void *process;
+    static void *libm;
+    if (!process) {
+        process = dlopen(NULL, RTLD_NOW);
+#ifdef __linux__
+        libm = dlopen("libm.so.6", RTLD_NOW);
+#endif
+    }
+    void *addr = process ? dlsym(process, name) : NULL;
+    if (!addr && libm) {
+        addr = dlsym(libm, name);
+    }
+    return addr;
+}
+
+void *jit_sym_addr(JitImage *image, size_t index) {
+    X64Sym *sym = x64_syms + index;
+    if (sym->is_defined) {
+        return image->sections[sym->section] + sym->offset;
+    }
+    void *addr = host_sym_addr(sym->name);
+    if (!addr) {
+        fatal("Unresolved foreign symbol '%s'", sym->name);
+    }
+    return addr;
+}
+
+void jit_patch32(char *ptr, long long val) {
+    if (val < INT32_MIN || val > INT32_MAX) {
+        fatal("JIT relocation out of range");
+    }
+    int32_t val32 = (int32_t)val;
+    memcpy(ptr, &val32, sizeof(val32));
+}
+
+// Lays out code, stubs and read-only data on the first pages and writable data, bss and the GOT after them.
+void jit_layout(JitImage *image, size_t page_size) {
+    size_t num_syms = buf_len(x64_syms);
+    size_t offsets[NUM_X64_SECTIONS];
+    size_t offset = buf_len(x64_sections[X64_TEXT]);
+    offsets[X64_TEXT] = 0;
+    size_t stubs_offset = ALIGN_UP(offset, JIT_STUB_SIZE);
+    offset = stubs_offset + num_syms * JIT_STUB_SIZE;
+    offsets[X64_RODATA] = ALIGN_UP(offset, x64_section_aligns[X64_RODATA]);
+    offset = offsets[X64_RODATA] + buf_len(x64_sections[X64_RODATA]);
+    image->code_size = ALIGN_UP(offset, page_size);
+    offsets[X64_DATA] = ALIGN_UP(image->code_size, x64_section_aligns[X64_DATA]);
+    offset = offsets[X64_DATA] + buf_len(x64_sections[X64_DATA]);
+    offsets[X64_BSS] = ALIGN_UP(offset, x64_section_aligns[X64_BSS]);
+    offset = offsets[X64_BSS] + x64_bss_size;
+    size_t got_offset = ALIGN_UP(offset, sizeof(void *));
+    offset = got_offset + num_syms * sizeof(void *);
+    image->size = ALIGN_UP(offset, page_size);
+    image->base = mmap(NULL, image->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (image->base == MAP_FAILED) {
+        fatal("JIT mmap failed");
+    }
+    for (int i = 0; i < NUM_X64_SECTIONS; i++) {
+        image->sections[i] = image->base + offsets[i];
+        if (i != X64_BSS && x64_sections[i]) {
+            memcpy(image->sections[i], x64_sections[i], buf_len(x64_sections[i]));
+        }
+    }
+    image->stubs = image->base + stubs_offset;
+    image->got = (void **)(image->base + got_offset);
+}
+
+void jit_link(JitImage *image) {
+    // Every symbol gets a GOT slot, and undefined ones a jmp [rip + slot] stub for calls out of range of rel32.
+    for (size_t i = 0; i < buf_len(x64_syms); i++) {
+        image->got[i] = jit_sym_addr(image, i);
+        char *stub = image->stubs + i*JIT_STUB_SIZE;
+        memset(stub, 0xCC, JIT_STUB_SIZE);
+        stub[0] = (char)0xFF;
+        stub[1] = 0x25;
+        jit_patch32(stub + 2, (char *)(image->got + i) - (stub + 6));
+    }
+    for (X64Reloc *it = x64_relocs; it != buf_end(x64_relocs); it++) {
+        char *ptr = image->sections[it->section] + it->offset;
+        char *target = x64_syms[it->sym].is_defined ? image->got[it->sym] : image->stubs + it->sym*JIT_STUB_SIZE;
+        switch (it->kind) {
+        case X64_RELOC_ABS64: {
+            uint64_t val = (uint64_t)(uintptr_t)image->got[it->sym] + it->addend;
+            memcpy(ptr, &val, sizeof(val));
+            break;
+        }
+        case X64_RELOC_PC32:
+            jit_patch32(ptr, (char *)image->got[it->sym] + it->addend - ptr);
+            break;
+        case X64_RELOC_PLT32:
+            jit_patch32(ptr, target + it->addend - ptr);
+            break;
+        case X64_RELOC_GOTPCREL:
+            jit_patch32(ptr, (char *)(image->got + it->sym) + it->addend - ptr);
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+    if (mprotect(image->base, image->code_size, PROT_READ | PROT_EXEC) != 0) {
+        fatal("JIT mprotect failed");
+    }
+}
+
+int jit_run(int argc, char **argv) {
+    uintptr_t index = (uintptr_t)map_get(&x64_sym_map, (void *)str_intern("main"));
+    if (!index || !x64_syms[index - 1].is_defined) {
+        fatal("No main function to run");
+    }
+    JitImage image = {0};
+    jit_layout(&image, (size_t)sysconf(_SC_PAGESIZE));
+    jit_link(&image);
+    JitMain main_func = (JitMain)(uintptr_t)image.got[index - 1];
+    int result = main_func(argc, argv);
+    fflush(stdout);
+    munmap(image.base, image.size);
+    return result;
+}
@@ -22,7 +22,82 @@ const char *first_keyword;
 const char *last_keyword;
 const char **keywords;
 
+// Perfect hash over the keywords so the lexer can classify an identifier before interning it. The hash mixes the
+// length with the first, second and last characters, which are distinct for every keyword; init_keyword_table
+// searches for a multiplier that maps them to distinct slots.
+#define KEYWORD_HASH_BITS 6
+#define KEYWORD_SEED_TRIES (1 << 20)
+
+// Each slot keeps its keyword's length, so a lookup compares lengths before touching the keyword's bytes.
+typedef struct KeywordSlot {
+    const char *name;
+    size_t len;
+} KeywordSlot;
+
+KeywordSlot keyword_table[1 << KEYWORD_HASH_BITS];
+uint32_t keyword_hash_seed;
+size_t keyword_min_len = SIZE_MAX;
+size_t keyword_max_len;
+
+uint32_t keyword_key(const char *start, size_t len) {
+    return (uint32_t)len | (uint32_t)(uint8_t)start[0] << 8 | (uint32_t)(uint8_t)start[1] << 16 |
+        (uint32_t)(uint8_t)start[len - 1] << 24;
+}
+
+uint32_t keyword_hash(const char *start, size_t len) {
+    return (keyword_key(start, len) * keyword_hash_seed) >> (32 - KEYWORD_HASH_BITS);
+}
+
+void init_keyword_table(void) {
+    for (const char **it = keywords; it != buf_end(keywords); it++) {
+        size_t len = strlen(*it);
+        keyword_min_len = MIN(keyword_min_len, len);
+        keyword_max_len = MAX(keyword_max_len, len);
+    }
+    assert(keyword_min_len >= 2);
+    // No multiplier separates two keywords with the same key, so check for that before searching.
+    for (const char **it = keywords; it != buf_end(keywords); it++) {
+        for (const char **other = it + 1; other != buf_end(keywords); other++) {
+            if (keyword_key(*it, strlen(*it)) == keyword_key(*other, strlen(*other))) {
+                fatal("Keywords '%s' and '%s' have the same hash key", *it, *other);
+            }
+        }
+    }
+    keyword_hash_seed = 0x9e3779b1;
+    for (int tries = 0; tries < KEYWORD_SEED_TRIES; tries++, keyword_hash_seed += 2) {
+        memset(keyword_table, 0, sizeof(keyword_table));
+        const char **it = keywords;
+        for (; it != buf_end(keywords); it++) {
+            size_t len = strlen(*it);
+            KeywordSlot *slot = &keyword_table[keyword_hash(*it, len)];
+            if (slot->name) {
+                break;
+            }
+            *slot = (KeywordSlot){*it, len};
+        }
+        if (it == buf_end(keywords)) {
+            return;
+        }
+    }
+    fatal("No perfect hash for %d keywords in %d slots", (int)buf_len(keywords), 1 << KEYWORD_HASH_BITS);
+}
+
+// Returns the interned keyword spelled by [start, start + len), or NULL.
+const char *keyword_lookup(const char *start, size_t len) {
+    if (len < keyword_min_len || len > keyword_max_len) {
+        return NULL;
+    }
+    KeywordSlot *slot = &keyword_table[keyword_hash(start, len)];
+    if (slot->len == len && memcmp(slot->name, start, len) == 0) {
+        return slot->name;
+    }
+    return NULL;
+}
+
 const char *foreign_name;
+const char *soa_name;
+const char *align_name;
+const char *simd_name;
 
 #define KEYWORD(name) name##_keyword = str_intern(#name); buf_push(keywords, name##_keyword)
 
@@ -54,8 +129,12 @@ void init_keywords(void) {
     assert(intern_arena.end == arena_end);
     first_keyword = typedef_keyword;
     last_keyword = default_keyword;
+    init_keyword_table();
 
     foreign_name = str_intern("foreign");
+    soa_name = str_intern("soa");
+    align_name = str_intern("align");
+    simd_name = str_intern("simd");
 
     inited = true;
 }
@@ -254,7 +333,6 @@ typedef struct Token {
     TokenSuffix suffix;
     SrcPos pos;
     const char *start;
-    const char *end;
     union {
         unsigned long long int_val;
         double float_val;
@@ -267,21 +345,30 @@ Token token;
 const char *stream;
 const char *line_start;
 
+char *error_buf;
+bool use_error_buf;
+
 void error(SrcPos pos, const char *fmt, ...) {
     if (pos.name == NULL) {
         pos = pos_builtin;
     }
     va_list args;
     va_start(args, fmt);
-    printf("%s(%d): error: ", pos.name, pos.line);
-    vprintf(fmt, args);
-    printf("\n");
+    if (use_error_buf) {
+        buf_printf(error_buf, "%s(%d): error: ", pos.name, pos.line);
+        error_buf = buf__vprintf(error_buf, fmt, args);
+        buf_printf(error_buf, "\n");
+    } else {
+        printf("%s(%d): error: ", pos.name, pos.line);
+        vprintf(fmt, args);
+        printf("\n");
+    }
     va_end(args);
 }
 
-#define fatal_error(...) (error(__VA_ARGS__), exit(1))
+#define fatal_error(...) (error(__VA_ARGS__), fatal_exit())
 #define error_here(...) (error(token.pos, __VA_ARGS__))
-#define fatal_error_here(...) (error_here(__VA_ARGS__), exit(1))
+#define fatal_error_here(...) (error_here(__VA_ARGS__), fatal_exit())
 
 const char *token_info(void) {
     if (token.kind == TOKEN_NAME || token.kind == TOKEN_KEYWORD) {
@@ -446,10 +533,14 @@ void scan_char(void) {
     token.mod = MOD_CHAR;
 }
 
+// Literals are built in a scratch buffer that is reused across calls and then interned, so lexing the same
+// program again allocates nothing new.
 void scan_str(void) {
     assert(*stream == '"');
     stream++;
-    char *str = NULL;
+    static char *str;
+    buf_fit(str, 1);
+    buf_clear(str);
     if (stream[0] == '"' && stream[1] == '"') {
         stream += 2;
         while (*stream) {
@@ -493,9 +584,8 @@ void scan_str(void) {
             error_here("Unexpected end of file within string literal");
         }
     }
-    buf_push(str, 0);
     token.kind = TOKEN_STR;
-    token.str_val = str;
+    token.str_val = str_lit_intern_range(str, str + buf_len(str));
 }
 
 #define CASE1(c1, k1) \
@@ -527,7 +617,7 @@ void scan_str(void) {
         } \
         break;
 
-void next_token(void) {
+void scan_token(void) {
 repeat:
     token.start = stream;
     token.mod = 0;
@@ -563,8 +653,10 @@ repeat:
             stream++;
         }
         char c = *stream;
+        // A dot that starts an ellipsis ends the integer, as in case 1...9.
+        bool is_float = (c == '.' && stream[1] != '.') || tolower(c) == 'e';
         stream = token.start;
-        if (c == '.' || tolower(c) == 'e') {
+        if (is_float) {
             scan_float();
         } else {
             scan_int();
@@ -581,8 +673,13 @@ repeat:
         while (isalnum(*stream) || *stream == '_') {
             stream++;
         }
-        token.name = str_intern_range(token.start, stream);
-        token.kind = is_keyword_name(token.name) ? TOKEN_KEYWORD : TOKEN_NAME;
+        token.name = keyword_lookup(token.start, stream - token.start);
+        if (token.name) {
+            token.kind = TOKEN_KEYWORD;
+        } else {
+            token.name = str_intern_range(token.start, stream);
+            token.kind = TOKEN_NAME;
+        }
         break;
     case '<':
         token.kind = TOKEN_LT;
@@ -655,14 +752,53 @@ repeat:
         stream++;
         goto repeat;
     }
-    token.end = stream;
 }
 
 #undef CASE1
 #undef CASE2
 #undef CASE3
 
+// A whole file lexed up front into parallel arrays, one entry per token, ending with TOKEN_EOF. The parser walks it
+// by index, which gives it lookahead, lets it jump back to re-parse a generic without re-lexing, and lets it skip
+// a bracketed range in one step. Lexing can also be timed on its own.
+typedef struct TokenArray {
+    const char *name;
+    const char *src;
+    uint8_t *kinds;
+    uint8_t *mods;          // TokenMod in the low nibble, TokenSuffix in the high nibble.
+    uint32_t *offsets;      // Start of the token in src.
+    uint32_t *lines;
+    unsigned long long *vals;   // The token's int_val, float_val, str_val or name, whichever it carries.
+    uint32_t *matches;      // For a bracket, the index of its partner; otherwise 0.
+} TokenArray;
+
+// When set, next_token reads from this array instead of scanning the stream.
+TokenArray *token_array;
+size_t token_index;
+
+void load_token(size_t index) {
+    TokenArray *tokens = token_array;
+    token_index = index;
+    token.kind = tokens->kinds[index];
+    token.mod = tokens->mods[index] & 0xF;
+    token.suffix = tokens->mods[index] >> 4;
+    token.start = tokens->src + tokens->offsets[index];
+    token.pos.line = tokens->lines[index];
+    token.int_val = tokens->vals[index];
+}
+
+void next_token(void) {
+    if (token_array) {
+        if (token.kind != TOKEN_EOF) {
+            load_token(token_index + 1);
+        }
+    } else {
+        scan_token();
+    }
+}
+
 void init_stream(const char *name, const char *buf) {
+    token_array = NULL;
     stream = buf;
     line_start = stream;
     token.pos.name = name ? name : "<string>";
@@ -670,6 +806,135 @@ void init_stream(const char *name, const char *buf) {
     next_token();
 }
 
+// Scans all of buf into tokens, reusing its storage, and starts the parser on the first token.
+void init_token_array(TokenArray *tokens, const char *name, const char *buf) {
+    size_t len = strlen(buf);
+    assert(len <= UINT32_MAX);
+    buf_clear(tokens->kinds);
+    buf_clear(tokens->mods);
+    buf_clear(tokens->offsets);
+    buf_clear(tokens->lines);
+    buf_clear(tokens->vals);
+    buf_clear(tokens->matches);
+    tokens->src = buf;
+    // Typical source has a token every 3 to 4 bytes.
+    size_t estimate = len / 4 + 1;
+    buf_fit(tokens->kinds, estimate);
+    buf_fit(tokens->mods, estimate);
+    buf_fit(tokens->offsets, estimate);
+    buf_fit(tokens->lines, estimate);
+    buf_fit(tokens->vals, estimate);
+    buf_fit(tokens->matches, estimate);
+    uint32_t *open = NULL;
+    init_stream(name, buf);
+    tokens->name = token.pos.name;
+    for (;;) {
+        uint32_t index = (uint32_t)buf_len(tokens->kinds);
+        uint32_t match = 0;
+        if (token.kind == TOKEN_LPAREN || token.kind == TOKEN_LBRACE || token.kind == TOKEN_LBRACKET) {
+            buf_push(open, index);
+        } else if ((token.kind == TOKEN_RPAREN || token.kind == TOKEN_RBRACE || token.kind == TOKEN_RBRACKET) &&
+                   buf_len(open)) {
+            match = open[--buf__hdr(open)->len];
+            tokens->matches[match] = index;
+        }
+        buf_push(tokens->kinds, (uint8_t)token.kind);
+        buf_push(tokens->mods, (uint8_t)(token.mod | token.suffix << 4));
+        buf_push(tokens->offsets, (uint32_t)(token.start - buf));
+        buf_push(tokens->lines, (uint32_t)token.pos.line);
+        buf_push(tokens->vals, token.int_val);
+        buf_push(tokens->matches, match);
+        if (token.kind == TOKEN_EOF) {
+            break;
+        }
+        scan_token();
+    }
+    buf_free(open);
+    token_array = tokens;
+    load_token(0);
+}
+
+void free_token_array(TokenArray *tokens) {
+    if (token_array == tokens) {
+        token_array = NULL;
+    }
+    buf_free(tokens->kinds);
+    buf_free(tokens->mods);
+    buf_free(tokens->offsets);
+    buf_free(tokens->lines);
+    buf_free(tokens->vals);
+    buf_free(tokens->matches);
+}
+
+// Returns the kind of the token n places ahead of the current one. Without a token array it scans ahead and
+// then rewinds the stream.
+TokenKind peek_token_kind(size_t n) {
+    if (token_array) {
+        size_t last = buf_len(token_array->kinds) - 1;
+        return token_array->kinds[MIN(token_index + n, last)];
+    }
+    Token saved_token = token;
+    const char *saved_stream = stream;
+    const char *saved_line_start = line_start;
+    for (size_t i = 0; i < n && token.kind != TOKEN_EOF; i++) {
+        scan_token();
+    }
+    TokenKind kind = token.kind;
+    token = saved_token;
+    stream = saved_stream;
+    line_start = saved_line_start;
+    return kind;
+}
+
+// Skips from an opening bracket to the token after its partner, in one step with a token array.
+void skip_token_group(void) {
+    TokenKind open = token.kind;
+    assert(open == TOKEN_LPAREN || open == TOKEN_LBRACE || open == TOKEN_LBRACKET);
+    TokenKind close = open == TOKEN_LPAREN ? TOKEN_RPAREN : open == TOKEN_LBRACE ? TOKEN_RBRACE : TOKEN_RBRACKET;
+    if (token_array && token_array->matches[token_index]) {
+        load_token(token_array->matches[token_index]);
+        next_token();
+        return;
+    }
+    int depth = 0;
+    do {
+        if (token.kind == open) {
+            depth++;
+        } else if (token.kind == close) {
+            depth--;
+        }
+        next_token();
+    } while (depth > 0 && token.kind != TOKEN_EOF);
+}
+
+// The EOF token's offset is the source length.
+bool token_in_array(const char *src) {
+    if (!token_array) {
+        return false;
+    }
+    const char *end = token_array->src + token_array->offsets[buf_len(token_array->offsets) - 1];
+    return token_array->src <= src && src < end;
+}
+
+// Moves the parser to the token that starts at src, which must come from the current token array.
+void seek_token(const char *src) {
+    TokenArray *tokens = token_array;
+    assert(tokens && tokens->src <= src);
+    uint32_t offset = (uint32_t)(src - tokens->src);
+    size_t lo = 0;
+    size_t hi = buf_len(tokens->offsets);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->offsets[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    assert(lo < buf_len(tokens->offsets) && tokens->offsets[lo] == offset);
+    load_token(lo);
+}
+
 bool is_token(TokenKind kind) {
     return token.kind == kind;
 }
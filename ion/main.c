@@ -1,4 +1,5 @@
 #define _CRT_SECURE_NO_WARNINGS
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
@@ -11,6 +12,27 @@
 #include <stdarg.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <setjmp.h>
+#include <time.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef _WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 #include "common.c"
 #include "lex.c"
@@ -21,8 +43,18 @@
 #include "parse.c"
 #include "resolve.c"
 #include "gen.c"
+#include "x64.c"
+#include "elf.c"
+#ifndef _WIN32
+#include "jit.c"
+#endif
+#include "vm.c"
+#include "rv64.c"
+#include "rvsim.c"
+#include "cc.c"
 #include "ion.c"
 #include "test.c"
+#include "bench.c"
 
 int main(int argc, char **argv) {
  //    main_test();
@@ -3,6 +3,7 @@ Decl *parse_decl(void);
 Typespec *parse_type(void);
 Stmt *parse_stmt(void);
 Expr *parse_expr(void);
+const char *parse_name(void);
 
 Typespec *parse_type_func_param(void) {
     Typespec *type = parse_type();
@@ -41,7 +42,19 @@ Typespec *parse_type_func(void) {
     if (match_token(TOKEN_COLON)) {
         ret = parse_type();
     }
-    return typespec_func(pos, args, buf_len(args), ret, has_varargs);
+    Typespec *type = typespec_func(pos, args, buf_len(args), ret, has_varargs);
+    buf_free(args);
+    return type;
+}
+
+// Nested type arguments like Vec<Vec<int>> end in a >> token, which closes two lists.
+void expect_type_args_end(void) {
+    if (is_token(TOKEN_RSHIFT)) {
+        token.kind = TOKEN_GT;
+        token.start++;
+    } else {
+        expect_token(TOKEN_GT);
+    }
 }
 
 Typespec *parse_type_base(void) {
@@ -49,6 +62,17 @@ Typespec *parse_type_base(void) {
         SrcPos pos = token.pos;
         const char *name = token.name;
         next_token();
+        if (match_token(TOKEN_LT)) {
+            Typespec **args = NULL;
+            buf_push(args, parse_type());
+            while (match_token(TOKEN_COMMA)) {
+                buf_push(args, parse_type());
+            }
+            expect_type_args_end();
+            Typespec *type = typespec_generic(pos, name, args, buf_len(args));
+            buf_free(args);
+            return type;
+        }
         return typespec_name(pos, name);
     } else if (match_keyword(func_keyword)) {
         return parse_type_func();
@@ -65,8 +89,17 @@ Typespec *parse_type_base(void) {
 Typespec *parse_type(void) {
     Typespec *type = parse_type_base();
     SrcPos pos = token.pos;
-    while (is_token(TOKEN_LBRACKET) || is_token(TOKEN_MUL) || is_keyword(const_keyword)) {
-        if (match_token(TOKEN_LBRACKET)) {
+    while (is_token(TOKEN_LBRACKET) || is_token(TOKEN_MUL) || is_token(TOKEN_AT) || is_keyword(const_keyword)) {
+        if (match_token(TOKEN_AT)) {
+            const char *name = parse_name();
+            if (name != simd_name) {
+                fatal_error_here("Unknown type note @%s", name);
+            }
+            if (type->kind != TYPESPEC_ARRAY || !type->num_elems) {
+                fatal_error_here("@simd must follow a sized array type");
+            }
+            type = typespec_vector(pos, type->base, type->num_elems);
+        } else if (match_token(TOKEN_LBRACKET)) {
             Expr *size = NULL;
             if (!is_token(TOKEN_RBRACKET)) {
                 size = parse_expr();
@@ -115,7 +148,9 @@ Expr *parse_expr_compound(Typespec *type) {
         }
     }
     expect_token(TOKEN_RBRACE);
-    return expr_compound(pos, type, fields, buf_len(fields));
+    Expr *expr = expr_compound(pos, type, fields, buf_len(fields));
+    buf_free(fields);
+    return expr;
 }
 
 Expr *parse_expr_unary(void);
@@ -193,6 +228,7 @@ Expr *parse_expr_base(void) {
             }
             expect_token(TOKEN_RPAREN);
             expr = expr_call(pos, expr, args, buf_len(args));
+            buf_free(args);
         } else if (match_token(TOKEN_LBRACKET)) {
             Expr *index = parse_expr();
             expect_token(TOKEN_RBRACKET);
@@ -229,72 +265,60 @@ Expr *parse_expr_unary(void) {
     }
 }
 
-bool is_mul_op(void) {
-    return TOKEN_FIRST_MUL <= token.kind && token.kind <= TOKEN_LAST_MUL;
-}
-
-Expr *parse_expr_mul(void) {
+// Binding power of each binary operator; tokens that aren't binary operators have PREC_NONE.
+typedef enum Prec {
+    PREC_NONE,
+    PREC_OR,
+    PREC_AND,
+    PREC_CMP,
+    PREC_ADD,
+    PREC_MUL,
+} Prec;
+
+const uint8_t binary_prec[NUM_TOKEN_KINDS] = {
+    [TOKEN_MUL] = PREC_MUL,
+    [TOKEN_DIV] = PREC_MUL,
+    [TOKEN_MOD] = PREC_MUL,
+    [TOKEN_AND] = PREC_MUL,
+    [TOKEN_LSHIFT] = PREC_MUL,
+    [TOKEN_RSHIFT] = PREC_MUL,
+    [TOKEN_ADD] = PREC_ADD,
+    [TOKEN_SUB] = PREC_ADD,
+    [TOKEN_XOR] = PREC_ADD,
+    [TOKEN_OR] = PREC_ADD,
+    [TOKEN_EQ] = PREC_CMP,
+    [TOKEN_NOTEQ] = PREC_CMP,
+    [TOKEN_LT] = PREC_CMP,
+    [TOKEN_GT] = PREC_CMP,
+    [TOKEN_LTEQ] = PREC_CMP,
+    [TOKEN_GTEQ] = PREC_CMP,
+    [TOKEN_AND_AND] = PREC_AND,
+    [TOKEN_OR_OR] = PREC_OR,
+};
+
+// Precedence climbing: parses operators that bind at least as tightly as min_prec, all left-associative. An
+// operand costs one call here instead of one per precedence level.
+Expr *parse_expr_binary(Prec min_prec) {
     Expr *expr = parse_expr_unary();
-    while (is_mul_op()) {
-        SrcPos pos = token.pos;
-        TokenKind op = token.kind;
-        next_token();
-        expr = expr_binary(pos, op, expr, parse_expr_unary());
-    }
-    return expr;
-}
-
-bool is_add_op(void) {
-    return TOKEN_FIRST_ADD <= token.kind && token.kind <= TOKEN_LAST_ADD;
-}
-
-Expr *parse_expr_add(void) {
-    Expr *expr = parse_expr_mul();
-    while (is_add_op()) {
-        SrcPos pos = token.pos;
+    for (;;) {
         TokenKind op = token.kind;
-        next_token();
-        expr = expr_binary(pos, op, expr, parse_expr_mul());
-    }
-    return expr;
-}
-
-bool is_cmp_op(void) {
-    return TOKEN_FIRST_CMP <= token.kind && token.kind <= TOKEN_LAST_CMP;
-}
-
-Expr *parse_expr_cmp(void) {
-    Expr *expr = parse_expr_add();
-    while (is_cmp_op()) {
+        Prec prec = binary_prec[op];
+        if (prec < min_prec) {
+            return expr;
+        }
         SrcPos pos = token.pos;
-        TokenKind op = token.kind;
         next_token();
-        expr = expr_binary(pos, op, expr, parse_expr_add());
-    }
-    return expr;
-}
-
-Expr *parse_expr_and(void) {
-    Expr *expr = parse_expr_cmp();
-    while (match_token(TOKEN_AND_AND)) {
-        SrcPos pos = token.pos;
-        expr = expr_binary(pos, TOKEN_AND_AND, expr, parse_expr_cmp());
-    }
-    return expr;
-}
-
-Expr *parse_expr_or(void) {
-    Expr *expr = parse_expr_and();
-    while (match_token(TOKEN_OR_OR)) {
-        SrcPos pos = token.pos;
-        expr = expr_binary(pos, TOKEN_OR_OR, expr, parse_expr_and());
+        if (prec <= PREC_AND) {
+            // Logical operators take the position of their right operand.
+            pos = token.pos;
+        }
+        expr = expr_binary(pos, op, expr, parse_expr_binary(prec + 1));
     }
-    return expr;
 }
 
 Expr *parse_expr_ternary(void) {
     SrcPos pos = token.pos;
-    Expr *expr = parse_expr_or();
+    Expr *expr = parse_expr_binary(PREC_OR);
     if (match_token(TOKEN_QUESTION)) {
         Expr *then_expr = parse_expr_ternary();
         expect_token(TOKEN_COLON);
@@ -323,7 +347,9 @@ StmtList parse_stmt_block(void) {
         buf_push(stmts, parse_stmt());
     }
     expect_token(TOKEN_RBRACE);
-    return stmt_list(pos, stmts, buf_len(stmts));
+    StmtList block = stmt_list(pos, stmts, buf_len(stmts));
+    buf_free(stmts);
+    return block;
 }
 
 Stmt *parse_stmt_if(SrcPos pos) {
@@ -340,7 +366,9 @@ Stmt *parse_stmt_if(SrcPos pos) {
         StmtList elseif_block = parse_stmt_block();
         buf_push(elseifs, (ElseIf){elseif_cond, elseif_block});
     }
-    return stmt_if(pos, cond, then_block, elseifs, buf_len(elseifs), else_block);
+    Stmt *stmt = stmt_if(pos, cond, then_block, elseifs, buf_len(elseifs), else_block);
+    buf_free(elseifs);
+    return stmt;
 }
 
 Stmt *parse_stmt_while(SrcPos pos) {
@@ -422,14 +450,20 @@ Stmt *parse_stmt_for(SrcPos pos) {
     return stmt_for(pos, init, cond, next, parse_stmt_block());
 }
 
+void parse_switch_case_value(Expr ***exprs, Expr ***ends) {
+    buf_push(*exprs, parse_expr());
+    buf_push(*ends, match_token(TOKEN_ELLIPSIS) ? parse_expr() : NULL);
+}
+
 SwitchCase parse_stmt_switch_case(void) {
     Expr **exprs = NULL;
+    Expr **ends = NULL;
     bool is_default = false;
     while (is_keyword(case_keyword) || is_keyword(default_keyword)) {
         if (match_keyword(case_keyword)) {
-            buf_push(exprs, parse_expr());
+            parse_switch_case_value(&exprs, &ends);
             while (match_token(TOKEN_COMMA)) {
-                buf_push(exprs, parse_expr());
+                parse_switch_case_value(&exprs, &ends);
             }
         } else {
             assert(is_keyword(default_keyword));
@@ -446,7 +480,10 @@ SwitchCase parse_stmt_switch_case(void) {
     while (!is_token_eof() && !is_token(TOKEN_RBRACE) && !is_keyword(case_keyword) && !is_keyword(default_keyword)) {
         buf_push(stmts, parse_stmt());
     }
-    return (SwitchCase){exprs, buf_len(exprs), is_default, stmt_list(pos, stmts, buf_len(stmts))};
+    size_t num_exprs = buf_len(exprs);
+    StmtList block = stmt_list(pos, stmts, buf_len(stmts));
+    buf_free(stmts);
+    return (SwitchCase){ast_buf(exprs, sizeof(*exprs)), ast_buf(ends, sizeof(*ends)), num_exprs, is_default, block};
 }
 
 Stmt *parse_stmt_switch(SrcPos pos) {
@@ -457,7 +494,9 @@ Stmt *parse_stmt_switch(SrcPos pos) {
         buf_push(cases, parse_stmt_switch_case());
     }
     expect_token(TOKEN_RBRACE);
-    return stmt_switch(pos, expr, cases, buf_len(cases));
+    Stmt *stmt = stmt_switch(pos, expr, cases, buf_len(cases));
+    buf_free(cases);
+    return stmt;
 }
 
 Stmt *parse_stmt(void) {
@@ -521,10 +560,15 @@ Decl *parse_decl_enum(SrcPos pos) {
         }
     }
     expect_token(TOKEN_RBRACE);
-    return decl_enum(pos, name, items, buf_len(items));
+    Decl *decl = decl_enum(pos, name, items, buf_len(items));
+    buf_free(items);
+    return decl;
 }
 
+NoteList parse_note_list(void);
+
 AggregateItem parse_decl_aggregate_item(void) {
+    NoteList notes = parse_note_list();
     SrcPos pos = token.pos;
     const char **names = NULL;
     buf_push(names, parse_name());
@@ -534,19 +578,42 @@ AggregateItem parse_decl_aggregate_item(void) {
     expect_token(TOKEN_COLON);
     Typespec *type = parse_type();
     expect_token(TOKEN_SEMICOLON);
-    return (AggregateItem){pos, names, buf_len(names), type};
+    size_t num_names = buf_len(names);
+    return (AggregateItem){pos, ast_buf(names, sizeof(*names)), num_names, type, notes};
+}
+
+const char **parse_type_params(void) {
+    const char **params = NULL;
+    if (match_token(TOKEN_LT)) {
+        do {
+            const char *name = parse_name();
+            for (const char **it = params; it != buf_end(params); it++) {
+                if (*it == name) {
+                    error_here("Duplicate type parameter %s", name);
+                }
+            }
+            buf_push(params, name);
+        } while (match_token(TOKEN_COMMA));
+        expect_token(TOKEN_GT);
+    }
+    return params;
 }
 
 Decl *parse_decl_aggregate(SrcPos pos, DeclKind kind) {
     assert(kind == DECL_STRUCT || kind == DECL_UNION);
     const char *name = parse_name();
+    const char **type_params = parse_type_params();
     expect_token(TOKEN_LBRACE);
     AggregateItem *items = NULL;
     while (!is_token_eof() && !is_token(TOKEN_RBRACE)) {
         buf_push(items, parse_decl_aggregate_item());
     }
     expect_token(TOKEN_RBRACE);
-    return decl_aggregate(pos, kind, name, items, buf_len(items));
+    Decl *decl = decl_aggregate(pos, kind, name, items, buf_len(items));
+    buf_free(items);
+    decl->num_type_params = buf_len(type_params);
+    decl->type_params = ast_buf(type_params, sizeof(*type_params));
+    return decl;
 }
 
 Decl *parse_decl_var(SrcPos pos) {
@@ -595,6 +662,7 @@ FuncParam parse_decl_func_param(void) {
 
 Decl *parse_decl_func(SrcPos pos) {
     const char *name = parse_name();
+    const char **type_params = parse_type_params();
     expect_token(TOKEN_LPAREN);
     FuncParam *params = NULL;
     bool has_varargs = false;
@@ -620,15 +688,34 @@ Decl *parse_decl_func(SrcPos pos) {
         ret_type = parse_type();
     }
     StmtList block = parse_stmt_block();
-    return decl_func(pos, name, params, buf_len(params), ret_type, has_varargs, block);
+    Decl *decl = decl_func(pos, name, params, buf_len(params), ret_type, has_varargs, block);
+    buf_free(params);
+    decl->num_type_params = buf_len(type_params);
+    decl->type_params = ast_buf(type_params, sizeof(*type_params));
+    return decl;
 }
 
 NoteList parse_note_list(void) {
     Note *notes = NULL;
     while (match_token(TOKEN_AT)) {
-        buf_push(notes, (Note){.pos = token.pos, .name = parse_name()});
+        SrcPos pos = token.pos;
+        const char *name = parse_name();
+        Expr **args = NULL;
+        if (match_token(TOKEN_LPAREN)) {
+            if (!is_token(TOKEN_RPAREN)) {
+                buf_push(args, parse_expr());
+                while (match_token(TOKEN_COMMA)) {
+                    buf_push(args, parse_expr());
+                }
+            }
+            expect_token(TOKEN_RPAREN);
+        }
+        buf_push(notes, note(pos, name, args, buf_len(args)));
+        buf_free(args);
     }
-    return note_list(notes, buf_len(notes));
+    NoteList list = note_list(notes, buf_len(notes));
+    buf_free(notes);
+    return list;
 }
 
 Decl *parse_decl_opt(void) {
@@ -654,11 +741,43 @@ Decl *parse_decl_opt(void) {
 
 Decl *parse_decl(void) {
     NoteList notes = parse_note_list();
+    const char *start = token.start;
     Decl *decl = parse_decl_opt();
     if (!decl) {
         fatal_error_here("Expected declaration keyword, got %s", token_info());
     }
     decl->notes = notes;
+    if (decl->num_type_params) {
+        decl->generic_src = start;
+    }
+    return decl;
+}
+
+// Each instance of a generic declaration gets its own AST, parsed again from the generic's source text.
+Decl *parse_generic_instance(Decl *generic) {
+    assert(generic->generic_src);
+    Token saved_token = token;
+    TokenArray *saved_array = token_array;
+    size_t saved_index = token_index;
+    const char *saved_stream = stream;
+    const char *saved_line_start = line_start;
+    token.pos = generic->pos;
+    if (token_in_array(generic->generic_src)) {
+        seek_token(generic->generic_src);
+    } else {
+        token_array = NULL;
+        stream = generic->generic_src;
+        line_start = stream;
+        next_token();
+    }
+    Decl *decl = parse_decl_opt();
+    decl->notes = generic->notes;
+    decl->generic_src = generic->generic_src;
+    token = saved_token;
+    token_array = saved_array;
+    token_index = saved_index;
+    stream = saved_stream;
+    line_start = saved_line_start;
     return decl;
 }
 
@@ -669,5 +788,7 @@ DeclSet *parse_file(void) {
         assert(decl);
         buf_push(decls, decl);
     }
-    return decl_set(decls, buf_len(decls));
+    DeclSet *declset = decl_set(decls, buf_len(decls));
+    buf_free(decls);
+    return declset;
 }
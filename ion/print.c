@@ -26,7 +26,16 @@ void print_typespec(Typespec *type) {
     Typespec *t = type;
     switch (t->kind) {
     case TYPESPEC_NAME:
-        printf("%s", t->name);
+        if (t->num_type_args) {
+            printf("(%s", t->name);
+            for (Typespec **it = t->type_args; it != t->type_args + t->num_type_args; it++) {
+                printf(" ");
+                print_typespec(*it);
+            }
+            printf(")");
+        } else {
+            printf("%s", t->name);
+        }
         break;
     case TYPESPEC_FUNC:
         printf("(func (");
@@ -49,6 +58,13 @@ void print_typespec(Typespec *type) {
         print_expr(t->num_elems);
         printf(")");
         break;
+    case TYPESPEC_VECTOR:
+        printf("(vector ");
+        print_typespec(t->base);
+        printf(" ");
+        print_expr(t->num_elems);
+        printf(")");
+        break;
     case TYPESPEC_PTR:
         printf("(ptr ");
         print_typespec(t->base);
@@ -256,9 +272,17 @@ void print_stmt(Stmt *stmt) {
         for (SwitchCase *it = s->switch_stmt.cases; it != s->switch_stmt.cases + s->switch_stmt.num_cases; it++) {
             print_newline();
             printf("(case (%s", it->is_default ? " default" : "");
-            for (Expr **expr = it->exprs; expr != it->exprs + it->num_exprs; expr++) {
+            for (size_t i = 0; i < it->num_exprs; i++) {
                 printf(" ");
-                print_expr(*expr);
+                if (it->ends[i]) {
+                    printf("(... ");
+                    print_expr(it->exprs[i]);
+                    printf(" ");
+                    print_expr(it->ends[i]);
+                    printf(")");
+                } else {
+                    print_expr(it->exprs[i]);
+                }
             }
             printf(" ) ");
             indent++;
@@ -12,6 +12,8 @@ typedef enum SymState {
     SYM_RESOLVED,
 } SymState;
 
+typedef struct SymDep SymDep;
+
 typedef struct Sym {
     const char *name;
     SymKind kind;
@@ -19,8 +21,16 @@ typedef struct Sym {
     Decl *decl;
     Type *type;
     Val val;
+    BuiltinFunc builtin;
+    SymDep *deps;
 } Sym;
 
+// An edge of the declaration dependency graph: the owning symbol refers to sym by name.
+struct SymDep {
+    Sym *sym;
+    SymDep *next;
+};
+
 enum {
     MAX_LOCAL_SYMS = 1024
 };
@@ -30,15 +40,66 @@ Map global_syms_map;
 Sym **global_syms_buf;
 Sym local_syms[MAX_LOCAL_SYMS];
 Sym *local_syms_end = local_syms;
+Map func_body_states;
+int const_expr_depth;
+// Nonzero while resolving code that can never run. It is checked like any other code, but the functions it
+// refers to are not kept alive by it.
+int dead_code_depth;
+Map live_funcs;
+
+// Global symbols and other resolver data live until the next resolve_reset.
+Arena resolve_arena;
+
+void *resolve_alloc(size_t size) {
+    void *ptr = arena_alloc(&resolve_arena, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// When set, every global name resolved while resolving dep_owner's declaration, body or fields becomes an edge
+// in dep_owner's deps list, in order of first reference. An enum constant counts as a reference to its enum.
+// Builtins and locals are left out.
+bool record_sym_deps;
+Sym *dep_owner;
+
+bool is_source_sym(Sym *sym) {
+    return sym->decl && sym->decl->pos.name != pos_builtin.name;
+}
+
+void add_sym_dep(Sym *from, Sym *to) {
+    if (!record_sym_deps || !from || !to) {
+        return;
+    }
+    if (!to->decl && to->kind == SYM_CONST && to->type->kind == TYPE_ENUM) {
+        to = to->type->sym;
+    }
+    if (from == to || !is_source_sym(to)) {
+        return;
+    }
+    SymDep **link = &from->deps;
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->sym == to) {
+            return;
+        }
+    }
+    SymDep *dep = resolve_alloc(sizeof(SymDep));
+    dep->sym = to;
+    *link = dep;
+}
 
 Sym *sym_new(SymKind kind, const char *name, Decl *decl) {
-    Sym *sym = xcalloc(1, sizeof(Sym));
+    Sym *sym = resolve_alloc(sizeof(Sym));
     sym->kind = kind;
     sym->name = name;
     sym->decl = decl;
     return sym;
 }
 
+// Generic templates are never resolved themselves, only their instances.
+bool is_generic_decl(Decl *decl) {
+    return decl->num_type_params && !decl->type_args;
+}
+
 Sym *sym_decl(Decl *decl) {
     SymKind kind = SYM_NONE;
     switch (decl->kind) {
@@ -62,7 +123,7 @@ Sym *sym_decl(Decl *decl) {
         break;
     }
     Sym *sym = sym_new(kind, decl->name, decl);
-    if (decl->kind == DECL_STRUCT || decl->kind == DECL_UNION) {
+    if ((decl->kind == DECL_STRUCT || decl->kind == DECL_UNION) && !is_generic_decl(decl)) {
         sym->state = SYM_RESOLVED;
         sym->type = type_incomplete(sym);
     }
@@ -100,6 +161,21 @@ bool sym_push_var(const char *name, Type *type) {
     return true;
 }
 
+// Binds an instance's type parameters to its type arguments in the current local scope.
+void sym_push_type_args(Decl *decl) {
+    for (size_t i = 0; i < decl->num_type_params; i++) {
+        if (local_syms_end == local_syms + MAX_LOCAL_SYMS) {
+            fatal("Too many local symbols");
+        }
+        *local_syms_end++ = (Sym){
+            .name = decl->type_params[i],
+            .kind = SYM_TYPE,
+            .state = SYM_RESOLVED,
+            .type = decl->type_args[i],
+        };
+    }
+}
+
 Sym *sym_enter(void) {
     return local_syms_end;
 }
@@ -109,7 +185,9 @@ void sym_leave(Sym *sym) {
 }
 
 void sym_global_put(Sym *sym) {
-    if (map_get(&global_syms_map, (void *)sym->name)) {
+    Sym *old = map_get(&global_syms_map, (void *)sym->name);
+    // Builtin functions have common names like popcount or likely, so a program's own declaration shadows them.
+    if (old && !(old->builtin && sym->decl)) {
         SrcPos pos = sym->decl ? sym->decl->pos : pos_builtin;
         fatal_error(pos, "Duplicate definition of global symbol");
     }
@@ -147,6 +225,13 @@ void sym_global_func(const char *name, Type *type) {
     sym_global_put(sym);
 }
 
+void sym_global_builtin(const char *name, BuiltinFunc builtin) {
+    Sym *sym = sym_new(SYM_FUNC, str_intern(name), NULL);
+    sym->state = SYM_RESOLVED;
+    sym->builtin = builtin;
+    sym_global_put(sym);
+}
+
 Sym *sym_global_decl(Decl *decl) {
     Sym *sym = sym_decl(decl);
     sym_global_put(sym);
@@ -198,7 +283,7 @@ Operand operand_const(Type *type, Val val) {
 
 Operand operand_decay(Operand operand) {
     operand.type = unqualify_type(operand.type);
-    if (operand.type->kind == TYPE_ARRAY) {
+    if (operand.type->kind == TYPE_ARRAY && !is_soa_array_type(operand.type)) {
         operand.type = type_ptr(operand.type->base);
     }
     operand.is_lvalue = false;
@@ -296,6 +381,8 @@ bool is_castable(Operand *operand, Type *dest) {
         return is_ptr_type(dest);
     } else if (is_ptr_type(dest) && is_ptr_type(src)) {
         return true;
+    } else if (is_vector_type(dest) && is_vector_type(src)) {
+        return type_sizeof(dest) == type_sizeof(src);
     } else {
         return false;
     }
@@ -415,7 +502,7 @@ void unify_arithmetic_operands(Operand *left, Operand *right) {
     assert(left->type == right->type);
 }
 
-Sym *resolve_name(const char *name);
+Sym *resolve_name(SrcPos pos, const char *name);
 Operand resolve_const_expr(Expr *expr);
 Operand resolve_expected_expr(Expr *expr, Type *expected_type);
 
@@ -431,6 +518,8 @@ Operand resolve_expected_expr_rvalue(Expr *expr, Type *expected_type) {
     return operand_decay(resolve_expected_expr(expr, expected_type));
 }
 
+Type *resolve_typespec_generic(Typespec *typespec);
+
 Type *resolve_typespec(Typespec *typespec) {
     if (!typespec) {
         return type_void;
@@ -438,7 +527,14 @@ Type *resolve_typespec(Typespec *typespec) {
     Type *result = NULL;
     switch (typespec->kind) {
     case TYPESPEC_NAME: {
-        Sym *sym = resolve_name(typespec->name);
+        if (typespec->num_type_args) {
+            result = resolve_typespec_generic(typespec);
+            break;
+        }
+        Sym *sym = resolve_name(typespec->pos, typespec->name);
+        if (!sym) {
+            fatal_error(typespec->pos, "Unresolved type name %s", typespec->name);
+        }
         if (sym->kind != SYM_TYPE) {
             fatal_error(typespec->pos, "%s must denote a type", typespec->name);
             return NULL;
@@ -468,14 +564,33 @@ Type *resolve_typespec(Typespec *typespec) {
         result = type_array(resolve_typespec(typespec->base), size);
         break;
     }
+    case TYPESPEC_VECTOR: {
+        Type *elem = resolve_typespec(typespec->base);
+        if (!is_integer_type(elem) && !is_floating_type(elem)) {
+            fatal_error(typespec->pos, "SIMD vector element type must be an integer or floating type");
+        }
+        if (elem->kind == TYPE_BOOL || elem->kind == TYPE_ENUM) {
+            fatal_error(typespec->pos, "SIMD vector element type cannot be bool or enum");
+        }
+        Operand operand = resolve_const_expr(typespec->num_elems);
+        if (!is_integer_type(operand.type)) {
+            fatal_error(typespec->pos, "SIMD vector lane count must have integer type");
+        }
+        cast_operand(&operand, type_int);
+        if (operand.val.i <= 0 || !IS_POW2(operand.val.i)) {
+            fatal_error(typespec->num_elems->pos, "SIMD vector lane count must be a positive power of two");
+        }
+        result = type_vector(elem, operand.val.i);
+        break;
+    }
     case TYPESPEC_FUNC: {
-        Type **args = NULL;
+        Type **args = resolve_alloc(typespec->func.num_args * sizeof(Type *));
         for (size_t i = 0; i < typespec->func.num_args; i++) {
             Type *arg = resolve_typespec(typespec->func.args[i]);
             if (arg == type_void) {
                 fatal_error(typespec->pos, "Function parameter type cannot be void");
             }
-            buf_push(args, arg);
+            args[i] = arg;
         }
         Type *ret = type_void;
         if (typespec->func.ret) {
@@ -484,7 +599,7 @@ Type *resolve_typespec(Typespec *typespec) {
         if (is_array_type(ret)) {
             fatal_error(typespec->pos, "Function return type cannot be array");
         }
-        result = type_func(args, buf_len(args), ret, false);
+        result = type_func(args, typespec->func.num_args, ret, false);
         break;
     }
     default:
@@ -496,6 +611,27 @@ Type *resolve_typespec(Typespec *typespec) {
     return result;
 }
 
+Operand resolve_const_expr(Expr *expr);
+
+size_t resolve_align_note(Note *note, size_t min_align) {
+    if (note->num_args != 1) {
+        fatal_error(note->pos, "@align takes exactly one argument");
+    }
+    Operand operand = resolve_const_expr(note->args[0]);
+    if (!is_integer_type(operand.type)) {
+        fatal_error(note->args[0]->pos, "@align argument must be an integer constant");
+    }
+    cast_operand(&operand, type_llong);
+    long long align = operand.val.ll;
+    if (align <= 0 || !IS_POW2(align)) {
+        fatal_error(note->args[0]->pos, "@align argument must be a positive power of two, got %lld", align);
+    }
+    if ((size_t)align < min_align) {
+        fatal_error(note->args[0]->pos, "@align(%lld) is less than the natural alignment %zu", align, min_align);
+    }
+    return (size_t)align;
+}
+
 void complete_type(Type *type) {
     if (type->kind == TYPE_COMPLETING) {
         fatal_error(type->sym->decl->pos, "Type completion cycle");
@@ -506,27 +642,54 @@ void complete_type(Type *type) {
     Decl *decl = type->sym->decl;
     type->kind = TYPE_COMPLETING;
     assert(decl->kind == DECL_STRUCT || decl->kind == DECL_UNION);
-    TypeField *fields = NULL;
+    Sym *owner = dep_owner;
+    dep_owner = type->sym;
+    Sym *scope = sym_enter();
+    sym_push_type_args(decl);
+    // Scratch arrays with a known size are taken from the resolver arena rather than grown on the heap.
+    size_t num_fields = 0;
+    for (size_t i = 0; i < decl->aggregate.num_items; i++) {
+        num_fields += decl->aggregate.items[i].num_names;
+    }
+    TypeField *fields = resolve_alloc(num_fields * sizeof(TypeField));
+    num_fields = 0;
     for (size_t i = 0; i < decl->aggregate.num_items; i++) {
         AggregateItem item = decl->aggregate.items[i];
         Type *item_type = resolve_typespec(item.type);
         complete_type(item_type);
+        Note *align_note = get_note(item.notes, align_name);
+        size_t align = align_note ? resolve_align_note(align_note, type_alignof(item_type)) : 0;
         for (size_t j = 0; j < item.num_names; j++) {
-            buf_push(fields, (TypeField){item.names[j], item_type});
+            fields[num_fields++] = (TypeField){item.names[j], item_type, .align = align};
         }
     }
-    if (buf_len(fields) == 0) {
+    sym_leave(scope);
+    if (num_fields == 0) {
         fatal_error(decl->pos, "No fields");
     }
-    if (has_duplicate_fields(fields, buf_len(fields))) {
+    if (has_duplicate_fields(fields, num_fields)) {
         fatal_error(decl->pos, "Duplicate fields");
     }
+    size_t align = 0;
+    Note *align_note = get_decl_note(decl, align_name);
+    if (align_note) {
+        size_t min_align = 0;
+        for (TypeField *it = fields; it != fields + num_fields; it++) {
+            min_align = MAX(min_align, type_field_alignof(it));
+        }
+        align = resolve_align_note(align_note, min_align);
+    }
     if (decl->kind == DECL_STRUCT) {
-        type_complete_struct(type, fields, buf_len(fields));
+        type_complete_struct(type, fields, num_fields, align);
+        type->aggregate.is_soa = is_decl_soa(decl);
     } else {
         assert(decl->kind == DECL_UNION);
-        type_complete_union(type, fields, buf_len(fields));
+        if (is_decl_soa(decl)) {
+            fatal_error(decl->pos, "@soa can only be applied to structs");
+        }
+        type_complete_union(type, fields, num_fields, align);
     }
+    dep_owner = owner;
     buf_push(sorted_syms, type->sym);
 }
 
@@ -558,13 +721,19 @@ Type *resolve_decl_var(Decl *decl) {
     if (type->size == 0) {
         fatal_error(decl->pos, "Cannot declare variable of size 0");
     }
+    Note *align_note = get_decl_note(decl, align_name);
+    if (align_note) {
+        resolve_align_note(align_note, type_alignof(type));
+    }
     return type;
 }
 
 Type *resolve_decl_const(Decl *decl, Val *val) {
     assert(decl->kind == DECL_CONST);
-    Operand result = resolve_const_expr(decl->const_decl.expr);
-    if (!is_scalar_type(result.type)) {
+    Expr *expr = decl->const_decl.expr;
+    Operand result = resolve_const_expr(expr);
+    bool is_folded_data = expr->kind == EXPR_CALL && expr->call.folded_data;
+    if (!is_scalar_type(result.type) && !is_folded_data) {
         fatal_error(decl->pos, "Const declarations must have scalar type");
     }
     *val = result.val;
@@ -573,14 +742,17 @@ Type *resolve_decl_const(Decl *decl, Val *val) {
 
 Type *resolve_decl_func(Decl *decl) {
     assert(decl->kind == DECL_FUNC);
-    Type **params = NULL;
+    Type **params = resolve_alloc(decl->func.num_params * sizeof(Type *));
     for (size_t i = 0; i < decl->func.num_params; i++) {
         Type *param = resolve_typespec(decl->func.params[i].type);
         complete_type(param);
         if (param == type_void) {
             fatal_error(decl->pos, "Function parameter type cannot be void");
         }
-        buf_push(params, param);
+        if (is_soa_array_type(param)) {
+            fatal_error(decl->func.params[i].pos, "SoA arrays cannot be passed by value, pass a pointer instead");
+        }
+        params[i] = param;
     }
     Type *ret_type = type_void;
     if (decl->func.ret_type) {
@@ -590,7 +762,7 @@ Type *resolve_decl_func(Decl *decl) {
     if (is_array_type(ret_type)) {
         fatal_error(decl->pos, "Function return type cannot be array");
     }
-    return type_func(params, buf_len(params), ret_type, decl->func.has_varargs);
+    return type_func(params, decl->func.num_params, ret_type, decl->func.has_varargs);
 }
 
 bool resolve_stmt(Stmt *stmt, Type *ret_type);
@@ -602,16 +774,48 @@ void resolve_cond_expr(Expr *expr) {
     }
 }
 
-bool resolve_stmt_block(StmtList block, Type *ret_type) {
+bool is_const_cond(Expr *expr, bool *value) {
+    if (!expr->is_const) {
+        return false;
+    }
+    Operand operand = operand_const(expr->type, expr->val);
+    cast_operand(&operand, type_ullong);
+    *value = operand.val.ull != 0;
+    return true;
+}
+
+void stmt_make_block(Stmt *stmt, StmtList block) {
+    stmt->kind = STMT_BLOCK;
+    stmt->block = block;
+}
+
+bool resolve_stmt_block(StmtList *block, Type *ret_type) {
     Sym *scope = sym_enter();
     bool returns = false;
-    for (size_t i = 0; i < block.num_stmts; i++) {
-        returns = resolve_stmt(block.stmts[i], ret_type) || returns;
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        Stmt *stmt = block->stmts[i];
+        returns = resolve_stmt(stmt, ret_type);
+        // Statements after a jump can never run, so they are dropped once resolved.
+        if (returns || stmt->kind == STMT_BREAK || stmt->kind == STMT_CONTINUE) {
+            dead_code_depth++;
+            for (size_t j = i + 1; j < block->num_stmts; j++) {
+                resolve_stmt(block->stmts[j], ret_type);
+            }
+            dead_code_depth--;
+            block->num_stmts = i + 1;
+            break;
+        }
     }
     sym_leave(scope);
     return returns;
 }
 
+void resolve_dead_stmt_block(StmtList *block, Type *ret_type) {
+    dead_code_depth++;
+    resolve_stmt_block(block, ret_type);
+    dead_code_depth--;
+}
+
 Operand resolve_expr_binary_op(TokenKind op, const char *op_name, SrcPos pos, Operand left, Operand right);
 
 void resolve_stmt_assign(Stmt *stmt) {
@@ -636,6 +840,8 @@ void resolve_stmt_assign(Stmt *stmt) {
         } else if (stmt->assign.op == TOKEN_ADD_ASSIGN || stmt->assign.op == TOKEN_SUB_ASSIGN) {
             if (left.type->kind == TYPE_PTR && is_integer_type(right.type)) {
                 result = operand_rvalue(left.type);
+            } else if (is_vector_type(left.type)) {
+                result = resolve_expr_binary_op(binary_op, assign_op_name, stmt->pos, left, right);
             } else if (is_arithmetic_type(left.type) && is_arithmetic_type(right.type)) {
                 result = resolve_expr_binary_op(binary_op, assign_op_name, stmt->pos, left, right);
             } else {
@@ -673,6 +879,7 @@ void resolve_stmt_init(Stmt *stmt) {
         assert(stmt->init.expr);
         type = unqualify_type(resolve_expr(stmt->init.expr).type);
     }
+    complete_type(type);
     if (type->size == 0) {
         fatal_error(stmt->pos, "Cannot declare variable of size 0");
     }
@@ -681,6 +888,438 @@ void resolve_stmt_init(Stmt *stmt) {
     }
 }
 
+// Arms with a constant false condition are dropped, and an arm with a constant true condition becomes the else block.
+bool resolve_stmt_if(Stmt *stmt, Type *ret_type) {
+    size_t num_arms = 1 + stmt->if_stmt.num_elseifs;
+    ElseIf *arms = resolve_alloc(num_arms * sizeof(ElseIf));
+    arms[0] = (ElseIf){stmt->if_stmt.cond, stmt->if_stmt.then_block};
+    if (stmt->if_stmt.num_elseifs) {
+        memcpy(arms + 1, stmt->if_stmt.elseifs, stmt->if_stmt.num_elseifs * sizeof(ElseIf));
+    }
+    ElseIf *live_arms = resolve_alloc(num_arms * sizeof(ElseIf));
+    size_t num_live_arms = 0;
+    StmtList else_block = stmt->if_stmt.else_block;
+    bool is_taken = false;
+    bool returns = true;
+    for (ElseIf *it = arms; it != arms + num_arms; it++) {
+        // Once an arm is always taken, the arms after it are dead.
+        bool is_dead = is_taken;
+        dead_code_depth += is_dead;
+        resolve_cond_expr(it->cond);
+        bool value = true;
+        bool is_const = !is_dead && is_const_cond(it->cond, &value);
+        if (is_dead || !value) {
+            resolve_dead_stmt_block(&it->block, ret_type);
+        } else {
+            returns = resolve_stmt_block(&it->block, ret_type) && returns;
+            if (is_const) {
+                is_taken = true;
+                else_block = it->block;
+            } else {
+                live_arms[num_live_arms++] = *it;
+            }
+        }
+        dead_code_depth -= is_dead;
+    }
+    if (is_taken) {
+        if (stmt->if_stmt.else_block.stmts) {
+            resolve_dead_stmt_block(&stmt->if_stmt.else_block, ret_type);
+        }
+    } else if (else_block.stmts) {
+        returns = resolve_stmt_block(&else_block, ret_type) && returns;
+    } else {
+        returns = false;
+    }
+    if (num_live_arms == 0) {
+        stmt_make_block(stmt, else_block.stmts ? else_block : (StmtList){.pos = stmt->pos});
+    } else {
+        stmt->if_stmt.cond = live_arms[0].cond;
+        stmt->if_stmt.then_block = live_arms[0].block;
+        stmt->if_stmt.elseifs = ast_dup(live_arms + 1, (num_live_arms - 1) * sizeof(ElseIf));
+        stmt->if_stmt.num_elseifs = num_live_arms - 1;
+        stmt->if_stmt.else_block = else_block;
+    }
+    return returns;
+}
+
+// Whether a break in the block leaves the enclosing switch, as opposed to a nested loop or switch.
+bool has_switch_break(StmtList block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        Stmt *stmt = block.stmts[i];
+        switch (stmt->kind) {
+        case STMT_BREAK:
+            return true;
+        case STMT_BLOCK:
+            if (has_switch_break(stmt->block)) {
+                return true;
+            }
+            break;
+        case STMT_IF:
+            if (has_switch_break(stmt->if_stmt.then_block) || has_switch_break(stmt->if_stmt.else_block)) {
+                return true;
+            }
+            for (size_t j = 0; j < stmt->if_stmt.num_elseifs; j++) {
+                if (has_switch_break(stmt->if_stmt.elseifs[j].block)) {
+                    return true;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+// String switches dispatch through a perfect hash of their case strings, so a lookup costs one pass over the
+// selector and a single memcmp. The table is built by hash and displace: the string hash picks a bucket, and a
+// displacement is searched per bucket, largest first, that moves all of its strings into distinct free slots.
+typedef struct StrSwitch {
+    uint32_t seed;
+    uint32_t mask;
+    uint32_t *disps;
+    const char **strs;
+    int *cases;
+} StrSwitch;
+
+enum {
+    STR_SWITCH_MAX_DISP = 1 << 16,
+};
+
+bool uses_str_switch;
+
+// Must match ion_str_switch_hash in the generated C helpers.
+uint32_t str_switch_hash(const char *str, size_t *len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    const char *ptr = str;
+    for (; *ptr; ptr++) {
+        hash = (hash ^ (uint8_t)*ptr) * 16777619u;
+    }
+    *len = ptr - str;
+    return hash;
+}
+
+uint32_t str_switch_mix(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    hash *= 0x846ca68bu;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+uint32_t str_switch_slot(StrSwitch *sw, uint32_t hash) {
+    return str_switch_mix(hash ^ sw->disps[hash & sw->mask]) & sw->mask;
+}
+
+// Returns the index of the case that matches str, or -1 for the default.
+int str_switch_case(StrSwitch *sw, const char *str) {
+    size_t len;
+    uint32_t slot = str_switch_slot(sw, str_switch_hash(str, &len, sw->seed));
+    const char *match = sw->strs[slot];
+    return match && strlen(match) == len && memcmp(match, str, len) == 0 ? sw->cases[slot] : -1;
+}
+
+bool try_build_str_switch(StrSwitch *sw, const char **strs, int *cases, size_t num_strs) {
+    size_t size = sw->mask + 1;
+    uint32_t *hashes = xmalloc(num_strs * sizeof(uint32_t));
+    size_t *bucket_sizes = xcalloc(size, sizeof(size_t));
+    size_t max_bucket_size = 0;
+    for (size_t i = 0; i < num_strs; i++) {
+        size_t len;
+        hashes[i] = str_switch_hash(strs[i], &len, sw->seed);
+        size_t bucket_size = ++bucket_sizes[hashes[i] & sw->mask];
+        max_bucket_size = MAX(max_bucket_size, bucket_size);
+    }
+    memset(sw->disps, 0, size * sizeof(uint32_t));
+    memset(sw->strs, 0, size * sizeof(const char *));
+    uint32_t *slots = xmalloc(max_bucket_size * sizeof(uint32_t));
+    bool success = true;
+    for (size_t bucket_size = max_bucket_size; bucket_size > 0 && success; bucket_size--) {
+        for (uint32_t bucket = 0; bucket < size && success; bucket++) {
+            if (bucket_sizes[bucket] != bucket_size) {
+                continue;
+            }
+            success = false;
+            for (uint32_t disp = 0; disp < STR_SWITCH_MAX_DISP && !success; disp++) {
+                sw->disps[bucket] = disp;
+                size_t num_slots = 0;
+                for (size_t i = 0; i < num_strs; i++) {
+                    if ((hashes[i] & sw->mask) != bucket) {
+                        continue;
+                    }
+                    uint32_t slot = str_switch_slot(sw, hashes[i]);
+                    bool is_free = !sw->strs[slot];
+                    for (size_t j = 0; j < num_slots; j++) {
+                        is_free &= slots[j] != slot;
+                    }
+                    if (!is_free) {
+                        break;
+                    }
+                    slots[num_slots++] = slot;
+                }
+                success = num_slots == bucket_size;
+            }
+            if (success) {
+                size_t num_slots = 0;
+                for (size_t i = 0; i < num_strs; i++) {
+                    if ((hashes[i] & sw->mask) == bucket) {
+                        sw->strs[slots[num_slots]] = strs[i];
+                        sw->cases[slots[num_slots]] = cases[i];
+                        num_slots++;
+                    }
+                }
+            }
+        }
+    }
+    free(slots);
+    free(bucket_sizes);
+    free(hashes);
+    return success;
+}
+
+StrSwitch *build_str_switch(const char **strs, int *cases, size_t num_strs) {
+    size_t size = 1;
+    while (size < num_strs) {
+        size *= 2;
+    }
+    StrSwitch *sw = resolve_alloc(sizeof(StrSwitch));
+    for (uint32_t seed = 0;; seed++) {
+        // Distinct strings can collide in the full hash, which no displacement separates, so reseed and grow as needed.
+        if (seed == 0 || seed % 8 == 0) {
+            if (seed) {
+                size *= 2;
+            }
+            sw->mask = (uint32_t)(size - 1);
+            sw->disps = resolve_alloc(size * sizeof(uint32_t));
+            sw->strs = resolve_alloc(size * sizeof(const char *));
+            sw->cases = resolve_alloc(size * sizeof(int));
+        }
+        sw->seed = seed;
+        if (try_build_str_switch(sw, strs, cases, num_strs)) {
+            return sw;
+        }
+    }
+}
+
+bool is_str_switch(Stmt *stmt, Type *type) {
+    if (!is_ptr_type(type) || unqualify_type(type->base) != type_char) {
+        return false;
+    }
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase *switch_case = stmt->switch_stmt.cases + i;
+        for (size_t j = 0; j < switch_case->num_exprs; j++) {
+            if (switch_case->exprs[j]->kind == EXPR_STR) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool resolve_stmt_str_switch(Stmt *stmt, Type *ret_type) {
+    size_t num_strs = 0;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        num_strs += stmt->switch_stmt.cases[i].num_exprs;
+    }
+    const char **strs = resolve_alloc(num_strs * sizeof(const char *));
+    int *cases = resolve_alloc(num_strs * sizeof(int));
+    num_strs = 0;
+    SwitchCase *default_case = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase *switch_case = stmt->switch_stmt.cases + i;
+        for (size_t j = 0; j < switch_case->num_exprs; j++) {
+            Expr *case_expr = switch_case->exprs[j];
+            if (case_expr->kind != EXPR_STR || switch_case->ends[j]) {
+                fatal_error(case_expr->pos, "String switch cases must be string literals");
+            }
+            resolve_expr(case_expr);
+            for (const char **it = strs; it != strs + num_strs; it++) {
+                if (strcmp(*it, case_expr->str_lit.val) == 0) {
+                    fatal_error(case_expr->pos, "Duplicate string switch case \"%s\"", case_expr->str_lit.val);
+                }
+            }
+            strs[num_strs] = case_expr->str_lit.val;
+            cases[num_strs++] = (int)i;
+        }
+        if (switch_case->is_default) {
+            if (default_case) {
+                fatal_error(stmt->pos, "Switch statement has multiple default clauses");
+            }
+            default_case = switch_case;
+        }
+    }
+    if (num_strs) {
+        stmt->switch_stmt.str_switch = build_str_switch(strs, cases, num_strs);
+        uses_str_switch = true;
+    }
+    bool returns = true;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        StmtList *block = &stmt->switch_stmt.cases[i].block;
+        returns = resolve_stmt_block(block, ret_type) && !has_switch_break(*block) && returns;
+    }
+    return returns && default_case;
+}
+
+enum {
+    SWITCH_SEARCH_MIN_RANGES = 4,
+    SWITCH_MIN_DENSITY = 4,
+};
+
+// Plain char is signed in the System V ABI, as in the backends.
+bool is_signed_switch_type(Type *type) {
+    return is_signed_type(type) || type->kind == TYPE_CHAR;
+}
+
+unsigned long long switch_case_key(Operand operand, Type *type) {
+    cast_operand(&operand, type);
+    if (is_signed_switch_type(type)) {
+        cast_operand(&operand, type_llong);
+        return (unsigned long long)operand.val.ll ^ (1ull << 63);
+    }
+    cast_operand(&operand, type_ullong);
+    return operand.val.ull;
+}
+
+// The case value as the backends hold it in a 64-bit register.
+unsigned long long switch_key_value(Type *type, unsigned long long key) {
+    return is_signed_switch_type(type) ? key ^ (1ull << 63) : key;
+}
+
+int compare_switch_ranges(const void *left, const void *right) {
+    const SwitchRange *a = left, *b = right;
+    return a->lo < b->lo ? -1 : a->lo > b->lo;
+}
+
+// Sorts the case values, rejects overlaps and merges adjacent runs of the same case. A switch is sparse when fewer
+// than one in SWITCH_MIN_DENSITY of the values it spans are case values; C compilers turn dense switches into jump
+// tables, and the C backend dispatches sparse ones by binary search.
+void resolve_switch_ranges(Stmt *stmt, Type *type, SwitchRange *ranges, size_t num_ranges) {
+    qsort(ranges, num_ranges, sizeof(SwitchRange), compare_switch_ranges);
+    size_t num_merged = 0;
+    unsigned long long num_values = 0;
+    for (size_t i = 0; i < num_ranges; i++) {
+        SwitchRange range = ranges[i];
+        unsigned long long size = range.hi - range.lo + 1;
+        num_values = size && num_values + size >= num_values ? num_values + size : ULLONG_MAX;
+        if (num_merged) {
+            SwitchRange *prev = ranges + num_merged - 1;
+            if (range.lo <= prev->hi) {
+                fatal_error(range.pos, "Switch case value overlaps another case");
+            }
+            if (range.lo == prev->hi + 1 && range.case_index == prev->case_index) {
+                prev->hi = range.hi;
+                continue;
+            }
+        }
+        ranges[num_merged++] = range;
+    }
+    stmt->switch_stmt.ranges = ranges;
+    stmt->switch_stmt.num_ranges = num_merged;
+    if (num_merged >= SWITCH_SEARCH_MIN_RANGES && is_integer_type(type)) {
+        unsigned long long span = ranges[num_merged - 1].hi - ranges[0].lo;
+        stmt->switch_stmt.is_sparse = span / SWITCH_MIN_DENSITY >= num_values;
+    }
+}
+
+// A switch on a constant keeps only the case it selects, as the default case, so breaks inside it still bind to the switch.
+bool resolve_stmt_switch(Stmt *stmt, Type *ret_type) {
+    Operand expr = resolve_expr(stmt->switch_stmt.expr);
+    if (is_str_switch(stmt, operand_decay(expr).type)) {
+        return resolve_stmt_str_switch(stmt, ret_type);
+    }
+    bool is_const = stmt->switch_stmt.expr->is_const;
+    unsigned long long switch_key = is_const ? switch_case_key(expr, expr.type) : 0;
+    bool is_const_cases = true;
+    size_t num_ranges = 0;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        num_ranges += stmt->switch_stmt.cases[i].num_exprs;
+    }
+    SwitchRange *ranges = resolve_alloc(num_ranges * sizeof(SwitchRange));
+    num_ranges = 0;
+    SwitchCase *selected = NULL;
+    SwitchCase *default_case = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase *switch_case = stmt->switch_stmt.cases + i;
+        for (size_t j = 0; j < switch_case->num_exprs; j++) {
+            Expr *case_expr = switch_case->exprs[j];
+            Operand case_operand = resolve_expr(case_expr);
+            Operand case_value = case_operand;
+            if (!convert_operand(&case_operand, expr.type)) {
+                fatal_error(case_expr->pos, "Invalid type in switch case expression");
+            }
+            Operand end_value = case_value;
+            Expr *end_expr = switch_case->ends[j];
+            if (end_expr) {
+                if (!is_integer_type(expr.type)) {
+                    fatal_error(end_expr->pos, "Case ranges require an integer switch expression");
+                }
+                end_value = resolve_expr(end_expr);
+                Operand end_operand = end_value;
+                if (!convert_operand(&end_operand, expr.type)) {
+                    fatal_error(end_expr->pos, "Invalid type in switch case range");
+                }
+                if (!case_value.is_const || !end_value.is_const) {
+                    fatal_error(case_expr->pos, "Switch case range bounds must be constants");
+                }
+            }
+            if (!case_value.is_const) {
+                is_const_cases = false;
+                continue;
+            }
+            SwitchRange range = {switch_case_key(case_value, expr.type), switch_case_key(end_value, expr.type), i, case_expr->pos};
+            if (range.lo > range.hi) {
+                fatal_error(case_expr->pos, "Empty switch case range");
+            }
+            ranges[num_ranges++] = range;
+            if (is_const && !selected && range.lo <= switch_key && switch_key <= range.hi) {
+                selected = switch_case;
+            }
+        }
+        if (switch_case->is_default) {
+            if (default_case) {
+                fatal_error(stmt->pos, "Switch statement has multiple default clauses");
+            }
+            default_case = switch_case;
+        }
+    }
+    is_const &= is_const_cases;
+    if (is_const_cases && num_ranges) {
+        resolve_switch_ranges(stmt, expr.type, ranges, num_ranges);
+    }
+    if (is_const) {
+        if (!selected) {
+            selected = default_case;
+        }
+        for (SwitchCase *it = stmt->switch_stmt.cases; it != stmt->switch_stmt.cases + stmt->switch_stmt.num_cases; it++) {
+            if (it != selected) {
+                resolve_dead_stmt_block(&it->block, ret_type);
+            }
+        }
+        if (!selected) {
+            stmt_make_block(stmt, (StmtList){.pos = stmt->pos});
+            return false;
+        }
+        SwitchCase *live_case = ast_dup(selected, sizeof(SwitchCase));
+        live_case->exprs = NULL;
+        live_case->ends = NULL;
+        live_case->num_exprs = 0;
+        stmt->switch_stmt.ranges = NULL;
+        stmt->switch_stmt.num_ranges = 0;
+        stmt->switch_stmt.is_sparse = false;
+        live_case->is_default = true;
+        stmt->switch_stmt.cases = live_case;
+        stmt->switch_stmt.num_cases = 1;
+        return resolve_stmt_block(&live_case->block, ret_type) && !has_switch_break(live_case->block);
+    }
+    bool returns = true;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        StmtList *block = &stmt->switch_stmt.cases[i].block;
+        returns = resolve_stmt_block(block, ret_type) && !has_switch_break(*block) && returns;
+    }
+    return returns && default_case;
+}
+
 bool resolve_stmt(Stmt *stmt, Type *ret_type) {
     switch (stmt->kind) {
     case STMT_RETURN:
@@ -697,59 +1336,46 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type) {
     case STMT_CONTINUE:
         return false;
     case STMT_BLOCK:
-        return resolve_stmt_block(stmt->block, ret_type);
-    case STMT_IF: {
-        resolve_cond_expr(stmt->if_stmt.cond);
-        bool returns = resolve_stmt_block(stmt->if_stmt.then_block, ret_type);
-        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
-            ElseIf elseif = stmt->if_stmt.elseifs[i];
-            resolve_cond_expr(elseif.cond);
-            returns = resolve_stmt_block(elseif.block, ret_type) && returns;
-        }
-        if (stmt->if_stmt.else_block.stmts) {
-            returns = resolve_stmt_block(stmt->if_stmt.else_block, ret_type) && returns;
-        } else {
-            returns = false;
+        return resolve_stmt_block(&stmt->block, ret_type);
+    case STMT_IF:
+        return resolve_stmt_if(stmt, ret_type);
+    case STMT_WHILE: {
+        resolve_cond_expr(stmt->while_stmt.cond);
+        bool value;
+        if (is_const_cond(stmt->while_stmt.cond, &value) && !value) {
+            resolve_dead_stmt_block(&stmt->while_stmt.block, ret_type);
+            stmt_make_block(stmt, (StmtList){.pos = stmt->pos});
+            return false;
         }
-        return returns;
+        resolve_stmt_block(&stmt->while_stmt.block, ret_type);
+        return false;
     }
-    case STMT_WHILE:
     case STMT_DO_WHILE:
         resolve_cond_expr(stmt->while_stmt.cond);
-        resolve_stmt_block(stmt->while_stmt.block, ret_type);
+        resolve_stmt_block(&stmt->while_stmt.block, ret_type);
         return false;
     case STMT_FOR: {
         Sym *scope = sym_enter();
         resolve_stmt(stmt->for_stmt.init, ret_type);
         resolve_cond_expr(stmt->for_stmt.cond);
-        resolve_stmt_block(stmt->for_stmt.block, ret_type);
-        resolve_stmt(stmt->for_stmt.next, ret_type);
+        bool value;
+        if (is_const_cond(stmt->for_stmt.cond, &value) && !value) {
+            // Only the init statement runs, in a block of its own to keep its scope.
+            dead_code_depth++;
+            resolve_stmt_block(&stmt->for_stmt.block, ret_type);
+            resolve_stmt(stmt->for_stmt.next, ret_type);
+            dead_code_depth--;
+            Stmt *init = stmt->for_stmt.init;
+            stmt_make_block(stmt, stmt_list(stmt->pos, &init, 1));
+        } else {
+            resolve_stmt_block(&stmt->for_stmt.block, ret_type);
+            resolve_stmt(stmt->for_stmt.next, ret_type);
+        }
         sym_leave(scope);
         return false;
     }
-    case STMT_SWITCH: {
-        Operand expr = resolve_expr(stmt->switch_stmt.expr);
-        bool returns = true;
-        bool has_default = false;
-        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
-            SwitchCase switch_case = stmt->switch_stmt.cases[i];
-            for (size_t j = 0; j < switch_case.num_exprs; j++) {
-                Expr *case_expr = switch_case.exprs[j];
-                Operand case_operand = resolve_expr(case_expr);
-                if (!convert_operand(&case_operand, expr.type)) {
-                    fatal_error(case_expr->pos, "Invalid type in switch case expression");
-                }
-                returns = resolve_stmt_block(switch_case.block, ret_type) && returns;
-            }
-            if (switch_case.is_default) {
-                if (has_default) {
-                    fatal_error(stmt->pos, "Switch statement has multiple default clauses");
-                }
-                has_default = true;
-            }
-        }
-        return returns && has_default;
-    }
+    case STMT_SWITCH:
+        return resolve_stmt_switch(stmt, ret_type);
     case STMT_ASSIGN:
         resolve_stmt_assign(stmt);
         return false;
@@ -765,11 +1391,24 @@ bool resolve_stmt(Stmt *stmt, Type *ret_type) {
     }
 }
 
+// Bodies can be resolved early when compile-time evaluation calls the function, so each one is only resolved once.
 void resolve_func_body(Sym *sym) {
     Decl *decl = sym->decl;
     assert(decl->kind == DECL_FUNC);
     assert(sym->state == SYM_RESOLVED);
+    SymState state = (SymState)(uintptr_t)map_get(&func_body_states, sym);
+    if (state == SYM_RESOLVED) {
+        return;
+    } else if (state == SYM_RESOLVING) {
+        fatal_error(decl->pos, "Cyclic dependency in compile-time evaluation of %s", sym->name);
+    }
+    map_put(&func_body_states, sym, (void *)(uintptr_t)SYM_RESOLVING);
+    int dead_depth = dead_code_depth;
+    dead_code_depth = 0;
+    Sym *owner = dep_owner;
+    dep_owner = sym;
     Sym *scope = sym_enter();
+    sym_push_type_args(decl);
     for (size_t i = 0; i < decl->func.num_params; i++) {
         FuncParam param = decl->func.params[i];
         Type *param_type = resolve_typespec(param.type);
@@ -780,11 +1419,14 @@ void resolve_func_body(Sym *sym) {
     }
     Type *ret_type = resolve_typespec(decl->func.ret_type);
     assert(!is_array_type(ret_type));
-    bool returns = resolve_stmt_block(decl->func.block, ret_type);
+    bool returns = resolve_stmt_block(&decl->func.block, ret_type);
     sym_leave(scope);
     if (ret_type != type_void && !returns) {
         fatal_error(decl->pos, "Not all control paths return values");
     }
+    dead_code_depth = dead_depth;
+    dep_owner = owner;
+    map_put(&func_body_states, sym, (void *)(uintptr_t)SYM_RESOLVED);
 }
 
 void resolve_sym(Sym *sym) {
@@ -795,7 +1437,20 @@ void resolve_sym(Sym *sym) {
         return;
     }
     assert(sym->state == SYM_UNRESOLVED);
+    if (sym->decl && is_generic_decl(sym->decl)) {
+        fatal_error(sym->decl->pos, "Generic %s can only be used with type arguments", sym->name);
+    }
     sym->state = SYM_RESOLVING;
+    // A declaration pulled in from a constant expression or dead code is not itself a constant context or dead.
+    int depth = const_expr_depth;
+    int dead_depth = dead_code_depth;
+    const_expr_depth = 0;
+    dead_code_depth = 0;
+    Sym *owner = dep_owner;
+    dep_owner = sym;
+    if (sym->kind != SYM_VAR && sym->decl && get_decl_note(sym->decl, align_name)) {
+        fatal_error(sym->decl->pos, "@align only applies to structs, unions, fields and global variables");
+    }
     switch (sym->kind) {
     case SYM_TYPE:
         sym->type = resolve_decl_type(sym->decl);
@@ -806,13 +1461,20 @@ void resolve_sym(Sym *sym) {
     case SYM_CONST:
         sym->type = resolve_decl_const(sym->decl, &sym->val);
         break;
-    case SYM_FUNC:
+    case SYM_FUNC: {
+        Sym *scope = sym_enter();
+        sym_push_type_args(sym->decl);
         sym->type = resolve_decl_func(sym->decl);
+        sym_leave(scope);
         break;
+    }
     default:
         assert(0);
         break;
     }
+    const_expr_depth = depth;
+    dead_code_depth = dead_depth;
+    dep_owner = owner;
     sym->state = SYM_RESOLVED;
     buf_push(sorted_syms, sym);
 }
@@ -826,18 +1488,244 @@ void finalize_sym(Sym *sym) {
     }
 }
 
-Sym *resolve_name(const char *name) {
-    Sym *sym = sym_get(name);
-    if (!sym) {
-        return NULL;
+// Resolves the symbol a use at pos refers to, or returns NULL if there is none.
+Sym *resolve_name(SrcPos pos, const char *name) {
+    Sym *sym = sym_get(name);
+    if (!sym) {
+        return NULL;
+    }
+    if (sym->decl && is_generic_decl(sym->decl)) {
+        fatal_error(pos, "Generic %s can only be used with type arguments", sym->name);
+    }
+    add_sym_dep(dep_owner, sym);
+    resolve_sym(sym);
+    if (sym->kind == SYM_FUNC && !dead_code_depth) {
+        map_put(&live_funcs, sym, (void *)1);
+    }
+    return sym;
+}
+
+// Instances are indexed like the array and func type caches: cached_instance_index maps a hash of the generic and
+// its argument types to the newest entry with that hash as index+1, and entries with the same hash are chained
+// through next. cached_instance_syms maps each instance's sym to its entry.
+typedef struct CachedInstance {
+    Sym *generic;
+    Type **args;
+    size_t num_args;
+    Sym *instance;
+    size_t next;
+} CachedInstance;
+
+CachedInstance *cached_instances;
+Map cached_instance_index;
+Map cached_instance_syms;
+
+void *instance_key(Sym *generic, Type **args, size_t num_args) {
+    uint64_t hash = hash_bytes((const char *)args, num_args * sizeof(*args));
+    return cached_type_key(hash_uint64(hash ^ hash_ptr(generic)));
+}
+
+void mangle_type(char **buf, Type *type) {
+    switch (type->kind) {
+    case TYPE_PTR:
+        buf_printf(*buf, "ptr_");
+        mangle_type(buf, type->base);
+        break;
+    case TYPE_CONST:
+        buf_printf(*buf, "const_");
+        mangle_type(buf, type->base);
+        break;
+    case TYPE_ARRAY:
+        buf_printf(*buf, "arr%zu_", type->num_elems);
+        mangle_type(buf, type->base);
+        break;
+    case TYPE_VECTOR:
+        buf_printf(*buf, "%s_x%zu", type_names[type->base->kind], type->num_elems);
+        break;
+    case TYPE_FUNC:
+        buf_printf(*buf, "func%zu", type->func.num_params);
+        break;
+    default:
+        buf_printf(*buf, "%s", type->sym ? type->sym->name : type_names[type->kind]);
+        break;
+    }
+}
+
+const char *mangle_instance_name(Sym *generic, Type **args, size_t num_args) {
+    char *buf = NULL;
+    buf_printf(buf, "%s", generic->name);
+    for (size_t i = 0; i < num_args; i++) {
+        buf_printf(buf, "_");
+        mangle_type(&buf, args[i]);
+    }
+    const char *name = str_intern(buf);
+    for (int n = 2; map_get(&global_syms_map, (void *)name); n++) {
+        name = str_intern(strf("%s%d", buf, n));
+    }
+    buf_free(buf);
+    return name;
+}
+
+// Instances are hash-consed on the generic and its argument types, so each distinct instance is resolved and emitted once.
+Sym *instantiate_generic(SrcPos pos, Sym *generic, Type **args, size_t num_args) {
+    Decl *decl = generic->decl;
+    if (num_args != decl->num_type_params) {
+        fatal_error(pos, "%s takes %zu type arguments, got %zu", generic->name, decl->num_type_params, num_args);
+    }
+    add_sym_dep(dep_owner, generic);
+    void *key = instance_key(generic, args, num_args);
+    size_t head = (size_t)(uintptr_t)map_get(&cached_instance_index, key);
+    for (size_t i = head; i; i = cached_instances[i-1].next) {
+        CachedInstance *it = &cached_instances[i-1];
+        if (it->generic == generic && memcmp(it->args, args, num_args * sizeof(*args)) == 0) {
+            add_sym_dep(dep_owner, it->instance);
+            return it->instance;
+        }
+    }
+    for (size_t i = 0; i < num_args; i++) {
+        if (args[i] == type_void) {
+            fatal_error(pos, "Type argument %s of %s cannot be void", decl->type_params[i], generic->name);
+        }
+    }
+    Decl *instance = parse_generic_instance(decl);
+    instance->name = mangle_instance_name(generic, args, num_args);
+    instance->type_args = ast_dup(args, num_args * sizeof(*args));
+    Sym *sym = sym_global_decl(instance);
+    add_sym_dep(dep_owner, sym);
+    add_sym_dep(sym, generic);
+    head = (size_t)(uintptr_t)map_get(&cached_instance_index, key);
+    buf_push(cached_instances, (CachedInstance){generic, instance->type_args, num_args, sym, head});
+    map_put(&cached_instance_index, key, (void *)(uintptr_t)buf_len(cached_instances));
+    map_put(&cached_instance_syms, sym, (void *)(uintptr_t)buf_len(cached_instances));
+    return sym;
+}
+
+// Instance types are named types, so their sym leads back to the instance.
+CachedInstance *find_instance(Type *type) {
+    if (!type->sym) {
+        return NULL;
+    }
+    size_t index = (size_t)(uintptr_t)map_get(&cached_instance_syms, type->sym);
+    if (!index || cached_instances[index-1].instance->type != type) {
+        return NULL;
+    }
+    return &cached_instances[index-1];
+}
+
+Type *resolve_typespec_generic(Typespec *typespec) {
+    Sym *sym = sym_get(typespec->name);
+    if (!sym || sym->kind != SYM_TYPE || !sym->decl || !is_generic_decl(sym->decl)) {
+        fatal_error(typespec->pos, "%s is not a generic type", typespec->name);
+    }
+    Type **args = resolve_alloc(typespec->num_type_args * sizeof(Type *));
+    for (size_t i = 0; i < typespec->num_type_args; i++) {
+        args[i] = resolve_typespec(typespec->type_args[i]);
+    }
+    return instantiate_generic(typespec->pos, sym, args, typespec->num_type_args)->type;
+}
+
+int type_param_index(Decl *decl, const char *name) {
+    for (size_t i = 0; i < decl->num_type_params; i++) {
+        if (decl->type_params[i] == name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+bool typespec_has_type_params(Decl *decl, Typespec *typespec) {
+    if (!typespec) {
+        return false;
+    }
+    switch (typespec->kind) {
+    case TYPESPEC_NAME:
+        if (type_param_index(decl, typespec->name) >= 0) {
+            return true;
+        }
+        for (size_t i = 0; i < typespec->num_type_args; i++) {
+            if (typespec_has_type_params(decl, typespec->type_args[i])) {
+                return true;
+            }
+        }
+        return false;
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < typespec->func.num_args; i++) {
+            if (typespec_has_type_params(decl, typespec->func.args[i])) {
+                return true;
+            }
+        }
+        return typespec_has_type_params(decl, typespec->func.ret);
+    default:
+        return typespec_has_type_params(decl, typespec->base);
+    }
+}
+
+// Matches a parameter's typespec against an argument's type. The first argument to mention a type parameter binds it;
+// later mismatches surface as ordinary argument conversion errors.
+void infer_type_args(Decl *decl, Typespec *typespec, Type *type, Type **args) {
+    if (!typespec) {
+        return;
+    }
+    switch (typespec->kind) {
+    case TYPESPEC_NAME: {
+        int index = type_param_index(decl, typespec->name);
+        if (index >= 0 && !args[index]) {
+            args[index] = type;
+        }
+        CachedInstance *instance = typespec->num_type_args ? find_instance(unqualify_type(type)) : NULL;
+        if (instance && instance->generic->name == typespec->name) {
+            for (size_t i = 0; i < typespec->num_type_args && i < instance->num_args; i++) {
+                infer_type_args(decl, typespec->type_args[i], instance->args[i], args);
+            }
+        }
+        break;
+    }
+    case TYPESPEC_CONST:
+        infer_type_args(decl, typespec->base, type->kind == TYPE_CONST ? type->base : type, args);
+        break;
+    case TYPESPEC_PTR:
+    case TYPESPEC_ARRAY:
+        if (type->kind == TYPE_PTR || type->kind == TYPE_ARRAY) {
+            infer_type_args(decl, typespec->base, type->base, args);
+        }
+        break;
+    case TYPESPEC_FUNC:
+        if (type->kind == TYPE_FUNC) {
+            for (size_t i = 0; i < typespec->func.num_args && i < type->func.num_params; i++) {
+                infer_type_args(decl, typespec->func.args[i], type->func.params[i], args);
+            }
+            infer_type_args(decl, typespec->func.ret, type->func.ret, args);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// Calls to generic functions infer the type arguments from the argument types and are redirected to the instance.
+void resolve_generic_call(Expr *expr, Sym *generic) {
+    Decl *decl = generic->decl;
+    Type **args = resolve_alloc(decl->num_type_params * sizeof(Type *));
+    for (size_t i = 0; i < decl->func.num_params && i < expr->call.num_args; i++) {
+        Typespec *param = decl->func.params[i].type;
+        if (typespec_has_type_params(decl, param)) {
+            infer_type_args(decl, param, resolve_expr_rvalue(expr->call.args[i]).type, args);
+        }
     }
-    resolve_sym(sym);
-    return sym;
+    for (size_t i = 0; i < decl->num_type_params; i++) {
+        if (!args[i]) {
+            fatal_error(expr->pos, "Cannot infer type parameter %s of %s from the call arguments", decl->type_params[i], generic->name);
+        }
+    }
+    Sym *instance = instantiate_generic(expr->pos, generic, args, decl->num_type_params);
+    expr->call.expr->name = instance->name;
 }
 
+Operand resolve_expr_soa_elem(Expr *expr);
+
 Operand resolve_expr_field(Expr *expr) {
     assert(expr->kind == EXPR_FIELD);
-    Operand operand = resolve_expr(expr->field.expr);
+    Operand operand = resolve_expr_soa_elem(expr->field.expr);
     bool is_const_type = operand.type->kind == TYPE_CONST;
     Type *type = unqualify_type(operand.type);
     complete_type(type);
@@ -1018,15 +1906,20 @@ Val eval_binary_op(TokenKind op, Type *type, Val left, Val right) {
 
 Operand resolve_expr_name(Expr *expr) {
     assert(expr->kind == EXPR_NAME);
-    Sym *sym = resolve_name(expr->name);
+    Sym *sym = resolve_name(expr->pos, expr->name);
     if (!sym) {
         fatal_error(expr->pos, "Unresolved name");
     }
     if (sym->kind == SYM_VAR) {
         return operand_lvalue(sym->type);
+    } else if (sym->kind == SYM_CONST && !is_scalar_type(sym->type)) {
+        return operand_lvalue(type_const(sym->type));
     } else if (sym->kind == SYM_CONST) {
         return operand_const(sym->type, sym->val);
     } else if (sym->kind == SYM_FUNC) {
+        if (sym->builtin) {
+            fatal_error(expr->pos, "Builtin function %s can only be called directly", expr->name);
+        }
         return operand_rvalue(sym->type);
     } else {
         fatal_error(expr->pos, "%s must be a var or const", expr->name);
@@ -1062,11 +1955,14 @@ Operand resolve_expr_unary(Expr *expr) {
             return operand_lvalue(type->base);
         case TOKEN_ADD:
         case TOKEN_SUB:
-            if (!is_arithmetic_type(type)) {
+            if (!is_arithmetic_type(type) && !is_vector_type(type)) {
                 fatal_error(expr->pos, "Can only use unary %s with arithmetic types", token_kind_name(expr->unary.op));
             }
             return resolve_unary_op(expr->unary.op, operand);
         case TOKEN_NEG:
+            if (is_vector_type(type) && is_integer_type(type->base)) {
+                return operand_rvalue(type);
+            }
             if (!is_integer_type(type)) {
                 fatal_error(expr->pos, "Can only use ~ with integer types");
             }
@@ -1075,6 +1971,9 @@ Operand resolve_expr_unary(Expr *expr) {
             if (!is_scalar_type(type)) {
                 fatal_error(expr->pos," Can only use ! with scalar types");
             }
+            if (!is_integer_type(type)) {
+                return operand_rvalue(type_int);
+            }
             return resolve_unary_op(expr->unary.op, operand);
         default:
             assert(0);
@@ -1097,7 +1996,52 @@ Operand resolve_binary_arithmetic_op(TokenKind op, Operand left, Operand right)
     return resolve_binary_op(op, left, right);
 }
 
+Operand resolve_vector_binary_op(TokenKind op, const char *op_name, SrcPos pos, Operand left, Operand right) {
+    Type *type = is_vector_type(left.type) ? left.type : right.type;
+    if (is_vector_type(left.type) && is_vector_type(right.type)) {
+        if (left.type != right.type) {
+            fatal_error(pos, "Vector operands of %s must have the same type", op_name);
+        }
+    } else {
+        // Broadcast the scalar operand to every lane.
+        Operand *scalar = is_vector_type(left.type) ? &right : &left;
+        if (!is_arithmetic_type(scalar->type) || !convert_operand(scalar, type->base)) {
+            fatal_error(pos, "Scalar operand of %s must be convertible to the vector element type", op_name);
+        }
+    }
+    switch (op) {
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+    case TOKEN_ADD:
+    case TOKEN_SUB:
+        return operand_rvalue(type);
+    case TOKEN_MOD:
+    case TOKEN_AND:
+    case TOKEN_OR:
+    case TOKEN_XOR:
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if (!is_integer_type(type->base)) {
+            fatal_error(pos, "Operands of %s must be vectors of integer type", op_name);
+        }
+        return operand_rvalue(type);
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+    case TOKEN_LT:
+    case TOKEN_LTEQ:
+    case TOKEN_GT:
+    case TOKEN_GTEQ:
+        return operand_rvalue(vector_mask_type(type));
+    default:
+        fatal_error(pos, "Operator %s is not supported on vectors", op_name);
+        return operand_null;
+    }
+}
+
 Operand resolve_expr_binary_op(TokenKind op, const char *op_name, SrcPos pos, Operand left, Operand right) {
+    if (is_vector_type(left.type) || is_vector_type(right.type)) {
+        return resolve_vector_binary_op(op, op_name, pos, left, right);
+    }
     switch (op) {
     case TOKEN_MUL:
     case TOKEN_DIV:
@@ -1274,6 +2218,9 @@ Operand resolve_expr_compound(Expr *expr, Type *expected_type) {
             index++;
         }
     } else if (type->kind == TYPE_ARRAY) {
+        if (is_soa_struct_type(type->base)) {
+            fatal_error(expr->pos, "SoA arrays cannot be initialized with compound literals");
+        }
         int index = 0, max_index = 0;
         for (size_t i = 0; i < expr->compound.num_fields; i++) {
             CompoundField field = expr->compound.fields[i];
@@ -1305,6 +2252,20 @@ Operand resolve_expr_compound(Expr *expr, Type *expected_type) {
         if (type->num_elems == 0) {
             type = type_array(type->base, max_index + 1);
         }
+    } else if (type->kind == TYPE_VECTOR) {
+        if (expr->compound.num_fields > type->num_elems) {
+            fatal_error(expr->pos, "Too many lanes in vector compound literal");
+        }
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind != FIELD_DEFAULT) {
+                fatal_error(field.pos, "Vector compound literals only allow positional lane initializers");
+            }
+            Operand init = resolve_expected_expr_rvalue(field.init, type->base);
+            if (!convert_operand(&init, type->base)) {
+                fatal_error(field.pos, "Invalid type in compound literal initializer");
+            }
+        }
     } else {
         if (expr->compound.num_fields > 1) {
             fatal_error(expr->pos, "Compound literal for scalar type cannot have more than one operand");
@@ -1320,21 +2281,274 @@ Operand resolve_expr_compound(Expr *expr, Type *expected_type) {
     return operand_lvalue(type);
 }
 
+// Bit widths of the rotate builtins used in this compilation, so the backend only emits the helpers it needs.
+unsigned rotate_builtin_sizes;
+
+Type *builtin_int_type(Type *type) {
+    type = unqualify_type(type);
+    if (type->kind == TYPE_ENUM) {
+        return type_int;
+    } else if (type->kind == TYPE_BOOL) {
+        return type_uchar;
+    } else {
+        return type;
+    }
+}
+
+Operand resolve_builtin_int_arg(Expr *expr, Expr *arg) {
+    Operand operand = resolve_expr_rvalue(arg);
+    if (!is_integer_type(operand.type)) {
+        fatal_error(arg->pos, "Argument of %s must have integer type", expr->call.expr->name);
+    }
+    cast_operand(&operand, builtin_int_type(operand.type));
+    return operand;
+}
+
+unsigned long long builtin_operand_bits(Operand operand) {
+    size_t bits = 8*type_sizeof(operand.type);
+    cast_operand(&operand, type_ullong);
+    return bits < 64 ? operand.val.ull & ((1ull << bits) - 1) : operand.val.ull;
+}
+
+unsigned long long eval_builtin(BuiltinFunc builtin, unsigned long long val, size_t bits, unsigned long long arg) {
+    unsigned long long result = 0;
+    switch (builtin) {
+    case BUILTIN_POPCOUNT:
+        for (; val; val &= val - 1) {
+            result++;
+        }
+        break;
+    case BUILTIN_CLZ:
+        for (size_t i = bits; i-- > 0 && !(val & (1ull << i));) {
+            result++;
+        }
+        break;
+    case BUILTIN_CTZ:
+        for (size_t i = 0; i < bits && !(val & (1ull << i)); i++) {
+            result++;
+        }
+        break;
+    case BUILTIN_BSWAP:
+        for (size_t i = 0; i < bits; i += 8) {
+            result = (result << 8) | ((val >> i) & 0xff);
+        }
+        break;
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR: {
+        size_t n = arg % bits;
+        if (builtin == BUILTIN_ROTR) {
+            n = (bits - n) % bits;
+        }
+        result = n ? (val << n) | (val >> (bits - n)) : val;
+        if (bits < 64) {
+            result &= (1ull << bits) - 1;
+        }
+        break;
+    }
+    default:
+        assert(0);
+        break;
+    }
+    return result;
+}
+
+Operand fold_call(Expr *expr, Operand operand) {
+    assert(operand.is_const);
+    Operand bits = operand;
+    cast_operand(&bits, type_ullong);
+    expr->call.is_folded = true;
+    expr->call.folded_val = bits.val.ull;
+    return operand;
+}
+
+Operand resolve_expr_call_builtin(Expr *expr, BuiltinFunc builtin) {
+    assert(expr->kind == EXPR_CALL);
+    const char *name = expr->call.expr->name;
+    size_t num_args = expr->call.num_args;
+    size_t min_args = 1, max_args = 1;
+    if (builtin == BUILTIN_ROTL || builtin == BUILTIN_ROTR || builtin == BUILTIN_EXPECT) {
+        min_args = max_args = 2;
+    } else if (builtin == BUILTIN_PREFETCH) {
+        max_args = 3;
+    }
+    if (num_args < min_args || num_args > max_args) {
+        fatal_error(expr->pos, "Wrong number of arguments to builtin function %s", name);
+    }
+    expr->call.builtin = builtin;
+    Expr **args = expr->call.args;
+    switch (builtin) {
+    case BUILTIN_POPCOUNT:
+    case BUILTIN_CLZ:
+    case BUILTIN_CTZ: {
+        Operand operand = resolve_builtin_int_arg(expr, args[0]);
+        if (!operand.is_const) {
+            return operand_rvalue(type_int);
+        }
+        unsigned long long val = builtin_operand_bits(operand);
+        if (val == 0 && builtin != BUILTIN_POPCOUNT) {
+            fatal_error(expr->pos, "%s is undefined for zero", name);
+        }
+        return fold_call(expr, operand_const(type_int, (Val){.i = (int)eval_builtin(builtin, val, 8*type_sizeof(operand.type), 0)}));
+    }
+    case BUILTIN_BSWAP:
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR: {
+        Operand operand = resolve_builtin_int_arg(expr, args[0]);
+        Type *type = operand.type;
+        Operand count = {0};
+        if (builtin != BUILTIN_BSWAP) {
+            count = resolve_builtin_int_arg(expr, args[1]);
+        }
+        if (!operand.is_const || (builtin != BUILTIN_BSWAP && !count.is_const)) {
+            if (builtin != BUILTIN_BSWAP) {
+                rotate_builtin_sizes |= (unsigned)type_sizeof(type);
+            }
+            return operand_rvalue(type);
+        }
+        unsigned long long arg = builtin != BUILTIN_BSWAP ? builtin_operand_bits(count) : 0;
+        Operand result = operand_const(type_ullong, (Val){.ull = eval_builtin(builtin, builtin_operand_bits(operand), 8*type_sizeof(type), arg)});
+        cast_operand(&result, type);
+        return fold_call(expr, result);
+    }
+    case BUILTIN_PREFETCH: {
+        Operand ptr = resolve_expr_rvalue(args[0]);
+        if (!is_ptr_type(ptr.type)) {
+            fatal_error(args[0]->pos, "First argument of prefetch must be a pointer");
+        }
+        for (size_t i = 1; i < num_args; i++) {
+            Operand operand = resolve_const_expr(args[i]);
+            if (!is_integer_type(operand.type)) {
+                fatal_error(args[i]->pos, "Arguments of prefetch after the pointer must be integer constants");
+            }
+            cast_operand(&operand, type_int);
+            if (operand.val.i < 0 || operand.val.i > (i == 1 ? 1 : 3)) {
+                fatal_error(args[i]->pos, "prefetch %s out of range", i == 1 ? "read/write flag" : "locality");
+            }
+        }
+        return operand_rvalue(type_void);
+    }
+    case BUILTIN_EXPECT: {
+        Operand operand = resolve_builtin_int_arg(expr, args[0]);
+        resolve_builtin_int_arg(expr, args[1]);
+        promote_operand(&operand);
+        return operand.is_const ? fold_call(expr, operand) : operand_rvalue(operand.type);
+    }
+    case BUILTIN_LIKELY:
+    case BUILTIN_UNLIKELY: {
+        Operand operand = resolve_expr_rvalue(args[0]);
+        if (!is_scalar_type(operand.type)) {
+            fatal_error(args[0]->pos, "Argument of %s must have scalar type", name);
+        }
+        if (operand.is_const) {
+            cast_operand(&operand, type_bool);
+            return fold_call(expr, operand_const(type_int, (Val){.i = operand.val.b}));
+        }
+        return operand_rvalue(type_int);
+    }
+    default:
+        assert(0);
+        return operand_null;
+    }
+}
+
+const void *vm_eval_call(Expr *expr, Type *type);
+
+bool is_const_data_type(Type *type) {
+    type = unqualify_type(type);
+    switch (type->kind) {
+    case TYPE_ARRAY:
+        return !is_soa_array_type(type) && is_const_data_type(type->base);
+    case TYPE_VECTOR:
+        return true;
+    case TYPE_STRUCT:
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            if (!is_const_data_type(type->aggregate.fields[i].type)) {
+                return false;
+            }
+        }
+        return true;
+    default:
+        return is_arithmetic_type(type);
+    }
+}
+
+// Calls to Ion functions with constant arguments inside constant expressions run on the bytecode VM.
+// The result is kept as raw data on the call so each backend can emit it as a literal.
+Operand resolve_const_call(Expr *expr, Sym *sym) {
+    Type *type = unqualify_type(sym->type->func.ret);
+    if (!is_const_data_type(type)) {
+        fatal_error(expr->pos, "Compile-time call to %s must return arithmetic values or structs and arrays of them", sym->name);
+    }
+    // The callee is resolved and evaluated outside the current function's scope.
+    size_t num_locals = local_syms_end - local_syms;
+    Sym *locals = num_locals ? memdup(local_syms, num_locals * sizeof(Sym)) : NULL;
+    local_syms_end = local_syms;
+    int depth = const_expr_depth;
+    const_expr_depth = 0;
+    expr->call.folded_data = vm_eval_call(expr, type);
+    const_expr_depth = depth;
+    if (num_locals) {
+        memcpy(local_syms, locals, num_locals * sizeof(Sym));
+        free(locals);
+    }
+    local_syms_end = local_syms + num_locals;
+    if (is_integer_type(type)) {
+        Val val = {0};
+        memcpy(&val, expr->call.folded_data, type_sizeof(type));
+        return fold_call(expr, operand_const(type, val));
+    }
+    return operand_const(type, (Val){0});
+}
+
+double folded_call_float(Expr *expr) {
+    assert(expr->kind == EXPR_CALL && expr->call.folded_data);
+    if (unqualify_type(expr->type)->kind == TYPE_FLOAT) {
+        float val;
+        memcpy(&val, expr->call.folded_data, sizeof(val));
+        return val;
+    }
+    double val;
+    memcpy(&val, expr->call.folded_data, sizeof(val));
+    return val;
+}
+
 Operand resolve_expr_call(Expr *expr) {
     assert(expr->kind == EXPR_CALL);
     if (expr->call.expr->kind == EXPR_NAME) {
-        Sym *sym = resolve_name(expr->call.expr->name);
+        Sym *generic = sym_get(expr->call.expr->name);
+        if (generic && generic->kind == SYM_FUNC && generic->decl && is_generic_decl(generic->decl)) {
+            resolve_generic_call(expr, generic);
+        }
+        Sym *sym = resolve_name(expr->call.expr->pos, expr->call.expr->name);
         if (!sym) {
             fatal_error(expr->pos, "Unresolved name");
         }
+        if (sym->kind == SYM_FUNC && sym->builtin) {
+            return resolve_expr_call_builtin(expr, sym->builtin);
+        }
         if (sym->kind == SYM_TYPE) {
             if (expr->call.num_args != 1) {
                 fatal_error(expr->pos, "Type conversion operator takes 1 argument");
             }
             Operand operand = resolve_expr_rvalue(expr->call.args[0]);
+            if (is_vector_type(sym->type) && is_arithmetic_type(operand.type)) {
+                if (!convert_operand(&operand, sym->type->base)) {
+                    fatal_error(expr->pos, "Invalid type in vector broadcast");
+                }
+                return operand_rvalue(sym->type);
+            }
             if (!cast_operand(&operand, sym->type)) {
                 fatal_error(expr->pos, "Invalid type cast");
             }
+            if (sym_get_local(expr->call.expr->name) == sym) {
+                // Type parameters have no name in the generated code, so conversions to them become casts.
+                Expr *arg = expr->call.args[0];
+                Typespec *type = typespec_name(expr->call.expr->pos, sym->name);
+                type->type = sym->type;
+                expr->kind = EXPR_CAST;
+                expr->cast.type = type;
+                expr->cast.expr = arg;
+            }
             return operand;
         }
     }
@@ -1349,22 +2563,41 @@ Operand resolve_expr_call(Expr *expr) {
     if (expr->call.num_args > num_params && !func.type->func.has_varargs) {
         fatal_error(expr->pos, "Function call with too many arguments");
     }
+    bool is_const_args = true;
     for (size_t i = 0; i < num_params; i++) {
         Type *param_type = func.type->func.params[i];
         Operand arg = resolve_expected_expr_rvalue(expr->call.args[i], param_type);
         if (is_array_type(param_type)) {
             param_type = type_ptr(param_type->base);
         }
+        is_const_args &= arg.is_const;
         if (!convert_operand(&arg, param_type)) {
             fatal_error(expr->call.args[i]->pos, "Invalid type in function call argument");
         }
     }
     for (size_t i = num_params; i < expr->call.num_args; i++) {
-        resolve_expr_rvalue(expr->call.args[i]);
+        is_const_args &= resolve_expr_rvalue(expr->call.args[i]).is_const;
+    }
+    if (const_expr_depth && is_const_args && expr->call.expr->kind == EXPR_NAME) {
+        Sym *sym = sym_get(expr->call.expr->name);
+        if (sym->kind == SYM_FUNC && !is_decl_foreign(sym->decl)) {
+            return resolve_const_call(expr, sym);
+        }
     }
     return operand_rvalue(func.type->func.ret);
 }
 
+// A constant condition folds the ternary into the selected operand when that already has the result type.
+void fold_ternary(Expr *expr, Type *type) {
+    bool value;
+    if (is_const_cond(expr->ternary.cond, &value)) {
+        Expr *selected = value ? expr->ternary.then_expr : expr->ternary.else_expr;
+        if (selected->type == type) {
+            *expr = *selected;
+        }
+    }
+}
+
 Operand resolve_expr_ternary(Expr *expr, Type *expected_type) {
     assert(expr->kind == EXPR_TERNARY);
     Operand cond = resolve_expr_rvalue(expr->ternary.cond);
@@ -1373,23 +2606,55 @@ Operand resolve_expr_ternary(Expr *expr, Type *expected_type) {
     }
     Operand left = resolve_expected_expr_rvalue(expr->ternary.then_expr, expected_type);
     Operand right = resolve_expected_expr_rvalue(expr->ternary.else_expr, expected_type);
+    Operand result;
     if (is_arithmetic_type(left.type) && is_arithmetic_type(right.type)) {
         unify_arithmetic_operands(&left, &right);
         if (cond.is_const && left.is_const && right.is_const) {
-            return operand_const(left.type, cond.val.i ? left.val : right.val);
+            result = operand_const(left.type, cond.val.i ? left.val : right.val);
         } else {
-            return operand_rvalue(left.type);
+            result = operand_rvalue(left.type);
         }
     } else if (left.type == right.type) {
-        return operand_rvalue(left.type);
+        result = operand_rvalue(left.type);
     } else {
         fatal_error(expr->pos, "Left and right operands of ternary expression must have arithmetic types or identical types");
     }
+    fold_ternary(expr, result.type);
+    return result;
 }
 
-Operand resolve_expr_index(Expr *expr) {
+Operand resolve_expr_index(Expr *expr, bool allow_soa) {
     assert(expr->kind == EXPR_INDEX);
-    Operand operand = resolve_expr_rvalue(expr->index.expr);
+    Operand operand = resolve_expr(expr->index.expr);
+    if (is_soa_array_type(unqualify_type(operand.type))) {
+        if (!allow_soa) {
+            fatal_error(expr->pos, "Elements of SoA arrays can only be accessed through their fields");
+        }
+        Operand index = resolve_expr_rvalue(expr->index.index);
+        if (!is_integer_type(index.type)) {
+            fatal_error(expr->pos, "Index must have integer type");
+        }
+        Type *elem = unqualify_type(operand.type)->base;
+        if (is_const_type(operand.type)) {
+            elem = type_const(elem);
+        }
+        return operand.is_lvalue ? operand_lvalue(elem) : operand_rvalue(elem);
+    }
+    if (is_vector_type(unqualify_type(operand.type))) {
+        Type *type = unqualify_type(operand.type);
+        Operand index = resolve_expr_rvalue(expr->index.index);
+        if (!is_integer_type(index.type)) {
+            fatal_error(expr->pos, "Index must have integer type");
+        }
+        if (index.is_const) {
+            cast_operand(&index, type_ullong);
+            if (index.val.ull >= type->num_elems) {
+                fatal_error(expr->pos, "Vector lane index out of range");
+            }
+        }
+        return operand.is_lvalue ? operand_lvalue(type->base) : operand_rvalue(type->base);
+    }
+    operand = operand_decay(operand);
     if (!is_ptr_type(operand.type)) {
         fatal_error(expr->pos, "Can only index arrays and pointers");
     }
@@ -1553,7 +2818,7 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
         result = resolve_expr_call(expr);
         break;
     case EXPR_INDEX:
-        result = resolve_expr_index(expr);
+        result = resolve_expr_index(expr, false);
         break;
     case EXPR_FIELD:
         result = resolve_expr_field(expr);
@@ -1571,7 +2836,11 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
         result = resolve_expr_ternary(expr, expected_type);
         break;
     case EXPR_SIZEOF_EXPR: {
-        Type *type = resolve_expr(expr->sizeof_expr).type;
+        // The operand is never evaluated, so calls in it are not run at compile time.
+        int depth = const_expr_depth;
+        const_expr_depth = 0;
+        Type *type = resolve_expr_soa_elem(expr->sizeof_expr).type;
+        const_expr_depth = depth;
         complete_type(type);
         result = operand_const(type_usize, (Val){.ull = type_sizeof(type)});
         break;
@@ -1590,12 +2859,27 @@ Operand resolve_expected_expr(Expr *expr, Type *expected_type) {
     if (result.type) {
         assert(!expr->type || expr->type == result.type);
         expr->type = result.type;
+        expr->is_const = result.is_const && (is_integer_type(result.type) || is_ptr_type(result.type));
+        expr->val = result.val;
+    }
+    return result;
+}
+
+// SoA array elements only exist as field access bases and sizeof operands, so those resolve through here.
+Operand resolve_expr_soa_elem(Expr *expr) {
+    if (expr->kind != EXPR_INDEX) {
+        return resolve_expr(expr);
     }
+    Operand result = resolve_expr_index(expr, true);
+    assert(!expr->type || expr->type == result.type);
+    expr->type = result.type;
     return result;
 }
 
 Operand resolve_const_expr(Expr *expr) {
+    const_expr_depth++;
     Operand result = resolve_expr(expr);
+    const_expr_depth--;
     if (!result.is_const) {
         fatal_error(expr->pos, "Expected constant expression");
     }
@@ -1630,6 +2914,17 @@ void init_builtins(void) {
     sym_global_const("true", type_bool, (Val){.b = true});
     sym_global_const("false", type_bool, (Val){.b = false});
     sym_global_const("NULL", type_ptr(type_void), (Val){.p = 0});
+
+    sym_global_builtin("popcount", BUILTIN_POPCOUNT);
+    sym_global_builtin("clz", BUILTIN_CLZ);
+    sym_global_builtin("ctz", BUILTIN_CTZ);
+    sym_global_builtin("bswap", BUILTIN_BSWAP);
+    sym_global_builtin("rotl", BUILTIN_ROTL);
+    sym_global_builtin("rotr", BUILTIN_ROTR);
+    sym_global_builtin("prefetch", BUILTIN_PREFETCH);
+    sym_global_builtin("expect", BUILTIN_EXPECT);
+    sym_global_builtin("likely", BUILTIN_LIKELY);
+    sym_global_builtin("unlikely", BUILTIN_UNLIKELY);
 }
 
 void sym_global_decls(DeclSet *declset) {
@@ -1638,11 +2933,244 @@ void sym_global_decls(DeclSet *declset) {
     }
 }
 
+// Syntactic summary of a function body: the names it references and declares, and its size.
+typedef struct BodyScan {
+    const char **refs;
+    const char **locals;
+    size_t num_stmts;
+    size_t num_exprs;
+    size_t num_returns;
+} BodyScan;
+
+void scan_stmt_block(BodyScan *scan, StmtList block);
+
+void scan_expr(BodyScan *scan, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    scan->num_exprs++;
+    switch (expr->kind) {
+    case EXPR_NAME:
+        buf_push(scan->refs, expr->name);
+        break;
+    case EXPR_CAST:
+        scan_expr(scan, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        scan_expr(scan, expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            scan_expr(scan, expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        scan_expr(scan, expr->index.expr);
+        scan_expr(scan, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        scan_expr(scan, expr->field.expr);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                scan_expr(scan, field.index);
+            }
+            scan_expr(scan, field.init);
+        }
+        break;
+    case EXPR_UNARY:
+        scan_expr(scan, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        scan_expr(scan, expr->binary.left);
+        scan_expr(scan, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        scan_expr(scan, expr->ternary.cond);
+        scan_expr(scan, expr->ternary.then_expr);
+        scan_expr(scan, expr->ternary.else_expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        scan_expr(scan, expr->sizeof_expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void scan_stmt(BodyScan *scan, Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    scan->num_stmts++;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        scan->num_returns++;
+        scan_expr(scan, stmt->expr);
+        break;
+    case STMT_EXPR:
+        scan_expr(scan, stmt->expr);
+        break;
+    case STMT_BLOCK:
+        scan_stmt_block(scan, stmt->block);
+        break;
+    case STMT_IF:
+        scan_expr(scan, stmt->if_stmt.cond);
+        scan_stmt_block(scan, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            scan_expr(scan, stmt->if_stmt.elseifs[i].cond);
+            scan_stmt_block(scan, stmt->if_stmt.elseifs[i].block);
+        }
+        scan_stmt_block(scan, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        scan_expr(scan, stmt->while_stmt.cond);
+        scan_stmt_block(scan, stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        scan_stmt(scan, stmt->for_stmt.init);
+        scan_expr(scan, stmt->for_stmt.cond);
+        scan_stmt(scan, stmt->for_stmt.next);
+        scan_stmt_block(scan, stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        scan_expr(scan, stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase switch_case = stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < switch_case.num_exprs; j++) {
+                scan_expr(scan, switch_case.exprs[j]);
+                scan_expr(scan, switch_case.ends[j]);
+            }
+            scan_stmt_block(scan, switch_case.block);
+        }
+        break;
+    case STMT_ASSIGN:
+        scan_expr(scan, stmt->assign.left);
+        scan_expr(scan, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        buf_push(scan->locals, stmt->init.name);
+        scan_expr(scan, stmt->init.expr);
+        break;
+    default:
+        break;
+    }
+}
+
+void scan_stmt_block(BodyScan *scan, StmtList block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        scan_stmt(scan, block.stmts[i]);
+    }
+}
+
+// Parameters count as locals. The scan's buffers are cleared and reused.
+void scan_func_body(BodyScan *scan, Decl *decl) {
+    assert(decl->kind == DECL_FUNC);
+    buf_clear(scan->refs);
+    buf_clear(scan->locals);
+    scan->num_stmts = 0;
+    scan->num_exprs = 0;
+    scan->num_returns = 0;
+    for (size_t i = 0; i < decl->func.num_params; i++) {
+        buf_push(scan->locals, decl->func.params[i].name);
+    }
+    scan_stmt_block(scan, decl->func.block);
+}
+
+bool is_scanned_local(BodyScan *scan, const char *name) {
+    for (const char **it = scan->locals; it != buf_end(scan->locals); it++) {
+        if (*it == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void free_body_scan(BodyScan *scan) {
+    buf_free(scan->refs);
+    buf_free(scan->locals);
+}
+
+// Names referenced from function bodies, not counting a function's references to itself or to its own locals.
+Map referenced_names;
+BodyScan refs_scan;
+
+void note_func_refs(Decl *decl) {
+    scan_func_body(&refs_scan, decl);
+    for (const char **it = refs_scan.refs; it != buf_end(refs_scan.refs); it++) {
+        if (*it != decl->name && !is_scanned_local(&refs_scan, *it)) {
+            map_put(&referenced_names, (void *)*it, (void *)1);
+        }
+    }
+}
+
+bool is_entry_func(Sym *sym) {
+    return !map_get(&referenced_names, (void *)sym->name) && !map_get(&cached_instance_syms, sym);
+}
+
+// Functions that are referenced somewhere only have their bodies resolved once live code reaches them. Those
+// referenced solely from dead code keep just their signature, which checked the dead references, and are dropped
+// before emission. Unreferenced functions are entry points and always kept.
 void finalize_syms(void) {
+    map_clear(&referenced_names);
     for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
         Sym *sym = *it;
-        if (sym->decl) {
+        if (sym->decl && sym->decl->kind == DECL_FUNC) {
+            note_func_refs(sym->decl);
+        }
+    }
+    // Generic instances are appended to global_syms_buf during resolution, so these loops go by index.
+    for (size_t i = 0; i < buf_len(global_syms_buf); i++) {
+        Sym *sym = global_syms_buf[i];
+        if (sym->decl && !is_generic_decl(sym->decl) && (sym->kind != SYM_FUNC || is_entry_func(sym))) {
             finalize_sym(sym);
         }
     }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < buf_len(global_syms_buf); i++) {
+            Sym *sym = global_syms_buf[i];
+            if (sym->decl && sym->kind == SYM_FUNC && map_get(&live_funcs, sym) && !map_get(&func_body_states, sym)) {
+                finalize_sym(sym);
+                changed = true;
+            } else if (sym->decl && sym->kind == SYM_TYPE && sym->type && sym->type->kind == TYPE_INCOMPLETE) {
+                finalize_sym(sym);
+                changed = true;
+            }
+        }
+    }
+    size_t num_sorted = 0;
+    for (size_t i = 0; i < buf_len(sorted_syms); i++) {
+        Sym *sym = sorted_syms[i];
+        if (sym->kind == SYM_FUNC && sym->decl && !map_get(&func_body_states, sym)) {
+            sym->state = SYM_UNRESOLVED;
+        } else {
+            sorted_syms[num_sorted++] = sym;
+        }
+    }
+    if (sorted_syms) {
+        buf__hdr(sorted_syms)->len = num_sorted;
+    }
+}
+
+// Returns the resolver to its initial state for the next compilation. Table storage is kept for reuse.
+void resolve_reset(void) {
+    buf_clear(global_syms_buf);
+    buf_clear(sorted_syms);
+    map_clear(&global_syms_map);
+    map_clear(&func_body_states);
+    map_clear(&referenced_names);
+    map_clear(&live_funcs);
+    local_syms_end = local_syms;
+    const_expr_depth = 0;
+    dead_code_depth = 0;
+    dep_owner = NULL;
+    buf_clear(cached_instances);
+    map_clear(&cached_instance_index);
+    map_clear(&cached_instance_syms);
+    uses_str_switch = false;
+    rotate_builtin_sizes = 0;
+    arena_reset(&resolve_arena);
 }
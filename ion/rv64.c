@@ -0,0 +1,1867 @@
+// RV64IM backend. Walks the resolved AST and emits RISC-V machine code in the same one-pass accumulator
+// style as x64.c: scalars end up in a0, aggregates and vectors are handled by address in a0, and operands
+// are spilled to frame slots indexed by expression depth, so sp only moves in prologues and epilogues.
+// Only the base integer ISA and the M extension are used, which rules out floating-point types.
+// The image is linked in host memory and run by the simulator in rvsim.c. Guest addresses are host
+// addresses, which lets the simulator hand pointers straight to @foreign functions.
+
+typedef enum RvReg {
+    RV_ZERO = 0,
+    RV_RA = 1,
+    RV_SP = 2,
+    RV_T0 = 5,
+    RV_T1 = 6,
+    RV_T2 = 7,
+    RV_S0 = 8,
+    RV_A0 = 10,
+    RV_A1 = 11,
+    RV_T3 = 28,
+    RV_T4 = 29,
+    RV_T5 = 30,
+    RV_T6 = 31,
+} RvReg;
+
+enum {
+    RV_OP_LOAD = 0x03,
+    RV_OP_IMM = 0x13,
+    RV_OP_AUIPC = 0x17,
+    RV_OP_IMM32 = 0x1B,
+    RV_OP_STORE = 0x23,
+    RV_OP_REG = 0x33,
+    RV_OP_LUI = 0x37,
+    RV_OP_REG32 = 0x3B,
+    RV_OP_BRANCH = 0x63,
+    RV_OP_JALR = 0x67,
+    RV_OP_JAL = 0x6F,
+    RV_OP_SYSTEM = 0x73,
+};
+
+enum {
+    RV_MAX_REG_ARGS = 8,
+    RV_COPY_UNROLL = 64,
+    RV_SAVE_SIZE = 16,
+};
+
+// Register-register operations, encoded as funct7 << 3 | funct3. The word forms use the same encoding
+// under RV_OP_REG32 and only exist for the arithmetic, shift and M operations.
+typedef enum RvAluOp {
+    RV_ADD = 0x000,
+    RV_SLL = 0x001,
+    RV_SLT = 0x002,
+    RV_SLTU = 0x003,
+    RV_XOR = 0x004,
+    RV_SRL = 0x005,
+    RV_OR = 0x006,
+    RV_AND = 0x007,
+    RV_MUL = 0x008,
+    RV_MULH = 0x009,
+    RV_MULHU = 0x00B,
+    RV_DIV = 0x00C,
+    RV_DIVU = 0x00D,
+    RV_REM = 0x00E,
+    RV_REMU = 0x00F,
+    RV_SUB = 0x100,
+    RV_SRA = 0x105,
+} RvAluOp;
+
+// Immediate operations share funct3 with their register forms.
+typedef enum RvImmOp {
+    RV_ADDI = 0,
+    RV_SLLI = 1,
+    RV_SLTI = 2,
+    RV_SLTIU = 3,
+    RV_XORI = 4,
+    RV_SRLI = 5,
+    RV_ORI = 6,
+    RV_ANDI = 7,
+} RvImmOp;
+
+typedef enum RvBranchCond {
+    RV_BEQ = 0,
+    RV_BNE = 1,
+    RV_BLT = 4,
+    RV_BGE = 5,
+    RV_BLTU = 6,
+    RV_BGEU = 7,
+} RvBranchCond;
+
+typedef enum RvSection {
+    RV_TEXT,
+    RV_DATA,
+} RvSection;
+
+typedef enum RvRelocKind {
+    RV_RELOC_ABS64,
+    RV_RELOC_PCREL,
+    RV_RELOC_GOT,
+    RV_RELOC_CALL,
+} RvRelocKind;
+
+typedef struct RvSym {
+    const char *name;
+    RvSection section;
+    size_t offset;
+    bool is_defined;
+} RvSym;
+
+typedef struct RvReloc {
+    RvSection section;
+    size_t offset;
+    RvRelocKind kind;
+    size_t sym;
+    long long addend;
+} RvReloc;
+
+uint32_t *rv_text;
+char *rv_data;
+size_t rv_data_align;
+RvSym *rv_syms;
+Map rv_sym_map;
+Map rv_str_map;
+RvReloc *rv_relocs;
+VmCallSite **rv_call_sites;
+
+size_t rv_sym_index(const char *name) {
+    uintptr_t index = (uintptr_t)map_get(&rv_sym_map, (void *)name);
+    if (index) {
+        return index - 1;
+    }
+    buf_push(rv_syms, (RvSym){.name = name});
+    map_put(&rv_sym_map, (void *)name, (void *)(uintptr_t)buf_len(rv_syms));
+    return buf_len(rv_syms) - 1;
+}
+
+void rv_define_sym(const char *name, RvSection section, size_t offset) {
+    size_t index = rv_sym_index(name);
+    RvSym *sym = rv_syms + index;
+    assert(!sym->is_defined);
+    sym->section = section;
+    sym->offset = offset;
+    sym->is_defined = true;
+}
+
+size_t rv_data_alloc(size_t size, size_t align) {
+    rv_data_align = MAX(rv_data_align, align);
+    size_t offset = ALIGN_UP(buf_len(rv_data), align);
+    buf_fit(rv_data, offset + size);
+    memset(rv_data + buf_len(rv_data), 0, offset + size - buf_len(rv_data));
+    buf__hdr(rv_data)->len = offset + size;
+    return offset;
+}
+
+size_t rv_str_sym(const char *str) {
+    str = str_intern(str);
+    uintptr_t index = (uintptr_t)map_get(&rv_str_map, (void *)str);
+    if (index) {
+        return index - 1;
+    }
+    size_t len = strlen(str) + 1;
+    size_t offset = rv_data_alloc(len, 1);
+    memcpy(rv_data + offset, str, len);
+    size_t sym = rv_sym_index(str_intern(strf(".Lstr%zu", rv_str_map.len)));
+    rv_define_sym(rv_syms[sym].name, RV_DATA, offset);
+    map_put(&rv_str_map, (void *)str, (void *)(uintptr_t)(sym + 1));
+    return sym;
+}
+
+size_t rv_const_data_sym(const void *data, Type *type) {
+    size_t size = type_sizeof(type);
+    size_t offset = rv_data_alloc(size, type_alignof(type));
+    memcpy(rv_data + offset, data, size);
+    size_t sym = rv_sym_index(str_intern(strf(".Lconst%zu", buf_len(rv_syms))));
+    rv_define_sym(rv_syms[sym].name, RV_DATA, offset);
+    return sym;
+}
+
+void rv_add_reloc(RvSection section, size_t offset, RvRelocKind kind, size_t sym, long long addend) {
+    buf_push(rv_relocs, (RvReloc){section, offset, kind, sym, addend});
+}
+
+// Instruction encoding
+
+size_t rv_pos(void) {
+    return buf_len(rv_text) * 4;
+}
+
+void rv_emit(uint32_t instr) {
+    buf_push(rv_text, instr);
+}
+
+bool rv_is_imm12(long long val) {
+    return -2048 <= val && val < 2048;
+}
+
+int32_t rv_sext12(long long val) {
+    return (int32_t)((val & 0xFFF) ^ 0x800) - 0x800;
+}
+
+uint32_t rv_b_imm(int32_t imm) {
+    uint32_t bits = (uint32_t)imm;
+    return ((bits >> 12) & 1) << 31 | ((bits >> 5) & 0x3F) << 25 | ((bits >> 1) & 0xF) << 8 | ((bits >> 11) & 1) << 7;
+}
+
+uint32_t rv_j_imm(int32_t imm) {
+    uint32_t bits = (uint32_t)imm;
+    return ((bits >> 20) & 1) << 31 | ((bits >> 1) & 0x3FF) << 21 | ((bits >> 11) & 1) << 20 | ((bits >> 12) & 0xFF) << 12;
+}
+
+void rv_op_i(uint32_t opcode, uint32_t funct3, int rd, int rs1, int32_t imm) {
+    rv_emit((uint32_t)(imm & 0xFFF) << 20 | (uint32_t)rs1 << 15 | funct3 << 12 | (uint32_t)rd << 7 | opcode);
+}
+
+void rv_op_u(uint32_t opcode, int rd, uint32_t imm20) {
+    rv_emit((imm20 & 0xFFFFF) << 12 | (uint32_t)rd << 7 | opcode);
+}
+
+void rv_alu(RvAluOp op, bool w, int rd, int rs1, int rs2) {
+    rv_emit((uint32_t)(op >> 3) << 25 | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | (uint32_t)(op & 7) << 12 | (uint32_t)rd << 7 | (w ? RV_OP_REG32 : RV_OP_REG));
+}
+
+void rv_alu_imm(RvImmOp op, int rd, int rs1, int32_t imm) {
+    assert(rv_is_imm12(imm));
+    rv_op_i(RV_OP_IMM, op, rd, rs1, imm);
+}
+
+void rv_shift_imm(RvAluOp op, bool w, int rd, int rs1, int shamt) {
+    rv_op_i(w ? RV_OP_IMM32 : RV_OP_IMM, op & 7, rd, rs1, (op == RV_SRA ? 0x400 : 0) | shamt);
+}
+
+void rv_mv(int rd, int rs) {
+    if (rd != rs) {
+        rv_alu_imm(RV_ADDI, rd, rs, 0);
+    }
+}
+
+void rv_jalr(int rd, int rs1, int32_t imm) {
+    rv_op_i(RV_OP_JALR, 0, rd, rs1, imm);
+}
+
+void rv_ecall(void) {
+    rv_emit(RV_OP_SYSTEM);
+}
+
+void rv_li(int rd, long long val) {
+    if (rv_is_imm12(val)) {
+        rv_alu_imm(RV_ADDI, rd, RV_ZERO, (int32_t)val);
+    } else if (val == (int32_t)val) {
+        int32_t lo = rv_sext12(val);
+        rv_op_u(RV_OP_LUI, rd, (uint32_t)((val - lo) >> 12));
+        if (lo) {
+            rv_op_i(RV_OP_IMM32, RV_ADDI, rd, rd, lo);
+        }
+    } else {
+        // Materialize the upper bits recursively, then shift them into place and add the low 12 bits.
+        int32_t lo = rv_sext12(val);
+        long long hi = (long long)((unsigned long long)val - (unsigned long long)lo) >> 12;
+        int shift = 12;
+        while (!(hi & 1)) {
+            hi >>= 1;
+            shift++;
+        }
+        rv_li(rd, hi);
+        rv_shift_imm(RV_SLL, false, rd, rd, shift);
+        if (lo) {
+            rv_alu_imm(RV_ADDI, rd, rd, lo);
+        }
+    }
+}
+
+void rv_add_imm(int rd, int rs, long long imm) {
+    if (rv_is_imm12(imm)) {
+        if (rd != rs || imm) {
+            rv_alu_imm(RV_ADDI, rd, rs, (int32_t)imm);
+        }
+    } else {
+        rv_li(RV_T6, imm);
+        rv_alu(RV_ADD, false, rd, rs, RV_T6);
+    }
+}
+
+void rv_mul_imm(int reg, size_t val) {
+    if (val == 1) {
+        return;
+    } else if (IS_POW2(val)) {
+        int shift = 0;
+        while (((size_t)1 << shift) != val) {
+            shift++;
+        }
+        rv_shift_imm(RV_SLL, false, reg, reg, shift);
+    } else {
+        rv_li(RV_T6, (long long)val);
+        rv_alu(RV_MUL, false, reg, reg, RV_T6);
+    }
+}
+
+// Returns a base register for which disp fits a 12-bit offset, computing large addresses into t6.
+int rv_mem_base(int base, int32_t *disp) {
+    if (rv_is_imm12(*disp)) {
+        return base;
+    }
+    rv_add_imm(RV_T6, base, *disp);
+    *disp = 0;
+    return RV_T6;
+}
+
+void rv_load_reg(int rd, size_t size, bool is_signed, int base, int32_t disp) {
+    static const uint32_t signed_funct3[] = {[1] = 0, [2] = 1, [4] = 2, [8] = 3};
+    static const uint32_t unsigned_funct3[] = {[1] = 4, [2] = 5, [4] = 6, [8] = 3};
+    assert(size == 1 || size == 2 || size == 4 || size == 8);
+    base = rv_mem_base(base, &disp);
+    rv_op_i(RV_OP_LOAD, is_signed ? signed_funct3[size] : unsigned_funct3[size], rd, base, disp);
+}
+
+void rv_store_reg(int rs, size_t size, int base, int32_t disp) {
+    static const uint32_t funct3[] = {[1] = 0, [2] = 1, [4] = 2, [8] = 3};
+    assert(size == 1 || size == 2 || size == 4 || size == 8);
+    base = rv_mem_base(base, &disp);
+    rv_emit((uint32_t)((disp >> 5) & 0x7F) << 25 | (uint32_t)rs << 20 | (uint32_t)base << 15 | funct3[size] << 12 | (uint32_t)(disp & 0x1F) << 7 | RV_OP_STORE);
+}
+
+// Copies size bytes from the address in src to dst + disp. Large copies loop over double words.
+void rv_copy(int dst, int32_t disp, int src, size_t size) {
+    if (size > RV_COPY_UNROLL || !rv_is_imm12(disp) || !rv_is_imm12(disp + (int32_t)size)) {
+        rv_add_imm(RV_T2, dst, disp);
+        rv_mv(RV_T3, src);
+        dst = RV_T2;
+        src = RV_T3;
+        disp = 0;
+    }
+    size_t offset = 0;
+    if (size > RV_COPY_UNROLL) {
+        rv_li(RV_T4, (long long)(size / 8));
+        rv_load_reg(RV_T1, 8, false, RV_T3, 0);
+        rv_store_reg(RV_T1, 8, RV_T2, 0);
+        rv_alu_imm(RV_ADDI, RV_T3, RV_T3, 8);
+        rv_alu_imm(RV_ADDI, RV_T2, RV_T2, 8);
+        rv_alu_imm(RV_ADDI, RV_T4, RV_T4, -1);
+        rv_emit(rv_b_imm(-20) | RV_T4 << 15 | RV_BNE << 12 | RV_OP_BRANCH);
+        size %= 8;
+    }
+    for (size_t chunk = 8; chunk; chunk /= 2) {
+        for (; size - offset >= chunk; offset += chunk) {
+            rv_load_reg(RV_T1, chunk, false, src, (int32_t)offset);
+            rv_store_reg(RV_T1, chunk, dst, disp + (int32_t)offset);
+        }
+    }
+}
+
+void rv_zero(int base, int32_t disp, size_t size) {
+    if (size > RV_COPY_UNROLL || !rv_is_imm12(disp) || !rv_is_imm12(disp + (int32_t)size)) {
+        rv_add_imm(RV_T2, base, disp);
+        base = RV_T2;
+        disp = 0;
+    }
+    size_t offset = 0;
+    if (size > RV_COPY_UNROLL) {
+        rv_li(RV_T4, (long long)(size / 8));
+        rv_store_reg(RV_ZERO, 8, RV_T2, 0);
+        rv_alu_imm(RV_ADDI, RV_T2, RV_T2, 8);
+        rv_alu_imm(RV_ADDI, RV_T4, RV_T4, -1);
+        rv_emit(rv_b_imm(-12) | RV_T4 << 15 | RV_BNE << 12 | RV_OP_BRANCH);
+        size %= 8;
+    }
+    for (size_t chunk = 8; chunk; chunk /= 2) {
+        for (; size - offset >= chunk; offset += chunk) {
+            rv_store_reg(RV_ZERO, chunk, base, disp + (int32_t)offset);
+        }
+    }
+}
+
+// Loads the address of a symbol pc-relatively, or its address from the GOT for host symbols.
+void rv_sym_addr(int rd, size_t sym, RvRelocKind kind) {
+    rv_add_reloc(RV_TEXT, rv_pos(), kind, sym, 0);
+    rv_op_u(RV_OP_AUIPC, rd, 0);
+    if (kind == RV_RELOC_GOT) {
+        rv_op_i(RV_OP_LOAD, 3, rd, rd, 0);
+    } else {
+        rv_alu_imm(RV_ADDI, rd, rd, 0);
+    }
+}
+
+// Function state
+
+typedef struct RvLocal {
+    const char *name;
+    Type *type;
+    int32_t offset;
+} RvLocal;
+
+typedef struct RvFixup {
+    size_t offset;
+    int label;
+} RvFixup;
+
+RvLocal *rv_locals;
+size_t *rv_labels;
+RvFixup *rv_fixups;
+int *rv_break_labels;
+int *rv_continue_labels;
+int32_t *rv_spill_slots;
+int rv_depth;
+int32_t rv_frame_size;
+int32_t rv_out_size;
+Type *rv_ret_type;
+int rv_ret_label;
+int32_t rv_ret_ptr_offset;
+
+// A function is generated again with these set when its frame or one of its branches turns out
+// to be out of range of the short encodings.
+bool rv_big_frame;
+bool rv_far_branches;
+
+int32_t rv_alloc_slot(size_t size, size_t align) {
+    align = MIN(MAX(align, 1), 16);
+    rv_frame_size = (int32_t)ALIGN_UP(rv_frame_size + size, align);
+    return -rv_frame_size;
+}
+
+RvLocal *rv_get_local(const char *name) {
+    for (RvLocal *it = buf_end(rv_locals); it != rv_locals; it--) {
+        if (it[-1].name == name) {
+            return it - 1;
+        }
+    }
+    return NULL;
+}
+
+void rv_push_local(const char *name, Type *type, int32_t offset) {
+    buf_push(rv_locals, (RvLocal){name, type, offset});
+}
+
+void rv_pop_locals(size_t num_locals) {
+    if (rv_locals) {
+        buf__hdr(rv_locals)->len = num_locals;
+    }
+}
+
+int rv_new_label(void) {
+    buf_push(rv_labels, SIZE_MAX);
+    return (int)buf_len(rv_labels) - 1;
+}
+
+void rv_bind_label(int label) {
+    rv_labels[label] = rv_pos();
+}
+
+void rv_jmp(int label) {
+    buf_push(rv_fixups, (RvFixup){rv_pos(), label});
+    rv_emit(RV_OP_JAL);
+}
+
+void rv_branch(RvBranchCond cond, int rs1, int rs2, int label) {
+    if (rv_far_branches) {
+        rv_emit(rv_b_imm(8) | (uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | (uint32_t)(cond ^ 1) << 12 | RV_OP_BRANCH);
+        rv_jmp(label);
+        return;
+    }
+    buf_push(rv_fixups, (RvFixup){rv_pos(), label});
+    rv_emit((uint32_t)rs2 << 20 | (uint32_t)rs1 << 15 | (uint32_t)cond << 12 | RV_OP_BRANCH);
+}
+
+bool rv_resolve_fixups(void) {
+    for (RvFixup *it = rv_fixups; it != buf_end(rv_fixups); it++) {
+        assert(rv_labels[it->label] != SIZE_MAX);
+        long long delta = (long long)rv_labels[it->label] - (long long)it->offset;
+        uint32_t *instr = rv_text + it->offset / 4;
+        if ((*instr & 0x7F) == RV_OP_BRANCH) {
+            if (delta < -4096 || delta >= 4096) {
+                return false;
+            }
+            *instr |= rv_b_imm((int32_t)delta);
+        } else {
+            if (delta < -(1 << 20) || delta >= (1 << 20)) {
+                fatal("Function is too large for the RV64 backend");
+            }
+            *instr |= rv_j_imm((int32_t)delta);
+        }
+    }
+    return true;
+}
+
+int32_t rv_spill_slot(int depth) {
+    while ((int)buf_len(rv_spill_slots) <= depth) {
+        buf_push(rv_spill_slots, rv_alloc_slot(8, 8));
+    }
+    return rv_spill_slots[depth];
+}
+
+void rv_push(int reg) {
+    rv_store_reg(reg, 8, RV_S0, rv_spill_slot(rv_depth));
+    rv_depth++;
+}
+
+void rv_pop(int reg) {
+    rv_depth--;
+    rv_load_reg(reg, 8, false, RV_S0, rv_spill_slot(rv_depth));
+}
+
+// Types
+
+// Plain char is unsigned in the RISC-V psABI, but programs run in the simulator next to the host, so it takes
+// the host's signedness like the other backends and constant folding.
+bool rv_is_signed(Type *type) {
+    return is_signed_type(type) || (type->kind == TYPE_CHAR && CHAR_MIN < 0);
+}
+
+void rv_check_type(SrcPos pos, Type *type) {
+    type = unqualify_type(type);
+    if (is_floating_type(type) || (is_vector_type(type) && is_floating_type(type->base))) {
+        fatal_error(pos, "Floating-point types are not supported by the RV64IM backend");
+    }
+}
+
+unsigned long long rv_const_val(Type *type, Val val) {
+    Operand operand = operand_const(type, val);
+    cast_operand(&operand, rv_is_signed(operand.type) ? type_llong : type_ullong);
+    return operand.val.ull;
+}
+
+// Loads and stores
+
+void rv_load(Type *type, int base, int32_t disp) {
+    type = unqualify_type(type);
+    if (x64_is_mem_type(type)) {
+        rv_add_imm(RV_A0, base, disp);
+        return;
+    }
+    rv_load_reg(RV_A0, type_sizeof(type), rv_is_signed(type), base, disp);
+}
+
+void rv_store(Type *type, int base, int32_t disp) {
+    type = unqualify_type(type);
+    if (x64_is_mem_type(type)) {
+        rv_copy(base, disp, RV_A0, type_sizeof(type));
+        return;
+    }
+    rv_store_reg(RV_A0, type_sizeof(type), base, disp);
+}
+
+// Conversions
+
+// Integer values are kept sign- or zero-extended to 64 bits according to their type.
+void rv_normalize_reg(int reg, Type *type) {
+    type = unqualify_type(type);
+    if (!is_integer_type(type)) {
+        return;
+    }
+    size_t size = type_sizeof(type);
+    bool is_signed = rv_is_signed(type);
+    if (size == 1 && !is_signed) {
+        rv_alu_imm(RV_ANDI, reg, reg, 0xFF);
+    } else if (size == 4 && is_signed) {
+        rv_op_i(RV_OP_IMM32, RV_ADDI, reg, reg, 0);
+    } else if (size < 8) {
+        int shift = 64 - 8*(int)size;
+        rv_shift_imm(RV_SLL, false, reg, reg, shift);
+        rv_shift_imm(is_signed ? RV_SRA : RV_SRL, false, reg, reg, shift);
+    }
+}
+
+void rv_normalize(Type *type) {
+    rv_normalize_reg(RV_A0, type);
+}
+
+void rv_convert_reg(int reg, Type *from, Type *to) {
+    from = x64_decay(from);
+    to = unqualify_type(to);
+    if (from == to || to->kind == TYPE_VOID || x64_is_mem_type(from) || x64_is_mem_type(to)) {
+        return;
+    }
+    if (is_floating_type(from) || is_floating_type(to)) {
+        fatal("Floating-point types are not supported by the RV64IM backend");
+    }
+    if (to->kind == TYPE_BOOL) {
+        rv_alu(RV_SLTU, false, reg, RV_ZERO, reg);
+    } else {
+        rv_normalize_reg(reg, to);
+    }
+}
+
+void rv_gen_convert(Type *from, Type *to) {
+    rv_convert_reg(RV_A0, from, to);
+}
+
+// Expressions
+
+void rv_gen_expr(Expr *expr);
+void rv_gen_init(int32_t offset, Type *type, Expr *expr);
+void rv_gen_addr(Expr *expr);
+
+void rv_gen_global_addr(int rd, Sym *sym) {
+    size_t index = rv_sym_index(sym->name);
+    rv_sym_addr(rd, index, sym->decl && is_decl_foreign(sym->decl) ? RV_RELOC_GOT : RV_RELOC_PCREL);
+}
+
+// Loads side-effect free leaf operands straight into rd, leaving a0 alone.
+bool rv_gen_leaf(Expr *expr, int rd) {
+    if (expr->kind == EXPR_INT) {
+        rv_li(rd, (long long)expr->int_lit.val);
+        return true;
+    } else if (expr->kind != EXPR_NAME) {
+        return false;
+    }
+    Type *type = unqualify_type(expr->type);
+    if (x64_is_mem_type(type) || is_floating_type(type)) {
+        return false;
+    }
+    RvLocal *local = rv_get_local(expr->name);
+    if (local) {
+        rv_load_reg(rd, type_sizeof(type), rv_is_signed(type), RV_S0, local->offset);
+        return true;
+    }
+    Sym *sym = sym_get(expr->name);
+    if (sym && sym->kind == SYM_CONST) {
+        rv_li(rd, (long long)rv_const_val(sym->type, sym->val));
+        return true;
+    }
+    return false;
+}
+
+// Evaluates right as the second operand into a1, keeping the first one in a0.
+void rv_gen_second(Expr *right, Type *type) {
+    if (rv_gen_leaf(right, RV_A1)) {
+        rv_convert_reg(RV_A1, right->type, type);
+        return;
+    }
+    rv_push(RV_A0);
+    rv_gen_expr(right);
+    rv_gen_convert(right->type, type);
+    rv_mv(RV_A1, RV_A0);
+    rv_pop(RV_A0);
+}
+
+bool rv_is_int_cmp(Expr *expr) {
+    if (expr->kind != EXPR_BINARY || !is_cmp_token(expr->binary.op)) {
+        return false;
+    }
+    Type *left = x64_decay(expr->binary.left->type);
+    Type *right = x64_decay(expr->binary.right->type);
+    return is_scalar_type(left) && is_scalar_type(right) && !is_floating_type(left) && !is_floating_type(right);
+}
+
+// Evaluates both operands of a scalar comparison into a0 and a1 and returns the compared type.
+Type *rv_gen_cmp_operands(Expr *expr) {
+    Type *left = x64_decay(expr->binary.left->type);
+    Type *right = x64_decay(expr->binary.right->type);
+    Type *type = is_integer_type(left) && is_integer_type(right) ? x64_unify(left, right) : type_ullong;
+    rv_gen_expr(expr->binary.left);
+    rv_gen_convert(left, type);
+    rv_gen_second(expr->binary.right, type);
+    return type;
+}
+
+void rv_gen_cond_jump(Expr *expr, bool jump_if_true, int label) {
+    if (expr->kind == EXPR_UNARY && expr->unary.op == TOKEN_NOT) {
+        rv_gen_cond_jump(expr->unary.expr, !jump_if_true, label);
+        return;
+    } else if (expr->kind == EXPR_BINARY && (expr->binary.op == TOKEN_AND_AND || expr->binary.op == TOKEN_OR_OR)) {
+        bool is_and = expr->binary.op == TOKEN_AND_AND;
+        if (is_and != jump_if_true) {
+            rv_gen_cond_jump(expr->binary.left, jump_if_true, label);
+            rv_gen_cond_jump(expr->binary.right, jump_if_true, label);
+        } else {
+            int skip = rv_new_label();
+            rv_gen_cond_jump(expr->binary.left, !jump_if_true, skip);
+            rv_gen_cond_jump(expr->binary.right, jump_if_true, label);
+            rv_bind_label(skip);
+        }
+        return;
+    } else if (rv_is_int_cmp(expr)) {
+        bool is_signed = rv_is_signed(rv_gen_cmp_operands(expr));
+        RvBranchCond cond;
+        bool swap = false;
+        switch (expr->binary.op) {
+        case TOKEN_EQ:
+            cond = RV_BEQ;
+            break;
+        case TOKEN_NOTEQ:
+            cond = RV_BNE;
+            break;
+        case TOKEN_LT:
+            cond = is_signed ? RV_BLT : RV_BLTU;
+            break;
+        case TOKEN_GTEQ:
+            cond = is_signed ? RV_BGE : RV_BGEU;
+            break;
+        case TOKEN_GT:
+            cond = is_signed ? RV_BLT : RV_BLTU;
+            swap = true;
+            break;
+        default:
+            cond = is_signed ? RV_BGE : RV_BGEU;
+            swap = true;
+            break;
+        }
+        if (!jump_if_true) {
+            cond ^= 1;
+        }
+        rv_branch(cond, swap ? RV_A1 : RV_A0, swap ? RV_A0 : RV_A1, label);
+        return;
+    }
+    rv_gen_expr(expr);
+    rv_branch(jump_if_true ? RV_BNE : RV_BEQ, RV_A0, RV_ZERO, label);
+}
+
+void rv_gen_soa_field_addr(Expr *expr) {
+    Expr *index = expr->field.expr;
+    Type *type = unqualify_type(index->index.expr->type);
+    Type *elem = type->base;
+    int field_index = aggregate_field_index(elem, expr->field.name);
+    assert(field_index >= 0);
+    rv_gen_expr(index->index.expr);
+    rv_gen_second(index->index.index, type_ullong);
+    rv_mul_imm(RV_A1, type_sizeof(elem->aggregate.fields[field_index].type));
+    rv_alu(RV_ADD, false, RV_A0, RV_A0, RV_A1);
+    rv_add_imm(RV_A0, RV_A0, (long long)type_soa_field_offset(type, field_index));
+}
+
+void rv_gen_addr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_NAME: {
+        RvLocal *local = rv_get_local(expr->name);
+        if (local) {
+            rv_add_imm(RV_A0, RV_S0, local->offset);
+        } else {
+            rv_gen_global_addr(RV_A0, sym_get(expr->name));
+        }
+        break;
+    }
+    case EXPR_INDEX: {
+        Type *type = unqualify_type(expr->index.expr->type);
+        rv_gen_expr(expr->index.expr);
+        rv_gen_second(expr->index.index, type_ullong);
+        rv_mul_imm(RV_A1, is_ptr_type(type) ? x64_elem_size(type) : type_sizeof(type->base));
+        rv_alu(RV_ADD, false, RV_A0, RV_A0, RV_A1);
+        break;
+    }
+    case EXPR_FIELD: {
+        Expr *base = expr->field.expr;
+        if (base->kind == EXPR_INDEX && is_soa_array_type(unqualify_type(base->index.expr->type))) {
+            rv_gen_soa_field_addr(expr);
+            break;
+        }
+        Type *type = unqualify_type(base->type);
+        rv_gen_expr(base);
+        if (is_ptr_type(type)) {
+            type = unqualify_type(type->base);
+        }
+        complete_type(type);
+        int field_index = aggregate_field_index(type, expr->field.name);
+        assert(field_index >= 0);
+        rv_add_imm(RV_A0, RV_A0, (long long)type->aggregate.fields[field_index].offset);
+        break;
+    }
+    case EXPR_UNARY:
+        assert(expr->unary.op == TOKEN_MUL);
+        rv_gen_expr(expr->unary.expr);
+        break;
+    case EXPR_COMPOUND: {
+        Type *type = unqualify_type(expr->type);
+        int32_t offset = rv_alloc_slot(type_sizeof(type), type_alignof(type));
+        rv_gen_init(offset, type, expr);
+        rv_add_imm(RV_A0, RV_S0, offset);
+        break;
+    }
+    default:
+        assert(x64_is_mem_type(expr->type));
+        rv_gen_expr(expr);
+        break;
+    }
+}
+
+// Applies op to a0 and a1, leaving the result in a0. 32-bit operations use the word forms,
+// whose results come out sign-extended.
+void rv_gen_arith_op(TokenKind op, Type *type) {
+    type = unqualify_type(type);
+    bool is_signed = rv_is_signed(type);
+    bool w = type_sizeof(type) == 4;
+    switch (op) {
+    case TOKEN_ADD:
+        rv_alu(RV_ADD, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_SUB:
+        rv_alu(RV_SUB, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_MUL:
+        rv_alu(RV_MUL, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_DIV:
+        rv_alu(is_signed ? RV_DIV : RV_DIVU, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_MOD:
+        rv_alu(is_signed ? RV_REM : RV_REMU, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_AND:
+        rv_alu(RV_AND, false, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_OR:
+        rv_alu(RV_OR, false, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_XOR:
+        rv_alu(RV_XOR, false, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_LSHIFT:
+        rv_alu(RV_SLL, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_RSHIFT:
+        rv_alu(is_signed ? RV_SRA : RV_SRL, w, RV_A0, RV_A0, RV_A1);
+        break;
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+        rv_alu(RV_XOR, false, RV_A0, RV_A0, RV_A1);
+        if (op == TOKEN_EQ) {
+            rv_alu_imm(RV_SLTIU, RV_A0, RV_A0, 1);
+        } else {
+            rv_alu(RV_SLTU, false, RV_A0, RV_ZERO, RV_A0);
+        }
+        return;
+    case TOKEN_LT:
+    case TOKEN_GTEQ:
+        rv_alu(is_signed ? RV_SLT : RV_SLTU, false, RV_A0, RV_A0, RV_A1);
+        if (op == TOKEN_GTEQ) {
+            rv_alu_imm(RV_XORI, RV_A0, RV_A0, 1);
+        }
+        return;
+    case TOKEN_GT:
+    case TOKEN_LTEQ:
+        rv_alu(is_signed ? RV_SLT : RV_SLTU, false, RV_A0, RV_A1, RV_A0);
+        if (op == TOKEN_LTEQ) {
+            rv_alu_imm(RV_XORI, RV_A0, RV_A0, 1);
+        }
+        return;
+    default:
+        assert(0);
+        break;
+    }
+    if (!w || !is_signed) {
+        rv_normalize(type);
+    }
+}
+
+// Spills the current vector operand (an address) or scalar operand (broadcast through a stride of 0).
+int32_t rv_gen_vector_operand(Type *type, Type *vector) {
+    if (is_vector_type(type)) {
+        rv_push(RV_A0);
+        return (int32_t)type_sizeof(vector->base);
+    }
+    rv_gen_convert(type, vector->base);
+    int32_t offset = rv_alloc_slot(8, 8);
+    rv_store(vector->base, RV_S0, offset);
+    rv_add_imm(RV_A0, RV_S0, offset);
+    rv_push(RV_A0);
+    return 0;
+}
+
+// Vector operations are unrolled lane by lane over memory operands.
+Type *rv_gen_vector_binary_rest(TokenKind op, Type *left_type, Expr *right) {
+    Type *right_type = unqualify_type(right->type);
+    Type *vector = is_vector_type(left_type) ? left_type : right_type;
+    Type *elem = vector->base;
+    Type *result = is_cmp_token(op) ? vector_mask_type(vector) : vector;
+    int32_t left_stride = rv_gen_vector_operand(left_type, vector);
+    rv_gen_expr(right);
+    int32_t right_stride = rv_gen_vector_operand(right_type, vector);
+    rv_pop(RV_T5);
+    rv_pop(RV_T4);
+    int32_t offset = rv_alloc_slot(type_sizeof(result), type_alignof(result));
+    for (size_t i = 0; i < vector->num_elems; i++) {
+        rv_load_reg(RV_A1, type_sizeof(elem), rv_is_signed(elem), RV_T5, right_stride * (int32_t)i);
+        rv_load(elem, RV_T4, left_stride * (int32_t)i);
+        rv_gen_arith_op(op, elem);
+        if (is_cmp_token(op)) {
+            rv_alu(RV_SUB, false, RV_A0, RV_ZERO, RV_A0);
+        }
+        rv_store(result->base, RV_S0, offset + (int32_t)(i * type_sizeof(elem)));
+    }
+    rv_add_imm(RV_A0, RV_S0, offset);
+    return result;
+}
+
+// Evaluates a binary operator whose left operand of type left_type is already in a0.
+Type *rv_gen_binary_rest(TokenKind op, Type *left_type, Expr *right) {
+    left_type = x64_decay(left_type);
+    Type *right_type = x64_decay(right->type);
+    if (is_vector_type(left_type) || is_vector_type(right_type)) {
+        return rv_gen_vector_binary_rest(op, left_type, right);
+    }
+    if (is_ptr_type(left_type) || is_ptr_type(right_type) || left_type->kind == TYPE_FUNC || right_type->kind == TYPE_FUNC) {
+        rv_gen_second(right, right_type);
+        switch (op) {
+        case TOKEN_ADD:
+            if (is_ptr_type(left_type)) {
+                rv_mul_imm(RV_A1, x64_elem_size(left_type));
+                rv_alu(RV_ADD, false, RV_A0, RV_A0, RV_A1);
+                return left_type;
+            } else {
+                rv_mul_imm(RV_A0, x64_elem_size(right_type));
+                rv_alu(RV_ADD, false, RV_A0, RV_A0, RV_A1);
+                return right_type;
+            }
+        case TOKEN_SUB:
+            if (is_ptr_type(right_type)) {
+                size_t size = x64_elem_size(left_type);
+                rv_alu(RV_SUB, false, RV_A0, RV_A0, RV_A1);
+                if (size != 1) {
+                    rv_li(RV_A1, (long long)size);
+                    rv_alu(RV_DIV, false, RV_A0, RV_A0, RV_A1);
+                }
+                return type_ssize;
+            } else {
+                rv_mul_imm(RV_A1, x64_elem_size(left_type));
+                rv_alu(RV_SUB, false, RV_A0, RV_A0, RV_A1);
+                return left_type;
+            }
+        default:
+            assert(is_cmp_token(op));
+            rv_gen_arith_op(op, type_ullong);
+            return type_int;
+        }
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        Type *type = x64_promote(left_type);
+        rv_gen_convert(left_type, type);
+        rv_gen_second(right, right_type);
+        rv_gen_arith_op(op, type);
+        return type;
+    }
+    Type *type = x64_unify(left_type, right_type);
+    rv_gen_convert(left_type, type);
+    rv_gen_second(right, type);
+    rv_gen_arith_op(op, type);
+    return is_cmp_token(op) ? type_int : type;
+}
+
+void rv_gen_expr_binary(Expr *expr) {
+    TokenKind op = expr->binary.op;
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        bool is_and = op == TOKEN_AND_AND;
+        int short_circuit = rv_new_label(), done = rv_new_label();
+        rv_gen_cond_jump(expr->binary.left, !is_and, short_circuit);
+        rv_gen_cond_jump(expr->binary.right, !is_and, short_circuit);
+        rv_li(RV_A0, is_and);
+        rv_jmp(done);
+        rv_bind_label(short_circuit);
+        rv_li(RV_A0, !is_and);
+        rv_bind_label(done);
+        return;
+    }
+    rv_gen_expr(expr->binary.left);
+    rv_gen_binary_rest(op, expr->binary.left->type, expr->binary.right);
+}
+
+void rv_gen_unary_op(TokenKind op, Type *type) {
+    switch (op) {
+    case TOKEN_ADD:
+        break;
+    case TOKEN_SUB:
+        rv_alu(RV_SUB, false, RV_A0, RV_ZERO, RV_A0);
+        rv_normalize(type);
+        break;
+    case TOKEN_NEG:
+        rv_alu_imm(RV_XORI, RV_A0, RV_A0, -1);
+        rv_normalize(type);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void rv_gen_expr_unary(Expr *expr) {
+    TokenKind op = expr->unary.op;
+    if (op == TOKEN_AND) {
+        rv_gen_addr(expr->unary.expr);
+        return;
+    } else if (op == TOKEN_MUL) {
+        rv_gen_expr(expr->unary.expr);
+        rv_load(expr->type, RV_A0, 0);
+        return;
+    }
+    Type *type = x64_decay(expr->unary.expr->type);
+    rv_gen_expr(expr->unary.expr);
+    if (is_vector_type(type)) {
+        Type *elem = type->base;
+        int32_t offset = rv_alloc_slot(type_sizeof(type), type_alignof(type));
+        rv_mv(RV_T4, RV_A0);
+        for (size_t i = 0; i < type->num_elems; i++) {
+            int32_t lane = (int32_t)(i * type_sizeof(elem));
+            rv_load(elem, RV_T4, lane);
+            rv_gen_unary_op(op, elem);
+            rv_store(elem, RV_S0, offset + lane);
+        }
+        rv_add_imm(RV_A0, RV_S0, offset);
+    } else if (op == TOKEN_NOT) {
+        rv_gen_convert(type, type_bool);
+        rv_alu_imm(RV_XORI, RV_A0, RV_A0, 1);
+    } else {
+        rv_gen_convert(type, expr->type);
+        rv_gen_unary_op(op, expr->type);
+    }
+}
+
+void rv_gen_expr_ternary(Expr *expr) {
+    int else_label = rv_new_label(), done = rv_new_label();
+    rv_gen_cond_jump(expr->ternary.cond, false, else_label);
+    rv_gen_expr(expr->ternary.then_expr);
+    rv_gen_convert(expr->ternary.then_expr->type, expr->type);
+    rv_jmp(done);
+    rv_bind_label(else_label);
+    rv_gen_expr(expr->ternary.else_expr);
+    rv_gen_convert(expr->ternary.else_expr->type, expr->type);
+    rv_bind_label(done);
+}
+
+// Calls
+
+void rv_gen_builtin_call(Expr *expr);
+void rv_gen_conversion_call(Expr *expr);
+
+void rv_gen_folded_call(Expr *expr) {
+    Type *type = unqualify_type(expr->type);
+    rv_check_type(expr->pos, type);
+    if (x64_is_mem_type(type)) {
+        rv_sym_addr(RV_A0, rv_const_data_sym(expr->call.folded_data, type), RV_RELOC_PCREL);
+    } else {
+        rv_li(RV_A0, (long long)expr->call.folded_val);
+        rv_normalize(type);
+    }
+}
+
+size_t rv_call_site(Type *func, Expr **args, size_t num_args, void *host_func) {
+    VmCallSite *site = vm_call_site(func, args, num_args);
+    site->func = host_func;
+    buf_push(rv_call_sites, site);
+    return buf_len(rv_call_sites) - 1;
+}
+
+void *rv_host_sym(Sym *sym) {
+    void *addr = NULL;
+#ifndef _WIN32
+    addr = host_sym_addr(sym->name);
+#endif
+    if (!addr) {
+        fatal("Foreign symbol '%s' is not available to the RV64 simulator", sym->name);
+    }
+    return addr;
+}
+
+// Arguments follow the integer part of the RISC-V calling convention: a hidden result pointer for
+// aggregate returns, then one double word per argument in a0-a7 and on the stack. Aggregates are
+// passed by address and copied by the callee, like in the VM.
+// Calls to the host load the call site index into t0 and either trap with ecall or, for function
+// pointers, jump to the host address, which the simulator recognizes as lying outside the image.
+void rv_gen_call(Expr *expr) {
+    if (expr->call.folded_data) {
+        rv_gen_folded_call(expr);
+        return;
+    } else if (expr->call.builtin) {
+        rv_gen_builtin_call(expr);
+        return;
+    } else if (!expr->call.expr->type) {
+        rv_gen_conversion_call(expr);
+        return;
+    }
+    Expr *callee = expr->call.expr;
+    Type *func = unqualify_type(callee->type);
+    assert(func->kind == TYPE_FUNC);
+    Sym *direct = NULL;
+    if (callee->kind == EXPR_NAME && !rv_get_local(callee->name)) {
+        Sym *sym = sym_get(callee->name);
+        if (sym->kind == SYM_FUNC) {
+            direct = sym;
+        }
+    }
+    Type *ret_type = unqualify_type(func->func.ret);
+    bool ret_in_mem = x64_is_mem_type(ret_type);
+    int32_t ret_offset = 0;
+    if (ret_in_mem) {
+        ret_offset = rv_alloc_slot(type_sizeof(ret_type), type_alignof(ret_type));
+    }
+    if (!direct) {
+        rv_gen_expr(callee);
+        rv_push(RV_A0);
+    }
+    size_t num_args = expr->call.num_args;
+    size_t first = ret_in_mem ? 1 : 0;
+    for (size_t i = 0; i < num_args; i++) {
+        Expr *arg = expr->call.args[i];
+        Type *type = i < func->func.num_params ? x64_decay(func->func.params[i]) : x64_vararg_type(arg->type);
+        rv_check_type(arg->pos, type);
+        rv_gen_expr(arg);
+        rv_gen_convert(arg->type, type);
+        rv_push(RV_A0);
+    }
+    if (first + num_args > RV_MAX_REG_ARGS) {
+        rv_out_size = MAX(rv_out_size, (int32_t)(8 * (first + num_args - RV_MAX_REG_ARGS)));
+    }
+    for (size_t i = num_args; i-- > 0;) {
+        size_t index = first + i;
+        if (index < RV_MAX_REG_ARGS) {
+            rv_pop(RV_A0 + (int)index);
+        } else {
+            rv_pop(RV_T1);
+            rv_store_reg(RV_T1, 8, RV_SP, (int32_t)(8 * (index - RV_MAX_REG_ARGS)));
+        }
+    }
+    if (ret_in_mem) {
+        rv_add_imm(RV_A0, RV_S0, ret_offset);
+    }
+    if (direct && !is_decl_foreign(direct->decl)) {
+        rv_add_reloc(RV_TEXT, rv_pos(), RV_RELOC_CALL, rv_sym_index(direct->name), 0);
+        rv_emit(RV_RA << 7 | RV_OP_JAL);
+    } else if (direct) {
+        rv_li(RV_T0, (long long)rv_call_site(func, expr->call.args, num_args, rv_host_sym(direct)));
+        rv_ecall();
+    } else {
+        rv_pop(RV_T1);
+        rv_li(RV_T0, (long long)rv_call_site(func, expr->call.args, num_args, NULL));
+        rv_jalr(RV_RA, RV_T1, 0);
+    }
+    if (ret_in_mem) {
+        rv_add_imm(RV_A0, RV_S0, ret_offset);
+    } else if (!direct || is_decl_foreign(direct->decl)) {
+        rv_normalize(ret_type);
+    }
+}
+
+void rv_gen_conversion_call(Expr *expr) {
+    Expr *arg = expr->call.args[0];
+    Type *type = unqualify_type(expr->type);
+    rv_gen_expr(arg);
+    if (is_vector_type(type) && !is_vector_type(unqualify_type(arg->type))) {
+        rv_gen_convert(arg->type, type->base);
+        int32_t offset = rv_alloc_slot(type_sizeof(type), type_alignof(type));
+        for (size_t i = 0; i < type->num_elems; i++) {
+            rv_store(type->base, RV_S0, offset + (int32_t)(i * type_sizeof(type->base)));
+        }
+        rv_add_imm(RV_A0, RV_S0, offset);
+    } else {
+        rv_gen_convert(arg->type, type);
+    }
+}
+
+// RV64IM has no bit manipulation instructions, so these builtins expand to short loops and shift sequences
+// over the zero-extended operand in a0.
+void rv_gen_bit_builtin(BuiltinFunc kind, size_t size) {
+    int bits = 8 * (int)size;
+    switch (kind) {
+    case BUILTIN_POPCOUNT:
+        // Clears the lowest set bit until none are left.
+        rv_li(RV_A1, 0);
+        rv_emit(rv_b_imm(20) | RV_A0 << 15 | RV_BEQ << 12 | RV_OP_BRANCH);
+        rv_alu_imm(RV_ADDI, RV_T1, RV_A0, -1);
+        rv_alu(RV_AND, false, RV_A0, RV_A0, RV_T1);
+        rv_alu_imm(RV_ADDI, RV_A1, RV_A1, 1);
+        rv_emit(rv_j_imm(-16) | RV_OP_JAL);
+        rv_mv(RV_A0, RV_A1);
+        break;
+    case BUILTIN_CLZ:
+        rv_li(RV_A1, bits);
+        rv_emit(rv_b_imm(16) | RV_A0 << 15 | RV_BEQ << 12 | RV_OP_BRANCH);
+        rv_shift_imm(RV_SRL, false, RV_A0, RV_A0, 1);
+        rv_alu_imm(RV_ADDI, RV_A1, RV_A1, -1);
+        rv_emit(rv_j_imm(-12) | RV_OP_JAL);
+        rv_mv(RV_A0, RV_A1);
+        break;
+    case BUILTIN_CTZ:
+        rv_li(RV_A1, bits);
+        rv_emit(rv_b_imm(28) | RV_A0 << 15 | RV_BEQ << 12 | RV_OP_BRANCH);
+        rv_li(RV_A1, 0);
+        rv_alu_imm(RV_ANDI, RV_T1, RV_A0, 1);
+        rv_emit(rv_b_imm(16) | RV_T1 << 15 | RV_BNE << 12 | RV_OP_BRANCH);
+        rv_shift_imm(RV_SRL, false, RV_A0, RV_A0, 1);
+        rv_alu_imm(RV_ADDI, RV_A1, RV_A1, 1);
+        rv_emit(rv_j_imm(-16) | RV_OP_JAL);
+        rv_mv(RV_A0, RV_A1);
+        break;
+    case BUILTIN_BSWAP:
+        rv_li(RV_A1, 0);
+        for (int i = 0; i < (int)size; i++) {
+            rv_shift_imm(RV_SRL, false, RV_T1, RV_A0, 8*i);
+            rv_alu_imm(RV_ANDI, RV_T1, RV_T1, 0xFF);
+            rv_shift_imm(RV_SLL, false, RV_T1, RV_T1, bits - 8 - 8*i);
+            rv_alu(RV_OR, false, RV_A1, RV_A1, RV_T1);
+        }
+        rv_mv(RV_A0, RV_A1);
+        break;
+    default: {
+        // The count is in a1. Rotating by n within the low bits is x << n | x >> (-n & (bits - 1)).
+        bool is_left = kind == BUILTIN_ROTL;
+        rv_alu_imm(RV_ANDI, RV_A1, RV_A1, bits - 1);
+        rv_alu(RV_SUB, false, RV_T2, RV_ZERO, RV_A1);
+        rv_alu_imm(RV_ANDI, RV_T2, RV_T2, bits - 1);
+        rv_alu(is_left ? RV_SLL : RV_SRL, false, RV_T1, RV_A0, RV_A1);
+        rv_alu(is_left ? RV_SRL : RV_SLL, false, RV_A0, RV_A0, RV_T2);
+        rv_alu(RV_OR, false, RV_A0, RV_A0, RV_T1);
+        break;
+    }
+    }
+}
+
+void rv_gen_builtin_call(Expr *expr) {
+    Expr **args = expr->call.args;
+    if (expr->call.is_folded) {
+        rv_li(RV_A0, (long long)expr->call.folded_val);
+        rv_normalize(expr->type);
+        return;
+    }
+    switch (expr->call.builtin) {
+    case BUILTIN_POPCOUNT:
+    case BUILTIN_CLZ:
+    case BUILTIN_CTZ:
+    case BUILTIN_BSWAP:
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR: {
+        Type *type = builtin_int_type(args[0]->type);
+        rv_gen_expr(args[0]);
+        rv_gen_convert(args[0]->type, type);
+        rv_normalize(unsigned_type(type));
+        if (expr->call.builtin == BUILTIN_ROTL || expr->call.builtin == BUILTIN_ROTR) {
+            rv_gen_second(args[1], x64_decay(args[1]->type));
+        }
+        rv_gen_bit_builtin(expr->call.builtin, type_sizeof(type));
+        rv_normalize(expr->type);
+        break;
+    }
+    case BUILTIN_PREFETCH:
+        // There is no prefetch instruction in RV64IM, the address is still evaluated for its side effects.
+        rv_gen_expr(args[0]);
+        break;
+    case BUILTIN_EXPECT:
+        rv_gen_expr(args[1]);
+        rv_gen_expr(args[0]);
+        rv_gen_convert(args[0]->type, expr->type);
+        break;
+    case BUILTIN_LIKELY:
+    case BUILTIN_UNLIKELY:
+        rv_gen_expr(args[0]);
+        rv_gen_convert(args[0]->type, type_bool);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void rv_gen_const_sym(Sym *sym) {
+    if (x64_is_mem_type(sym->type)) {
+        rv_gen_global_addr(RV_A0, sym);
+    } else {
+        rv_li(RV_A0, (long long)rv_const_val(sym->type, sym->val));
+    }
+}
+
+void rv_gen_expr(Expr *expr) {
+    rv_check_type(expr->pos, expr->type);
+    switch (expr->kind) {
+    case EXPR_INT:
+        rv_li(RV_A0, (long long)expr->int_lit.val);
+        break;
+    case EXPR_STR:
+        rv_sym_addr(RV_A0, rv_str_sym(expr->str_lit.val), RV_RELOC_PCREL);
+        break;
+    case EXPR_NAME: {
+        if (rv_gen_leaf(expr, RV_A0)) {
+            break;
+        }
+        RvLocal *local = rv_get_local(expr->name);
+        if (local) {
+            rv_load(local->type, RV_S0, local->offset);
+            break;
+        }
+        Sym *sym = sym_get(expr->name);
+        assert(sym);
+        if (sym->kind == SYM_CONST) {
+            rv_gen_const_sym(sym);
+        } else {
+            rv_gen_global_addr(RV_A0, sym);
+            if (sym->kind == SYM_VAR) {
+                rv_load(sym->type, RV_A0, 0);
+            }
+        }
+        break;
+    }
+    case EXPR_CAST:
+        rv_gen_expr(expr->cast.expr);
+        rv_gen_convert(expr->cast.expr->type, expr->type);
+        break;
+    case EXPR_CALL:
+        rv_gen_call(expr);
+        break;
+    case EXPR_INDEX:
+    case EXPR_FIELD:
+    case EXPR_COMPOUND:
+        rv_gen_addr(expr);
+        rv_load(expr->type, RV_A0, 0);
+        break;
+    case EXPR_UNARY:
+        rv_gen_expr_unary(expr);
+        break;
+    case EXPR_BINARY:
+        rv_gen_expr_binary(expr);
+        break;
+    case EXPR_TERNARY:
+        rv_gen_expr_ternary(expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        rv_li(RV_A0, (long long)type_sizeof(expr->sizeof_expr->type));
+        break;
+    case EXPR_SIZEOF_TYPE:
+        rv_li(RV_A0, (long long)type_sizeof(expr->sizeof_type->type));
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void rv_gen_init(int32_t offset, Type *type, Expr *expr) {
+    type = unqualify_type(type);
+    rv_check_type(expr->pos, type);
+    if (expr->kind != EXPR_COMPOUND) {
+        rv_gen_expr(expr);
+        rv_gen_convert(expr->type, type);
+        rv_store(type, RV_S0, offset);
+        return;
+    }
+    rv_zero(RV_S0, offset, type_sizeof(type));
+    if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            rv_gen_init(offset + (int32_t)type_field.offset, type_field.type, field.init);
+            index++;
+        }
+    } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR) {
+        long long index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = x64_const_int(field.index);
+            }
+            rv_gen_init(offset + (int32_t)(index * type_sizeof(type->base)), type->base, field.init);
+            index++;
+        }
+    } else if (expr->compound.num_fields == 1) {
+        rv_gen_init(offset, type, expr->compound.fields[0].init);
+    }
+}
+
+// Statements
+
+void rv_gen_stmt(Stmt *stmt);
+
+void rv_gen_stmt_block(StmtList block) {
+    size_t num_locals = buf_len(rv_locals);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        rv_gen_stmt(block.stmts[i]);
+    }
+    rv_pop_locals(num_locals);
+}
+
+void rv_gen_return(Expr *expr) {
+    if (expr) {
+        Type *type = rv_ret_type;
+        rv_check_type(expr->pos, type);
+        rv_gen_expr(expr);
+        rv_gen_convert(expr->type, type);
+        if (x64_is_mem_type(type)) {
+            rv_load_reg(RV_A1, 8, false, RV_S0, rv_ret_ptr_offset);
+            rv_copy(RV_A1, 0, RV_A0, type_sizeof(type));
+            rv_mv(RV_A0, RV_A1);
+        }
+    }
+    rv_jmp(rv_ret_label);
+}
+
+void rv_gen_assign(Stmt *stmt) {
+    Expr *left = stmt->assign.left;
+    Type *type = unqualify_type(left->type);
+    rv_check_type(stmt->pos, type);
+    rv_gen_addr(left);
+    rv_push(RV_A0);
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        rv_gen_expr(stmt->assign.right);
+        rv_gen_convert(stmt->assign.right->type, type);
+    } else if (stmt->assign.op == TOKEN_INC || stmt->assign.op == TOKEN_DEC) {
+        rv_load(type, RV_A0, 0);
+        long long delta = is_ptr_type(type) ? (long long)x64_elem_size(type) : 1;
+        rv_add_imm(RV_A0, RV_A0, stmt->assign.op == TOKEN_INC ? delta : -delta);
+        rv_normalize(type);
+    } else {
+        rv_load(type, RV_A0, 0);
+        Type *result = rv_gen_binary_rest(assign_token_to_binary_token[stmt->assign.op], type, stmt->assign.right);
+        rv_gen_convert(result, type);
+    }
+    rv_pop(RV_A1);
+    rv_store(type, RV_A1, 0);
+}
+
+void rv_gen_init_stmt(Stmt *stmt) {
+    Type *type;
+    if (stmt->init.type) {
+        type = stmt->init.type->type;
+        if (is_incomplete_array_type(type) && stmt->init.expr) {
+            type = stmt->init.expr->type;
+        }
+    } else {
+        type = stmt->init.expr->type;
+    }
+    type = unqualify_type(type);
+    rv_check_type(stmt->pos, type);
+    int32_t offset = rv_alloc_slot(type_sizeof(type), type_alignof(type));
+    if (stmt->init.expr) {
+        rv_gen_init(offset, type, stmt->init.expr);
+    }
+    rv_push_local(stmt->init.name, type, offset);
+}
+
+void rv_gen_switch(Stmt *stmt) {
+    Type *type = x64_decay(stmt->switch_stmt.expr->type);
+    if (!is_integer_type(type) && !is_ptr_type(type)) {
+        fatal_error(stmt->pos, "Switch on non-integer types is not supported by the RV64 backend");
+    }
+    if (stmt->switch_stmt.str_switch) {
+        fatal_error(stmt->pos, "String switches are not supported by the RV64 backend");
+    }
+    rv_gen_expr(stmt->switch_stmt.expr);
+    int end = rv_new_label(), default_label = end;
+    int *labels = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        buf_push(labels, rv_new_label());
+    }
+    if (stmt->switch_stmt.ranges && type->kind == TYPE_CHAR && !rv_is_signed(type)) {
+        // Plain char is unsigned on this host, but case ranges are ordered as signed chars.
+        rv_shift_imm(RV_SLL, false, RV_A0, RV_A0, 56);
+        rv_shift_imm(RV_SRA, false, RV_A0, RV_A0, 56);
+    }
+    // Constant cases are tested as ranges: value - lo <= hi - lo, unsigned.
+    for (size_t i = 0; i < stmt->switch_stmt.num_ranges; i++) {
+        SwitchRange range = stmt->switch_stmt.ranges[i];
+        rv_li(RV_A1, (long long)switch_key_value(type, range.lo));
+        rv_alu(RV_SUB, false, RV_A1, RV_A0, RV_A1);
+        rv_li(RV_T0, (long long)(range.hi - range.lo));
+        rv_branch(RV_BGEU, RV_T0, RV_A1, labels[range.case_index]);
+    }
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        int label = labels[i];
+        for (size_t j = 0; j < switch_case.num_exprs && !stmt->switch_stmt.ranges; j++) {
+            Operand operand = resolve_const_expr(switch_case.exprs[j]);
+            cast_operand(&operand, type);
+            rv_li(RV_A1, (long long)rv_const_val(operand.type, operand.val));
+            rv_branch(RV_BEQ, RV_A0, RV_A1, label);
+        }
+        if (switch_case.is_default) {
+            default_label = label;
+        }
+    }
+    rv_jmp(default_label);
+    buf_push(rv_break_labels, end);
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        rv_bind_label(labels[i]);
+        rv_gen_stmt_block(stmt->switch_stmt.cases[i].block);
+        rv_jmp(end);
+    }
+    buf__hdr(rv_break_labels)->len--;
+    rv_bind_label(end);
+    buf_free(labels);
+}
+
+void rv_gen_stmt(Stmt *stmt) {
+    assert(rv_depth == 0);
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        rv_gen_return(stmt->expr);
+        break;
+    case STMT_BREAK:
+        rv_jmp(rv_break_labels[buf_len(rv_break_labels) - 1]);
+        break;
+    case STMT_CONTINUE:
+        rv_jmp(rv_continue_labels[buf_len(rv_continue_labels) - 1]);
+        break;
+    case STMT_BLOCK:
+        rv_gen_stmt_block(stmt->block);
+        break;
+    case STMT_IF: {
+        int end = rv_new_label();
+        int next = rv_new_label();
+        rv_gen_cond_jump(stmt->if_stmt.cond, false, next);
+        rv_gen_stmt_block(stmt->if_stmt.then_block);
+        rv_jmp(end);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            ElseIf elseif = stmt->if_stmt.elseifs[i];
+            rv_bind_label(next);
+            next = rv_new_label();
+            rv_gen_cond_jump(elseif.cond, false, next);
+            rv_gen_stmt_block(elseif.block);
+            rv_jmp(end);
+        }
+        rv_bind_label(next);
+        rv_gen_stmt_block(stmt->if_stmt.else_block);
+        rv_bind_label(end);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE: {
+        int top = rv_new_label(), cont = rv_new_label(), end = rv_new_label();
+        buf_push(rv_break_labels, end);
+        buf_push(rv_continue_labels, cont);
+        if (stmt->kind == STMT_WHILE) {
+            rv_jmp(cont);
+        }
+        rv_bind_label(top);
+        rv_gen_stmt_block(stmt->while_stmt.block);
+        rv_bind_label(cont);
+        rv_gen_cond_jump(stmt->while_stmt.cond, true, top);
+        rv_bind_label(end);
+        buf__hdr(rv_break_labels)->len--;
+        buf__hdr(rv_continue_labels)->len--;
+        break;
+    }
+    case STMT_FOR: {
+        size_t num_locals = buf_len(rv_locals);
+        int top = rv_new_label(), cont = rv_new_label(), end = rv_new_label();
+        if (stmt->for_stmt.init) {
+            rv_gen_stmt(stmt->for_stmt.init);
+        }
+        buf_push(rv_break_labels, end);
+        buf_push(rv_continue_labels, cont);
+        rv_bind_label(top);
+        if (stmt->for_stmt.cond) {
+            rv_gen_cond_jump(stmt->for_stmt.cond, false, end);
+        }
+        rv_gen_stmt_block(stmt->for_stmt.block);
+        rv_bind_label(cont);
+        if (stmt->for_stmt.next) {
+            rv_gen_stmt(stmt->for_stmt.next);
+        }
+        rv_jmp(top);
+        rv_bind_label(end);
+        buf__hdr(rv_break_labels)->len--;
+        buf__hdr(rv_continue_labels)->len--;
+        rv_pop_locals(num_locals);
+        break;
+    }
+    case STMT_SWITCH:
+        rv_gen_switch(stmt);
+        break;
+    case STMT_ASSIGN:
+        rv_gen_assign(stmt);
+        break;
+    case STMT_INIT:
+        rv_gen_init_stmt(stmt);
+        break;
+    case STMT_EXPR:
+        rv_gen_expr(stmt->expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// The frame pointer s0 holds the incoming sp, with ra and the caller's s0 saved just below it and
+// locals and spill slots below those. Outgoing stack arguments sit at the bottom of the frame.
+void rv_gen_prologue(void) {
+    if (rv_big_frame) {
+        rv_alu_imm(RV_ADDI, RV_SP, RV_SP, -RV_SAVE_SIZE);
+        rv_store_reg(RV_RA, 8, RV_SP, 8);
+        rv_store_reg(RV_S0, 8, RV_SP, 0);
+        rv_alu_imm(RV_ADDI, RV_S0, RV_SP, RV_SAVE_SIZE);
+        rv_op_u(RV_OP_LUI, RV_T6, 0);
+        rv_op_i(RV_OP_IMM32, RV_ADDI, RV_T6, RV_T6, 0);
+        rv_alu(RV_SUB, false, RV_SP, RV_SP, RV_T6);
+    } else {
+        rv_emit(0);
+        rv_emit(0);
+        rv_emit(0);
+        rv_emit(0);
+    }
+}
+
+void rv_patch_prologue(size_t start, int32_t frame) {
+    uint32_t *save = rv_text;
+    size_t len = buf_len(rv_text);
+    buf__hdr(rv_text)->len = start / 4;
+    if (rv_big_frame) {
+        buf__hdr(rv_text)->len += 4;
+        int32_t size = frame - RV_SAVE_SIZE;
+        int32_t lo = rv_sext12(size);
+        rv_op_u(RV_OP_LUI, RV_T6, (uint32_t)((size - lo) >> 12));
+        rv_op_i(RV_OP_IMM32, RV_ADDI, RV_T6, RV_T6, lo);
+    } else {
+        rv_alu_imm(RV_ADDI, RV_SP, RV_SP, -frame);
+        rv_store_reg(RV_RA, 8, RV_SP, frame - 8);
+        rv_store_reg(RV_S0, 8, RV_SP, frame - 16);
+        rv_alu_imm(RV_ADDI, RV_S0, RV_SP, frame);
+    }
+    assert(rv_text == save);
+    buf__hdr(rv_text)->len = len;
+}
+
+// Generates the function once; returns false if it has to be generated again with longer encodings.
+bool rv_gen_func_body(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    size_t start = rv_pos();
+    buf_clear(rv_locals);
+    buf_clear(rv_spill_slots);
+    buf_clear(rv_labels);
+    buf_clear(rv_fixups);
+    rv_depth = 0;
+    rv_frame_size = RV_SAVE_SIZE;
+    rv_out_size = 0;
+    rv_ret_type = type->func.ret;
+    rv_ret_label = rv_new_label();
+    rv_gen_prologue();
+    int index = 0;
+    if (x64_is_mem_type(rv_ret_type)) {
+        rv_ret_ptr_offset = rv_alloc_slot(8, 8);
+        rv_store_reg(RV_A0, 8, RV_S0, rv_ret_ptr_offset);
+        index++;
+    }
+    for (size_t i = 0; i < type->func.num_params; i++, index++) {
+        Type *param_type = x64_decay(type->func.params[i]);
+        rv_check_type(decl->pos, param_type);
+        size_t size = type_sizeof(param_type);
+        int32_t offset;
+        if (index < RV_MAX_REG_ARGS) {
+            offset = rv_alloc_slot(size, type_alignof(param_type));
+            if (x64_is_mem_type(param_type)) {
+                rv_copy(RV_S0, offset, RV_A0 + index, size);
+            } else {
+                rv_store_reg(RV_A0 + index, size, RV_S0, offset);
+            }
+        } else {
+            int32_t stack_offset = 8 * (index - RV_MAX_REG_ARGS);
+            if (x64_is_mem_type(param_type)) {
+                offset = rv_alloc_slot(size, type_alignof(param_type));
+                rv_load_reg(RV_T5, 8, false, RV_S0, stack_offset);
+                rv_copy(RV_S0, offset, RV_T5, size);
+            } else {
+                offset = stack_offset;
+            }
+        }
+        rv_push_local(decl->func.params[i].name, param_type, offset);
+    }
+    rv_gen_stmt_block(decl->func.block);
+    rv_bind_label(rv_ret_label);
+    rv_load_reg(RV_RA, 8, false, RV_S0, -8);
+    rv_mv(RV_SP, RV_S0);
+    rv_load_reg(RV_S0, 8, false, RV_SP, -16);
+    rv_jalr(RV_ZERO, RV_RA, 0);
+    int32_t frame = (int32_t)ALIGN_UP(rv_frame_size + rv_out_size, 16);
+    if (!rv_big_frame && frame >= 2048) {
+        rv_big_frame = true;
+        return false;
+    }
+    if (!rv_resolve_fixups()) {
+        rv_far_branches = true;
+        return false;
+    }
+    rv_patch_prologue(start, frame);
+    return true;
+}
+
+void rv_gen_func(Sym *sym) {
+    size_t start = rv_pos();
+    size_t num_relocs = buf_len(rv_relocs);
+    rv_big_frame = false;
+    rv_far_branches = false;
+    while (!rv_gen_func_body(sym)) {
+        buf__hdr(rv_text)->len = start / 4;
+        if (rv_relocs) {
+            buf__hdr(rv_relocs)->len = num_relocs;
+        }
+    }
+    rv_define_sym(sym->name, RV_TEXT, start);
+}
+
+// Static data
+
+bool rv_static_addr(Expr *expr, size_t *sym, long long *addend);
+
+// Finds the symbol and byte offset of a global lvalue built from names, constant indexes and fields, for
+// initializers like &garr[2] or &gs.field. SoA elements aren't contiguous, so they have no single address.
+bool rv_static_lvalue(Expr *expr, size_t *sym, long long *addend) {
+    switch (expr->kind) {
+    case EXPR_NAME: {
+        Sym *name_sym = sym_get(expr->name);
+        if (name_sym && (name_sym->kind == SYM_VAR || name_sym->kind == SYM_FUNC)) {
+            *sym = rv_sym_index(expr->name);
+            return true;
+        }
+        return false;
+    }
+    case EXPR_INDEX: {
+        Type *type = unqualify_type(expr->index.expr->type);
+        if (is_soa_array_type(type)) {
+            return false;
+        }
+        if (is_array_type(type)) {
+            if (!rv_static_lvalue(expr->index.expr, sym, addend)) {
+                return false;
+            }
+        } else if (!is_ptr_type(type) || !rv_static_addr(expr->index.expr, sym, addend)) {
+            return false;
+        }
+        *addend += x64_const_int(expr->index.index) * (long long)type_sizeof(type->base);
+        return true;
+    }
+    case EXPR_FIELD: {
+        Type *type = unqualify_type(expr->field.expr->type);
+        if ((type->kind != TYPE_STRUCT && type->kind != TYPE_UNION) || !rv_static_lvalue(expr->field.expr, sym, addend)) {
+            return false;
+        }
+        *addend += type->aggregate.fields[aggregate_field_index(type, expr->field.name)].offset;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Finds the relocation for a pointer initializer: a symbol plus a constant byte offset.
+bool rv_static_addr(Expr *expr, size_t *sym, long long *addend) {
+    switch (expr->kind) {
+    case EXPR_STR:
+        *sym = rv_str_sym(expr->str_lit.val);
+        return true;
+    case EXPR_CAST:
+        return rv_static_addr(expr->cast.expr, sym, addend);
+    case EXPR_UNARY:
+        return expr->unary.op == TOKEN_AND && rv_static_lvalue(expr->unary.expr, sym, addend);
+    case EXPR_NAME: {
+        Sym *name_sym = sym_get(expr->name);
+        if (name_sym && (name_sym->kind == SYM_FUNC || (name_sym->kind == SYM_VAR && is_array_type(unqualify_type(name_sym->type))))) {
+            *sym = rv_sym_index(expr->name);
+            return true;
+        }
+        return false;
+    }
+    case EXPR_BINARY: {
+        // Pointer plus or minus an integer constant, with the pointer on either side of a +.
+        TokenKind op = expr->binary.op;
+        Expr *base = expr->binary.left;
+        Expr *offset = expr->binary.right;
+        if (op == TOKEN_ADD && !is_ptr_type(x64_decay(base->type))) {
+            base = expr->binary.right;
+            offset = expr->binary.left;
+        }
+        Type *type = x64_decay(base->type);
+        if ((op != TOKEN_ADD && op != TOKEN_SUB) || !is_ptr_type(type) || !is_integer_type(unqualify_type(offset->type))) {
+            return false;
+        }
+        if (!rv_static_addr(base, sym, addend)) {
+            return false;
+        }
+        long long delta = x64_const_int(offset) * (long long)type_sizeof(type->base);
+        *addend += op == TOKEN_SUB ? -delta : delta;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void rv_gen_static(size_t offset, Type *type, Expr *expr) {
+    type = unqualify_type(type);
+    rv_check_type(expr->pos, type);
+    if (expr->kind == EXPR_COMPOUND) {
+        if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) {
+            int index = 0;
+            for (size_t i = 0; i < expr->compound.num_fields; i++) {
+                CompoundField field = expr->compound.fields[i];
+                if (field.kind == FIELD_NAME) {
+                    index = aggregate_field_index(type, field.name);
+                }
+                TypeField type_field = type->aggregate.fields[index];
+                rv_gen_static(offset + type_field.offset, type_field.type, field.init);
+                index++;
+            }
+        } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR) {
+            long long index = 0;
+            for (size_t i = 0; i < expr->compound.num_fields; i++) {
+                CompoundField field = expr->compound.fields[i];
+                if (field.kind == FIELD_INDEX) {
+                    index = x64_const_int(field.index);
+                }
+                rv_gen_static(offset + index * type_sizeof(type->base), type->base, field.init);
+                index++;
+            }
+        } else if (expr->compound.num_fields == 1) {
+            rv_gen_static(offset, type, expr->compound.fields[0].init);
+        }
+        return;
+    }
+    size_t sym;
+    long long addend = 0;
+    if ((is_ptr_type(type) || type->kind == TYPE_FUNC) && rv_static_addr(expr, &sym, &addend)) {
+        rv_add_reloc(RV_DATA, offset, RV_RELOC_ABS64, sym, addend);
+    } else if (is_ptr_type(type) && expr->kind == EXPR_UNARY && expr->unary.op == TOKEN_AND) {
+        fatal_error(expr->pos, "Address initializer is not supported by the RV64 backend");
+    } else if (is_integer_type(type) || is_ptr_type(type)) {
+        Operand operand = resolve_const_expr(expr);
+        cast_operand(&operand, type);
+        unsigned long long val = rv_const_val(operand.type, operand.val);
+        memcpy(rv_data + offset, &val, type_sizeof(type));
+    } else {
+        fatal_error(expr->pos, "Initializer is not supported by the RV64 backend");
+    }
+}
+
+void rv_gen_global_var(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    size_t align = type_alignof(type);
+    Note *align_note = get_decl_note(decl, align_name);
+    if (align_note) {
+        align = MAX(align, (size_t)x64_const_int(align_note->args[0]));
+    }
+    size_t offset = rv_data_alloc(type_sizeof(type), align);
+    if (decl->var.expr) {
+        rv_gen_static(offset, type, decl->var.expr);
+    }
+    rv_define_sym(sym->name, RV_DATA, offset);
+}
+
+void rv_gen_const_data(Sym *sym) {
+    size_t size = type_sizeof(sym->type);
+    size_t offset = rv_data_alloc(size, type_alignof(sym->type));
+    memcpy(rv_data + offset, sym->decl->const_decl.expr->call.folded_data, size);
+    rv_define_sym(sym->name, RV_DATA, offset);
+}
+
+void rv_reset(void) {
+    buf_free(rv_text);
+    buf_free(rv_data);
+    rv_data_align = 16;
+    buf_free(rv_syms);
+    buf_free(rv_relocs);
+    buf_free(rv_call_sites);
+    map_free(&rv_sym_map);
+    map_free(&rv_str_map);
+}
+
+void rv_gen_all(void) {
+    rv_reset();
+    for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
+        Sym *sym = *it;
+        if (sym->decl && sym->kind == SYM_VAR && !is_decl_foreign(sym->decl)) {
+            rv_gen_global_var(sym);
+        } else if (sym->decl && sym->kind == SYM_CONST && !is_scalar_type(sym->type)) {
+            rv_gen_const_data(sym);
+        }
+    }
+    for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
+        Sym *sym = *it;
+        if (sym->decl && sym->decl->kind == DECL_FUNC && !is_decl_foreign(sym->decl) && sym->state == SYM_RESOLVED) {
+            rv_gen_func(sym);
+        }
+    }
+}
@@ -0,0 +1,483 @@
+// Links the output of the RV64 backend into host memory and interprets it as RV64IM code.
+// The simulator counts executed instructions and estimates cycles for a simple single-issue
+// in-order pipeline without branch prediction: taken branches and jumps flush the fetch stages,
+// a load followed by an instruction that reads its result stalls once, and multiplies and
+// divides occupy an iterative unit for several cycles.
+// Calls to the host trap with ecall, or jump to an address outside the image for function pointers,
+// and go through the VM's foreign call trampoline.
+
+enum {
+    RV_STACK_SIZE = 8 << 20,
+    RV_MAX_HOST_ARGS = 32,
+    RV_BRANCH_PENALTY = 2,
+    RV_LOAD_USE_PENALTY = 1,
+    RV_MUL_CYCLES = 3,
+    RV_DIV_CYCLES = 34,
+};
+
+typedef struct RvImage {
+    char *mem;
+    char *text;
+    char *data;
+    void **got;
+    size_t text_size;
+} RvImage;
+
+typedef struct RvStats {
+    uint64_t instrs;
+    uint64_t cycles;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t branches;
+    uint64_t taken;
+    uint64_t muls;
+    uint64_t divs;
+    uint64_t host_calls;
+} RvStats;
+
+RvStats rv_stats;
+
+void *rv_link_sym_addr(RvImage *image, size_t index) {
+    RvSym *sym = rv_syms + index;
+    if (sym->is_defined) {
+        return (sym->section == RV_TEXT ? image->text : image->data) + sym->offset;
+    }
+    void *addr = NULL;
+#ifndef _WIN32
+    addr = host_sym_addr(sym->name);
+#endif
+    if (!addr) {
+        fatal("Unresolved foreign symbol '%s'", sym->name);
+    }
+    return addr;
+}
+
+void rv_link(RvImage *image) {
+    size_t num_syms = buf_len(rv_syms);
+    image->text_size = rv_pos();
+    size_t data_offset = ALIGN_UP(image->text_size, rv_data_align);
+    size_t got_offset = ALIGN_UP(data_offset + buf_len(rv_data), sizeof(void *));
+    size_t size = got_offset + num_syms * sizeof(void *);
+    image->mem = xcalloc(1, size + rv_data_align);
+    image->text = ALIGN_UP_PTR(image->mem, rv_data_align);
+    image->data = image->text + data_offset;
+    image->got = (void **)(image->text + got_offset);
+    memcpy(image->text, rv_text, image->text_size);
+    if (rv_data) {
+        memcpy(image->data, rv_data, buf_len(rv_data));
+    }
+    for (size_t i = 0; i < num_syms; i++) {
+        image->got[i] = rv_link_sym_addr(image, i);
+    }
+    for (RvReloc *it = rv_relocs; it != buf_end(rv_relocs); it++) {
+        char *ptr = (it->section == RV_TEXT ? image->text : image->data) + it->offset;
+        char *target = it->kind == RV_RELOC_GOT ? (char *)(image->got + it->sym) : image->got[it->sym];
+        long long delta = target - ptr;
+        uint32_t instr[2];
+        switch (it->kind) {
+        case RV_RELOC_ABS64: {
+            uint64_t val = (uint64_t)(uintptr_t)target + (uint64_t)it->addend;
+            memcpy(ptr, &val, sizeof(val));
+            break;
+        }
+        case RV_RELOC_PCREL:
+        case RV_RELOC_GOT: {
+            if (delta < INT32_MIN || delta > INT32_MAX - 0x800) {
+                fatal("RV64 pc-relative relocation out of range");
+            }
+            int32_t lo = rv_sext12(delta);
+            memcpy(instr, ptr, sizeof(instr));
+            instr[0] |= (uint32_t)((delta - lo) >> 12) << 12;
+            instr[1] |= (uint32_t)(lo & 0xFFF) << 20;
+            memcpy(ptr, instr, sizeof(instr));
+            break;
+        }
+        case RV_RELOC_CALL:
+            if (delta < -(1 << 20) || delta >= (1 << 20)) {
+                fatal("RV64 call out of range");
+            }
+            memcpy(instr, ptr, sizeof(*instr));
+            instr[0] |= rv_j_imm((int32_t)delta);
+            memcpy(ptr, instr, sizeof(*instr));
+            break;
+        default:
+            assert(0);
+            break;
+        }
+    }
+}
+
+// Arguments are read from a0-a7 and the stack in the order the code generator assigned them,
+// which is also the order the VM passes them in.
+void rv_host_call(uint64_t *x, void *func) {
+    uint64_t index = x[RV_T0];
+    if (index >= buf_len(rv_call_sites)) {
+        fatal("Invalid RV64 host call site %" PRIu64, index);
+    }
+    VmCallSite *site = rv_call_sites[index];
+    size_t num_args = site->num_args + (x64_is_mem_type(site->ret_type) ? 1 : 0);
+    if (num_args > RV_MAX_HOST_ARGS) {
+        fatal("Too many arguments in RV64 host call");
+    }
+    VmValue args[RV_MAX_HOST_ARGS + 1] = {0};
+    for (size_t i = 0; i < num_args; i++) {
+        if (i < RV_MAX_REG_ARGS) {
+            args[i].u = x[RV_A0 + i];
+        } else {
+            memcpy(&args[i], (char *)(uintptr_t)x[RV_SP] + 8*(i - RV_MAX_REG_ARGS), 8);
+        }
+    }
+    vm_call_foreign(site, func ? func : site->func, args);
+    x[RV_A0] = args[0].u;
+    rv_stats.host_calls++;
+}
+
+void rv_illegal(uint64_t pc, uint32_t instr) {
+    fatal("Illegal RV64 instruction %08x at %" PRIx64, instr, pc);
+}
+
+uint64_t rv_mulhu(uint64_t a, uint64_t b) {
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32, b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo, lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    return hi_hi + (hi_lo >> 32) + (cross >> 32);
+}
+
+uint64_t rv_mulh(int64_t a, int64_t b) {
+    uint64_t hi = rv_mulhu((uint64_t)a, (uint64_t)b);
+    if (a < 0) {
+        hi -= (uint64_t)b;
+    }
+    if (b < 0) {
+        hi -= (uint64_t)a;
+    }
+    return hi;
+}
+
+// Division follows the ISA: dividing by zero gives all ones (or the dividend for remainders)
+// and the overflowing signed case gives the dividend (or zero), rather than trapping.
+uint64_t rv_div_op(uint32_t funct3, uint64_t a, uint64_t b, bool w) {
+    if (w) {
+        int32_t sa = (int32_t)a, sb = (int32_t)b;
+        uint32_t ua = (uint32_t)a, ub = (uint32_t)b;
+        int32_t result;
+        switch (funct3) {
+        case 4:
+            result = sb == 0 ? -1 : (sa == INT32_MIN && sb == -1) ? sa : sa / sb;
+            break;
+        case 5:
+            result = (int32_t)(ub == 0 ? UINT32_MAX : ua / ub);
+            break;
+        case 6:
+            result = sb == 0 ? sa : (sa == INT32_MIN && sb == -1) ? 0 : sa % sb;
+            break;
+        default:
+            result = (int32_t)(ub == 0 ? ua : ua % ub);
+            break;
+        }
+        return (uint64_t)(int64_t)result;
+    }
+    int64_t sa = (int64_t)a, sb = (int64_t)b;
+    switch (funct3) {
+    case 4:
+        return sb == 0 ? UINT64_MAX : (sa == INT64_MIN && sb == -1) ? a : (uint64_t)(sa / sb);
+    case 5:
+        return b == 0 ? UINT64_MAX : a / b;
+    case 6:
+        return sb == 0 ? a : (sa == INT64_MIN && sb == -1) ? 0 : (uint64_t)(sa % sb);
+    default:
+        return b == 0 ? a : a % b;
+    }
+}
+
+uint64_t rv_alu_result(uint32_t instr, uint64_t a, uint64_t b, bool w) {
+    uint32_t funct3 = (instr >> 12) & 7;
+    uint32_t funct7 = instr >> 25;
+    if (funct7 == 1) {
+        if (funct3 >= 4) {
+            rv_stats.divs++;
+            rv_stats.cycles += RV_DIV_CYCLES - 1;
+            return rv_div_op(funct3, a, b, w);
+        }
+        rv_stats.muls++;
+        rv_stats.cycles += RV_MUL_CYCLES - 1;
+        switch (funct3) {
+        case 0:
+            return w ? (uint64_t)(int64_t)(int32_t)(uint32_t)(a * b) : a * b;
+        case 1:
+            return rv_mulh((int64_t)a, (int64_t)b);
+        case 2:
+            return rv_mulh((int64_t)a, (int64_t)b) + ((int64_t)b < 0 ? a : 0);
+        default:
+            return rv_mulhu(a, b);
+        }
+    }
+    bool alt = funct7 == 0x20;
+    int shamt = (int)(b & (w ? 31 : 63));
+    uint64_t result;
+    switch (funct3) {
+    case 0:
+        result = alt ? a - b : a + b;
+        break;
+    case 1:
+        result = a << shamt;
+        break;
+    case 2:
+        return (int64_t)a < (int64_t)b;
+    case 3:
+        return a < b;
+    case 4:
+        return a ^ b;
+    case 5:
+        if (w) {
+            result = alt ? (uint64_t)((int32_t)a >> shamt) : (uint32_t)a >> shamt;
+        } else {
+            result = alt ? (uint64_t)((int64_t)a >> shamt) : a >> shamt;
+        }
+        break;
+    case 6:
+        return a | b;
+    default:
+        return a & b;
+    }
+    return w ? (uint64_t)(int64_t)(int32_t)result : result;
+}
+
+// Runs from the entry point until it returns to address zero, which the simulator puts in ra.
+uint64_t rv_exec(RvImage *image, char *entry, uint64_t *x) {
+    char *text_end = image->text + image->text_size;
+    char *pc = entry;
+    int load_rd = 0;
+    for (;;) {
+        uint32_t instr;
+        memcpy(&instr, pc, sizeof(instr));
+        rv_stats.instrs++;
+        rv_stats.cycles++;
+        uint32_t opcode = instr & 0x7F;
+        int rd = (instr >> 7) & 31;
+        int rs1 = (instr >> 15) & 31;
+        int rs2 = (instr >> 20) & 31;
+        uint32_t funct3 = (instr >> 12) & 7;
+        int64_t imm_i = (int32_t)instr >> 20;
+        char *next = pc + 4;
+        if (load_rd) {
+            bool reads_rs2 = opcode == RV_OP_STORE || opcode == RV_OP_BRANCH || opcode == RV_OP_REG || opcode == RV_OP_REG32;
+            bool reads_rs1 = reads_rs2 || opcode == RV_OP_LOAD || opcode == RV_OP_IMM || opcode == RV_OP_IMM32 || opcode == RV_OP_JALR;
+            if ((reads_rs1 && rs1 == load_rd) || (reads_rs2 && rs2 == load_rd)) {
+                rv_stats.cycles += RV_LOAD_USE_PENALTY;
+            }
+            load_rd = 0;
+        }
+        switch (opcode) {
+        case RV_OP_LUI:
+            x[rd] = (uint64_t)(int64_t)(int32_t)(instr & 0xFFFFF000);
+            break;
+        case RV_OP_AUIPC:
+            x[rd] = (uint64_t)(uintptr_t)pc + (uint64_t)(int64_t)(int32_t)(instr & 0xFFFFF000);
+            break;
+        case RV_OP_JAL: {
+            uint32_t bits = (instr >> 31) << 20 | ((instr >> 21) & 0x3FF) << 1 | ((instr >> 20) & 1) << 11 | ((instr >> 12) & 0xFF) << 12;
+            int32_t imm = (int32_t)(bits << 11) >> 11;
+            x[rd] = (uint64_t)(uintptr_t)next;
+            next = pc + imm;
+            rv_stats.cycles += RV_BRANCH_PENALTY;
+            break;
+        }
+        case RV_OP_JALR: {
+            char *target = (char *)(uintptr_t)((x[rs1] + (uint64_t)imm_i) & ~(uint64_t)1);
+            x[rd] = (uint64_t)(uintptr_t)next;
+            x[0] = 0;
+            rv_stats.cycles += RV_BRANCH_PENALTY;
+            if (image->text <= target && target < text_end) {
+                next = target;
+            } else if (!target) {
+                return x[RV_A0];
+            } else {
+                rv_host_call(x, target);
+                next = (char *)(uintptr_t)x[RV_RA];
+            }
+            break;
+        }
+        case RV_OP_BRANCH: {
+            uint32_t bits = (instr >> 31) << 12 | ((instr >> 25) & 0x3F) << 5 | ((instr >> 8) & 0xF) << 1 | ((instr >> 7) & 1) << 11;
+            int32_t imm = (int32_t)(bits << 19) >> 19;
+            uint64_t a = x[rs1], b = x[rs2];
+            bool taken;
+            switch (funct3) {
+            case RV_BEQ:
+                taken = a == b;
+                break;
+            case RV_BNE:
+                taken = a != b;
+                break;
+            case RV_BLT:
+                taken = (int64_t)a < (int64_t)b;
+                break;
+            case RV_BGE:
+                taken = (int64_t)a >= (int64_t)b;
+                break;
+            case RV_BLTU:
+                taken = a < b;
+                break;
+            case RV_BGEU:
+                taken = a >= b;
+                break;
+            default:
+                rv_illegal((uint64_t)(uintptr_t)pc, instr);
+                return 0;
+            }
+            rv_stats.branches++;
+            if (taken) {
+                rv_stats.taken++;
+                rv_stats.cycles += RV_BRANCH_PENALTY;
+                next = pc + imm;
+            }
+            break;
+        }
+        case RV_OP_LOAD: {
+            char *addr = (char *)(uintptr_t)(x[rs1] + (uint64_t)imm_i);
+            switch (funct3) {
+            case 0: {
+                int8_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = (uint64_t)(int64_t)val;
+                break;
+            }
+            case 1: {
+                int16_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = (uint64_t)(int64_t)val;
+                break;
+            }
+            case 2: {
+                int32_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = (uint64_t)(int64_t)val;
+                break;
+            }
+            case 3:
+                memcpy(&x[rd], addr, sizeof(uint64_t));
+                break;
+            case 4: {
+                uint8_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = val;
+                break;
+            }
+            case 5: {
+                uint16_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = val;
+                break;
+            }
+            case 6: {
+                uint32_t val;
+                memcpy(&val, addr, sizeof(val));
+                x[rd] = val;
+                break;
+            }
+            default:
+                rv_illegal((uint64_t)(uintptr_t)pc, instr);
+                return 0;
+            }
+            rv_stats.loads++;
+            load_rd = rd;
+            break;
+        }
+        case RV_OP_STORE: {
+            int64_t imm = (int64_t)((int32_t)(instr & 0xFE000000) >> 20) | ((instr >> 7) & 0x1F);
+            char *addr = (char *)(uintptr_t)(x[rs1] + (uint64_t)imm);
+            if (funct3 > 3) {
+                rv_illegal((uint64_t)(uintptr_t)pc, instr);
+            }
+            memcpy(addr, &x[rs2], (size_t)1 << funct3);
+            rv_stats.stores++;
+            break;
+        }
+        case RV_OP_IMM:
+        case RV_OP_IMM32: {
+            bool w = opcode == RV_OP_IMM32;
+            uint64_t a = x[rs1];
+            uint64_t b = (uint64_t)imm_i;
+            int shamt = (int)(imm_i & (w ? 31 : 63));
+            uint64_t result;
+            switch (funct3) {
+            case RV_ADDI:
+                result = a + b;
+                break;
+            case RV_SLLI:
+                result = a << shamt;
+                break;
+            case RV_SLTI:
+                result = (int64_t)a < imm_i;
+                break;
+            case RV_SLTIU:
+                result = a < b;
+                break;
+            case RV_XORI:
+                result = a ^ b;
+                break;
+            case RV_SRLI:
+                if (w) {
+                    result = imm_i & 0x400 ? (uint64_t)((int32_t)a >> shamt) : (uint32_t)a >> shamt;
+                } else {
+                    result = imm_i & 0x400 ? (uint64_t)((int64_t)a >> shamt) : a >> shamt;
+                }
+                break;
+            case RV_ORI:
+                result = a | b;
+                break;
+            default:
+                result = a & b;
+                break;
+            }
+            x[rd] = w ? (uint64_t)(int64_t)(int32_t)result : result;
+            break;
+        }
+        case RV_OP_REG:
+        case RV_OP_REG32:
+            x[rd] = rv_alu_result(instr, x[rs1], x[rs2], opcode == RV_OP_REG32);
+            break;
+        case RV_OP_SYSTEM:
+            if (instr != RV_OP_SYSTEM) {
+                rv_illegal((uint64_t)(uintptr_t)pc, instr);
+            }
+            rv_host_call(x, NULL);
+            break;
+        default:
+            rv_illegal((uint64_t)(uintptr_t)pc, instr);
+            return 0;
+        }
+        x[0] = 0;
+        pc = next;
+    }
+}
+
+void rv_print_stats(void) {
+    RvStats *s = &rv_stats;
+    fprintf(stderr, "rv64: %" PRIu64 " instructions, %" PRIu64 " cycles (%.2f CPI), %zu bytes of code\n",
+            s->instrs, s->cycles, s->instrs ? (double)s->cycles / (double)s->instrs : 0.0, rv_pos());
+    fprintf(stderr, "rv64: %" PRIu64 " loads, %" PRIu64 " stores, %" PRIu64 " branches (%" PRIu64 " taken), %" PRIu64 " multiplies, %" PRIu64 " divides, %" PRIu64 " host calls\n",
+            s->loads, s->stores, s->branches, s->taken, s->muls, s->divs, s->host_calls);
+}
+
+int rv_run(int argc, char **argv) {
+    uintptr_t index = (uintptr_t)map_get(&rv_sym_map, (void *)str_intern("main"));
+    if (!index || !rv_syms[index - 1].is_defined) {
+        fatal("No main function to run");
+    }
+    RvImage image = {0};
+    rv_link(&image);
+    char *stack = xmalloc(RV_STACK_SIZE);
+    uint64_t x[32] = {0};
+    x[RV_SP] = (uint64_t)(uintptr_t)(stack + RV_STACK_SIZE);
+    x[RV_A0] = (uint64_t)argc;
+    x[RV_A1] = (uint64_t)(uintptr_t)argv;
+    rv_stats = (RvStats){0};
+    int result = (int)rv_exec(&image, image.got[index - 1], x);
+    fflush(stdout);
+    rv_print_stats();
+    free(stack);
+    free(image.mem);
+    return result;
+}
@@ -33,6 +33,41 @@ void keyword_test(void) {
         assert(is_keyword_name(*it));
     }
     assert(!is_keyword_name(str_intern("foo")));
+    for (const char **it = keywords; it != buf_end(keywords); it++) {
+        assert(keyword_lookup(*it, strlen(*it)) == *it);
+    }
+    assert(!keyword_lookup("fo", 2));
+    assert(!keyword_lookup("form", 4));
+    assert(keyword_lookup("forx", 3) == for_keyword);
+    assert(!keyword_lookup("sizeof_", 7));
+    assert(!keyword_lookup("cases", 5));
+}
+
+void token_array_test(void) {
+    TokenArray tokens = {0};
+    init_token_array(&tokens, NULL, "f(a[1], {2}) 0x10 'c'\n\"s\"");
+    assert(buf_len(tokens.kinds) == 15);
+    assert(is_token_name(str_intern("f")));
+    assert(peek_token_kind(1) == TOKEN_LPAREN);
+    assert(peek_token_kind(3) == TOKEN_LBRACKET);
+    assert(peek_token_kind(100) == TOKEN_EOF);
+    next_token();
+    const char *group = token.start;
+    skip_token_group();
+    assert(token.int_val == 0x10 && token.mod == MOD_HEX && match_token(TOKEN_INT));
+    assert(token.int_val == 'c' && token.mod == MOD_CHAR && match_token(TOKEN_INT));
+    assert(token.pos.line == 2 && strcmp(token.str_val, "s") == 0 && match_token(TOKEN_STR));
+    assert(is_token(TOKEN_EOF));
+    next_token();
+    assert(is_token(TOKEN_EOF));
+    seek_token(group);
+    assert(match_token(TOKEN_LPAREN) && is_token_name(str_intern("a")));
+    assert(token_in_array(group) && !token_in_array("f"));
+    init_stream(NULL, "(a, (b)) c");
+    assert(peek_token_kind(3) == TOKEN_LPAREN);
+    skip_token_group();
+    assert(is_token_name(str_intern("c")));
+    free_token_array(&tokens);
 }
 
 #define assert_token(x) assert(match_token(x))
@@ -181,9 +216,9 @@ void resolve_test(void) {
 
     const char *code[] = {
         "union IntOrPtr { i: int; p: int*; }",
-        "var u1 = IntOrPtr{i = 42}",
-        "var u2 = IntOrPtr{p = (:int*)42}",
-        "var i: int",
+        "var u1 = IntOrPtr{i = 42};",
+        "var u2 = IntOrPtr{p = (:int*)42};",
+        "var i: int;",
         "struct Vector { x, y: int; }",
         "func f1() { v := Vector{1, 2}; j := i; i++; j++; v.x = 2*j; }",
         "func f2(n: int): int { return 2*n; }",
@@ -266,11 +301,90 @@ void resolve_test(void) {
     }
 }
 
+void ion_test(void) {
+    const char *src = "struct V { x, y: int; }\n"
+                      "func dot(a: V, b: V): int { return a.x*b.x + a.y*b.y; }\n"
+                      "func main(argc: int, argv: char**): int { return dot({1, 2}, {argc, 4}); }\n";
+    for (int i = 0; i < 3; i++) {
+        const char *c_code = ion_compile_str(src);
+        assert(c_code && strstr(c_code, "int dot(V a, V b)"));
+    }
+    assert(!ion_compile_str("func main(argc: int, argv: char**): int { return undefined; }"));
+    assert(strstr(error_buf, "<string>(1): error: Unresolved name"));
+    assert(!ion_compile_str("func main(argc: int, argv: char**): int { return 0 }"));
+    // With recording on, each declaration lists the global declarations it refers to. Builtins are left out.
+    record_sym_deps = true;
+    assert(ion_compile_str(src));
+    record_sym_deps = false;
+    Sym *main_sym = sym_get(str_intern("main"));
+    Sym *dot_sym = sym_get(str_intern("dot"));
+    assert(main_sym->deps->sym == dot_sym && !main_sym->deps->next);
+    assert(dot_sym->deps->sym == sym_get(str_intern("V")) && !dot_sym->deps->next);
+    // Symbols, types and scratch arrays come from arenas, so resolving again in a warm compiler needs no mallocs.
+    ion_reset();
+    init_stream(NULL, src);
+    init_builtins();
+    DeclSet *declset = parse_file();
+    size_t allocs = num_allocs;
+    sym_global_decls(declset);
+    finalize_syms();
+    assert(num_allocs == allocs);
+}
+
+// Code that can never run is dropped, but only after it has been checked.
+void dead_code_test(void) {
+    assert(!ion_compile_str("func main(argc: int, argv: char**): int {\n"
+                            "    if (0) { return undefined + \"x\"; }\n"
+                            "    return 0;\n"
+                            "}\n"));
+    assert(strstr(error_buf, "<string>(2): error: Unresolved name"));
+    assert(!ion_compile_str("func main(argc: int, argv: char**): int {\n"
+                            "    return 0;\n"
+                            "    x := undefined;\n"
+                            "}\n"));
+    assert(strstr(error_buf, "<string>(3): error: Unresolved name"));
+    const char *c_code = ion_compile_str("const DEBUG = 0;\n"
+                                         "func debug_only(): int { return 1; }\n"
+                                         "func main(argc: int, argv: char**): int {\n"
+                                         "    if (DEBUG) { return debug_only(); }\n"
+                                         "    return 0;\n"
+                                         "}\n");
+    assert(c_code && !strstr(c_code, "debug_only"));
+}
+
+// Programs may declare their own functions and variables with the names of builtins.
+void builtin_shadow_test(void) {
+    const char *c_code = ion_compile_str("func popcount(x: int): int { return x; }\n"
+                                         "var likely = 1;\n"
+                                         "func main(argc: int, argv: char**): int { return popcount(likely) + ctz(argc); }\n");
+    assert(c_code && strstr(c_code, "int popcount(int x)") && strstr(c_code, "__builtin_ctz"));
+    assert(!ion_compile_str("func clz(x: int): int { return x; }\n"
+                            "func clz(x: int): int { return x; }\n"
+                            "func main(argc: int, argv: char**): int { return 0; }\n"));
+    assert(strstr(error_buf, "Duplicate definition of global symbol"));
+}
+
+void soa_unsized_test(void) {
+    const char *c_code = ion_compile_str("@soa struct P { x: int; }\n"
+                                         "func first(a: P[]): int { return a[0].x; }\n"
+                                         "func main(argc: int, argv: char**): int { p: P; p.x = argc; return first(&p); }\n");
+    assert(c_code && strstr(c_code, "int first(P (a[]))"));
+    assert(!ion_compile_str("@soa struct P { x: int; }\n"
+                            "var g: P[] = {{1}, {2}};\n"
+                            "func main(argc: int, argv: char**): int { return 0; }\n"));
+    assert(strstr(error_buf, "SoA arrays cannot be initialized with compound literals"));
+}
+
 void main_test(void) {
     common_test();
+    keyword_test();
+    token_array_test();
     // lex_test();
     // print_test();
     // parse_test();
     resolve_test();
-    // ion_test();
+    ion_test();
+    dead_code_test();
+    builtin_shadow_test();
+    soa_unsized_test();
 }
@@ -28,6 +28,38 @@ typedef union IntOrPtr IntOrPtr;
 typedef struct Vector Vector;
 typedef struct T T;
 typedef struct ConstVector ConstVector;
+typedef struct Particle Particle;
+typedef struct Counter Counter;
+typedef struct Padded Padded;
+typedef struct CrcTable CrcTable;
+typedef struct Pair_int_float Pair_int_float;
+typedef struct Pair_Pair_int_float_char Pair_Pair_int_float_char;
+typedef struct ListNode_int ListNode_int;
+
+// Vector types
+typedef float float_x4 __attribute__((vector_size(16)));
+typedef int int_x4 __attribute__((vector_size(16)));
+typedef uchar uchar_x16 __attribute__((vector_size(16)));
+
+// Builtin helpers
+static inline unsigned int ion_rotl32(unsigned int x, unsigned int n) { n &= 31; return (unsigned int)(n ? (x << n) | (x >> (32 - n)) : x); }
+static inline unsigned int ion_rotr32(unsigned int x, unsigned int n) { n &= 31; return (unsigned int)(n ? (x >> n) | (x << (32 - n)) : x); }
+static inline unsigned long long ion_rotl64(unsigned long long x, unsigned int n) { n &= 63; return (unsigned long long)(n ? (x << n) | (x >> (64 - n)) : x); }
+static inline unsigned long long ion_rotr64(unsigned long long x, unsigned int n) { n &= 63; return (unsigned long long)(n ? (x >> n) | (x << (64 - n)) : x); }
+
+// String switch helpers
+#include <string.h>
+static inline uint32 ion_str_switch_hash(const char *str, size_t *len, uint32 seed) {
+    uint32 hash = 2166136261u ^ seed;
+    const char *ptr = str;
+    for (; *ptr; ptr++) hash = (hash ^ (uint8)*ptr) * 16777619u;
+    *len = ptr - str;
+    return hash;
+}
+static inline uint32 ion_str_switch_mix(uint32 hash) {
+    hash ^= hash >> 16; hash *= 0x7feb352du; hash ^= hash >> 15; hash *= 0x846ca68bu; hash ^= hash >> 16;
+    return hash;
+}
 
 // Sorted declarations
 #line 183 "../test1.ion"
@@ -79,11 +111,6 @@ struct S2 {
     S1 s1;
 };
 
-void f10(int (a[3]));
-
-#line 43
-void test_arrays(void);
-
 #line 48
 void test_nonmodifiable(void);
 
@@ -96,13 +123,14 @@ struct UartCtrl {
 
 #define UART_CTRL ((uint *)(0x12345678))
 
-uint32 pack(UartCtrl ctrl);
+#line 74
+void test_uart(void);
 
 #line 70
 UartCtrl unpack(uint32 word);
 
-#line 74
-void test_uart(void);
+#line 66
+uint32 pack(UartCtrl ctrl);
 
 #line 151
 struct Vector {
@@ -132,15 +160,6 @@ void f1(void);
 #line 106
 void f3(int (a[]));
 
-#line 111
-int example_test(void);
-
-#line 167
-int fact_rec(int n);
-
-#line 159
-int fact_iter(int n);
-
 #line 120
 char const ((escape_to_char[256])) = {['n'] = '\n', ['r'] = '\r', ['t'] = '\t', ['v'] = '\v', ['b'] = '\b', ['a'] = '\a', ['0'] = 0};
 
@@ -170,69 +189,222 @@ struct T {
 #line 191
 char const ((*(color_names[NUM_COLORS]))) = {[COLOR_NONE] = "none", [COLOR_RED] = "red", [COLOR_GREEN] = "green", [COLOR_BLUE] = "blue"};
 
-#line 198
-void test_enum(void);
-
-#line 207
-void test_assign(void);
-
 #line 230
 void benchmark(int n);
 
-#line 237
-int va_test(int x, ...);
-
 #line 241
 typedef int (*F)(int, ...);
 
-void test_lits(void);
-
-#line 258
-void test_ops(void);
-
 #line 288
 #define IS_DEBUG (true)
 
-void test_bool(void);
-
-#line 297
+#line 418
 int test_ctrl(void);
 
-#line 307
+#line 428
 int const (j);
 
-#line 308
+#line 429
 int const ((*q));
 
-#line 309
+#line 430
 Vector const (cv);
 
-void f4(char const ((*x)));
-
-#line 314
+#line 435
 struct ConstVector {
     int const (x);
-    #line 315
+    #line 436
     int const (y);
 };
 
+#line 442
+void test_convert(void);
+
+#line 439
 void f5(int const ((*p)));
 
-#line 321
-void test_convert(void);
+#line 487
+struct Particle {
+    float x;
+    #line 488
+    float y;
+    bool alive;
+};
+typedef struct Particle_soa64 {
+    float x[64];
+    float y[64];
+    bool alive[64];
+} Particle_soa64;
 
-#line 329
-void test_const(void);
+#line 492
+Particle_soa64 particles;
 
-#line 352
-void test_init(void);
+#line 511
+typedef float_x4 float4;
 
-#line 365
-void test_cast(void);
+#line 512
+typedef int_x4 int4;
+
+#line 532
+#define BSWAPPED (((uint)0x44332211ull))
 
-#line 374
+#line 533
+#define HIGH_BIT ((31) - (((int)0xcull)))
+
+#line 553
+#define CACHE_LINE (64)
+
+#line 556
+struct Counter {
+    _Alignas(CACHE_LINE) int hits;
+    int misses;
+};
+
+struct Padded {
+    char tag;
+    _Alignas(32) float (lanes[8]);
+};
+
+#line 567
+_Alignas(32) float (avx_buf[16]);
+
+Counter (counters[4]);
+
+#line 578
+struct CrcTable {
+    uint32 (entries[256]);
+};
+
+CrcTable make_crc_table(uint32 poly);
+
+#line 594
+int factorial(int n);
+
+#line 598
+CrcTable const (CRC_TABLE) = {{0u, 1996959894u, 3993919788u, 2567524794u, 124634137u, 1886057615u, 3915621685u, 2657392035u, 249268274u, 2044508324u, 3772115230u, 2547177864u, 162941995u, 2125561021u, 3887607047u, 2428444049u, 498536548u, 1789927666u, 4089016648u, 2227061214u, 450548861u, 1843258603u, 4107580753u, 2211677639u, 325883990u, 1684777152u, 4251122042u, 2321926636u, 335633487u, 1661365465u, 4195302755u, 2366115317u, 997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u, 901097722u, 1119000684u, 3686517206u, 2898065728u, 853044451u, 1172266101u, 3705015759u, 2882616665u, 651767980u, 1373503546u, 3369554304u, 3218104598u, 565507253u, 1454621731u, 3485111705u, 3099436303u, 671266974u, 1594198024u, 3322730930u, 2970347812u, 795835527u, 1483230225u, 3244367275u, 3060149565u, 1994146192u, 31158534u, 2563907772u, 4023717930u, 1907459465u, 112637215u, 2680153253u, 3904427059u, 2013776290u, 251722036u, 2517215374u, 3775830040u, 2137656763u, 141376813u, 2439277719u, 3865271297u, 1802195444u, 476864866u, 2238001368u, 4066508878u, 1812370925u, 453092731u, 2181625025u, 4111451223u, 1706088902u, 314042704u, 2344532202u, 4240017532u, 1658658271u, 366619977u, 2362670323u, 4224994405u, 1303535960u, 984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u, 1131014506u, 879679996u, 2909243462u, 3663771856u, 1141124467u, 855842277u, 2852801631u, 3708648649u, 1342533948u, 654459306u, 3188396048u, 3373015174u, 1466479909u, 544179635u, 3110523913u, 3462522015u, 1591671054u, 702138776u, 2966460450u, 3352799412u, 1504918807u, 783551873u, 3082640443u, 3233442989u, 3988292384u, 2596254646u, 62317068u, 1957810842u, 3939845945u, 2647816111u, 81470997u, 1943803523u, 3814918930u, 2489596804u, 225274430u, 2053790376u, 3826175755u, 2466906013u, 167816743u, 2097651377u, 4027552580u, 2265490386u, 503444072u, 1762050814u, 4150417245u, 2154129355u, 426522225u, 1852507879u, 4275313526u, 2312317920u, 282753626u, 1742555852u, 4189708143u, 2394877945u, 397917763u, 1622183637u, 3604390888u, 2714866558u, 953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u, 3624741850u, 2936675148u, 906185462u, 1090812512u, 3747672003u, 2825379669u, 829329135u, 1181335161u, 3412177804u, 3160834842u, 628085408u, 1382605366u, 3423369109u, 3138078467u, 570562233u, 1426400815u, 3317316542u, 2998733608u, 733239954u, 1555261956u, 3268935591u, 3050360625u, 752459403u, 1541320221u, 2607071920u, 3965973030u, 1969922972u, 40735498u, 2617837225u, 3943577151u, 1913087877u, 83908371u, 2512341634u, 3803740692u, 2075208622u, 213261112u, 2463272603u, 3855990285u, 2094854071u, 198958881u, 2262029012u, 4057260610u, 1759359992u, 534414190u, 2176718541u, 4139329115u, 1873836001u, 414664567u, 2282248934u, 4279200368u, 1711684554u, 285281116u, 2405801727u, 4167216745u, 1634467795u, 376229701u, 2685067896u, 3608007406u, 1308918612u, 956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u, 2932959818u, 3654703836u, 1088359270u, 936918000u, 2847714899u, 3736837829u, 1202900863u, 817233897u, 3183342108u, 3401237130u, 1404277552u, 615818150u, 3134207493u, 3453421203u, 1423857449u, 601450431u, 3009837614u, 3294710456u, 1567103746u, 711928724u, 3020668471u, 3272380065u, 1510334235u, 755167117u}};
+
+#line 599
+#define FACTORIAL_5 (((int)120))
+
+#line 615
 int main(int argc, char const ((*(*argv))));
 
+#line 207
+void test_assign(void);
+
+#line 198
+void test_enum(void);
+
+#line 43
+void test_arrays(void);
+
+#line 606
+void test_cast(void);
+
+#line 494
+void test_soa(void);
+
+#line 519
+void test_simd(void);
+
+#line 535
+void test_builtins(void);
+
+#line 571
+void test_align(void);
+
+#line 601
+void test_ctfe(void);
+
+#line 473
+void test_init(void);
+
+#line 243
+void test_lits(void);
+
+#line 450
+void test_const(void);
+
+#line 290
+void test_bool(void);
+
+#line 302
+void test_dead_code(void);
+
+#line 406
+void test_generics(void);
+
+#line 336
+void test_str_switch(void);
+
+#line 368
+void test_switch_ranges(void);
+
+#line 258
+void test_ops(void);
+
+#line 111
+int example_test(void);
+
+#line 237
+int va_test(int x, ...);
+
+#line 39
+void f10(int (a[3]));
+
+#line 167
+int fact_rec(int n);
+
+#line 159
+int fact_iter(int n);
+
+#line 323
+int command_arity(char const ((*command)));
+
+#line 340
+int char_class(char c);
+
+#line 351
+int http_status_class(int status);
+
+#line 386
+void generic_swap_int(int (*a), int (*b));
+
+#line 382
+int generic_max_int(int a, int b);
+
+#line 382
+float generic_max_float(float a, float b);
+
+#line 372
+struct Pair_int_float {
+    int first;
+    float second;
+};
+
+#line 392
+Pair_int_float make_pair_int_float(int a, float b);
+
+#line 372
+struct Pair_Pair_int_float_char {
+    Pair_int_float first;
+    char second;
+};
+
+struct ListNode_int {
+    int value;
+    ListNode_int (*next);
+};
+
+#line 397
+int list_sum_int(ListNode_int (*node));
+
+#line 432
+void f4(char const ((*x)));
+
+#line 514
+float dot4(float4 a, float4 b);
+
 // Function definitions
 #line 39
 void f10(int (a[3])) {
@@ -435,25 +607,188 @@ void test_bool(void) {
     i = IS_DEBUG;
 }
 
-int test_ctrl(void) {
-    switch (1) {
-    case 0: {
+#line 302
+void test_dead_code(void) {
+    {
+    }
+    #line 306
+    {
+    }
+    #line 309
+    int n = 1;
+    switch ((n) + ((0) * (IS_DEBUG))) {
+    case 1: {
+        n++;
+        break;
+    }
+    }
+    #line 314
+    switch (IS_DEBUG) {
+    default: {
+        #line 318
+        n++;
+        break;
+    }
+    }
+    #line 320
+    (printf)("dead code: %d\n", n);
+}
+
+int command_arity(char const ((*command))) {
+    {
+        static const uint32 ion_sw_disps[8] = {0, 0, 0, 0, 0, 0, 0, 3};
+        const char *ion_sw_str = command;
+        size_t ion_sw_len;
+        uint32 ion_sw_hash = ion_str_switch_hash(ion_sw_str, &ion_sw_len, 0u);
+        int ion_sw_case = -1;
+        switch (ion_str_switch_mix(ion_sw_hash ^ ion_sw_disps[ion_sw_hash & 7]) & 7) {
+        case 0: if (ion_sw_len == 3 && memcmp(ion_sw_str, "set", 3) == 0) ion_sw_case = 2; break;
+        case 1: if (ion_sw_len == 4 && memcmp(ion_sw_str, "help", 4) == 0) ion_sw_case = 0; break;
+        case 4: if (ion_sw_len == 4 && memcmp(ion_sw_str, "quit", 4) == 0) ion_sw_case = 0; break;
+        case 5: if (ion_sw_len == 3 && memcmp(ion_sw_str, "del", 3) == 0) ion_sw_case = 1; break;
+        case 7: if (ion_sw_len == 3 && memcmp(ion_sw_str, "get", 3) == 0) ion_sw_case = 1; break;
+        }
+        switch (ion_sw_case) {
+        case 0: {
+            #line 326
+            return 0;
+            break;
+        }
+        case 1: {
+            #line 328
+            return 1;
+            break;
+        }
+        case 2: {
+            #line 330
+            return 2;
+            break;
+        }
+        default: {
+            #line 332
+            return -(1);
+            break;
+        }
+        }
+    }
+}
+
+#line 336
+void test_str_switch(void) {
+    (printf)("str switch: %d %d %d %d\n", (command_arity)("help"), (command_arity)("del"), (command_arity)("set"), (command_arity)("sets"));
+}
+
+int char_class(char c) {
+    switch (c) {
+    case 'a' ... 'z':
+    case 'A' ... 'Z': {
+        #line 343
+        return 1;
+        break;
+    }
+    case '0' ... '9': {
+        #line 345
+        return 2;
+        break;
+    }
+    default: {
+        #line 347
         return 0;
         break;
     }
+    }
+}
+
+#line 351
+int http_status_class(int status) {
+    {
+        llong ion_sw_val = (llong)(status);
+        int ion_sw_case = -1;
+        if (ion_sw_val < 301ll) {
+            if (ion_sw_val < 200ll) {
+                if (ion_sw_val == 100ll) ion_sw_case = 0;
+            } else {
+                if (ion_sw_val >= 200ll && ion_sw_val <= 206ll) ion_sw_case = 1;
+            }
+        } else {
+            if (ion_sw_val < 404ll) {
+                if (ion_sw_val >= 301ll && ion_sw_val <= 302ll) ion_sw_case = 2;
+            } else {
+                if (ion_sw_val < 500ll) {
+                    if (ion_sw_val == 404ll) ion_sw_case = 3;
+                } else {
+                    if (ion_sw_val >= 500ll && ion_sw_val <= 504ll) ion_sw_case = 4;
+                }
+            }
+        }
+        switch (ion_sw_case) {
+        case 0: {
+            #line 354
+            return 1;
+            break;
+        }
+        case 1: {
+            #line 356
+            return 2;
+            break;
+        }
+        case 2: {
+            #line 358
+            return 3;
+            break;
+        }
+        case 3: {
+            #line 360
+            return 4;
+            break;
+        }
+        case 4: {
+            #line 362
+            return 5;
+            break;
+        }
+        default: {
+            #line 364
+            return 0;
+            break;
+        }
+        }
+    }
+}
+
+#line 368
+void test_switch_ranges(void) {
+    (printf)("switch ranges: %d %d %d %d %d %d %d\n", (char_class)('q'), (char_class)('7'), (char_class)('-'), (http_status_class)(204), (http_status_class)(302), (http_status_class)(503), (http_status_class)(600));
+}
+
+#line 406
+void test_generics(void) {
+    int x = 1;
+    int y = 2;
+    (generic_swap_int)(&(x), &(y));
+    Pair_int_float p = (make_pair_int_float)((generic_max_int)(x, y), (generic_max_float)(0.500000f, 1.500000f));
+    Pair_Pair_int_float_char q = {p, 'q'};
+    ListNode_int c = {3};
+    ListNode_int b = {2, &(c)};
+    ListNode_int a = {1, &(b)};
+    (printf)("generics: %d %d %f %c %d\n", x, q.first.first, q.first.second, q.second, (list_sum_int)(&(a)));
+}
+
+int test_ctrl(void) {
+    switch (1) {
     default: {
-        #line 302
+        #line 423
         return 1;
         break;
     }
     }
 }
 
-#line 311
+#line 432
 void f4(char const ((*x))) {
 }
 
-#line 318
+#line 439
 void f5(int const ((*p))) {
 }
 
@@ -467,22 +802,22 @@ void test_convert(void) {
 
 void test_const(void) {
     ConstVector cv2 = {1, 2};
-    #line 332
+    #line 453
     int i = 0;
     i = 1;
-    #line 336
+    #line 457
     int x = cv.x;
-    #line 338
+    #line 459
     char c = escape_to_char[0];
-    #line 340
+    #line 461
     (f4)(escape_to_char);
     char const ((*p)) = (char const (*))(0);
     p = (escape_to_char) + (1);
     char (*q) = (char *)(escape_to_char);
     c = q['n'];
-    #line 346
+    #line 467
     p = (char const (*))(1);
-    #line 349
+    #line 470
     i = (int)((ullong)(p));
 }
 
@@ -492,22 +827,109 @@ void test_init(void) {
     y = 0;
     int z = 42;
     int (a[3]) = {1, 2, 3};
-    #line 360
+    #line 481
     for (ullong i = 0; (i) < (10); i++) {
         (printf)("%llu\n", i);
     }
 }
 
+#line 494
+void test_soa(void) {
+    for (int i = 0; (i) < (64); i++) {
+        (particles).x[i] = i;
+        (particles).y[i] = (2) * (i);
+        (particles).alive[i] = ((i) % (3)) == (0);
+    }
+    Particle_soa64 (*p) = &(particles);
+    int alive = 0;
+    for (int i = 0; (i) < (64); i++) {
+        if ((*(p)).alive[i]) {
+            alive++;
+        }
+    }
+    ullong n = (sizeof(particles)) + (sizeof(Particle));
+    (printf)("%d alive of %d\n", alive, 64);
+}
+
+#line 514
+float dot4(float4 a, float4 b) {
+    float_x4 p = (a) * (b);
+    return (((p[0]) + (p[1])) + (p[2])) + (p[3]);
+}
+
+void test_simd(void) {
+    float_x4 a = {1, 2, 3, 4};
+    float_x4 b = ((float_x4){0} + (float)(0.500000f));
+    float_x4 c = ((a) * (b)) + ((float)(1));
+    c -= a;
+    c = -(c);
+    c[2] = 42;
+    int_x4 mask = (a) > (b);
+    int_x4 bits = (((int4){1, 2, 4, 8}) << ((int)(1))) | (((int_x4){0} + (int)(1)));
+    uchar_x16 lanes = (uchar_x16)(bits);
+    (printf)("%f %d %d\n", (dot4)(a, b), mask[0], bits[3]);
+}
+
+#line 535
+void test_builtins(void) {
+    uint x = 0xf0u;
+    (printf)("%d %d %d %d %x\n", ((int)0x8ull), ((int)0x4ull), ((int)0x3ull), ((uchar)0x3ull), ((ushort)0x8000ull));
+    int (buf[HIGH_BIT]);
+    __builtin_prefetch(&(buf[0]));
+    __builtin_prefetch(&(buf[1]), 1, 3);
+    int n = 0;
+    for (int i = 0; (i) < (8); i++) {
+        if ((int)__builtin_expect(!!((i) != (3)), 1)) {
+            n += ((__builtin_popcount((unsigned int)(x))) + (__builtin_clz((unsigned int)(x)))) + (__builtin_ctz((unsigned int)(x)));
+        }
+        if ((int)__builtin_expect(!!(((int)__builtin_expect(i, 0)) == (7)), 0)) {
+            x = ((uint)ion_rotl32((unsigned int)(x), (unsigned int)(4))) ^ ((uint32)((ushort)__builtin_bswap16((unsigned short)((uint16)(i)))));
+        }
+    }
+    (printf)("%d %x %x %x\n", n, x, BSWAPPED, (uint32)(((ullong)ion_rotr64((unsigned long long)((uint64)(x)), (unsigned int)(12))) >> (56)));
+}
+
+#line 571
+void test_align(void) {
+    Counter (*c) = &(counters[1]);
+    c->hits++;
+    (printf)("%d %d\n", (int)(sizeof(Counter)), (int)(sizeof(Padded)));
+    (printf)("%d %d\n", (int)(((uint64)(c)) % (CACHE_LINE)), (int)(((uint64)(&(avx_buf))) % (32)));
+}
+
+#line 582
+CrcTable make_crc_table(uint32 poly) {
+    CrcTable table;
+    for (int i = 0; (i) < (256); i++) {
+        uint c = (uint32)(i);
+        for (int k = 0; (k) < (8); k++) {
+            c = ((c) & (1) ? (poly) ^ ((c) >> (1)) : (c) >> (1));
+        }
+        table.entries[i] = c;
+    }
+    return table;
+}
+
+int factorial(int n) {
+    return ((n) <= (1) ? 1 : (n) * ((factorial)((n) - (1))));
+}
+
+#line 601
+void test_ctfe(void) {
+    char (digits[((int)24)]);
+    (printf)("%d %d %x\n", FACTORIAL_5, (int)(sizeof(digits)), CRC_TABLE.entries[255]);
+}
+
 void test_cast(void) {
     int (*p) = 0;
     uint64 a = 0;
-    #line 369
+    #line 610
     a = (uint64)(p);
-    #line 371
+    #line 612
     p = (int *)(a);
 }
 
-int main(int argc, char const **argv) {
+int main(int argc, char const ((*(*argv)))) {
     if ((argv) == (0)) {
         (printf)("argv is null\n");
     }
@@ -515,10 +937,19 @@ int main(int argc, char const **argv) {
     (test_enum)();
     (test_arrays)();
     (test_cast)();
+    (test_soa)();
+    (test_simd)();
+    (test_builtins)();
+    (test_align)();
+    (test_ctfe)();
     (test_init)();
     (test_lits)();
     (test_const)();
     (test_bool)();
+    (test_dead_code)();
+    (test_generics)();
+    (test_str_switch)();
+    (test_switch_ranges)();
     (test_ops)();
     int b = (example_test)();
     (puts)("Hello, world!");
@@ -529,3 +960,35 @@ int main(int argc, char const **argv) {
     argv = NULL;
     return 0;
 }
+
+#line 386
+void generic_swap_int(int (*a), int (*b)) {
+    int t = *(a);
+    *(a) = *(b);
+    *(b) = t;
+}
+
+#line 382
+int generic_max_int(int a, int b) {
+    return ((a) > (b) ? a : b);
+}
+
+#line 382
+float generic_max_float(float a, float b) {
+    return ((a) > (b) ? a : b);
+}
+
+#line 392
+Pair_int_float make_pair_int_float(int a, float b) {
+    Pair_int_float p = {a, b};
+    return p;
+}
+
+int list_sum_int(ListNode_int (*node)) {
+    int sum = (int)(0);
+    while (node) {
+        sum += node->value;
+        node = node->next;
+    }
+    return sum;
+}
@@ -31,28 +31,17 @@ struct vec2 {
     float y;
 };
 
-vec2 add2(vec2 a, vec2 b);
-
-#line 18
-vec2 sub2(vec2 a, vec2 b);
-
 #line 22
 vec2 neg2(vec2 a);
 
-#line 26
-vec2 mul2(float a, vec2 b);
-
 #line 30
 vec2 addmul2(vec2 a, float b, vec2 c);
 
-#line 34
-float dot2(vec2 a, vec2 b);
-
-#line 38
-float len2(vec2 a);
+#line 14
+vec2 add2(vec2 a, vec2 b);
 
-#line 42
-vec2 unit2(vec2 a);
+#line 26
+vec2 mul2(float a, vec2 b);
 
 #line 46
 vec2 perp2(vec2 a);
@@ -60,12 +49,24 @@ vec2 perp2(vec2 a);
 #line 50
 vec2 dir2(vec2 a, vec2 b);
 
-#line 54
-vec2 rot2(float a, vec2 b);
+#line 42
+vec2 unit2(vec2 a);
+
+#line 18
+vec2 sub2(vec2 a, vec2 b);
 
 #line 60
 int main(int argc, char (*(*argv)));
 
+#line 54
+vec2 rot2(float a, vec2 b);
+
+#line 38
+float len2(vec2 a);
+
+#line 34
+float dot2(vec2 a, vec2 b);
+
 // Function definitions
 #line 14
 vec2 add2(vec2 a, vec2 b) {
@@ -0,0 +1,101 @@
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+# Compiles each test program through every backend and checks that its output and exit code match the C backend's.
+# A backend that rejects a program as unsupported is reported as skipped rather than failed.
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_ION = os.path.join(SCRIPT_DIR, "ion_linux", "ion_linux")
+# test1 reads a character from stdin. test3 sticks to integers, so the RV64IM backend can run it too.
+PROGRAMS = [("test1.ion", "x\n"), ("test2.ion", ""), ("test3.ion", "")]
+BACKENDS = ["x64", "run", "vm", "rv64"]
+
+class Unsupported(Exception):
+    pass
+
+def compile_ion(args, cwd):
+    proc = subprocess.run(args, cwd=cwd, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    if proc.returncode != 0:
+        raise RuntimeError(proc.stdout.strip())
+
+def run_program(args, cwd, stdin, timeout):
+    proc = subprocess.run(args, cwd=cwd, input=stdin, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True, timeout=timeout)
+    return proc.returncode, proc.stdout, proc.stderr
+
+# Returns (exit code, stdout) of the program built or run by the given backend.
+def run_backend(args, backend, name, stdin, temp_dir):
+    base = os.path.splitext(name)[0]
+    exe = os.path.join(temp_dir, base + "_" + backend)
+    if backend == "c":
+        compile_ion([args.ion, name], temp_dir)
+        compile_ion([args.cc, "-std=c11", "-w", base + ".c", "-o", exe, "-lm"], temp_dir)
+        code, out, _ = run_program([exe], temp_dir, stdin, args.timeout)
+    elif backend == "x64":
+        compile_ion([args.ion, "--backend=x64", name], temp_dir)
+        compile_ion([args.cc, base + ".o", "-o", exe, "-lm"], temp_dir)
+        code, out, _ = run_program([exe], temp_dir, stdin, args.timeout)
+    else:
+        code, out, err = run_program([args.ion, backend, name], temp_dir, stdin, args.timeout)
+        # Compile errors come before the program runs, so one shows up as the first line of output.
+        first = (out + err).lstrip().split("\n", 1)[0]
+        if code != 0 and re.match(r"%s\(\d+\): error: " % re.escape(name), first):
+            if "not supported" in first:
+                raise Unsupported(first)
+            raise RuntimeError(first)
+    return code, out
+
+# Returns why a backend's (exit code, stdout) doesn't match the C backend's, or None.
+def compare(actual, expected):
+    if actual[0] != expected[0]:
+        return "exit code %d, C backend %d" % (actual[0], expected[0])
+    actual_lines = actual[1].splitlines()
+    expected_lines = expected[1].splitlines()
+    if actual_lines != expected_lines:
+        line = next((i for i, (a, b) in enumerate(zip(actual_lines, expected_lines)) if a != b),
+                    min(len(actual_lines), len(expected_lines)))
+        return "output differs from the C backend at line %d" % (line + 1)
+    return None
+
+def main():
+    parser = argparse.ArgumentParser(description="Check every Ion backend against the C backend.")
+    parser.add_argument("--ion", default=DEFAULT_ION, help="path to the ion executable")
+    parser.add_argument("--cc", default=os.environ.get("CC", "cc"), help="C compiler and linker")
+    parser.add_argument("--backends", default=",".join(BACKENDS))
+    parser.add_argument("--timeout", type=float, default=60, help="seconds allowed per program run")
+    args = parser.parse_args()
+    args.ion = os.path.abspath(args.ion)
+
+    backends = args.backends.split(",")
+    for backend in backends:
+        if backend not in BACKENDS:
+            parser.error("unknown backend %s" % backend)
+
+    failures = []
+    with tempfile.TemporaryDirectory(prefix="ion-backends-") as temp_dir:
+        for name, stdin in PROGRAMS:
+            shutil.copy(os.path.join(SCRIPT_DIR, name), temp_dir)
+            expected = run_backend(args, "c", name, stdin, temp_dir)
+            for backend in backends:
+                try:
+                    failure = compare(run_backend(args, backend, name, stdin, temp_dir), expected)
+                except Unsupported as e:
+                    print("%-10s %-5s skipped: %s" % (name, backend, e))
+                    continue
+                except (RuntimeError, subprocess.TimeoutExpired) as e:
+                    failure = str(e)
+                print("%-10s %-5s %s" % (name, backend, "FAILED" if failure else "ok"))
+                if failure:
+                    failures.append("%s %s: %s" % (name, backend, failure))
+
+    for failure in failures:
+        print("FAIL: " + failure)
+    return 1 if failures else 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -21,6 +21,7 @@ typedef enum TypeKind {
     TYPE_PTR,
     TYPE_FUNC,
     TYPE_ARRAY,
+    TYPE_VECTOR,
     TYPE_STRUCT,
     TYPE_UNION,
     TYPE_CONST,
@@ -34,6 +35,7 @@ typedef struct TypeField {
     const char *name;
     Type *type;
     size_t offset;
+    size_t align;
 } TypeField;
 
 struct Type {
@@ -48,6 +50,7 @@ struct Type {
         struct {
             TypeField *fields;
             size_t num_fields;
+            bool is_soa;
         } aggregate;
         struct {
             Type **params;
@@ -60,8 +63,21 @@ struct Type {
 
 void complete_type(Type *type);
 
+// Types and their field and parameter arrays live until the next type_reset.
+Arena type_arena;
+
+void *type_dup(const void *src, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    void *ptr = arena_alloc(&type_arena, size);
+    memcpy(ptr, src, size);
+    return ptr;
+}
+
 Type *type_alloc(TypeKind kind) {
-    Type *type = xcalloc(1, sizeof(Type));
+    Type *type = arena_alloc(&type_arena, sizeof(Type));
+    memset(type, 0, sizeof(Type));
     type->kind = kind;
     return type;
 }
@@ -104,6 +120,19 @@ bool is_incomplete_array_type(Type *type) {
     return is_array_type(type) && type->num_elems == 0;
 }
 
+bool is_vector_type(Type *type) {
+    return type->kind == TYPE_VECTOR;
+}
+
+bool is_soa_struct_type(Type *type) {
+    return type->kind == TYPE_STRUCT && type->aggregate.is_soa;
+}
+
+// Unsized arrays have no per-field storage to split, so like their C declarations they keep the plain layout.
+bool is_soa_array_type(Type *type) {
+    return is_array_type(type) && type->num_elems != 0 && is_soa_struct_type(type->base);
+}
+
 bool is_integer_type(Type *type) {
     return TYPE_BOOL <= type->kind && type->kind <= TYPE_ENUM;
 }
@@ -251,16 +280,27 @@ Type *unqualify_type(Type *type) {
     }
 }
 
+// Array and func types are cached in stretchy buffers indexed by a Map from a key hash to the newest entry with
+// that hash, stored as index+1. Entries with the same hash are chained through next, another index+1.
+void *cached_type_key(uint64_t hash) {
+    return (void *)(uintptr_t)(hash ? hash : 1);
+}
+
 typedef struct CachedArrayType {
     Type *elem;
     size_t num_elems;
     Type *array;
+    size_t next;
 } CachedArrayType;
 
 CachedArrayType *cached_array_types;
+Map cached_array_index;
 
 Type *type_array(Type *elem, size_t num_elems) {
-    for (CachedArrayType *it = cached_array_types; it != buf_end(cached_array_types); it++) {
+    void *key = cached_type_key(hash_uint64(hash_ptr(elem) ^ num_elems));
+    size_t head = (size_t)(uintptr_t)map_get(&cached_array_index, key);
+    for (size_t i = head; i; i = cached_array_types[i-1].next) {
+        CachedArrayType *it = &cached_array_types[i-1];
         if (it->elem == elem && it->num_elems == num_elems) {
             return it->array;
         }
@@ -272,22 +312,112 @@ Type *type_array(Type *elem, size_t num_elems) {
     type->align = type_alignof(elem);
     type->base = elem;
     type->num_elems = num_elems;
-    buf_push(cached_array_types, (CachedArrayType){elem, num_elems, type});
+    if (is_soa_struct_type(elem)) {
+        // Struct-of-arrays layout: one num_elems-long array per field, laid out like a C struct of arrays.
+        type->size = 0;
+        for (size_t i = 0; i < elem->aggregate.num_fields; i++) {
+            Type *field_type = elem->aggregate.fields[i].type;
+            type->size = num_elems * type_sizeof(field_type) + ALIGN_UP(type->size, type_alignof(field_type));
+        }
+        type->size = ALIGN_UP(type->size, type->align);
+    }
+    // complete_type can build other array types, so the chain head is looked up again.
+    head = (size_t)(uintptr_t)map_get(&cached_array_index, key);
+    buf_push(cached_array_types, (CachedArrayType){elem, num_elems, type, head});
+    map_put(&cached_array_index, key, (void *)(uintptr_t)buf_len(cached_array_types));
+    return type;
+}
+
+size_t type_soa_field_offset(Type *type, size_t field_index) {
+    assert(is_soa_array_type(type));
+    Type *elem = type->base;
+    assert(field_index < elem->aggregate.num_fields);
+    size_t offset = 0;
+    for (size_t i = 0; i < field_index; i++) {
+        Type *field_type = elem->aggregate.fields[i].type;
+        offset = type->num_elems * type_sizeof(field_type) + ALIGN_UP(offset, type_alignof(field_type));
+    }
+    return ALIGN_UP(offset, type_alignof(elem->aggregate.fields[field_index].type));
+}
+
+typedef struct CachedVectorType {
+    Type *elem;
+    size_t num_lanes;
+    Type *vector;
+} CachedVectorType;
+
+CachedVectorType *cached_vector_types;
+
+Type *type_vector(Type *elem, size_t num_lanes) {
+    for (CachedVectorType *it = cached_vector_types; it != buf_end(cached_vector_types); it++) {
+        if (it->elem == elem && it->num_lanes == num_lanes) {
+            return it->vector;
+        }
+    }
+    assert(is_integer_type(elem) || is_floating_type(elem));
+    assert(IS_POW2(num_lanes));
+    Type *type = type_alloc(TYPE_VECTOR);
+    type->size = num_lanes * type_sizeof(elem);
+    type->align = type->size;
+    type->base = elem;
+    type->num_elems = num_lanes;
+    buf_push(cached_vector_types, (CachedVectorType){elem, num_lanes, type});
     return type;
 }
 
+// Lane-wise comparisons produce a mask vector of signed integers with the same lane width, like GCC and Clang.
+Type *vector_mask_type(Type *type) {
+    assert(is_vector_type(type));
+    Type *elem = NULL;
+    switch (type_sizeof(type->base)) {
+    case 1:
+        elem = type_schar;
+        break;
+    case 2:
+        elem = type_short;
+        break;
+    case 4:
+        elem = type_int;
+        break;
+    case 8:
+        elem = type_llong;
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    return type_vector(elem, type->num_elems);
+}
+
 typedef struct CachedFuncType {
     Type **params;
     size_t num_params;
     bool has_varargs;
     Type *ret;
     Type *func;
+    size_t next;
 } CachedFuncType;
 
 CachedFuncType *cached_func_types;
+Map cached_func_index;
+
+void type_reset(void) {
+    map_clear(&cached_ptr_types);
+    map_clear(&cached_const_types);
+    buf_clear(cached_array_types);
+    map_clear(&cached_array_index);
+    buf_clear(cached_vector_types);
+    buf_clear(cached_func_types);
+    map_clear(&cached_func_index);
+    arena_reset(&type_arena);
+}
 
 Type *type_func(Type **params, size_t num_params, Type *ret, bool has_varargs) {
-    for (CachedFuncType *it = cached_func_types; it != buf_end(cached_func_types); it++) {
+    uint64_t hash = hash_bytes((const char *)params, num_params * sizeof(*params));
+    void *key = cached_type_key(hash_uint64(hash ^ hash_ptr(ret) ^ has_varargs));
+    size_t head = (size_t)(uintptr_t)map_get(&cached_func_index, key);
+    for (size_t i = head; i; i = cached_func_types[i-1].next) {
+        CachedFuncType *it = &cached_func_types[i-1];
         if (it->num_params == num_params && it->ret == ret && it->has_varargs == has_varargs) {
             bool match = true;
             for (size_t i = 0; i < num_params; i++) {
@@ -304,11 +434,12 @@ Type *type_func(Type **params, size_t num_params, Type *ret, bool has_varargs) {
     Type *type = type_alloc(TYPE_FUNC);
     type->size = PTR_SIZE;
     type->align = PTR_ALIGN;
-    type->func.params = memdup(params, num_params * sizeof(*params));
+    type->func.params = type_dup(params, num_params * sizeof(*params));
     type->func.num_params = num_params;
     type->func.has_varargs = has_varargs;
     type->func.ret = ret;
-    buf_push(cached_func_types, (CachedFuncType){params, num_params, ret, type});
+    buf_push(cached_func_types, (CachedFuncType){type->func.params, num_params, has_varargs, ret, type, head});
+    map_put(&cached_func_index, key, (void *)(uintptr_t)buf_len(cached_func_types));
     return type;
 }
 
@@ -323,38 +454,45 @@ bool has_duplicate_fields(TypeField *fields, size_t num_fields) {
     return false;
 }
 
-void type_complete_struct(Type *type, TypeField *fields, size_t num_fields) {
+size_t type_field_alignof(TypeField *field) {
+    return MAX(type_alignof(field->type), field->align);
+}
+
+void type_complete_struct(Type *type, TypeField *fields, size_t num_fields, size_t align) {
     assert(type->kind == TYPE_COMPLETING);
     type->kind = TYPE_STRUCT;
     type->size = 0;
-    type->align = 0;
+    type->align = align;
     bool nonmodifiable = false;
     for (TypeField *it = fields; it != fields + num_fields; it++) {
-        assert(IS_POW2(type_alignof(it->type)));
-        it->offset = type->size;
-        type->size = type_sizeof(it->type) + ALIGN_UP(type->size, type_alignof(it->type));
-        type->align = MAX(type->align, type_alignof(it->type));
+        size_t field_align = type_field_alignof(it);
+        assert(IS_POW2(field_align));
+        it->offset = ALIGN_UP(type->size, field_align);
+        type->size = type_sizeof(it->type) + it->offset;
+        type->align = MAX(type->align, field_align);
         nonmodifiable = it->type->nonmodifiable || nonmodifiable;
     }
-    type->aggregate.fields = memdup(fields, num_fields * sizeof(*fields));
+    type->size = ALIGN_UP(type->size, type->align);
+    type->aggregate.fields = type_dup(fields, num_fields * sizeof(*fields));
     type->aggregate.num_fields = num_fields;
     type->nonmodifiable = nonmodifiable;
 }
 
-void type_complete_union(Type *type, TypeField *fields, size_t num_fields) {
+void type_complete_union(Type *type, TypeField *fields, size_t num_fields, size_t align) {
     assert(type->kind == TYPE_COMPLETING);
     type->kind = TYPE_UNION;
     type->size = 0;
-    type->align = 0;
+    type->align = align;
     bool nonmodifiable = false;
     for (TypeField *it = fields; it != fields + num_fields; it++) {
         assert(it->type->kind > TYPE_COMPLETING);
         it->offset = 0;
         type->size = MAX(type->size, type_sizeof(it->type));
-        type->align = MAX(type->align, type_alignof(it->type));
+        type->align = MAX(type->align, type_field_alignof(it));
         nonmodifiable = it->type->nonmodifiable || nonmodifiable;
     }
-    type->aggregate.fields = memdup(fields, num_fields * sizeof(*fields));
+    type->size = ALIGN_UP(type->size, type->align);
+    type->aggregate.fields = type_dup(fields, num_fields * sizeof(*fields));
     type->aggregate.num_fields = num_fields;
     type->nonmodifiable = nonmodifiable;
 }
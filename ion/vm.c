@@ -0,0 +1,1961 @@
+// Register-based bytecode VM. Functions are compiled lazily from the resolved AST on their first call,
+// so running a program only pays for the code it reaches.
+// Registers are 64-bit slots in a sliding window: a call passes its arguments in the caller's top registers,
+// which become the callee's first registers. Aggregates, arrays and vectors live in frame memory and
+// are handled by address, exactly like the x64 backend.
+
+#define VM_OPS(X) \
+    X(MOV) X(LOADI) X(LOADK) X(FRAME) X(ADDI) \
+    X(JMP) X(JZ) X(JNZ) \
+    X(ADD) X(SUB) X(MUL) X(DIVS) X(DIVU) X(MODS) X(MODU) \
+    X(AND) X(OR) X(XOR) X(SHL) X(SHRS) X(SHRU) X(NEG) X(BNOT) X(LNOT) X(BOOL) \
+    X(EQ) X(NE) X(LTS) X(LES) X(LTU) X(LEU) \
+    X(ADDF) X(SUBF) X(MULF) X(DIVF) X(NEGF) X(EQF) X(NEF) X(LTF) X(LEF) X(BOOLF) \
+    X(ADDD) X(SUBD) X(MULD) X(DIVD) X(NEGD) X(EQD) X(NED) X(LTD) X(LED) X(BOOLD) \
+    X(SEXT8) X(SEXT16) X(SEXT32) X(ZEXT8) X(ZEXT16) X(ZEXT32) \
+    X(I2F) X(U2F) X(I2D) X(U2D) X(F2I) X(F2U) X(D2I) X(D2U) X(F2D) X(D2F) \
+    X(LD8S) X(LD8U) X(LD16S) X(LD16U) X(LD32S) X(LD32U) X(LD64) X(ST8) X(ST16) X(ST32) X(ST64) \
+    X(COPY) X(ZERO) X(BOUNDS) \
+    X(POPCNT) X(CLZ) X(CTZ) X(BSWAP) X(ROTL) X(ROTR) X(STRCASE) \
+    X(CALL) X(CALLI) X(CALLF) X(RET) X(RETV)
+
+typedef enum VmOp {
+#define X(name) VM_##name,
+    VM_OPS(X)
+#undef X
+    NUM_VM_OPS,
+} VmOp;
+
+typedef union VmValue {
+    int64_t i;
+    uint64_t u;
+    float f;
+    double d;
+    void *p;
+} VmValue;
+
+// Operands are register numbers unless noted. Ops that need a 32-bit immediate (constant index,
+// frame offset or jump target) combine b and c.
+typedef struct VmInstr {
+    uint16_t op;
+    uint16_t a;
+    uint16_t b;
+    uint16_t c;
+} VmInstr;
+
+#define VM_BC(instr) ((uint32_t)(instr)->b | (uint32_t)(instr)->c << 16)
+
+typedef struct VmFunc {
+    Sym *sym;
+    VmInstr *code;
+    VmValue *consts;
+    size_t num_regs;
+    size_t frame_size;
+} VmFunc;
+
+typedef struct VmCallSite {
+    Type *ret_type;
+    Type **arg_types;
+    size_t num_args;
+    void *func;
+} VmCallSite;
+
+enum {
+    VM_MAX_REGS = 1 << 16,
+    VM_STACK_SIZE = 1 << 20,
+    VM_REG_LIMIT = UINT16_MAX,
+    VM_EVAL_STEPS = 1 << 28,
+};
+
+// Turning these off keeps a call's result a function of its arguments alone.
+bool vm_allow_foreign = true;
+bool vm_allow_globals = true;
+
+// Compile-time evaluation runs checked, since a bad constant must not crash or hang the compiler. Loads and
+// stores must stay in the evaluation's part of the VM stack or its result, or read compiler-owned data such as
+// string literals and folded calls. Array indexes are bounds-checked in code compiled during an evaluation, and
+// jumps and calls draw on a step budget. Failures are reported at the call being evaluated.
+typedef struct VmEval {
+    SrcPos pos;
+    char *stack_start;
+    char *result;
+    size_t result_size;
+    uint64_t steps;
+} VmEval;
+
+// The innermost evaluation in progress, or NULL when running a program.
+VmEval *vm_eval;
+
+#define vm_fail(...) (vm_eval ? fatal_error(vm_eval->pos, __VA_ARGS__) : fatal(__VA_ARGS__))
+
+Map vm_funcs;
+Map vm_func_ptrs;
+Map vm_globals;
+Arena vm_globals_arena;
+Sym **vm_pending_inits;
+VmValue *vm_regs;
+char *vm_stack;
+VmValue *vm_free_regs;
+char *vm_free_stack;
+
+// Compiler state
+
+typedef struct VmLocal {
+    const char *name;
+    Type *type;
+    bool is_reg;
+    uint32_t loc;
+} VmLocal;
+
+typedef struct VmFixup {
+    size_t instr;
+    int label;
+} VmFixup;
+
+VmInstr *vm_code;
+VmValue *vm_consts;
+VmLocal *vm_locals;
+size_t *vm_labels;
+VmFixup *vm_fixups;
+int *vm_break_labels;
+int *vm_continue_labels;
+const char **vm_addr_taken;
+uint32_t vm_reg_top;
+uint32_t vm_max_regs;
+uint32_t vm_frame_size;
+Type *vm_ret_type;
+
+void vm_emit(VmOp op, uint32_t a, uint32_t b, uint32_t c) {
+    assert(a <= VM_REG_LIMIT && b <= VM_REG_LIMIT && c <= VM_REG_LIMIT);
+    buf_push(vm_code, (VmInstr){(uint16_t)op, (uint16_t)a, (uint16_t)b, (uint16_t)c});
+}
+
+void vm_emit_bc(VmOp op, uint32_t a, uint32_t bc) {
+    vm_emit(op, a, bc & 0xFFFF, bc >> 16);
+}
+
+uint32_t vm_const(VmValue val) {
+    buf_push(vm_consts, val);
+    if (buf_len(vm_consts) > VM_REG_LIMIT) {
+        fatal("Too many constants in VM function");
+    }
+    return (uint32_t)buf_len(vm_consts) - 1;
+}
+
+uint32_t vm_const_ptr(void *ptr) {
+    return vm_const((VmValue){.p = ptr});
+}
+
+uint32_t vm_const_size(size_t size) {
+    return vm_const((VmValue){.u = size});
+}
+
+uint32_t vm_alloc_reg(void) {
+    uint32_t reg = vm_reg_top++;
+    if (vm_reg_top > VM_REG_LIMIT) {
+        fatal("Too many registers in VM function");
+    }
+    vm_max_regs = MAX(vm_max_regs, vm_reg_top);
+    return reg;
+}
+
+uint32_t vm_alloc_slot(size_t size, size_t align) {
+    align = MIN(MAX(align, 1), 16);
+    uint32_t offset = (uint32_t)ALIGN_UP(vm_frame_size, align);
+    vm_frame_size = (uint32_t)(offset + size);
+    return offset;
+}
+
+int vm_new_label(void) {
+    buf_push(vm_labels, SIZE_MAX);
+    return (int)buf_len(vm_labels) - 1;
+}
+
+void vm_bind_label(int label) {
+    vm_labels[label] = buf_len(vm_code);
+}
+
+void vm_jump(VmOp op, uint32_t reg, int label) {
+    buf_push(vm_fixups, (VmFixup){buf_len(vm_code), label});
+    vm_emit_bc(op, reg, 0);
+}
+
+void vm_load_imm(uint32_t dst, uint64_t val) {
+    if ((int64_t)val >= INT16_MIN && (int64_t)val <= INT16_MAX) {
+        vm_emit(VM_LOADI, dst, (uint16_t)(int16_t)val, 0);
+    } else {
+        vm_emit_bc(VM_LOADK, dst, vm_const((VmValue){.u = val}));
+    }
+}
+
+void vm_load_ptr(uint32_t dst, void *ptr) {
+    vm_emit_bc(VM_LOADK, dst, vm_const_ptr(ptr));
+}
+
+void vm_add_imm(uint32_t dst, uint32_t src, int64_t val) {
+    if (val >= 0 && val <= VM_REG_LIMIT) {
+        if (val || dst != src) {
+            vm_emit(VM_ADDI, dst, src, (uint32_t)val);
+        }
+    } else {
+        uint32_t tmp = vm_alloc_reg();
+        vm_load_imm(tmp, (uint64_t)val);
+        vm_emit(VM_ADD, dst, src, tmp);
+        vm_reg_top--;
+    }
+}
+
+void vm_mul_imm(uint32_t reg, size_t val) {
+    if (val != 1) {
+        uint32_t tmp = vm_alloc_reg();
+        vm_load_imm(tmp, val);
+        vm_emit(VM_MUL, reg, reg, tmp);
+        vm_reg_top--;
+    }
+}
+
+// Globals and functions
+
+void *vm_host_sym(Sym *sym) {
+    void *addr = NULL;
+#ifndef _WIN32
+    if (vm_allow_foreign) {
+        addr = host_sym_addr(sym->name);
+    }
+#endif
+    if (!addr) {
+        vm_fail("Foreign symbol '%s' is not available in the VM", sym->name);
+    }
+    return addr;
+}
+
+VmFunc *vm_get_func(Sym *sym) {
+    VmFunc *func = map_get(&vm_funcs, sym);
+    if (!func) {
+        func = xcalloc(1, sizeof(VmFunc));
+        func->sym = sym;
+        map_put(&vm_funcs, sym, func);
+        map_put(&vm_func_ptrs, func, func);
+    }
+    return func;
+}
+
+void *vm_global_addr(Sym *sym) {
+    if (sym->kind == SYM_CONST) {
+        return (void *)sym->decl->const_decl.expr->call.folded_data;
+    } else if (!vm_allow_globals) {
+        vm_fail("Global variable '%s' is not available in compile-time evaluation", sym->name);
+    } else if (sym->decl && is_decl_foreign(sym->decl)) {
+        return vm_host_sym(sym);
+    }
+    void *addr = map_get(&vm_globals, sym);
+    if (!addr) {
+        size_t align = type_alignof(sym->type);
+        Note *align_note = sym->decl ? get_decl_note(sym->decl, align_name) : NULL;
+        if (align_note) {
+            align = MAX(align, (size_t)x64_const_int(align_note->args[0]));
+        }
+        size_t size = type_sizeof(sym->type) + align;
+        char *mem = arena_alloc(&vm_globals_arena, size);
+        memset(mem, 0, size);
+        addr = (void *)ALIGN_UP((uintptr_t)mem, align);
+        map_put(&vm_globals, sym, addr);
+        if (sym->decl && sym->decl->var.expr) {
+            buf_push(vm_pending_inits, sym);
+        }
+    }
+    return addr;
+}
+
+// Loads and stores
+
+bool vm_is_signed(Type *type) {
+    return is_signed_type(type) || (type->kind == TYPE_CHAR && CHAR_MIN < 0);
+}
+
+void vm_normalize(uint32_t reg, Type *type) {
+    type = unqualify_type(type);
+    if (!is_integer_type(type)) {
+        return;
+    }
+    bool is_signed = vm_is_signed(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        vm_emit(is_signed ? VM_SEXT8 : VM_ZEXT8, reg, reg, 0);
+        break;
+    case 2:
+        vm_emit(is_signed ? VM_SEXT16 : VM_ZEXT16, reg, reg, 0);
+        break;
+    case 4:
+        vm_emit(is_signed ? VM_SEXT32 : VM_ZEXT32, reg, reg, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+// Returns the base register to address [addr + offset] with an offset that fits in an instruction.
+uint32_t vm_addr_base(uint32_t addr, size_t *offset) {
+    if (*offset <= VM_REG_LIMIT) {
+        return addr;
+    }
+    uint32_t tmp = vm_alloc_reg();
+    vm_add_imm(tmp, addr, (int64_t)*offset);
+    *offset = 0;
+    return tmp;
+}
+
+void vm_load(Type *type, uint32_t dst, uint32_t addr, size_t offset) {
+    type = unqualify_type(type);
+    uint32_t mark = vm_reg_top;
+    if (x64_is_mem_type(type)) {
+        vm_add_imm(dst, addr, (int64_t)offset);
+        return;
+    }
+    addr = vm_addr_base(addr, &offset);
+    VmOp op;
+    bool is_signed = vm_is_signed(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        op = is_signed ? VM_LD8S : VM_LD8U;
+        break;
+    case 2:
+        op = is_signed ? VM_LD16S : VM_LD16U;
+        break;
+    case 4:
+        op = is_signed ? VM_LD32S : VM_LD32U;
+        break;
+    default:
+        op = VM_LD64;
+        break;
+    }
+    vm_emit(op, dst, addr, (uint32_t)offset);
+    vm_reg_top = mark;
+}
+
+void vm_store(Type *type, uint32_t addr, size_t offset, uint32_t src) {
+    type = unqualify_type(type);
+    uint32_t mark = vm_reg_top;
+    if (x64_is_mem_type(type)) {
+        uint32_t dst = vm_alloc_reg();
+        vm_add_imm(dst, addr, (int64_t)offset);
+        vm_emit(VM_COPY, dst, src, vm_const_size(type_sizeof(type)));
+    } else {
+        addr = vm_addr_base(addr, &offset);
+        static const VmOp stores[] = {[1] = VM_ST8, [2] = VM_ST16, [4] = VM_ST32, [8] = VM_ST64};
+        vm_emit(stores[type_sizeof(type)], addr, src, (uint32_t)offset);
+    }
+    vm_reg_top = mark;
+}
+
+// Conversions
+
+void vm_convert(uint32_t reg, Type *from, Type *to) {
+    from = x64_decay(from);
+    to = unqualify_type(to);
+    if (from == to || to->kind == TYPE_VOID || x64_is_mem_type(from) || x64_is_mem_type(to)) {
+        return;
+    }
+    if (to->kind == TYPE_BOOL) {
+        vm_emit(from->kind == TYPE_FLOAT ? VM_BOOLF : from->kind == TYPE_DOUBLE ? VM_BOOLD : VM_BOOL, reg, reg, 0);
+    } else if (is_floating_type(to)) {
+        bool is_double = to->kind == TYPE_DOUBLE;
+        if (from->kind == TYPE_FLOAT) {
+            vm_emit(is_double ? VM_F2D : VM_MOV, reg, reg, 0);
+        } else if (from->kind == TYPE_DOUBLE) {
+            vm_emit(is_double ? VM_MOV : VM_D2F, reg, reg, 0);
+        } else if (vm_is_signed(from)) {
+            vm_emit(is_double ? VM_I2D : VM_I2F, reg, reg, 0);
+        } else {
+            vm_emit(is_double ? VM_U2D : VM_U2F, reg, reg, 0);
+        }
+    } else {
+        if (is_floating_type(from)) {
+            bool is_unsigned = !vm_is_signed(to) && type_sizeof(to) == 8;
+            if (from->kind == TYPE_DOUBLE) {
+                vm_emit(is_unsigned ? VM_D2U : VM_D2I, reg, reg, 0);
+            } else {
+                vm_emit(is_unsigned ? VM_F2U : VM_F2I, reg, reg, 0);
+            }
+        }
+        vm_normalize(reg, to);
+    }
+}
+
+// Address-taken scalars have to live in frame memory rather than registers.
+
+void vm_scan_stmt(Stmt *stmt);
+
+void vm_scan_expr(Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_AND && expr->unary.expr->kind == EXPR_NAME) {
+            buf_push(vm_addr_taken, expr->unary.expr->name);
+        }
+        vm_scan_expr(expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        vm_scan_expr(expr->binary.left);
+        vm_scan_expr(expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        vm_scan_expr(expr->ternary.cond);
+        vm_scan_expr(expr->ternary.then_expr);
+        vm_scan_expr(expr->ternary.else_expr);
+        break;
+    case EXPR_CALL:
+        vm_scan_expr(expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            vm_scan_expr(expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        vm_scan_expr(expr->index.expr);
+        vm_scan_expr(expr->index.index);
+        break;
+    case EXPR_FIELD:
+        vm_scan_expr(expr->field.expr);
+        break;
+    case EXPR_CAST:
+        vm_scan_expr(expr->cast.expr);
+        break;
+    case EXPR_COMPOUND:
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            vm_scan_expr(expr->compound.fields[i].init);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void vm_scan_block(StmtList block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        vm_scan_stmt(block.stmts[i]);
+    }
+}
+
+void vm_scan_stmt(Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        vm_scan_expr(stmt->expr);
+        break;
+    case STMT_BLOCK:
+        vm_scan_block(stmt->block);
+        break;
+    case STMT_IF:
+        vm_scan_expr(stmt->if_stmt.cond);
+        vm_scan_block(stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            vm_scan_expr(stmt->if_stmt.elseifs[i].cond);
+            vm_scan_block(stmt->if_stmt.elseifs[i].block);
+        }
+        vm_scan_block(stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+    case STMT_DO_WHILE:
+        vm_scan_expr(stmt->while_stmt.cond);
+        vm_scan_block(stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        vm_scan_stmt(stmt->for_stmt.init);
+        vm_scan_expr(stmt->for_stmt.cond);
+        vm_scan_stmt(stmt->for_stmt.next);
+        vm_scan_block(stmt->for_stmt.block);
+        break;
+    case STMT_SWITCH:
+        vm_scan_expr(stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            vm_scan_block(stmt->switch_stmt.cases[i].block);
+        }
+        break;
+    case STMT_ASSIGN:
+        vm_scan_expr(stmt->assign.left);
+        vm_scan_expr(stmt->assign.right);
+        break;
+    case STMT_INIT:
+        vm_scan_expr(stmt->init.expr);
+        break;
+    default:
+        break;
+    }
+}
+
+bool vm_is_addr_taken(const char *name) {
+    for (const char **it = vm_addr_taken; it != buf_end(vm_addr_taken); it++) {
+        if (*it == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Locals
+
+VmLocal *vm_get_local(const char *name) {
+    for (VmLocal *it = buf_end(vm_locals); it != vm_locals; it--) {
+        if (it[-1].name == name) {
+            return it - 1;
+        }
+    }
+    return NULL;
+}
+
+void vm_pop_locals(size_t num_locals) {
+    if (vm_locals) {
+        buf__hdr(vm_locals)->len = num_locals;
+    }
+}
+
+// Expressions
+
+void vm_expr(Expr *expr, uint32_t dst);
+void vm_init(uint32_t addr, size_t offset, Type *type, Expr *expr);
+
+void vm_cond_jump(Expr *expr, bool jump_if_true, int label) {
+    uint32_t mark = vm_reg_top;
+    uint32_t reg = vm_alloc_reg();
+    vm_expr(expr, reg);
+    Type *type = x64_decay(expr->type);
+    if (is_floating_type(type)) {
+        vm_convert(reg, type, type_bool);
+    }
+    vm_jump(jump_if_true ? VM_JNZ : VM_JZ, reg, label);
+    vm_reg_top = mark;
+}
+
+// Checks an array index against the array's length when compiling for compile-time evaluation.
+void vm_bounds(Type *type, uint32_t index) {
+    if (vm_eval && is_array_type(type) && type->num_elems) {
+        vm_emit(VM_BOUNDS, index, 0, vm_const_size(type->num_elems));
+    }
+}
+
+void vm_addr(Expr *expr, uint32_t dst) {
+    uint32_t mark = vm_reg_top;
+    switch (expr->kind) {
+    case EXPR_NAME: {
+        VmLocal *local = vm_get_local(expr->name);
+        if (local) {
+            assert(!local->is_reg);
+            vm_emit_bc(VM_FRAME, dst, local->loc);
+        } else {
+            vm_load_ptr(dst, vm_global_addr(sym_get(expr->name)));
+        }
+        break;
+    }
+    case EXPR_INDEX: {
+        Type *type = unqualify_type(expr->index.expr->type);
+        uint32_t index = vm_alloc_reg();
+        vm_expr(expr->index.expr, dst);
+        vm_expr(expr->index.index, index);
+        vm_bounds(type, index);
+        vm_mul_imm(index, is_ptr_type(type) ? x64_elem_size(type) : type_sizeof(type->base));
+        vm_emit(VM_ADD, dst, dst, index);
+        break;
+    }
+    case EXPR_FIELD: {
+        Expr *base = expr->field.expr;
+        Type *type = unqualify_type(base->type);
+        if (base->kind == EXPR_INDEX && is_soa_array_type(unqualify_type(base->index.expr->type))) {
+            Type *array = unqualify_type(base->index.expr->type);
+            int field_index = aggregate_field_index(array->base, expr->field.name);
+            uint32_t index = vm_alloc_reg();
+            vm_expr(base->index.expr, dst);
+            vm_expr(base->index.index, index);
+            vm_bounds(array, index);
+            vm_mul_imm(index, type_sizeof(array->base->aggregate.fields[field_index].type));
+            vm_emit(VM_ADD, dst, dst, index);
+            vm_add_imm(dst, dst, (int64_t)type_soa_field_offset(array, field_index));
+            break;
+        }
+        vm_expr(base, dst);
+        if (is_ptr_type(type)) {
+            type = unqualify_type(type->base);
+        }
+        complete_type(type);
+        int field_index = aggregate_field_index(type, expr->field.name);
+        assert(field_index >= 0);
+        vm_add_imm(dst, dst, (int64_t)type->aggregate.fields[field_index].offset);
+        break;
+    }
+    case EXPR_UNARY:
+        assert(expr->unary.op == TOKEN_MUL);
+        vm_expr(expr->unary.expr, dst);
+        break;
+    case EXPR_COMPOUND: {
+        Type *type = unqualify_type(expr->type);
+        vm_emit_bc(VM_FRAME, dst, vm_alloc_slot(type_sizeof(type), type_alignof(type)));
+        vm_init(dst, 0, type, expr);
+        break;
+    }
+    default:
+        assert(x64_is_mem_type(expr->type));
+        vm_expr(expr, dst);
+        break;
+    }
+    vm_reg_top = mark;
+}
+
+bool vm_is_cmp_op(TokenKind op) {
+    return TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+}
+
+// dst = left op right for operands already converted to type.
+void vm_arith(TokenKind op, Type *type, uint32_t dst, uint32_t left, uint32_t right) {
+    type = unqualify_type(type);
+    if (op == TOKEN_GT || op == TOKEN_GTEQ) {
+        uint32_t tmp = left;
+        left = right;
+        right = tmp;
+        op = op == TOKEN_GT ? TOKEN_LT : TOKEN_LTEQ;
+    }
+    if (is_floating_type(type)) {
+        static const VmOp float_ops[][2] = {
+            [TOKEN_ADD] = {VM_ADDF, VM_ADDD},
+            [TOKEN_SUB] = {VM_SUBF, VM_SUBD},
+            [TOKEN_MUL] = {VM_MULF, VM_MULD},
+            [TOKEN_DIV] = {VM_DIVF, VM_DIVD},
+            [TOKEN_EQ] = {VM_EQF, VM_EQD},
+            [TOKEN_NOTEQ] = {VM_NEF, VM_NED},
+            [TOKEN_LT] = {VM_LTF, VM_LTD},
+            [TOKEN_LTEQ] = {VM_LEF, VM_LED},
+        };
+        vm_emit(float_ops[op][type->kind == TYPE_DOUBLE], dst, left, right);
+        return;
+    }
+    bool is_signed = vm_is_signed(type);
+    VmOp vm_op;
+    switch (op) {
+    case TOKEN_ADD:
+        vm_op = VM_ADD;
+        break;
+    case TOKEN_SUB:
+        vm_op = VM_SUB;
+        break;
+    case TOKEN_MUL:
+        vm_op = VM_MUL;
+        break;
+    case TOKEN_DIV:
+        vm_op = is_signed ? VM_DIVS : VM_DIVU;
+        break;
+    case TOKEN_MOD:
+        vm_op = is_signed ? VM_MODS : VM_MODU;
+        break;
+    case TOKEN_AND:
+        vm_op = VM_AND;
+        break;
+    case TOKEN_OR:
+        vm_op = VM_OR;
+        break;
+    case TOKEN_XOR:
+        vm_op = VM_XOR;
+        break;
+    case TOKEN_LSHIFT:
+        vm_op = VM_SHL;
+        break;
+    case TOKEN_RSHIFT:
+        vm_op = is_signed ? VM_SHRS : VM_SHRU;
+        break;
+    case TOKEN_EQ:
+        vm_emit(VM_EQ, dst, left, right);
+        return;
+    case TOKEN_NOTEQ:
+        vm_emit(VM_NE, dst, left, right);
+        return;
+    case TOKEN_LT:
+        vm_emit(is_signed ? VM_LTS : VM_LTU, dst, left, right);
+        return;
+    case TOKEN_LTEQ:
+        vm_emit(is_signed ? VM_LES : VM_LEU, dst, left, right);
+        return;
+    default:
+        assert(0);
+        return;
+    }
+    vm_emit(vm_op, dst, left, right);
+    vm_normalize(dst, type);
+}
+
+// Puts a vector operand's address in reg, spilling a scalar operand to memory with a lane stride of 0.
+size_t vm_vector_operand(uint32_t reg, Type *type, Type *vector) {
+    if (is_vector_type(type)) {
+        return type_sizeof(vector->base);
+    }
+    vm_convert(reg, type, vector->base);
+    uint32_t addr = vm_alloc_reg();
+    vm_emit_bc(VM_FRAME, addr, vm_alloc_slot(8, 8));
+    vm_store(vector->base, addr, 0, reg);
+    vm_emit(VM_MOV, reg, addr, 0);
+    vm_reg_top--;
+    return 0;
+}
+
+Type *vm_vector_binary(TokenKind op, Type *left_type, uint32_t dst, Expr *right) {
+    Type *right_type = unqualify_type(right->type);
+    Type *vector = is_vector_type(left_type) ? left_type : right_type;
+    Type *elem = vector->base;
+    Type *result = vm_is_cmp_op(op) ? vector_mask_type(vector) : vector;
+    uint32_t left = vm_alloc_reg(), right_reg = vm_alloc_reg(), l = vm_alloc_reg(), r = vm_alloc_reg();
+    vm_emit(VM_MOV, left, dst, 0);
+    size_t left_stride = vm_vector_operand(left, left_type, vector);
+    vm_expr(right, right_reg);
+    size_t right_stride = vm_vector_operand(right_reg, right_type, vector);
+    vm_emit_bc(VM_FRAME, dst, vm_alloc_slot(type_sizeof(result), type_alignof(result)));
+    for (size_t i = 0; i < vector->num_elems; i++) {
+        vm_load(elem, l, left, left_stride * i);
+        vm_load(elem, r, right_reg, right_stride * i);
+        vm_arith(op, elem, l, l, r);
+        if (vm_is_cmp_op(op)) {
+            vm_emit(VM_NEG, l, l, 0);
+        }
+        vm_store(result->base, dst, i * type_sizeof(elem), l);
+    }
+    vm_reg_top = left;
+    return result;
+}
+
+// Applies a binary operator to the value of type left_type in dst and the right expression.
+Type *vm_binary_rest(TokenKind op, Type *left_type, uint32_t dst, Expr *right) {
+    left_type = x64_decay(left_type);
+    Type *right_type = x64_decay(right->type);
+    if (is_vector_type(left_type) || is_vector_type(right_type)) {
+        return vm_vector_binary(op, left_type, dst, right);
+    }
+    uint32_t mark = vm_reg_top;
+    uint32_t right_reg = vm_alloc_reg();
+    Type *result;
+    if (is_ptr_type(left_type) || is_ptr_type(right_type) || left_type->kind == TYPE_FUNC || right_type->kind == TYPE_FUNC) {
+        vm_expr(right, right_reg);
+        if (op == TOKEN_ADD && is_ptr_type(left_type)) {
+            vm_mul_imm(right_reg, x64_elem_size(left_type));
+            vm_emit(VM_ADD, dst, dst, right_reg);
+            result = left_type;
+        } else if (op == TOKEN_ADD) {
+            vm_mul_imm(dst, x64_elem_size(right_type));
+            vm_emit(VM_ADD, dst, dst, right_reg);
+            result = right_type;
+        } else if (op == TOKEN_SUB && is_ptr_type(right_type)) {
+            vm_emit(VM_SUB, dst, dst, right_reg);
+            size_t size = x64_elem_size(left_type);
+            if (size != 1) {
+                vm_load_imm(right_reg, size);
+                vm_emit(VM_DIVS, dst, dst, right_reg);
+            }
+            result = type_ssize;
+        } else if (op == TOKEN_SUB) {
+            vm_mul_imm(right_reg, x64_elem_size(left_type));
+            vm_emit(VM_SUB, dst, dst, right_reg);
+            result = left_type;
+        } else {
+            vm_arith(op, type_ullong, dst, dst, right_reg);
+            result = type_int;
+        }
+    } else if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        result = x64_promote(left_type);
+        vm_convert(dst, left_type, result);
+        vm_expr(right, right_reg);
+        vm_arith(op, result, dst, dst, right_reg);
+    } else {
+        Type *type = x64_unify(left_type, right_type);
+        vm_convert(dst, left_type, type);
+        vm_expr(right, right_reg);
+        vm_convert(right_reg, right_type, type);
+        vm_arith(op, type, dst, dst, right_reg);
+        result = vm_is_cmp_op(op) ? type_int : type;
+    }
+    vm_reg_top = mark;
+    return result;
+}
+
+void vm_expr_binary(Expr *expr, uint32_t dst) {
+    TokenKind op = expr->binary.op;
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        bool is_and = op == TOKEN_AND_AND;
+        int short_circuit = vm_new_label(), done = vm_new_label();
+        vm_cond_jump(expr->binary.left, !is_and, short_circuit);
+        vm_cond_jump(expr->binary.right, !is_and, short_circuit);
+        vm_load_imm(dst, is_and);
+        vm_jump(VM_JMP, 0, done);
+        vm_bind_label(short_circuit);
+        vm_load_imm(dst, !is_and);
+        vm_bind_label(done);
+        return;
+    }
+    vm_expr(expr->binary.left, dst);
+    vm_binary_rest(op, expr->binary.left->type, dst, expr->binary.right);
+}
+
+void vm_unary_op(TokenKind op, Type *type, uint32_t dst, uint32_t src) {
+    switch (op) {
+    case TOKEN_ADD:
+        vm_emit(VM_MOV, dst, src, 0);
+        break;
+    case TOKEN_SUB:
+        vm_emit(type->kind == TYPE_FLOAT ? VM_NEGF : type->kind == TYPE_DOUBLE ? VM_NEGD : VM_NEG, dst, src, 0);
+        vm_normalize(dst, type);
+        break;
+    case TOKEN_NEG:
+        vm_emit(VM_BNOT, dst, src, 0);
+        vm_normalize(dst, type);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void vm_expr_unary(Expr *expr, uint32_t dst) {
+    TokenKind op = expr->unary.op;
+    if (op == TOKEN_AND) {
+        vm_addr(expr->unary.expr, dst);
+        return;
+    } else if (op == TOKEN_MUL) {
+        vm_expr(expr->unary.expr, dst);
+        vm_load(expr->type, dst, dst, 0);
+        return;
+    }
+    Type *type = x64_decay(expr->unary.expr->type);
+    vm_expr(expr->unary.expr, dst);
+    if (is_vector_type(type)) {
+        Type *elem = type->base;
+        uint32_t src = vm_alloc_reg(), lane = vm_alloc_reg();
+        vm_emit(VM_MOV, src, dst, 0);
+        vm_emit_bc(VM_FRAME, dst, vm_alloc_slot(type_sizeof(type), type_alignof(type)));
+        for (size_t i = 0; i < type->num_elems; i++) {
+            vm_load(elem, lane, src, i * type_sizeof(elem));
+            vm_unary_op(op, elem, lane, lane);
+            vm_store(elem, dst, i * type_sizeof(elem), lane);
+        }
+        vm_reg_top = src;
+        return;
+    }
+    if (op == TOKEN_NOT) {
+        vm_convert(dst, type, type_bool);
+        vm_emit(VM_LNOT, dst, dst, 0);
+        return;
+    }
+    vm_convert(dst, type, expr->type);
+    vm_unary_op(op, unqualify_type(expr->type), dst, dst);
+}
+
+void vm_expr_ternary(Expr *expr, uint32_t dst) {
+    int else_label = vm_new_label(), done = vm_new_label();
+    vm_cond_jump(expr->ternary.cond, false, else_label);
+    vm_expr(expr->ternary.then_expr, dst);
+    vm_convert(dst, expr->ternary.then_expr->type, expr->type);
+    vm_jump(VM_JMP, 0, done);
+    vm_bind_label(else_label);
+    vm_expr(expr->ternary.else_expr, dst);
+    vm_convert(dst, expr->ternary.else_expr->type, expr->type);
+    vm_bind_label(done);
+}
+
+void vm_builtin_call(Expr *expr, uint32_t dst) {
+    Expr **args = expr->call.args;
+    if (expr->call.is_folded) {
+        vm_load_imm(dst, expr->call.folded_val);
+        vm_normalize(dst, expr->type);
+        return;
+    }
+    uint32_t mark = vm_reg_top;
+    switch (expr->call.builtin) {
+    case BUILTIN_POPCOUNT:
+    case BUILTIN_CLZ:
+    case BUILTIN_CTZ:
+    case BUILTIN_BSWAP:
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR: {
+        Type *type = builtin_int_type(args[0]->type);
+        uint32_t bits = (uint32_t)(8 * type_sizeof(type));
+        vm_expr(args[0], dst);
+        vm_convert(dst, args[0]->type, type);
+        vm_normalize(dst, unsigned_type(type));
+        switch (expr->call.builtin) {
+        case BUILTIN_POPCOUNT:
+            vm_emit(VM_POPCNT, dst, dst, 0);
+            break;
+        case BUILTIN_CLZ:
+            vm_emit(VM_CLZ, dst, dst, bits);
+            break;
+        case BUILTIN_CTZ:
+            vm_emit(VM_CTZ, dst, dst, 0);
+            break;
+        case BUILTIN_BSWAP:
+            vm_emit(VM_BSWAP, dst, dst, bits);
+            break;
+        default: {
+            uint32_t count = vm_alloc_reg();
+            vm_expr(args[1], count);
+            vm_emit(expr->call.builtin == BUILTIN_ROTL ? VM_ROTL : VM_ROTR, dst, count, bits);
+            break;
+        }
+        }
+        vm_normalize(dst, expr->type);
+        break;
+    }
+    case BUILTIN_PREFETCH:
+        vm_expr(args[0], dst);
+        break;
+    case BUILTIN_EXPECT:
+        vm_expr(args[0], dst);
+        vm_convert(dst, args[0]->type, expr->type);
+        break;
+    case BUILTIN_LIKELY:
+    case BUILTIN_UNLIKELY:
+        vm_expr(args[0], dst);
+        vm_convert(dst, args[0]->type, type_bool);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    vm_reg_top = mark;
+}
+
+void vm_conversion_call(Expr *expr, uint32_t dst) {
+    Expr *arg = expr->call.args[0];
+    Type *type = unqualify_type(expr->type);
+    vm_expr(arg, dst);
+    if (is_vector_type(type) && !is_vector_type(unqualify_type(arg->type))) {
+        uint32_t lane = vm_alloc_reg();
+        vm_emit(VM_MOV, lane, dst, 0);
+        vm_convert(lane, arg->type, type->base);
+        vm_emit_bc(VM_FRAME, dst, vm_alloc_slot(type_sizeof(type), type_alignof(type)));
+        for (size_t i = 0; i < type->num_elems; i++) {
+            vm_store(type->base, dst, i * type_sizeof(type->base), lane);
+        }
+        vm_reg_top--;
+    } else {
+        vm_convert(dst, arg->type, type);
+    }
+}
+
+VmCallSite *vm_call_site(Type *func, Expr **args, size_t num_args) {
+    VmCallSite *site = ast_alloc(sizeof(VmCallSite));
+    site->ret_type = func->func.ret;
+    site->num_args = num_args;
+    site->arg_types = num_args ? ast_alloc(num_args * sizeof(Type *)) : NULL;
+    for (size_t i = 0; i < num_args; i++) {
+        site->arg_types[i] = i < func->func.num_params ? x64_decay(func->func.params[i]) : x64_vararg_type(args[i]->type);
+    }
+    return site;
+}
+
+// Arguments go in consecutive registers at the top of the frame, after a hidden destination
+// pointer for aggregate results. Aggregate arguments are passed by address and copied by the callee.
+void vm_call(Expr *expr, uint32_t dst) {
+    if (expr->call.folded_data && x64_is_mem_type(expr->type)) {
+        vm_load_ptr(dst, (void *)expr->call.folded_data);
+        return;
+    } else if (expr->call.folded_data) {
+        VmValue val = {0};
+        memcpy(&val, expr->call.folded_data, type_sizeof(expr->type));
+        vm_emit_bc(VM_LOADK, dst, vm_const(val));
+        return;
+    } else if (expr->call.builtin) {
+        vm_builtin_call(expr, dst);
+        return;
+    } else if (!expr->call.expr->type) {
+        vm_conversion_call(expr, dst);
+        return;
+    }
+    Expr *callee = expr->call.expr;
+    Type *func = unqualify_type(callee->type);
+    Sym *direct = NULL;
+    if (callee->kind == EXPR_NAME && !vm_get_local(callee->name)) {
+        Sym *sym = sym_get(callee->name);
+        if (sym->kind == SYM_FUNC) {
+            direct = sym;
+        }
+    }
+    uint32_t mark = vm_reg_top;
+    Type *ret_type = unqualify_type(func->func.ret);
+    bool ret_in_mem = x64_is_mem_type(ret_type);
+    uint32_t fn = 0;
+    if (!direct) {
+        fn = vm_alloc_reg();
+        vm_expr(callee, fn);
+    }
+    uint32_t base = vm_reg_top;
+    uint32_t first = base;
+    if (ret_in_mem) {
+        vm_alloc_reg();
+        vm_emit_bc(VM_FRAME, base, vm_alloc_slot(type_sizeof(ret_type), type_alignof(ret_type)));
+        first++;
+    }
+    size_t num_args = expr->call.num_args;
+    for (size_t i = 0; i < num_args; i++) {
+        vm_alloc_reg();
+    }
+    for (size_t i = 0; i < num_args; i++) {
+        Expr *arg = expr->call.args[i];
+        Type *type = i < func->func.num_params ? x64_decay(func->func.params[i]) : x64_vararg_type(arg->type);
+        vm_expr(arg, first + (uint32_t)i);
+        vm_convert(first + (uint32_t)i, arg->type, type);
+    }
+    if (direct && !is_decl_foreign(direct->decl)) {
+        vm_emit(VM_CALL, base, vm_const_ptr(vm_get_func(direct)), 0);
+    } else if (direct) {
+        VmCallSite *site = vm_call_site(func, expr->call.args, num_args);
+        site->func = vm_host_sym(direct);
+        vm_emit(VM_CALLF, base, vm_const_ptr(site), 0);
+    } else {
+        vm_emit(VM_CALLI, base, fn, vm_const_ptr(vm_call_site(func, expr->call.args, num_args)));
+    }
+    if (ret_type->kind != TYPE_VOID) {
+        vm_emit(VM_MOV, dst, base, 0);
+        vm_normalize(dst, ret_type);
+    }
+    vm_reg_top = mark;
+}
+
+void vm_const_sym(Sym *sym, uint32_t dst) {
+    if (x64_is_mem_type(sym->type)) {
+        vm_load_ptr(dst, vm_global_addr(sym));
+    } else if (is_floating_type(sym->type)) {
+        Expr *expr = sym->decl->const_decl.expr;
+        vm_expr(expr, dst);
+        vm_convert(dst, expr->type, sym->type);
+    } else {
+        vm_load_imm(dst, x64_const_val(sym->type, sym->val));
+    }
+}
+
+void vm_float_const(Type *type, double val, uint32_t dst) {
+    VmValue value = {0};
+    if (unqualify_type(type)->kind == TYPE_FLOAT) {
+        value.f = (float)val;
+    } else {
+        value.d = val;
+    }
+    vm_emit_bc(VM_LOADK, dst, vm_const(value));
+}
+
+void vm_expr(Expr *expr, uint32_t dst) {
+    switch (expr->kind) {
+    case EXPR_INT:
+        vm_load_imm(dst, expr->int_lit.val);
+        break;
+    case EXPR_FLOAT:
+        vm_float_const(expr->type, expr->float_lit.val, dst);
+        break;
+    case EXPR_STR:
+        vm_load_ptr(dst, (void *)expr->str_lit.val);
+        break;
+    case EXPR_NAME: {
+        VmLocal *local = vm_get_local(expr->name);
+        if (local && local->is_reg) {
+            vm_emit(VM_MOV, dst, local->loc, 0);
+            break;
+        } else if (local) {
+            vm_emit_bc(VM_FRAME, dst, local->loc);
+            vm_load(local->type, dst, dst, 0);
+            break;
+        }
+        Sym *sym = sym_get(expr->name);
+        assert(sym);
+        if (sym->kind == SYM_CONST) {
+            vm_const_sym(sym, dst);
+        } else if (sym->kind == SYM_FUNC) {
+            vm_load_ptr(dst, is_decl_foreign(sym->decl) ? vm_host_sym(sym) : vm_get_func(sym));
+        } else {
+            vm_load_ptr(dst, vm_global_addr(sym));
+            vm_load(sym->type, dst, dst, 0);
+        }
+        break;
+    }
+    case EXPR_CAST:
+        vm_expr(expr->cast.expr, dst);
+        vm_convert(dst, expr->cast.expr->type, expr->type);
+        break;
+    case EXPR_CALL:
+        vm_call(expr, dst);
+        break;
+    case EXPR_INDEX:
+    case EXPR_FIELD:
+    case EXPR_COMPOUND:
+        vm_addr(expr, dst);
+        vm_load(expr->type, dst, dst, 0);
+        break;
+    case EXPR_UNARY:
+        vm_expr_unary(expr, dst);
+        break;
+    case EXPR_BINARY:
+        vm_expr_binary(expr, dst);
+        break;
+    case EXPR_TERNARY:
+        vm_expr_ternary(expr, dst);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        vm_load_imm(dst, type_sizeof(expr->sizeof_expr->type));
+        break;
+    case EXPR_SIZEOF_TYPE:
+        vm_load_imm(dst, type_sizeof(expr->sizeof_type->type));
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void vm_init(uint32_t addr, size_t offset, Type *type, Expr *expr) {
+    type = unqualify_type(type);
+    uint32_t mark = vm_reg_top;
+    if (expr->kind != EXPR_COMPOUND) {
+        uint32_t val = vm_alloc_reg();
+        vm_expr(expr, val);
+        vm_convert(val, expr->type, type);
+        vm_store(type, addr, offset, val);
+        vm_reg_top = mark;
+        return;
+    }
+    uint32_t base = vm_alloc_reg();
+    vm_add_imm(base, addr, (int64_t)offset);
+    vm_emit(VM_ZERO, base, 0, vm_const_size(type_sizeof(type)));
+    if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            vm_init(base, type_field.offset, type_field.type, field.init);
+            index++;
+        }
+    } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR) {
+        long long index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = x64_const_int(field.index);
+            }
+            vm_init(base, index * type_sizeof(type->base), type->base, field.init);
+            index++;
+        }
+    } else if (expr->compound.num_fields == 1) {
+        vm_init(base, 0, type, expr->compound.fields[0].init);
+    }
+    vm_reg_top = mark;
+}
+
+// Statements
+
+void vm_stmt(Stmt *stmt);
+
+void vm_stmt_block(StmtList block) {
+    size_t num_locals = buf_len(vm_locals);
+    uint32_t mark = vm_reg_top;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        vm_stmt(block.stmts[i]);
+    }
+    vm_pop_locals(num_locals);
+    vm_reg_top = mark;
+}
+
+void vm_return(Expr *expr) {
+    if (!expr) {
+        vm_emit(VM_RETV, 0, 0, 0);
+        return;
+    }
+    uint32_t val = vm_alloc_reg();
+    vm_expr(expr, val);
+    vm_convert(val, expr->type, vm_ret_type);
+    if (x64_is_mem_type(vm_ret_type)) {
+        vm_emit(VM_COPY, 0, val, vm_const_size(type_sizeof(vm_ret_type)));
+        vm_emit(VM_RETV, 0, 0, 0);
+    } else {
+        vm_emit(VM_RET, val, 0, 0);
+    }
+}
+
+void vm_assign(Stmt *stmt) {
+    Expr *left = stmt->assign.left;
+    Type *type = unqualify_type(left->type);
+    VmLocal *local = left->kind == EXPR_NAME ? vm_get_local(left->name) : NULL;
+    uint32_t addr = 0, val;
+    if (local && local->is_reg) {
+        val = local->loc;
+    } else {
+        addr = vm_alloc_reg();
+        val = vm_alloc_reg();
+        vm_addr(left, addr);
+    }
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        uint32_t tmp = vm_alloc_reg();
+        vm_expr(stmt->assign.right, tmp);
+        vm_convert(tmp, stmt->assign.right->type, type);
+        vm_emit(VM_MOV, val, tmp, 0);
+    } else {
+        if (!local || !local->is_reg) {
+            vm_load(type, val, addr, 0);
+        }
+        if (stmt->assign.op == TOKEN_INC || stmt->assign.op == TOKEN_DEC) {
+            int64_t delta = is_ptr_type(type) ? (int64_t)x64_elem_size(type) : 1;
+            uint32_t tmp = vm_alloc_reg();
+            vm_load_imm(tmp, (uint64_t)(stmt->assign.op == TOKEN_INC ? delta : -delta));
+            vm_emit(VM_ADD, val, val, tmp);
+            vm_normalize(val, type);
+        } else {
+            Type *result = vm_binary_rest(assign_token_to_binary_token[stmt->assign.op], type, val, stmt->assign.right);
+            vm_convert(val, result, type);
+        }
+    }
+    if (!local || !local->is_reg) {
+        vm_store(type, addr, 0, val);
+    }
+}
+
+void vm_init_stmt(Stmt *stmt) {
+    Type *type;
+    if (stmt->init.type) {
+        type = stmt->init.type->type;
+        if (is_incomplete_array_type(type) && stmt->init.expr) {
+            type = stmt->init.expr->type;
+        }
+    } else {
+        type = stmt->init.expr->type;
+    }
+    type = unqualify_type(type);
+    VmLocal local = {.name = stmt->init.name, .type = type};
+    if (!x64_is_mem_type(type) && !vm_is_addr_taken(stmt->init.name)) {
+        local.is_reg = true;
+        local.loc = vm_alloc_reg();
+        if (stmt->init.expr) {
+            vm_expr(stmt->init.expr, local.loc);
+            vm_convert(local.loc, stmt->init.expr->type, type);
+        } else {
+            vm_load_imm(local.loc, 0);
+        }
+    } else {
+        local.loc = vm_alloc_slot(type_sizeof(type), type_alignof(type));
+        uint32_t addr = vm_alloc_reg();
+        vm_emit_bc(VM_FRAME, addr, local.loc);
+        if (stmt->init.expr) {
+            vm_init(addr, 0, type, stmt->init.expr);
+        } else {
+            vm_emit(VM_ZERO, addr, 0, vm_const_size(type_sizeof(type)));
+        }
+        vm_reg_top--;
+    }
+    buf_push(vm_locals, local);
+}
+
+void vm_switch(Stmt *stmt) {
+    Type *type = x64_decay(stmt->switch_stmt.expr->type);
+    uint32_t val = vm_alloc_reg(), tmp = vm_alloc_reg();
+    vm_expr(stmt->switch_stmt.expr, val);
+    StrSwitch *str_switch = stmt->switch_stmt.str_switch;
+    if (str_switch) {
+        // String cases are matched by the perfect hash lookup, which leaves the case index or -1 in val.
+        vm_emit(VM_STRCASE, val, val, vm_const_ptr(str_switch));
+        type = type_llong;
+    }
+    int end = vm_new_label(), default_label = end;
+    int *labels = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        buf_push(labels, vm_new_label());
+    }
+    if (stmt->switch_stmt.ranges) {
+        // Constant cases are tested as ranges: value - lo <= hi - lo, unsigned.
+        uint32_t size = vm_alloc_reg();
+        for (size_t i = 0; i < stmt->switch_stmt.num_ranges; i++) {
+            SwitchRange range = stmt->switch_stmt.ranges[i];
+            vm_load_imm(tmp, switch_key_value(type, range.lo));
+            vm_arith(TOKEN_SUB, type_ullong, tmp, val, tmp);
+            vm_load_imm(size, range.hi - range.lo);
+            vm_arith(TOKEN_LTEQ, type_ullong, tmp, tmp, size);
+            vm_jump(VM_JNZ, tmp, labels[range.case_index]);
+        }
+        vm_reg_top--;
+    }
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        int label = labels[i];
+        if (str_switch && switch_case.num_exprs) {
+            vm_load_imm(tmp, i);
+            vm_arith(TOKEN_EQ, type, tmp, val, tmp);
+            vm_jump(VM_JNZ, tmp, label);
+        }
+        for (size_t j = 0; j < switch_case.num_exprs && !str_switch && !stmt->switch_stmt.ranges; j++) {
+            vm_expr(switch_case.exprs[j], tmp);
+            vm_convert(tmp, switch_case.exprs[j]->type, type);
+            vm_arith(TOKEN_EQ, type, tmp, val, tmp);
+            vm_jump(VM_JNZ, tmp, label);
+        }
+        if (switch_case.is_default) {
+            default_label = label;
+        }
+    }
+    vm_jump(VM_JMP, 0, default_label);
+    buf_push(vm_break_labels, end);
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        vm_bind_label(labels[i]);
+        vm_stmt_block(stmt->switch_stmt.cases[i].block);
+        vm_jump(VM_JMP, 0, end);
+    }
+    buf__hdr(vm_break_labels)->len--;
+    vm_bind_label(end);
+    buf_free(labels);
+}
+
+void vm_stmt(Stmt *stmt) {
+    uint32_t mark = vm_reg_top;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        vm_return(stmt->expr);
+        break;
+    case STMT_BREAK:
+        vm_jump(VM_JMP, 0, vm_break_labels[buf_len(vm_break_labels) - 1]);
+        break;
+    case STMT_CONTINUE:
+        vm_jump(VM_JMP, 0, vm_continue_labels[buf_len(vm_continue_labels) - 1]);
+        break;
+    case STMT_BLOCK:
+        vm_stmt_block(stmt->block);
+        break;
+    case STMT_IF: {
+        int end = vm_new_label();
+        int next = vm_new_label();
+        vm_cond_jump(stmt->if_stmt.cond, false, next);
+        vm_stmt_block(stmt->if_stmt.then_block);
+        vm_jump(VM_JMP, 0, end);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            ElseIf elseif = stmt->if_stmt.elseifs[i];
+            vm_bind_label(next);
+            next = vm_new_label();
+            vm_cond_jump(elseif.cond, false, next);
+            vm_stmt_block(elseif.block);
+            vm_jump(VM_JMP, 0, end);
+        }
+        vm_bind_label(next);
+        vm_stmt_block(stmt->if_stmt.else_block);
+        vm_bind_label(end);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE: {
+        int top = vm_new_label(), cont = vm_new_label(), end = vm_new_label();
+        buf_push(vm_break_labels, end);
+        buf_push(vm_continue_labels, cont);
+        if (stmt->kind == STMT_WHILE) {
+            vm_jump(VM_JMP, 0, cont);
+        }
+        vm_bind_label(top);
+        vm_stmt_block(stmt->while_stmt.block);
+        vm_bind_label(cont);
+        vm_cond_jump(stmt->while_stmt.cond, true, top);
+        vm_bind_label(end);
+        buf__hdr(vm_break_labels)->len--;
+        buf__hdr(vm_continue_labels)->len--;
+        break;
+    }
+    case STMT_FOR: {
+        size_t num_locals = buf_len(vm_locals);
+        int top = vm_new_label(), cont = vm_new_label(), end = vm_new_label();
+        if (stmt->for_stmt.init) {
+            vm_stmt(stmt->for_stmt.init);
+        }
+        uint32_t loop_mark = vm_reg_top;
+        buf_push(vm_break_labels, end);
+        buf_push(vm_continue_labels, cont);
+        vm_bind_label(top);
+        if (stmt->for_stmt.cond) {
+            vm_cond_jump(stmt->for_stmt.cond, false, end);
+        }
+        vm_stmt_block(stmt->for_stmt.block);
+        vm_bind_label(cont);
+        if (stmt->for_stmt.next) {
+            vm_stmt(stmt->for_stmt.next);
+            vm_reg_top = loop_mark;
+        }
+        vm_jump(VM_JMP, 0, top);
+        vm_bind_label(end);
+        buf__hdr(vm_break_labels)->len--;
+        buf__hdr(vm_continue_labels)->len--;
+        vm_pop_locals(num_locals);
+        break;
+    }
+    case STMT_SWITCH:
+        vm_switch(stmt);
+        break;
+    case STMT_ASSIGN:
+        vm_assign(stmt);
+        break;
+    case STMT_INIT:
+        vm_init_stmt(stmt);
+        // The new local keeps its register, temporaries above it are released.
+        mark = vm_reg_top;
+        if (buf_end(vm_locals)[-1].is_reg) {
+            mark = buf_end(vm_locals)[-1].loc + 1;
+        }
+        break;
+    case STMT_EXPR: {
+        uint32_t tmp = vm_alloc_reg();
+        vm_expr(stmt->expr, tmp);
+        break;
+    }
+    default:
+        assert(0);
+        break;
+    }
+    vm_reg_top = mark;
+}
+
+void vm_begin_func(void) {
+    buf_clear(vm_code);
+    buf_clear(vm_consts);
+    buf_clear(vm_locals);
+    buf_clear(vm_addr_taken);
+    vm_reg_top = 0;
+    vm_max_regs = 0;
+    vm_frame_size = 0;
+}
+
+void vm_patch_func(VmFunc *func) {
+    for (VmFixup *it = vm_fixups; it != buf_end(vm_fixups); it++) {
+        assert(vm_labels[it->label] != SIZE_MAX);
+        VmInstr *instr = vm_code + it->instr;
+        uint32_t target = (uint32_t)vm_labels[it->label];
+        instr->b = target & 0xFFFF;
+        instr->c = target >> 16;
+    }
+    buf_clear(vm_fixups);
+    buf_clear(vm_labels);
+    func->num_regs = MAX(vm_max_regs, 1);
+    func->frame_size = ALIGN_UP(vm_frame_size, 16);
+}
+
+void vm_end_func(VmFunc *func) {
+    vm_patch_func(func);
+    func->code = memdup(vm_code, buf_sizeof(vm_code));
+    func->consts = vm_consts ? memdup(vm_consts, buf_sizeof(vm_consts)) : NULL;
+}
+
+// Thunks for global initializers and compile-time calls run once, so their code goes in the AST arena. That is
+// rewound with the rest of the compilation, also when a failing evaluation longjmps past the thunk.
+void vm_end_thunk(VmFunc *func) {
+    vm_patch_func(func);
+    func->code = ast_dup(vm_code, buf_sizeof(vm_code));
+    func->consts = ast_dup(vm_consts, buf_sizeof(vm_consts));
+}
+
+void vm_compile_func(VmFunc *func) {
+    Sym *sym = func->sym;
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    resolve_func_body(sym);
+    vm_begin_func();
+    vm_ret_type = unqualify_type(type->func.ret);
+    vm_scan_block(decl->func.block);
+    if (x64_is_mem_type(vm_ret_type)) {
+        vm_alloc_reg();
+    }
+    size_t num_params = type->func.num_params;
+    for (size_t i = 0; i < num_params; i++) {
+        vm_alloc_reg();
+    }
+    uint32_t first = vm_reg_top - (uint32_t)num_params;
+    for (size_t i = 0; i < num_params; i++) {
+        const char *name = decl->func.params[i].name;
+        Type *param_type = x64_decay(type->func.params[i]);
+        VmLocal local = {name, param_type, true, first + (uint32_t)i};
+        if (x64_is_mem_type(param_type) || vm_is_addr_taken(name)) {
+            local.is_reg = false;
+            local.loc = vm_alloc_slot(type_sizeof(param_type), type_alignof(param_type));
+            uint32_t addr = vm_alloc_reg();
+            vm_emit_bc(VM_FRAME, addr, local.loc);
+            vm_store(param_type, addr, 0, first + (uint32_t)i);
+            vm_reg_top--;
+        }
+        buf_push(vm_locals, local);
+    }
+    vm_stmt_block(decl->func.block);
+    vm_emit(VM_RETV, 0, 0, 0);
+    vm_end_func(func);
+}
+
+// Foreign calls go through a trampoline that loads all System V argument registers and 16 stack slots at once.
+// Arguments are classified with the x64 backend's rules, so this only works on x86-64 hosts.
+
+#if defined(__x86_64__) && !defined(_WIN32)
+enum {
+    VM_MAX_STACK_ARGS = 16,
+};
+
+#define VM_TRAMPOLINE_PARAMS \
+    uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, \
+    double, double, double, double, double, double, double, double, \
+    uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, \
+    uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, ...
+
+#define VM_TRAMPOLINE_ARGS(ints, sses, stack) \
+    ints[0], ints[1], ints[2], ints[3], ints[4], ints[5], \
+    sses[0], sses[1], sses[2], sses[3], sses[4], sses[5], sses[6], sses[7], \
+    stack[0], stack[1], stack[2], stack[3], stack[4], stack[5], stack[6], stack[7], \
+    stack[8], stack[9], stack[10], stack[11], stack[12], stack[13], stack[14], stack[15]
+
+typedef struct VmRetII { uint64_t lo, hi; } VmRetII;
+typedef struct VmRetIS { uint64_t lo; double hi; } VmRetIS;
+typedef struct VmRetSI { double lo; uint64_t hi; } VmRetSI;
+typedef struct VmRetSS { double lo, hi; } VmRetSS;
+
+uint64_t vm_double_bits(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return bits;
+}
+
+double vm_bits_double(uint64_t bits) {
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+// args[0] holds the result address for aggregate returns and the arguments follow.
+void vm_call_foreign(VmCallSite *site, void *func, VmValue *args) {
+    uint64_t ints[X64_MAX_INT_ARGS] = {0};
+    uint64_t sses[X64_MAX_SSE_ARGS] = {0};
+    uint64_t stack[VM_MAX_STACK_ARGS] = {0};
+    int num_int = 0, num_sse = 0, num_stack = 0;
+    X64ArgInfo ret = x64_classify(site->ret_type);
+    VmValue *arg = args;
+    if (x64_is_mem_type(ret.type)) {
+        if (ret.in_memory) {
+            ints[num_int++] = args[0].u;
+        }
+        arg++;
+    }
+    for (size_t i = 0; i < site->num_args; i++, arg++) {
+        X64ArgInfo info = x64_classify(site->arg_types[i]);
+        int int_index = num_int, sse_index = num_sse;
+        x64_assign_arg_regs(&info, &num_int, &num_sse);
+        size_t size = type_sizeof(info.type);
+        if (info.in_memory) {
+            size_t num_words = ALIGN_UP(size, 8) / 8;
+            if (num_stack + num_words > VM_MAX_STACK_ARGS) {
+                fatal("Too many stack arguments in VM foreign call");
+            }
+            if (x64_is_mem_type(info.type)) {
+                memcpy(stack + num_stack, arg->p, size);
+            } else {
+                // Registers hold scalars already extended to 64 bits, which is what the callee expects in the slot.
+                stack[num_stack] = arg->u;
+            }
+            num_stack += (int)num_words;
+        } else if (info.is_vector) {
+            if (size > 8) {
+                fatal("VM foreign calls cannot pass vectors wider than 8 bytes");
+            }
+            memcpy(sses + sse_index, arg->p, size);
+        } else if (x64_is_mem_type(info.type)) {
+            for (int j = 0; j < info.num_parts; j++) {
+                uint64_t word = 0;
+                memcpy(&word, (char *)arg->p + 8*j, MIN(size - 8*j, 8));
+                if (info.parts[j] == X64_CLASS_INT) {
+                    ints[int_index++] = word;
+                } else {
+                    sses[sse_index++] = word;
+                }
+            }
+        } else if (info.parts[0] == X64_CLASS_INT) {
+            ints[int_index] = arg->u;
+        } else {
+            sses[sse_index] = arg->u;
+        }
+    }
+    double sse_args[X64_MAX_SSE_ARGS];
+    for (int i = 0; i < X64_MAX_SSE_ARGS; i++) {
+        sse_args[i] = vm_bits_double(sses[i]);
+    }
+    uint64_t result[2];
+    bool lo_sse = ret.num_sse && ret.parts[0] == X64_CLASS_SSE;
+    bool hi_sse = ret.num_parts > 1 && ret.parts[1] == X64_CLASS_SSE;
+    if (ret.is_vector || (lo_sse && (ret.num_parts == 1 || hi_sse))) {
+        VmRetSS r = ((VmRetSS (*)(VM_TRAMPOLINE_PARAMS))func)(VM_TRAMPOLINE_ARGS(ints, sse_args, stack));
+        result[0] = vm_double_bits(r.lo);
+        result[1] = vm_double_bits(r.hi);
+    } else if (lo_sse) {
+        VmRetSI r = ((VmRetSI (*)(VM_TRAMPOLINE_PARAMS))func)(VM_TRAMPOLINE_ARGS(ints, sse_args, stack));
+        result[0] = vm_double_bits(r.lo);
+        result[1] = r.hi;
+    } else if (hi_sse) {
+        VmRetIS r = ((VmRetIS (*)(VM_TRAMPOLINE_PARAMS))func)(VM_TRAMPOLINE_ARGS(ints, sse_args, stack));
+        result[0] = r.lo;
+        result[1] = vm_double_bits(r.hi);
+    } else {
+        VmRetII r = ((VmRetII (*)(VM_TRAMPOLINE_PARAMS))func)(VM_TRAMPOLINE_ARGS(ints, sse_args, stack));
+        result[0] = r.lo;
+        result[1] = r.hi;
+    }
+    if (x64_is_mem_type(ret.type)) {
+        if (!ret.in_memory) {
+            memcpy(args[0].p, result, type_sizeof(ret.type));
+        }
+    } else if (ret.type->kind != TYPE_VOID) {
+        args[0].u = result[0];
+    }
+}
+#else
+void vm_call_foreign(VmCallSite *site, void *func, VmValue *args) {
+    fatal("VM foreign calls are only supported on x86-64 System V hosts");
+}
+#endif
+
+// Interpreter
+
+uint64_t vm_clz(uint64_t val, uint32_t bits) {
+    uint32_t n = 0;
+    for (uint64_t bit = 1ull << (bits - 1); bit && !(val & bit); bit >>= 1) {
+        n++;
+    }
+    return n;
+}
+
+uint64_t vm_ctz(uint64_t val) {
+    uint32_t n = 0;
+    while (n < 64 && !(val & (1ull << n))) {
+        n++;
+    }
+    return n;
+}
+
+uint64_t vm_popcount(uint64_t val) {
+    uint64_t n = 0;
+    for (; val; val &= val - 1) {
+        n++;
+    }
+    return n;
+}
+
+uint64_t vm_bswap(uint64_t val, uint32_t bits) {
+    uint64_t result = 0;
+    for (uint32_t i = 0; i < bits; i += 8) {
+        result = (result << 8) | ((val >> i) & 0xFF);
+    }
+    return result;
+}
+
+uint64_t vm_rotl(uint64_t val, uint64_t count, uint32_t bits) {
+    uint64_t mask = bits == 64 ? ~0ull : (1ull << bits) - 1;
+    count %= bits;
+    return count ? ((val << count) | (val >> (bits - count))) & mask : val;
+}
+
+void vm_flush_inits(VmValue *r, char *m);
+void vm_exec(VmFunc *func, VmValue *r, char *m);
+
+bool vm_range_contains(const char *start, size_t len, const char *ptr, size_t size) {
+    uintptr_t offset = (uintptr_t)ptr - (uintptr_t)start;
+    return (uintptr_t)ptr >= (uintptr_t)start && size <= len && offset <= len - size;
+}
+
+bool vm_arena_contains(Arena *arena, const char *ptr, size_t size) {
+    for (ArenaBlock *it = arena->blocks; it != buf_end(arena->blocks); it++) {
+        if (vm_range_contains(it->base, it->size, ptr, size)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void vm_check_mem(VmEval *eval, const char *ptr, size_t size, bool write) {
+    char *stack_end = vm_stack + VM_STACK_SIZE;
+    if (vm_range_contains(eval->stack_start, stack_end - eval->stack_start, ptr, size) ||
+        vm_range_contains(eval->result, eval->result_size, ptr, size)) {
+        return;
+    }
+    if (!write && (vm_arena_contains(&str_lit_arena, ptr, size) || vm_arena_contains(&ast_arena, ptr, size))) {
+        return;
+    }
+    fatal_error(eval->pos, "Compile-time evaluation %s %zu bytes outside its memory", write ? "wrote" : "read", size);
+}
+
+// Returns ptr after checking that an evaluation may access size bytes there.
+char *vm_mem(VmEval *eval, void *ptr, size_t size, bool write) {
+    if (eval) {
+        vm_check_mem(eval, ptr, size, write);
+    }
+    return ptr;
+}
+
+void vm_step(VmEval *eval) {
+    if (eval && --eval->steps == 0) {
+        fatal_error(eval->pos, "Compile-time evaluation did not finish within %d steps", VM_EVAL_STEPS);
+    }
+}
+
+void vm_enter(VmFunc *func, VmValue *r, char *m) {
+    if (!func->code) {
+        // Compile-time evaluation while resolving the body runs above the arguments already in place.
+        VmValue *free_regs = vm_free_regs;
+        char *free_stack = vm_free_stack;
+        vm_free_regs = r + 1 + func->sym->type->func.num_params;
+        vm_free_stack = m;
+        vm_compile_func(func);
+        vm_free_regs = free_regs;
+        vm_free_stack = free_stack;
+        vm_flush_inits(r + func->num_regs, m);
+    }
+    if (r + func->num_regs > vm_regs + VM_MAX_REGS || m + func->frame_size > vm_stack + VM_STACK_SIZE) {
+        vm_fail("VM stack overflow in %s", func->sym ? func->sym->name : "initializer");
+    }
+    vm_exec(func, r, m);
+}
+
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+uint64_t vm_div_zero(void) {
+    vm_fail("Division by zero");
+    return 0;
+}
+
+void vm_exec(VmFunc *func, VmValue *r, char *m) {
+    VmInstr *code = func->code;
+    VmValue *k = func->consts;
+    char *next_m = m + func->frame_size;
+    VmInstr *ip = code;
+    VmEval *eval = vm_eval;
+#define A r[ip->a]
+#define B r[ip->b]
+#define C r[ip->c]
+#if VM_COMPUTED_GOTO
+    static void *labels[] = {
+#define X(name) &&op_##name,
+        VM_OPS(X)
+#undef X
+    };
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *labels[ip->op]
+#define VM_BEGIN() VM_DISPATCH();
+#define VM_END()
+#else
+#define VM_CASE(name) case VM_##name:
+#define VM_DISPATCH() continue
+#define VM_BEGIN() for (;;) switch (ip->op) {
+#define VM_END() default: assert(0); return; }
+#endif
+#define VM_NEXT() ip++; VM_DISPATCH()
+#define VM_BINARY(name, expr) VM_CASE(name) expr; VM_NEXT();
+    VM_BEGIN()
+    VM_CASE(MOV) A = B; VM_NEXT();
+    VM_CASE(LOADI) A.i = (int16_t)ip->b; VM_NEXT();
+    VM_CASE(LOADK) A = k[VM_BC(ip)]; VM_NEXT();
+    VM_CASE(FRAME) A.p = m + VM_BC(ip); VM_NEXT();
+    VM_CASE(ADDI) A.u = B.u + ip->c; VM_NEXT();
+    VM_CASE(JMP) vm_step(eval); ip = code + VM_BC(ip); VM_DISPATCH();
+    VM_CASE(JZ) vm_step(eval); ip = A.u ? ip + 1 : code + VM_BC(ip); VM_DISPATCH();
+    VM_CASE(JNZ) vm_step(eval); ip = A.u ? code + VM_BC(ip) : ip + 1; VM_DISPATCH();
+    VM_BINARY(ADD, A.u = B.u + C.u)
+    VM_BINARY(SUB, A.u = B.u - C.u)
+    VM_BINARY(MUL, A.u = B.u * C.u)
+    VM_BINARY(DIVS, A.i = C.i ? (C.i == -1 ? (int64_t)(0 - B.u) : B.i / C.i) : (int64_t)vm_div_zero())
+    VM_BINARY(DIVU, A.u = C.u ? B.u / C.u : vm_div_zero())
+    VM_BINARY(MODS, A.i = C.i && C.i != -1 ? B.i % C.i : C.i ? 0 : (int64_t)vm_div_zero())
+    VM_BINARY(MODU, A.u = C.u ? B.u % C.u : vm_div_zero())
+    VM_BINARY(AND, A.u = B.u & C.u)
+    VM_BINARY(OR, A.u = B.u | C.u)
+    VM_BINARY(XOR, A.u = B.u ^ C.u)
+    VM_BINARY(SHL, A.u = B.u << (C.u & 63))
+    VM_BINARY(SHRS, A.i = B.i >> (C.u & 63))
+    VM_BINARY(SHRU, A.u = B.u >> (C.u & 63))
+    VM_BINARY(NEG, A.u = 0 - B.u)
+    VM_BINARY(BNOT, A.u = ~B.u)
+    VM_BINARY(LNOT, A.u = !B.u)
+    VM_BINARY(BOOL, A.u = B.u != 0)
+    VM_BINARY(EQ, A.u = B.u == C.u)
+    VM_BINARY(NE, A.u = B.u != C.u)
+    VM_BINARY(LTS, A.u = B.i < C.i)
+    VM_BINARY(LES, A.u = B.i <= C.i)
+    VM_BINARY(LTU, A.u = B.u < C.u)
+    VM_BINARY(LEU, A.u = B.u <= C.u)
+    VM_BINARY(ADDF, A.f = B.f + C.f)
+    VM_BINARY(SUBF, A.f = B.f - C.f)
+    VM_BINARY(MULF, A.f = B.f * C.f)
+    VM_BINARY(DIVF, A.f = B.f / C.f)
+    VM_BINARY(NEGF, A.f = -B.f)
+    VM_BINARY(EQF, A.u = B.f == C.f)
+    VM_BINARY(NEF, A.u = B.f != C.f)
+    VM_BINARY(LTF, A.u = B.f < C.f)
+    VM_BINARY(LEF, A.u = B.f <= C.f)
+    VM_BINARY(BOOLF, A.u = B.f != 0)
+    VM_BINARY(ADDD, A.d = B.d + C.d)
+    VM_BINARY(SUBD, A.d = B.d - C.d)
+    VM_BINARY(MULD, A.d = B.d * C.d)
+    VM_BINARY(DIVD, A.d = B.d / C.d)
+    VM_BINARY(NEGD, A.d = -B.d)
+    VM_BINARY(EQD, A.u = B.d == C.d)
+    VM_BINARY(NED, A.u = B.d != C.d)
+    VM_BINARY(LTD, A.u = B.d < C.d)
+    VM_BINARY(LED, A.u = B.d <= C.d)
+    VM_BINARY(BOOLD, A.u = B.d != 0)
+    VM_BINARY(SEXT8, A.i = (int8_t)B.u)
+    VM_BINARY(SEXT16, A.i = (int16_t)B.u)
+    VM_BINARY(SEXT32, A.i = (int32_t)B.u)
+    VM_BINARY(ZEXT8, A.u = (uint8_t)B.u)
+    VM_BINARY(ZEXT16, A.u = (uint16_t)B.u)
+    VM_BINARY(ZEXT32, A.u = (uint32_t)B.u)
+    VM_BINARY(I2F, A.f = (float)B.i)
+    VM_BINARY(U2F, A.f = (float)B.u)
+    VM_BINARY(I2D, A.d = (double)B.i)
+    VM_BINARY(U2D, A.d = (double)B.u)
+    VM_BINARY(F2I, A.i = (int64_t)B.f)
+    VM_BINARY(F2U, A.u = (uint64_t)B.f)
+    VM_BINARY(D2I, A.i = (int64_t)B.d)
+    VM_BINARY(D2U, A.u = (uint64_t)B.d)
+    VM_BINARY(F2D, A.d = B.f)
+    VM_BINARY(D2F, A.f = (float)B.d)
+#define LD(size) vm_mem(eval, (char *)B.p + ip->c, size, false)
+#define ST(size) vm_mem(eval, (char *)A.p + ip->c, size, true)
+    VM_BINARY(LD8S, A.i = *(int8_t *)LD(1))
+    VM_BINARY(LD8U, A.u = *(uint8_t *)LD(1))
+    VM_BINARY(LD16S, { int16_t v; memcpy(&v, LD(2), 2); A.i = v; })
+    VM_BINARY(LD16U, { uint16_t v; memcpy(&v, LD(2), 2); A.u = v; })
+    VM_BINARY(LD32S, { int32_t v; memcpy(&v, LD(4), 4); A.i = v; })
+    VM_BINARY(LD32U, { uint32_t v; memcpy(&v, LD(4), 4); A.u = v; })
+    VM_BINARY(LD64, memcpy(&A.u, LD(8), 8))
+    VM_BINARY(ST8, *ST(1) = (char)B.u)
+    VM_BINARY(ST16, { uint16_t v = (uint16_t)B.u; memcpy(ST(2), &v, 2); })
+    VM_BINARY(ST32, { uint32_t v = (uint32_t)B.u; memcpy(ST(4), &v, 4); })
+    VM_BINARY(ST64, memcpy(ST(8), &B.u, 8))
+#undef LD
+#undef ST
+    VM_BINARY(COPY, memmove(vm_mem(eval, A.p, k[ip->c].u, true), vm_mem(eval, B.p, k[ip->c].u, false), k[ip->c].u))
+    VM_BINARY(ZERO, memset(vm_mem(eval, A.p, k[ip->c].u, true), 0, k[ip->c].u))
+    VM_BINARY(BOUNDS, if (A.u >= k[ip->c].u) vm_fail("Index %" PRId64 " is out of bounds for an array of %" PRIu64 " elements", A.i, k[ip->c].u))
+    VM_BINARY(POPCNT, A.u = vm_popcount(B.u))
+    VM_BINARY(CLZ, A.u = vm_clz(B.u, ip->c))
+    VM_BINARY(CTZ, A.u = vm_ctz(B.u))
+    VM_BINARY(BSWAP, A.u = vm_bswap(B.u, ip->c))
+    VM_BINARY(ROTL, A.u = vm_rotl(A.u, B.u, ip->c))
+    VM_BINARY(ROTR, A.u = vm_rotl(A.u, ip->c - B.u % ip->c, ip->c))
+    VM_BINARY(STRCASE, A.i = str_switch_case(k[ip->c].p, B.p))
+    VM_CASE(CALL) vm_step(eval); vm_enter(k[ip->b].p, &A, next_m); VM_NEXT();
+    VM_CASE(CALLI) {
+        vm_step(eval);
+        VmFunc *callee = map_get(&vm_func_ptrs, B.p);
+        if (callee) {
+            vm_enter(callee, &A, next_m);
+        } else if (eval) {
+            fatal_error(eval->pos, "Compile-time evaluation called through an invalid function pointer");
+        } else {
+            vm_call_foreign(k[ip->c].p, B.p, &A);
+        }
+        VM_NEXT();
+    }
+    VM_CASE(CALLF) vm_call_foreign(k[ip->b].p, ((VmCallSite *)k[ip->b].p)->func, &A); VM_NEXT();
+    VM_CASE(RET) r[0] = A; return;
+    VM_CASE(RETV) return;
+    VM_END()
+#undef A
+#undef B
+#undef C
+#undef VM_CASE
+#undef VM_DISPATCH
+#undef VM_BEGIN
+#undef VM_END
+#undef VM_NEXT
+#undef VM_BINARY
+}
+
+void vm_init_runtime(void) {
+    if (!vm_regs) {
+        vm_regs = xcalloc(VM_MAX_REGS, sizeof(VmValue));
+        vm_stack = xmalloc(VM_STACK_SIZE);
+        vm_free_regs = vm_regs;
+        vm_free_stack = vm_stack;
+    }
+}
+
+// Drops compiled functions and global storage, which belong to the previous compilation's symbols.
+void vm_reset(void) {
+    for (size_t i = 0; i < vm_funcs.cap; i++) {
+        if (map_slot_full(&vm_funcs, i)) {
+            VmFunc *func = vm_funcs.entries[i].val;
+            free(func->code);
+            free(func->consts);
+            free(func);
+        }
+    }
+    map_clear(&vm_funcs);
+    map_clear(&vm_func_ptrs);
+    map_clear(&vm_globals);
+    arena_reset(&vm_globals_arena);
+    buf_clear(vm_pending_inits);
+    vm_free_regs = vm_regs;
+    vm_free_stack = vm_stack;
+    vm_allow_foreign = true;
+    vm_allow_globals = true;
+    vm_eval = NULL;
+}
+
+// Global initializers run as small bytecode functions in the free registers above r
+// once the function that first referenced the global has been compiled.
+void vm_flush_inits(VmValue *r, char *m) {
+    while (buf_len(vm_pending_inits)) {
+        Sym *sym = vm_pending_inits[buf_len(vm_pending_inits) - 1];
+        buf__hdr(vm_pending_inits)->len--;
+        VmFunc init = {0};
+        vm_begin_func();
+        uint32_t addr = vm_alloc_reg();
+        vm_load_ptr(addr, map_get(&vm_globals, sym));
+        vm_init(addr, 0, sym->type, sym->decl->var.expr);
+        vm_emit(VM_RETV, 0, 0, 0);
+        vm_end_thunk(&init);
+        vm_enter(&init, r, m);
+    }
+}
+
+int vm_run_main(int argc, char **argv) {
+    Sym *sym = sym_get(str_intern("main"));
+    if (!sym || sym->kind != SYM_FUNC) {
+        fatal("No main function to run");
+    }
+    vm_init_runtime();
+    VmFunc *func = vm_get_func(sym);
+    vm_regs[0].i = argc;
+    vm_regs[1].p = argv;
+    vm_enter(func, vm_regs, vm_stack);
+    fflush(stdout);
+    return (int)vm_regs[0].i;
+}
+
+// Evaluates a call with constant arguments for the resolver. Foreign calls and global variables are
+// unavailable so the result only depends on the arguments.
+const void *vm_eval_call(Expr *expr, Type *type) {
+    vm_init_runtime();
+    bool allow_foreign = vm_allow_foreign;
+    bool allow_globals = vm_allow_globals;
+    vm_allow_foreign = false;
+    vm_allow_globals = false;
+    void *result = ast_alloc(MAX(type_sizeof(type), 1));
+    VmEval *outer = vm_eval;
+    VmEval eval = {expr->pos, vm_free_stack, result, MAX(type_sizeof(type), 1), VM_EVAL_STEPS};
+    vm_eval = &eval;
+    VmFunc thunk = {0};
+    vm_begin_func();
+    uint32_t addr = vm_alloc_reg();
+    uint32_t val = vm_alloc_reg();
+    vm_load_ptr(addr, result);
+    vm_call(expr, val);
+    vm_store(type, addr, 0, val);
+    vm_emit(VM_RETV, 0, 0, 0);
+    vm_end_thunk(&thunk);
+    vm_enter(&thunk, vm_free_regs, vm_free_stack);
+    vm_eval = outer;
+    vm_allow_foreign = allow_foreign;
+    vm_allow_globals = allow_globals;
+    return result;
+}
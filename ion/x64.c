@@ -0,0 +1,2217 @@
+// Native x86-64 backend. Walks the resolved AST and emits System V machine code along with the
+// data, symbols and relocations that elf.c writes out as a relocatable object file.
+// Code generation is a simple one-pass accumulator scheme: scalars end up in rax or xmm0,
+// aggregates and vectors are passed around by address in rax, and operands are spilled to the stack.
+
+typedef enum X64Reg {
+    X64_RAX,
+    X64_RCX,
+    X64_RDX,
+    X64_RBX,
+    X64_RSP,
+    X64_RBP,
+    X64_RSI,
+    X64_RDI,
+    X64_R8,
+    X64_R9,
+    X64_R10,
+    X64_R11,
+} X64Reg;
+
+typedef enum X64Cond {
+    X64_O,
+    X64_NO,
+    X64_B,
+    X64_AE,
+    X64_E,
+    X64_NE,
+    X64_BE,
+    X64_A,
+    X64_S,
+    X64_NS,
+    X64_P,
+    X64_NP,
+    X64_L,
+    X64_GE,
+    X64_LE,
+    X64_G,
+} X64Cond;
+
+typedef enum X64Section {
+    X64_TEXT,
+    X64_DATA,
+    X64_BSS,
+    X64_RODATA,
+    NUM_X64_SECTIONS,
+} X64Section;
+
+typedef enum X64RelocKind {
+    X64_RELOC_ABS64,
+    X64_RELOC_PC32,
+    X64_RELOC_PLT32,
+    X64_RELOC_GOTPCREL,
+} X64RelocKind;
+
+typedef struct X64Sym {
+    const char *name;
+    X64Section section;
+    size_t offset;
+    size_t size;
+    bool is_defined;
+    bool is_func;
+    bool is_local;
+} X64Sym;
+
+typedef struct X64Reloc {
+    X64Section section;
+    size_t offset;
+    X64RelocKind kind;
+    size_t sym;
+    long long addend;
+} X64Reloc;
+
+char *x64_sections[NUM_X64_SECTIONS];
+size_t x64_section_aligns[NUM_X64_SECTIONS];
+size_t x64_bss_size;
+X64Sym *x64_syms;
+Map x64_sym_map;
+Map x64_str_map;
+X64Reloc *x64_relocs;
+
+int x64_int_arg_regs[] = {X64_RDI, X64_RSI, X64_RDX, X64_RCX, X64_R8, X64_R9};
+
+enum {
+    X64_MAX_INT_ARGS = sizeof(x64_int_arg_regs) / sizeof(*x64_int_arg_regs),
+    X64_MAX_SSE_ARGS = 8,
+};
+
+size_t x64_sym_index(const char *name) {
+    uintptr_t index = (uintptr_t)map_get(&x64_sym_map, (void *)name);
+    if (index) {
+        return index - 1;
+    }
+    buf_push(x64_syms, (X64Sym){.name = name});
+    map_put(&x64_sym_map, (void *)name, (void *)(uintptr_t)buf_len(x64_syms));
+    return buf_len(x64_syms) - 1;
+}
+
+void x64_define_sym(const char *name, X64Section section, size_t offset, size_t size, bool is_func) {
+    size_t index = x64_sym_index(name);
+    X64Sym *sym = x64_syms + index;
+    assert(!sym->is_defined);
+    sym->section = section;
+    sym->offset = offset;
+    sym->size = size;
+    sym->is_defined = true;
+    sym->is_func = is_func;
+}
+
+size_t x64_section_alloc(X64Section section, size_t size, size_t align) {
+    x64_section_aligns[section] = MAX(x64_section_aligns[section], align);
+    if (section == X64_BSS) {
+        x64_bss_size = ALIGN_UP(x64_bss_size, align);
+        size_t offset = x64_bss_size;
+        x64_bss_size += size;
+        return offset;
+    }
+    char **buf = &x64_sections[section];
+    size_t offset = ALIGN_UP(buf_len(*buf), align);
+    buf_fit(*buf, offset + size);
+    memset(*buf + buf_len(*buf), 0, offset + size - buf_len(*buf));
+    buf__hdr(*buf)->len = offset + size;
+    return offset;
+}
+
+void x64_add_reloc(X64Section section, size_t offset, X64RelocKind kind, size_t sym, long long addend) {
+    buf_push(x64_relocs, (X64Reloc){section, offset, kind, sym, addend});
+}
+
+size_t x64_str_sym(const char *str) {
+    str = str_intern(str);
+    uintptr_t index = (uintptr_t)map_get(&x64_str_map, (void *)str);
+    if (index) {
+        return index - 1;
+    }
+    size_t len = strlen(str) + 1;
+    size_t offset = x64_section_alloc(X64_RODATA, len, 1);
+    memcpy(x64_sections[X64_RODATA] + offset, str, len);
+    size_t sym = x64_sym_index(str_intern(strf(".Lstr%zu", x64_str_map.len)));
+    x64_define_sym(x64_syms[sym].name, X64_RODATA, offset, len, false);
+    x64_syms[sym].is_local = true;
+    map_put(&x64_str_map, (void *)str, (void *)(uintptr_t)(sym + 1));
+    return sym;
+}
+
+// Read-only data for compile-time evaluated call results.
+size_t x64_const_data_sym(const void *data, Type *type) {
+    size_t size = type_sizeof(type);
+    size_t offset = x64_section_alloc(X64_RODATA, size, type_alignof(type));
+    memcpy(x64_sections[X64_RODATA] + offset, data, size);
+    size_t sym = x64_sym_index(str_intern(strf(".Lconst%zu", buf_len(x64_syms))));
+    x64_define_sym(x64_syms[sym].name, X64_RODATA, offset, size, false);
+    x64_syms[sym].is_local = true;
+    return sym;
+}
+
+// Instruction encoding
+
+size_t x64_pos(void) {
+    return buf_len(x64_sections[X64_TEXT]);
+}
+
+void x64_emit8(uint8_t byte) {
+    buf_push(x64_sections[X64_TEXT], (char)byte);
+}
+
+void x64_emit32(uint32_t val) {
+    for (int i = 0; i < 4; i++) {
+        x64_emit8((uint8_t)(val >> 8*i));
+    }
+}
+
+void x64_emit64(uint64_t val) {
+    x64_emit32((uint32_t)val);
+    x64_emit32((uint32_t)(val >> 32));
+}
+
+void x64_patch32(size_t offset, uint32_t val) {
+    memcpy(x64_sections[X64_TEXT] + offset, &val, sizeof(val));
+}
+
+void x64_rex(bool w, int reg, int base) {
+    uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+    if (rex != 0x40) {
+        x64_emit8(rex);
+    }
+}
+
+void x64_opcode(uint32_t op) {
+    if (op > 0xFFFF) {
+        x64_emit8((uint8_t)(op >> 16));
+    }
+    if (op > 0xFF) {
+        x64_emit8((uint8_t)(op >> 8));
+    }
+    x64_emit8((uint8_t)op);
+}
+
+// op reg, [base + disp32]
+void x64_op_mem(uint8_t prefix, bool w, uint32_t op, int reg, int base, int32_t disp) {
+    if (prefix) {
+        x64_emit8(prefix);
+    }
+    x64_rex(w, reg, base);
+    x64_opcode(op);
+    x64_emit8(0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == X64_RSP) {
+        x64_emit8(0x24);
+    }
+    x64_emit32((uint32_t)disp);
+}
+
+// op reg, rm
+void x64_op_reg(uint8_t prefix, bool w, uint32_t op, int reg, int rm) {
+    if (prefix) {
+        x64_emit8(prefix);
+    }
+    x64_rex(w, reg, rm);
+    x64_opcode(op);
+    x64_emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op reg, [rip + sym]. The displacement must be the last field of the instruction.
+void x64_op_rip(uint8_t prefix, bool w, uint32_t op, int reg, size_t sym, X64RelocKind kind) {
+    if (prefix) {
+        x64_emit8(prefix);
+    }
+    x64_rex(w, reg, 0);
+    x64_opcode(op);
+    x64_emit8(0x05 | ((reg & 7) << 3));
+    x64_add_reloc(X64_TEXT, x64_pos(), kind, sym, -4);
+    x64_emit32(0);
+}
+
+void x64_mov_rr(int dst, int src) {
+    x64_op_reg(0, true, 0x89, src, dst);
+}
+
+void x64_mov_imm(int reg, unsigned long long imm) {
+    if (imm <= UINT32_MAX) {
+        x64_rex(false, 0, reg);
+        x64_emit8(0xB8 + (reg & 7));
+        x64_emit32((uint32_t)imm);
+    } else if ((long long)imm < 0 && (long long)imm >= INT32_MIN) {
+        x64_op_reg(0, true, 0xC7, 0, reg);
+        x64_emit32((uint32_t)imm);
+    } else {
+        x64_rex(true, 0, reg);
+        x64_emit8(0xB8 + (reg & 7));
+        x64_emit64(imm);
+    }
+}
+
+void x64_lea(int reg, int base, int32_t disp) {
+    x64_op_mem(0, true, 0x8D, reg, base, disp);
+}
+
+void x64_add_imm(int reg, int32_t imm) {
+    if (imm) {
+        x64_op_reg(0, true, 0x81, 0, reg);
+        x64_emit32((uint32_t)imm);
+    }
+}
+
+void x64_imul_imm(int reg, int32_t imm) {
+    if (imm != 1) {
+        x64_op_reg(0, true, 0x69, reg, reg);
+        x64_emit32((uint32_t)imm);
+    }
+}
+
+void x64_setcc(X64Cond cond) {
+    x64_op_reg(0, false, 0x0F90 + cond, 0, X64_RAX);
+    x64_op_reg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+}
+
+void x64_rep_movsb(size_t size) {
+    x64_mov_imm(X64_RCX, size);
+    x64_emit8(0xF3);
+    x64_emit8(0xA4);
+}
+
+// Copies size bytes from the address in rax to [base + disp].
+void x64_copy(int base, int32_t disp, size_t size) {
+    x64_lea(X64_RDI, base, disp);
+    x64_mov_rr(X64_RSI, X64_RAX);
+    x64_rep_movsb(size);
+}
+
+void x64_zero(int32_t offset, size_t size) {
+    x64_lea(X64_RDI, X64_RBP, offset);
+    x64_op_reg(0, false, 0x31, X64_RAX, X64_RAX);
+    x64_mov_imm(X64_RCX, size);
+    x64_emit8(0xF3);
+    x64_emit8(0xAA);
+}
+
+// Function state
+
+typedef struct X64Local {
+    const char *name;
+    Type *type;
+    int32_t offset;
+} X64Local;
+
+typedef struct X64Fixup {
+    size_t offset;
+    int label;
+} X64Fixup;
+
+X64Local *x64_locals;
+size_t *x64_labels;
+X64Fixup *x64_fixups;
+int *x64_break_labels;
+int *x64_continue_labels;
+int x64_depth;
+int32_t x64_frame_size;
+size_t x64_frame_align;
+size_t x64_max_slot_align;
+int32_t x64_saved_rsp_offset;
+Type *x64_ret_type;
+int x64_ret_label;
+int32_t x64_ret_ptr_offset;
+
+int32_t x64_alloc_slot(size_t size, size_t align) {
+    // Stricter alignment than the frame's is capped here; x64_gen_func then regenerates the function with a realigned frame.
+    align = MAX(align, 1);
+    x64_max_slot_align = MAX(x64_max_slot_align, align);
+    align = MIN(align, x64_frame_align);
+    x64_frame_size = (int32_t)ALIGN_UP(x64_frame_size + size, align);
+    return -x64_frame_size;
+}
+
+X64Local *x64_get_local(const char *name) {
+    for (X64Local *it = buf_end(x64_locals); it != x64_locals; it--) {
+        if (it[-1].name == name) {
+            return it - 1;
+        }
+    }
+    return NULL;
+}
+
+void x64_push_local(const char *name, Type *type, int32_t offset) {
+    buf_push(x64_locals, (X64Local){name, type, offset});
+}
+
+void x64_pop_locals(size_t num_locals) {
+    if (x64_locals) {
+        buf__hdr(x64_locals)->len = num_locals;
+    }
+}
+
+int x64_new_label(void) {
+    buf_push(x64_labels, SIZE_MAX);
+    return (int)buf_len(x64_labels) - 1;
+}
+
+void x64_bind_label(int label) {
+    x64_labels[label] = x64_pos();
+}
+
+void x64_jmp(int label) {
+    x64_emit8(0xE9);
+    buf_push(x64_fixups, (X64Fixup){x64_pos(), label});
+    x64_emit32(0);
+}
+
+void x64_jcc(X64Cond cond, int label) {
+    x64_emit8(0x0F);
+    x64_emit8(0x80 + cond);
+    buf_push(x64_fixups, (X64Fixup){x64_pos(), label});
+    x64_emit32(0);
+}
+
+void x64_resolve_fixups(void) {
+    for (X64Fixup *it = x64_fixups; it != buf_end(x64_fixups); it++) {
+        assert(x64_labels[it->label] != SIZE_MAX);
+        x64_patch32(it->offset, (uint32_t)(x64_labels[it->label] - (it->offset + 4)));
+    }
+    buf_clear(x64_fixups);
+    buf_clear(x64_labels);
+}
+
+void x64_push(int reg) {
+    x64_rex(false, 0, reg);
+    x64_emit8(0x50 + (reg & 7));
+    x64_depth += 8;
+}
+
+void x64_pop(int reg) {
+    x64_rex(false, 0, reg);
+    x64_emit8(0x58 + (reg & 7));
+    x64_depth -= 8;
+}
+
+void x64_sub_rsp(int32_t size) {
+    if (size) {
+        x64_op_reg(0, true, 0x81, 5, X64_RSP);
+        x64_emit32((uint32_t)size);
+        x64_depth += size;
+    }
+}
+
+void x64_add_rsp(int32_t size) {
+    x64_add_imm(X64_RSP, size);
+    x64_depth -= size;
+}
+
+// Types
+
+bool x64_is_mem_type(Type *type) {
+    type = unqualify_type(type);
+    return type->kind == TYPE_STRUCT || type->kind == TYPE_UNION || type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR;
+}
+
+bool x64_is_signed(Type *type) {
+    // Plain char is signed in the System V ABI.
+    return is_signed_type(type) || type->kind == TYPE_CHAR;
+}
+
+Type *x64_decay(Type *type) {
+    type = unqualify_type(type);
+    if (type->kind == TYPE_ARRAY && !is_soa_array_type(type)) {
+        return type_ptr(type->base);
+    }
+    return type;
+}
+
+Type *x64_unify(Type *left, Type *right) {
+    Operand left_operand = operand_rvalue(left);
+    Operand right_operand = operand_rvalue(right);
+    unify_arithmetic_operands(&left_operand, &right_operand);
+    return left_operand.type;
+}
+
+Type *x64_promote(Type *type) {
+    Operand operand = operand_rvalue(type);
+    promote_operand(&operand);
+    return operand.type;
+}
+
+size_t x64_elem_size(Type *ptr) {
+    assert(is_ptr_type(ptr));
+    Type *base = unqualify_type(ptr->base);
+    if (base->kind == TYPE_VOID || base->kind == TYPE_FUNC) {
+        return 1;
+    }
+    complete_type(base);
+    return type_sizeof(base);
+}
+
+long long x64_const_int(Expr *expr) {
+    Operand operand = resolve_const_expr(expr);
+    if (!cast_operand(&operand, type_llong)) {
+        fatal_error(expr->pos, "Expected integer constant expression");
+    }
+    return operand.val.ll;
+}
+
+unsigned long long x64_const_val(Type *type, Val val) {
+    Operand operand = operand_const(type, val);
+    cast_operand(&operand, x64_is_signed(operand.type) ? type_llong : type_ullong);
+    return operand.val.ull;
+}
+
+// Loads and stores
+
+void x64_load(Type *type, int base, int32_t disp) {
+    type = unqualify_type(type);
+    if (x64_is_mem_type(type)) {
+        if (base != X64_RAX || disp != 0) {
+            x64_lea(X64_RAX, base, disp);
+        }
+        return;
+    }
+    switch (type->kind) {
+    case TYPE_FLOAT:
+        x64_op_mem(0xF3, false, 0x0F10, 0, base, disp);
+        return;
+    case TYPE_DOUBLE:
+        x64_op_mem(0xF2, false, 0x0F10, 0, base, disp);
+        return;
+    default:
+        break;
+    }
+    bool is_signed = x64_is_signed(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        x64_op_mem(0, is_signed, is_signed ? 0x0FBE : 0x0FB6, X64_RAX, base, disp);
+        break;
+    case 2:
+        x64_op_mem(0, is_signed, is_signed ? 0x0FBF : 0x0FB7, X64_RAX, base, disp);
+        break;
+    case 4:
+        x64_op_mem(0, is_signed, is_signed ? 0x63 : 0x8B, X64_RAX, base, disp);
+        break;
+    case 8:
+        x64_op_mem(0, true, 0x8B, X64_RAX, base, disp);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void x64_store(Type *type, int base, int32_t disp) {
+    type = unqualify_type(type);
+    if (x64_is_mem_type(type)) {
+        x64_copy(base, disp, type_sizeof(type));
+        return;
+    }
+    switch (type->kind) {
+    case TYPE_FLOAT:
+        x64_op_mem(0xF3, false, 0x0F11, 0, base, disp);
+        return;
+    case TYPE_DOUBLE:
+        x64_op_mem(0xF2, false, 0x0F11, 0, base, disp);
+        return;
+    default:
+        break;
+    }
+    switch (type_sizeof(type)) {
+    case 1:
+        x64_op_mem(0, false, 0x88, X64_RAX, base, disp);
+        break;
+    case 2:
+        x64_op_mem(0x66, false, 0x89, X64_RAX, base, disp);
+        break;
+    case 4:
+        x64_op_mem(0, false, 0x89, X64_RAX, base, disp);
+        break;
+    case 8:
+        x64_op_mem(0, true, 0x89, X64_RAX, base, disp);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void x64_load_xmm(int xmm, int base, int32_t disp, size_t size) {
+    x64_op_mem(size == 16 ? 0 : size == 8 ? 0xF2 : 0xF3, false, 0x0F10, xmm, base, disp);
+}
+
+void x64_store_xmm(int xmm, int base, int32_t disp, size_t size) {
+    x64_op_mem(size == 16 ? 0 : size == 8 ? 0xF2 : 0xF3, false, 0x0F11, xmm, base, disp);
+}
+
+void x64_load_int_part(int reg, int base, int32_t disp, size_t size) {
+    if (size > 4) {
+        x64_op_mem(0, true, 0x8B, reg, base, disp);
+    } else if (size > 2) {
+        x64_op_mem(0, false, 0x8B, reg, base, disp);
+    } else {
+        x64_op_mem(0, false, size == 2 ? 0x0FB7 : 0x0FB6, reg, base, disp);
+    }
+}
+
+void x64_push_value(Type *type) {
+    if (is_floating_type(unqualify_type(type))) {
+        x64_sub_rsp(8);
+        x64_op_mem(0xF2, false, 0x0F11, 0, X64_RSP, 0);
+    } else {
+        x64_push(X64_RAX);
+    }
+}
+
+void x64_pop_value(Type *type, int index) {
+    if (is_floating_type(unqualify_type(type))) {
+        x64_op_mem(0xF2, false, 0x0F10, index, X64_RSP, 0);
+        x64_add_rsp(8);
+    } else {
+        x64_pop(index == 0 ? X64_RAX : X64_RCX);
+    }
+}
+
+// Moves the current value into the second operand register (rcx or xmm1).
+void x64_move_to_second(Type *type) {
+    if (is_floating_type(unqualify_type(type))) {
+        x64_op_reg(0, false, 0x0F28, 1, 0);
+    } else {
+        x64_mov_rr(X64_RCX, X64_RAX);
+    }
+}
+
+// Conversions
+
+// Integer values are kept sign- or zero-extended to 64 bits according to their type.
+void x64_normalize(Type *type) {
+    type = unqualify_type(type);
+    if (!is_integer_type(type)) {
+        return;
+    }
+    bool is_signed = x64_is_signed(type);
+    switch (type_sizeof(type)) {
+    case 1:
+        x64_op_reg(0, is_signed, is_signed ? 0x0FBE : 0x0FB6, X64_RAX, X64_RAX);
+        break;
+    case 2:
+        x64_op_reg(0, is_signed, is_signed ? 0x0FBF : 0x0FB7, X64_RAX, X64_RAX);
+        break;
+    case 4:
+        if (is_signed) {
+            x64_op_reg(0, true, 0x63, X64_RAX, X64_RAX);
+        } else {
+            x64_op_reg(0, false, 0x89, X64_RAX, X64_RAX);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void x64_float_to_bool(bool is_double) {
+    x64_op_reg(0, false, 0x0F57, 1, 1);
+    x64_op_reg(is_double ? 0x66 : 0, false, 0x0F2E, 0, 1);
+    x64_op_reg(0, false, 0x0F90 + X64_NE, 0, X64_RAX);
+    x64_op_reg(0, false, 0x0F90 + X64_P, 0, X64_RCX);
+    x64_op_reg(0, false, 0x08, X64_RCX, X64_RAX);
+    x64_op_reg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+}
+
+void x64_load_float_const(int xmm, Type *type, double val) {
+    if (unqualify_type(type)->kind == TYPE_DOUBLE) {
+        uint64_t bits;
+        memcpy(&bits, &val, sizeof(bits));
+        x64_mov_imm(X64_RAX, bits);
+        x64_op_reg(0x66, true, 0x0F6E, xmm, X64_RAX);
+    } else {
+        float f = (float)val;
+        uint32_t bits;
+        memcpy(&bits, &f, sizeof(bits));
+        x64_mov_imm(X64_RAX, bits);
+        x64_op_reg(0x66, false, 0x0F6E, xmm, X64_RAX);
+    }
+}
+
+void x64_gen_convert(Type *from, Type *to) {
+    from = x64_decay(from);
+    to = unqualify_type(to);
+    if (from == to || to->kind == TYPE_VOID || x64_is_mem_type(from) || x64_is_mem_type(to)) {
+        return;
+    }
+    if (to->kind == TYPE_BOOL) {
+        if (is_floating_type(from)) {
+            x64_float_to_bool(from->kind == TYPE_DOUBLE);
+        } else {
+            x64_op_reg(0, true, 0x85, X64_RAX, X64_RAX);
+            x64_setcc(X64_NE);
+        }
+    } else if (is_floating_type(to)) {
+        uint8_t prefix = to->kind == TYPE_DOUBLE ? 0xF2 : 0xF3;
+        if (is_floating_type(from)) {
+            x64_op_reg(from->kind == TYPE_DOUBLE ? 0xF2 : 0xF3, false, 0x0F5A, 0, 0);
+        } else if (type_sizeof(from) == 8 && !x64_is_signed(from)) {
+            // Values with the top bit set are halved (keeping the low bit for rounding) and doubled afterwards.
+            int big = x64_new_label(), done = x64_new_label();
+            x64_op_reg(0, true, 0x85, X64_RAX, X64_RAX);
+            x64_jcc(X64_S, big);
+            x64_op_reg(prefix, true, 0x0F2A, 0, X64_RAX);
+            x64_jmp(done);
+            x64_bind_label(big);
+            x64_mov_rr(X64_RCX, X64_RAX);
+            x64_op_reg(0, true, 0xD1, 5, X64_RCX);
+            x64_op_reg(0, false, 0x83, 4, X64_RAX);
+            x64_emit8(1);
+            x64_op_reg(0, true, 0x09, X64_RAX, X64_RCX);
+            x64_op_reg(prefix, true, 0x0F2A, 0, X64_RCX);
+            x64_op_reg(prefix, false, 0x0F58, 0, 0);
+            x64_bind_label(done);
+        } else {
+            x64_op_reg(prefix, true, 0x0F2A, 0, X64_RAX);
+        }
+    } else if (is_floating_type(from) && type_sizeof(to) == 8 && !x64_is_signed(to)) {
+        // Values at or above 2^63 are rebased below it before truncating and the top bit is restored after.
+        bool is_double = from->kind == TYPE_DOUBLE;
+        uint8_t prefix = is_double ? 0xF2 : 0xF3;
+        int big = x64_new_label(), done = x64_new_label();
+        x64_load_float_const(1, from, 9223372036854775808.0);
+        x64_op_reg(is_double ? 0x66 : 0, false, 0x0F2E, 0, 1);
+        x64_jcc(X64_AE, big);
+        x64_op_reg(prefix, true, 0x0F2C, X64_RAX, 0);
+        x64_jmp(done);
+        x64_bind_label(big);
+        x64_op_reg(prefix, false, 0x0F5C, 0, 1);
+        x64_op_reg(prefix, true, 0x0F2C, X64_RAX, 0);
+        x64_mov_imm(X64_RCX, 0x8000000000000000ull);
+        x64_op_reg(0, true, 0x31, X64_RCX, X64_RAX);
+        x64_bind_label(done);
+    } else {
+        if (is_floating_type(from)) {
+            x64_op_reg(from->kind == TYPE_DOUBLE ? 0xF2 : 0xF3, true, 0x0F2C, X64_RAX, 0);
+        }
+        x64_normalize(to);
+    }
+}
+
+// Expressions
+
+void x64_gen_expr(Expr *expr);
+void x64_gen_init(int32_t offset, Type *type, Expr *expr);
+
+void x64_gen_global_addr(Sym *sym) {
+    size_t index = x64_sym_index(sym->name);
+    if (sym->decl && is_decl_foreign(sym->decl)) {
+        x64_op_rip(0, true, 0x8B, X64_RAX, index, X64_RELOC_GOTPCREL);
+    } else {
+        x64_op_rip(0, true, 0x8D, X64_RAX, index, X64_RELOC_PC32);
+    }
+}
+
+void x64_gen_cond_jump(Expr *expr, bool jump_if_true, int label) {
+    x64_gen_expr(expr);
+    Type *type = x64_decay(expr->type);
+    if (is_floating_type(type)) {
+        x64_op_reg(0, false, 0x0F57, 1, 1);
+        x64_op_reg(type->kind == TYPE_DOUBLE ? 0x66 : 0, false, 0x0F2E, 0, 1);
+        if (jump_if_true) {
+            x64_jcc(X64_NE, label);
+            x64_jcc(X64_P, label);
+        } else {
+            int skip = x64_new_label();
+            x64_jcc(X64_P, skip);
+            x64_jcc(X64_E, label);
+            x64_bind_label(skip);
+        }
+    } else {
+        x64_op_reg(0, true, 0x85, X64_RAX, X64_RAX);
+        x64_jcc(jump_if_true ? X64_NE : X64_E, label);
+    }
+}
+
+void x64_gen_addr(Expr *expr);
+
+void x64_gen_soa_field_addr(Expr *expr) {
+    Expr *index = expr->field.expr;
+    Type *type = unqualify_type(index->index.expr->type);
+    Type *elem = type->base;
+    int field_index = aggregate_field_index(elem, expr->field.name);
+    assert(field_index >= 0);
+    x64_gen_expr(index->index.expr);
+    x64_push(X64_RAX);
+    x64_gen_expr(index->index.index);
+    x64_imul_imm(X64_RAX, (int32_t)type_sizeof(elem->aggregate.fields[field_index].type));
+    x64_pop(X64_RCX);
+    x64_op_reg(0, true, 0x01, X64_RCX, X64_RAX);
+    x64_add_imm(X64_RAX, (int32_t)type_soa_field_offset(type, field_index));
+}
+
+void x64_gen_addr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_NAME: {
+        X64Local *local = x64_get_local(expr->name);
+        if (local) {
+            x64_lea(X64_RAX, X64_RBP, local->offset);
+        } else {
+            x64_gen_global_addr(sym_get(expr->name));
+        }
+        break;
+    }
+    case EXPR_INDEX: {
+        Type *type = unqualify_type(expr->index.expr->type);
+        x64_gen_expr(expr->index.expr);
+        x64_push(X64_RAX);
+        x64_gen_expr(expr->index.index);
+        x64_imul_imm(X64_RAX, (int32_t)(is_ptr_type(type) ? x64_elem_size(type) : type_sizeof(type->base)));
+        x64_pop(X64_RCX);
+        x64_op_reg(0, true, 0x01, X64_RCX, X64_RAX);
+        break;
+    }
+    case EXPR_FIELD: {
+        Expr *base = expr->field.expr;
+        if (base->kind == EXPR_INDEX && is_soa_array_type(unqualify_type(base->index.expr->type))) {
+            x64_gen_soa_field_addr(expr);
+            break;
+        }
+        Type *type = unqualify_type(base->type);
+        x64_gen_expr(base);
+        if (is_ptr_type(type)) {
+            type = unqualify_type(type->base);
+        }
+        complete_type(type);
+        int field_index = aggregate_field_index(type, expr->field.name);
+        assert(field_index >= 0);
+        x64_add_imm(X64_RAX, (int32_t)type->aggregate.fields[field_index].offset);
+        break;
+    }
+    case EXPR_UNARY:
+        assert(expr->unary.op == TOKEN_MUL);
+        x64_gen_expr(expr->unary.expr);
+        break;
+    case EXPR_COMPOUND: {
+        Type *type = unqualify_type(expr->type);
+        int32_t offset = x64_alloc_slot(type_sizeof(type), type_alignof(type));
+        x64_gen_init(offset, type, expr);
+        x64_lea(X64_RAX, X64_RBP, offset);
+        break;
+    }
+    default:
+        assert(x64_is_mem_type(expr->type));
+        x64_gen_expr(expr);
+        break;
+    }
+}
+
+void x64_gen_arith_op(TokenKind op, Type *type) {
+    type = unqualify_type(type);
+    if (is_floating_type(type)) {
+        bool is_double = type->kind == TYPE_DOUBLE;
+        uint8_t prefix = is_double ? 0xF2 : 0xF3;
+        uint8_t cmp_prefix = is_double ? 0x66 : 0;
+        switch (op) {
+        case TOKEN_ADD:
+            x64_op_reg(prefix, false, 0x0F58, 0, 1);
+            break;
+        case TOKEN_SUB:
+            x64_op_reg(prefix, false, 0x0F5C, 0, 1);
+            break;
+        case TOKEN_MUL:
+            x64_op_reg(prefix, false, 0x0F59, 0, 1);
+            break;
+        case TOKEN_DIV:
+            x64_op_reg(prefix, false, 0x0F5E, 0, 1);
+            break;
+        case TOKEN_LT:
+        case TOKEN_LTEQ:
+            // Compare with swapped operands so that unordered results come out false.
+            x64_op_reg(cmp_prefix, false, 0x0F2E, 1, 0);
+            x64_setcc(op == TOKEN_LT ? X64_A : X64_AE);
+            break;
+        case TOKEN_GT:
+        case TOKEN_GTEQ:
+            x64_op_reg(cmp_prefix, false, 0x0F2E, 0, 1);
+            x64_setcc(op == TOKEN_GT ? X64_A : X64_AE);
+            break;
+        case TOKEN_EQ:
+        case TOKEN_NOTEQ:
+            x64_op_reg(cmp_prefix, false, 0x0F2E, 0, 1);
+            x64_op_reg(0, false, 0x0F90 + (op == TOKEN_EQ ? X64_E : X64_NE), 0, X64_RAX);
+            x64_op_reg(0, false, 0x0F90 + (op == TOKEN_EQ ? X64_NP : X64_P), 0, X64_RCX);
+            x64_op_reg(0, false, op == TOKEN_EQ ? 0x20 : 0x08, X64_RCX, X64_RAX);
+            x64_op_reg(0, false, 0x0FB6, X64_RAX, X64_RAX);
+            break;
+        default:
+            assert(0);
+            break;
+        }
+        return;
+    }
+    bool is_signed = x64_is_signed(type);
+    switch (op) {
+    case TOKEN_ADD:
+        x64_op_reg(0, true, 0x01, X64_RCX, X64_RAX);
+        break;
+    case TOKEN_SUB:
+        x64_op_reg(0, true, 0x29, X64_RCX, X64_RAX);
+        break;
+    case TOKEN_MUL:
+        x64_op_reg(0, true, 0x0FAF, X64_RAX, X64_RCX);
+        break;
+    case TOKEN_AND:
+        x64_op_reg(0, true, 0x21, X64_RCX, X64_RAX);
+        break;
+    case TOKEN_OR:
+        x64_op_reg(0, true, 0x09, X64_RCX, X64_RAX);
+        break;
+    case TOKEN_XOR:
+        x64_op_reg(0, true, 0x31, X64_RCX, X64_RAX);
+        break;
+    case TOKEN_DIV:
+    case TOKEN_MOD: {
+        // Only 32-bit operands need 32-bit division, narrower lane types are already extended to 64 bits.
+        bool w = type_sizeof(type) != 4;
+        if (is_signed) {
+            if (w) {
+                x64_emit8(0x48);
+            }
+            x64_emit8(0x99);
+        } else {
+            x64_op_reg(0, false, 0x31, X64_RDX, X64_RDX);
+        }
+        x64_op_reg(0, w, 0xF7, is_signed ? 7 : 6, X64_RCX);
+        if (op == TOKEN_MOD) {
+            x64_mov_rr(X64_RAX, X64_RDX);
+        }
+        break;
+    }
+    case TOKEN_LSHIFT:
+        x64_op_reg(0, true, 0xD3, 4, X64_RAX);
+        break;
+    case TOKEN_RSHIFT:
+        x64_op_reg(0, true, 0xD3, is_signed ? 7 : 5, X64_RAX);
+        break;
+    case TOKEN_EQ:
+    case TOKEN_NOTEQ:
+    case TOKEN_LT:
+    case TOKEN_LTEQ:
+    case TOKEN_GT:
+    case TOKEN_GTEQ: {
+        x64_op_reg(0, true, 0x39, X64_RCX, X64_RAX);
+        X64Cond cond;
+        switch (op) {
+        case TOKEN_EQ:
+            cond = X64_E;
+            break;
+        case TOKEN_NOTEQ:
+            cond = X64_NE;
+            break;
+        case TOKEN_LT:
+            cond = is_signed ? X64_L : X64_B;
+            break;
+        case TOKEN_LTEQ:
+            cond = is_signed ? X64_LE : X64_BE;
+            break;
+        case TOKEN_GT:
+            cond = is_signed ? X64_G : X64_A;
+            break;
+        default:
+            cond = is_signed ? X64_GE : X64_AE;
+            break;
+        }
+        x64_setcc(cond);
+        return;
+    }
+    default:
+        assert(0);
+        break;
+    }
+    x64_normalize(type);
+}
+
+bool is_cmp_token(TokenKind op) {
+    return TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+}
+
+// Spills the current vector operand (an address) or scalar operand (broadcast through a stride of 0).
+int32_t x64_gen_vector_operand(Type *type, Type *vector) {
+    if (is_vector_type(type)) {
+        x64_push(X64_RAX);
+        return (int32_t)type_sizeof(vector->base);
+    }
+    x64_gen_convert(type, vector->base);
+    int32_t offset = x64_alloc_slot(8, 8);
+    x64_store(vector->base, X64_RBP, offset);
+    x64_lea(X64_RAX, X64_RBP, offset);
+    x64_push(X64_RAX);
+    return 0;
+}
+
+// Vector operations are unrolled lane by lane over memory operands.
+Type *x64_gen_vector_binary_rest(TokenKind op, Type *left_type, Expr *right) {
+    Type *right_type = unqualify_type(right->type);
+    Type *vector = is_vector_type(left_type) ? left_type : right_type;
+    Type *elem = vector->base;
+    Type *result = is_cmp_token(op) ? vector_mask_type(vector) : vector;
+    int32_t left_stride = x64_gen_vector_operand(left_type, vector);
+    x64_gen_expr(right);
+    int32_t right_stride = x64_gen_vector_operand(right_type, vector);
+    x64_pop(X64_RDI);
+    x64_pop(X64_RSI);
+    int32_t offset = x64_alloc_slot(type_sizeof(result), type_alignof(result));
+    for (size_t i = 0; i < vector->num_elems; i++) {
+        x64_load(elem, X64_RDI, right_stride * (int32_t)i);
+        x64_move_to_second(elem);
+        x64_load(elem, X64_RSI, left_stride * (int32_t)i);
+        x64_gen_arith_op(op, elem);
+        if (is_cmp_token(op)) {
+            x64_op_reg(0, true, 0xF7, 3, X64_RAX);
+        }
+        x64_store(result->base, X64_RBP, offset + (int32_t)(i * type_sizeof(elem)));
+    }
+    x64_lea(X64_RAX, X64_RBP, offset);
+    return result;
+}
+
+// Evaluates a binary operator whose left operand of type left_type is already in rax or xmm0.
+Type *x64_gen_binary_rest(TokenKind op, Type *left_type, Expr *right) {
+    left_type = x64_decay(left_type);
+    Type *right_type = x64_decay(right->type);
+    if (is_vector_type(left_type) || is_vector_type(right_type)) {
+        return x64_gen_vector_binary_rest(op, left_type, right);
+    }
+    if (is_ptr_type(left_type) || is_ptr_type(right_type) || left_type->kind == TYPE_FUNC || right_type->kind == TYPE_FUNC) {
+        x64_push(X64_RAX);
+        x64_gen_expr(right);
+        x64_mov_rr(X64_RCX, X64_RAX);
+        x64_pop(X64_RAX);
+        switch (op) {
+        case TOKEN_ADD:
+            if (is_ptr_type(left_type)) {
+                x64_imul_imm(X64_RCX, (int32_t)x64_elem_size(left_type));
+                x64_op_reg(0, true, 0x01, X64_RCX, X64_RAX);
+                return left_type;
+            } else {
+                x64_imul_imm(X64_RAX, (int32_t)x64_elem_size(right_type));
+                x64_op_reg(0, true, 0x01, X64_RCX, X64_RAX);
+                return right_type;
+            }
+        case TOKEN_SUB:
+            if (is_ptr_type(right_type)) {
+                size_t size = x64_elem_size(left_type);
+                x64_op_reg(0, true, 0x29, X64_RCX, X64_RAX);
+                if (size != 1) {
+                    x64_mov_imm(X64_RCX, size);
+                    x64_emit8(0x48);
+                    x64_emit8(0x99);
+                    x64_op_reg(0, true, 0xF7, 7, X64_RCX);
+                }
+                return type_ssize;
+            } else {
+                x64_imul_imm(X64_RCX, (int32_t)x64_elem_size(left_type));
+                x64_op_reg(0, true, 0x29, X64_RCX, X64_RAX);
+                return left_type;
+            }
+        default:
+            assert(is_cmp_token(op));
+            x64_gen_arith_op(op, type_ullong);
+            return type_int;
+        }
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        Type *type = x64_promote(left_type);
+        x64_gen_convert(left_type, type);
+        x64_push(X64_RAX);
+        x64_gen_expr(right);
+        x64_mov_rr(X64_RCX, X64_RAX);
+        x64_pop(X64_RAX);
+        x64_gen_arith_op(op, type);
+        return type;
+    }
+    Type *type = x64_unify(left_type, right_type);
+    x64_gen_convert(left_type, type);
+    x64_push_value(type);
+    x64_gen_expr(right);
+    x64_gen_convert(right_type, type);
+    x64_move_to_second(type);
+    x64_pop_value(type, 0);
+    x64_gen_arith_op(op, type);
+    return is_cmp_token(op) ? type_int : type;
+}
+
+void x64_gen_expr_binary(Expr *expr) {
+    TokenKind op = expr->binary.op;
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        bool is_and = op == TOKEN_AND_AND;
+        int short_circuit = x64_new_label(), done = x64_new_label();
+        x64_gen_cond_jump(expr->binary.left, !is_and, short_circuit);
+        x64_gen_cond_jump(expr->binary.right, !is_and, short_circuit);
+        x64_mov_imm(X64_RAX, is_and);
+        x64_jmp(done);
+        x64_bind_label(short_circuit);
+        x64_mov_imm(X64_RAX, !is_and);
+        x64_bind_label(done);
+        return;
+    }
+    x64_gen_expr(expr->binary.left);
+    x64_gen_binary_rest(op, expr->binary.left->type, expr->binary.right);
+}
+
+void x64_gen_expr_unary(Expr *expr) {
+    TokenKind op = expr->unary.op;
+    if (op == TOKEN_AND) {
+        x64_gen_addr(expr->unary.expr);
+        return;
+    } else if (op == TOKEN_MUL) {
+        x64_gen_expr(expr->unary.expr);
+        x64_load(expr->type, X64_RAX, 0);
+        return;
+    }
+    Type *type = x64_decay(expr->unary.expr->type);
+    x64_gen_expr(expr->unary.expr);
+    if (is_vector_type(type)) {
+        Type *elem = type->base;
+        int32_t offset = x64_alloc_slot(type_sizeof(type), type_alignof(type));
+        x64_mov_rr(X64_RSI, X64_RAX);
+        for (size_t i = 0; i < type->num_elems; i++) {
+            int32_t lane = (int32_t)(i * type_sizeof(elem));
+            if (op == TOKEN_ADD) {
+                x64_load(elem, X64_RSI, lane);
+            } else {
+                x64_mov_imm(X64_RAX, 0);
+                x64_gen_convert(type_int, elem);
+                x64_move_to_second(elem);
+                x64_load(elem, X64_RSI, lane);
+                if (op == TOKEN_SUB) {
+                    // 0 - x, computed as -(x - 0) to keep the sign of zero lanes right for floats.
+                    x64_gen_arith_op(TOKEN_SUB, elem);
+                    x64_move_to_second(elem);
+                    x64_mov_imm(X64_RAX, 0);
+                    x64_gen_convert(type_int, elem);
+                    if (is_floating_type(elem)) {
+                        x64_op_reg(0, false, 0x0F28, 2, 1);
+                        x64_op_reg(0, false, 0x0F28, 1, 0);
+                        x64_op_reg(0, false, 0x0F28, 0, 2);
+                    }
+                    if (is_floating_type(elem)) {
+                        x64_op_reg(elem->kind == TYPE_DOUBLE ? 0x66 : 0, false, 0x0F57, 0, 0);
+                        x64_op_reg(elem->kind == TYPE_DOUBLE ? 0x66 : 0, false, 0x0F57, 0, 1);
+                        x64_mov_imm(X64_RAX, elem->kind == TYPE_DOUBLE ? 0x8000000000000000ull : 0x80000000);
+                        x64_op_reg(0x66, elem->kind == TYPE_DOUBLE, 0x0F6E, 1, X64_RAX);
+                        x64_op_reg(elem->kind == TYPE_DOUBLE ? 0x66 : 0, false, 0x0F57, 0, 1);
+                    } else {
+                        x64_op_reg(0, true, 0xF7, 3, X64_RCX);
+                        x64_mov_rr(X64_RAX, X64_RCX);
+                        x64_normalize(elem);
+                    }
+                } else {
+                    x64_op_reg(0, true, 0xF7, 2, X64_RAX);
+                    x64_normalize(elem);
+                }
+            }
+            x64_store(elem, X64_RBP, offset + lane);
+        }
+        x64_lea(X64_RAX, X64_RBP, offset);
+        return;
+    }
+    switch (op) {
+    case TOKEN_ADD:
+        x64_gen_convert(type, expr->type);
+        break;
+    case TOKEN_SUB:
+        x64_gen_convert(type, expr->type);
+        if (is_floating_type(expr->type)) {
+            bool is_double = expr->type->kind == TYPE_DOUBLE;
+            x64_mov_imm(X64_RAX, is_double ? 0x8000000000000000ull : 0x80000000);
+            x64_op_reg(0x66, is_double, 0x0F6E, 1, X64_RAX);
+            x64_op_reg(is_double ? 0x66 : 0, false, 0x0F57, 0, 1);
+        } else {
+            x64_op_reg(0, true, 0xF7, 3, X64_RAX);
+            x64_normalize(expr->type);
+        }
+        break;
+    case TOKEN_NEG:
+        x64_gen_convert(type, expr->type);
+        x64_op_reg(0, true, 0xF7, 2, X64_RAX);
+        x64_normalize(expr->type);
+        break;
+    case TOKEN_NOT:
+        x64_gen_convert(type, type_bool);
+        x64_op_reg(0, false, 0x83, 6, X64_RAX);
+        x64_emit8(1);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void x64_gen_expr_ternary(Expr *expr) {
+    int else_label = x64_new_label(), done = x64_new_label();
+    x64_gen_cond_jump(expr->ternary.cond, false, else_label);
+    x64_gen_expr(expr->ternary.then_expr);
+    x64_gen_convert(expr->ternary.then_expr->type, expr->type);
+    x64_jmp(done);
+    x64_bind_label(else_label);
+    x64_gen_expr(expr->ternary.else_expr);
+    x64_gen_convert(expr->ternary.else_expr->type, expr->type);
+    x64_bind_label(done);
+}
+
+// System V calling convention
+
+typedef enum X64ArgClass {
+    X64_CLASS_NONE,
+    X64_CLASS_INT,
+    X64_CLASS_SSE,
+} X64ArgClass;
+
+typedef struct X64ArgInfo {
+    Type *type;
+    bool in_memory;
+    bool is_vector;
+    int num_parts;
+    X64ArgClass parts[2];
+    int num_int;
+    int num_sse;
+} X64ArgInfo;
+
+void x64_classify_parts(Type *type, size_t offset, X64ArgClass *parts) {
+    type = unqualify_type(type);
+    switch (type->kind) {
+    case TYPE_STRUCT:
+    case TYPE_UNION:
+        for (size_t i = 0; i < type->aggregate.num_fields; i++) {
+            x64_classify_parts(type->aggregate.fields[i].type, offset + type->aggregate.fields[i].offset, parts);
+        }
+        break;
+    case TYPE_ARRAY:
+    case TYPE_VECTOR:
+        for (size_t i = 0; i < type->num_elems; i++) {
+            x64_classify_parts(type->base, offset + i*type_sizeof(type->base), parts);
+        }
+        break;
+    case TYPE_FLOAT:
+    case TYPE_DOUBLE:
+        if (parts[offset/8] == X64_CLASS_NONE) {
+            parts[offset/8] = X64_CLASS_SSE;
+        }
+        break;
+    default:
+        parts[offset/8] = X64_CLASS_INT;
+        break;
+    }
+}
+
+X64ArgInfo x64_classify(Type *type) {
+    type = unqualify_type(type);
+    X64ArgInfo info = {.type = type};
+    if (type->kind == TYPE_VOID) {
+        return info;
+    }
+    size_t size = type_sizeof(type);
+    if (is_vector_type(type)) {
+        if (size == 4 || size == 8 || size == 16) {
+            info.is_vector = true;
+            info.num_sse = 1;
+        } else {
+            info.in_memory = true;
+        }
+        return info;
+    } else if (x64_is_mem_type(type)) {
+        if (size > 16 || is_soa_array_type(type)) {
+            info.in_memory = true;
+            return info;
+        }
+        info.num_parts = (int)(size + 7) / 8;
+        x64_classify_parts(type, 0, info.parts);
+    } else {
+        info.num_parts = 1;
+        info.parts[0] = is_floating_type(type) ? X64_CLASS_SSE : X64_CLASS_INT;
+    }
+    for (int i = 0; i < info.num_parts; i++) {
+        if (info.parts[i] == X64_CLASS_INT) {
+            info.num_int++;
+        } else {
+            info.parts[i] = X64_CLASS_SSE;
+            info.num_sse++;
+        }
+    }
+    return info;
+}
+
+// Size of the staging area a by-value argument occupies on the stack.
+size_t x64_arg_stack_size(X64ArgInfo *info) {
+    if (info->in_memory) {
+        return ALIGN_UP(type_sizeof(info->type), 8);
+    } else if (info->is_vector) {
+        return 16;
+    } else {
+        return 8 * info->num_parts;
+    }
+}
+
+// Assigns registers in order and demotes arguments that no longer fit to the stack.
+void x64_assign_arg_regs(X64ArgInfo *info, int *num_int, int *num_sse) {
+    if (!info->in_memory && *num_int + info->num_int <= X64_MAX_INT_ARGS && *num_sse + info->num_sse <= X64_MAX_SSE_ARGS) {
+        *num_int += info->num_int;
+        *num_sse += info->num_sse;
+    } else {
+        info->in_memory = true;
+    }
+}
+
+Type *x64_vararg_type(Type *type) {
+    type = x64_decay(type);
+    return type->kind == TYPE_FLOAT ? type_double : type;
+}
+
+void x64_gen_push_arg(Expr *arg, X64ArgInfo *info) {
+    x64_gen_expr(arg);
+    x64_gen_convert(arg->type, info->type);
+    if (x64_is_mem_type(info->type)) {
+        x64_sub_rsp((int32_t)x64_arg_stack_size(info));
+        x64_copy(X64_RSP, 0, type_sizeof(info->type));
+    } else {
+        x64_push_value(info->type);
+    }
+}
+
+void x64_gen_builtin_call(Expr *expr);
+void x64_gen_conversion_call(Expr *expr);
+
+void x64_gen_folded_call(Expr *expr) {
+    Type *type = unqualify_type(expr->type);
+    if (is_floating_type(type)) {
+        x64_load_float_const(0, type, folded_call_float(expr));
+    } else if (x64_is_mem_type(type)) {
+        x64_op_rip(0, true, 0x8D, X64_RAX, x64_const_data_sym(expr->call.folded_data, type), X64_RELOC_PC32);
+    } else {
+        x64_mov_imm(X64_RAX, expr->call.folded_val);
+        x64_normalize(type);
+    }
+}
+
+void x64_gen_call(Expr *expr) {
+    if (expr->call.folded_data) {
+        x64_gen_folded_call(expr);
+        return;
+    } else if (expr->call.builtin) {
+        x64_gen_builtin_call(expr);
+        return;
+    } else if (!expr->call.expr->type) {
+        x64_gen_conversion_call(expr);
+        return;
+    }
+    Expr *callee = expr->call.expr;
+    Type *func = unqualify_type(callee->type);
+    assert(func->kind == TYPE_FUNC);
+    Sym *direct = NULL;
+    if (callee->kind == EXPR_NAME && !x64_get_local(callee->name)) {
+        Sym *sym = sym_get(callee->name);
+        if (sym->kind == SYM_FUNC) {
+            direct = sym;
+        }
+    }
+    X64ArgInfo ret = x64_classify(func->func.ret);
+    int32_t ret_offset = 0;
+    if (x64_is_mem_type(ret.type)) {
+        ret_offset = x64_alloc_slot(ALIGN_UP(type_sizeof(ret.type), 16), type_alignof(ret.type));
+    }
+    size_t num_args = expr->call.num_args;
+    X64ArgInfo *args = NULL;
+    int num_int = ret.in_memory ? 1 : 0, num_sse = 0;
+    int32_t stack_size = 0;
+    for (size_t i = 0; i < num_args; i++) {
+        Type *type = i < func->func.num_params ? x64_decay(func->func.params[i]) : x64_vararg_type(expr->call.args[i]->type);
+        X64ArgInfo info = x64_classify(type);
+        x64_assign_arg_regs(&info, &num_int, &num_sse);
+        if (info.in_memory) {
+            stack_size += (int32_t)x64_arg_stack_size(&info);
+        }
+        buf_push(args, info);
+    }
+    if (!direct) {
+        x64_gen_expr(callee);
+        x64_push(X64_RAX);
+    }
+    int32_t pad = (x64_depth + stack_size) % 16 ? 8 : 0;
+    x64_sub_rsp(pad);
+    for (size_t i = num_args; i-- > 0;) {
+        if (args[i].in_memory) {
+            x64_gen_push_arg(expr->call.args[i], &args[i]);
+        }
+    }
+    for (size_t i = num_args; i-- > 0;) {
+        if (!args[i].in_memory) {
+            x64_gen_push_arg(expr->call.args[i], &args[i]);
+        }
+    }
+    int int_index = ret.in_memory ? 1 : 0, sse_index = 0;
+    for (size_t i = 0; i < num_args; i++) {
+        X64ArgInfo *info = &args[i];
+        if (info->in_memory) {
+            continue;
+        }
+        if (info->is_vector) {
+            x64_load_xmm(sse_index++, X64_RSP, 0, type_sizeof(info->type));
+            x64_add_rsp(16);
+            continue;
+        }
+        for (int j = 0; j < info->num_parts; j++) {
+            if (info->parts[j] == X64_CLASS_INT) {
+                x64_op_mem(0, true, 0x8B, x64_int_arg_regs[int_index++], X64_RSP, 0);
+            } else {
+                x64_op_mem(0xF2, false, 0x0F10, sse_index++, X64_RSP, 0);
+            }
+            x64_add_rsp(8);
+        }
+    }
+    buf_free(args);
+    if (ret.in_memory) {
+        x64_lea(X64_RDI, X64_RBP, ret_offset);
+    }
+    if (func->func.has_varargs) {
+        x64_mov_imm(X64_RAX, num_sse);
+    }
+    if (direct) {
+        x64_emit8(0xE8);
+        x64_add_reloc(X64_TEXT, x64_pos(), X64_RELOC_PLT32, x64_sym_index(direct->name), -4);
+        x64_emit32(0);
+        x64_add_rsp(stack_size + pad);
+    } else {
+        x64_op_mem(0, true, 0x8B, X64_R11, X64_RSP, stack_size + pad);
+        x64_op_reg(0, false, 0xFF, 2, X64_R11);
+        x64_add_rsp(stack_size + pad + 8);
+    }
+    if (ret.in_memory) {
+        x64_lea(X64_RAX, X64_RBP, ret_offset);
+    } else if (ret.is_vector) {
+        x64_store_xmm(0, X64_RBP, ret_offset, type_sizeof(ret.type));
+        x64_lea(X64_RAX, X64_RBP, ret_offset);
+    } else if (x64_is_mem_type(ret.type)) {
+        int int_reg = X64_RAX, sse_reg = 0;
+        for (int i = 0; i < ret.num_parts; i++) {
+            if (ret.parts[i] == X64_CLASS_INT) {
+                x64_op_mem(0, true, 0x89, int_reg, X64_RBP, ret_offset + 8*i);
+                int_reg = X64_RDX;
+            } else {
+                x64_op_mem(0xF2, false, 0x0F11, sse_reg++, X64_RBP, ret_offset + 8*i);
+            }
+        }
+        x64_lea(X64_RAX, X64_RBP, ret_offset);
+    } else if (ret.type->kind != TYPE_VOID) {
+        x64_normalize(ret.type);
+    }
+}
+
+void x64_gen_conversion_call(Expr *expr) {
+    Expr *arg = expr->call.args[0];
+    Type *type = unqualify_type(expr->type);
+    x64_gen_expr(arg);
+    if (is_vector_type(type) && !is_vector_type(unqualify_type(arg->type))) {
+        x64_gen_convert(arg->type, type->base);
+        int32_t offset = x64_alloc_slot(type_sizeof(type), type_alignof(type));
+        for (size_t i = 0; i < type->num_elems; i++) {
+            x64_store(type->base, X64_RBP, offset + (int32_t)(i * type_sizeof(type->base)));
+        }
+        x64_lea(X64_RAX, X64_RBP, offset);
+    } else {
+        x64_gen_convert(arg->type, type);
+    }
+}
+
+void x64_gen_builtin_call(Expr *expr) {
+    Expr **args = expr->call.args;
+    if (expr->call.is_folded) {
+        x64_mov_imm(X64_RAX, expr->call.folded_val);
+        x64_normalize(expr->type);
+        return;
+    }
+    switch (expr->call.builtin) {
+    case BUILTIN_POPCOUNT:
+    case BUILTIN_CLZ:
+    case BUILTIN_CTZ:
+    case BUILTIN_BSWAP:
+    case BUILTIN_ROTL:
+    case BUILTIN_ROTR: {
+        Type *type = builtin_int_type(args[0]->type);
+        size_t size = type_sizeof(type);
+        if (expr->call.builtin == BUILTIN_ROTL || expr->call.builtin == BUILTIN_ROTR) {
+            x64_gen_expr(args[1]);
+            x64_push(X64_RAX);
+        }
+        x64_gen_expr(args[0]);
+        x64_gen_convert(args[0]->type, type);
+        x64_normalize(unsigned_type(type));
+        switch (expr->call.builtin) {
+        case BUILTIN_POPCOUNT:
+            x64_op_reg(0xF3, true, 0x0FB8, X64_RAX, X64_RAX);
+            break;
+        case BUILTIN_CLZ:
+            x64_op_reg(0, true, 0x0FBD, X64_RAX, X64_RAX);
+            x64_mov_imm(X64_RCX, 8*size - 1);
+            x64_op_reg(0, true, 0x29, X64_RAX, X64_RCX);
+            x64_mov_rr(X64_RAX, X64_RCX);
+            break;
+        case BUILTIN_CTZ:
+            x64_op_reg(0, true, 0x0FBC, X64_RAX, X64_RAX);
+            break;
+        case BUILTIN_BSWAP:
+            if (size == 2) {
+                x64_op_reg(0x66, false, 0xC1, 0, X64_RAX);
+                x64_emit8(8);
+            } else if (size > 2) {
+                x64_rex(size == 8, 0, X64_RAX);
+                x64_emit8(0x0F);
+                x64_emit8(0xC8);
+            }
+            break;
+        default: {
+            x64_pop(X64_RCX);
+            int ext = expr->call.builtin == BUILTIN_ROTL ? 0 : 1;
+            if (size == 1) {
+                x64_op_reg(0, false, 0xD2, ext, X64_RAX);
+            } else {
+                x64_op_reg(size == 2 ? 0x66 : 0, size == 8, 0xD3, ext, X64_RAX);
+            }
+            break;
+        }
+        }
+        x64_normalize(expr->type);
+        break;
+    }
+    case BUILTIN_PREFETCH: {
+        long long rw = expr->call.num_args > 1 ? x64_const_int(args[1]) : 0;
+        long long locality = expr->call.num_args > 2 ? x64_const_int(args[2]) : 3;
+        x64_gen_expr(args[0]);
+        if (rw) {
+            x64_op_mem(0, false, 0x0F0D, 1, X64_RAX, 0);
+        } else {
+            static const int hints[] = {0, 3, 2, 1};
+            x64_op_mem(0, false, 0x0F18, hints[locality], X64_RAX, 0);
+        }
+        break;
+    }
+    case BUILTIN_EXPECT:
+        x64_gen_expr(args[1]);
+        x64_gen_expr(args[0]);
+        x64_gen_convert(args[0]->type, expr->type);
+        break;
+    case BUILTIN_LIKELY:
+    case BUILTIN_UNLIKELY:
+        x64_gen_expr(args[0]);
+        x64_gen_convert(args[0]->type, type_bool);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void x64_gen_const_sym(Sym *sym) {
+    if (x64_is_mem_type(sym->type)) {
+        x64_gen_global_addr(sym);
+    } else if (is_floating_type(sym->type)) {
+        Expr *expr = sym->decl->const_decl.expr;
+        x64_gen_expr(expr);
+        x64_gen_convert(expr->type, sym->type);
+    } else {
+        x64_mov_imm(X64_RAX, x64_const_val(sym->type, sym->val));
+    }
+}
+
+void x64_gen_expr(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_INT:
+        // Literal types are picked with host limits, so the value is kept exact rather than truncated.
+        x64_mov_imm(X64_RAX, expr->int_lit.val);
+        break;
+    case EXPR_FLOAT:
+        x64_load_float_const(0, expr->type, expr->float_lit.val);
+        break;
+    case EXPR_STR:
+        x64_op_rip(0, true, 0x8D, X64_RAX, x64_str_sym(expr->str_lit.val), X64_RELOC_PC32);
+        break;
+    case EXPR_NAME: {
+        X64Local *local = x64_get_local(expr->name);
+        if (local) {
+            x64_load(local->type, X64_RBP, local->offset);
+            break;
+        }
+        Sym *sym = sym_get(expr->name);
+        assert(sym);
+        if (sym->kind == SYM_CONST) {
+            x64_gen_const_sym(sym);
+        } else {
+            x64_gen_global_addr(sym);
+            if (sym->kind == SYM_VAR) {
+                x64_load(sym->type, X64_RAX, 0);
+            }
+        }
+        break;
+    }
+    case EXPR_CAST:
+        x64_gen_expr(expr->cast.expr);
+        x64_gen_convert(expr->cast.expr->type, expr->type);
+        break;
+    case EXPR_CALL:
+        x64_gen_call(expr);
+        break;
+    case EXPR_INDEX:
+    case EXPR_FIELD:
+    case EXPR_COMPOUND:
+        x64_gen_addr(expr);
+        x64_load(expr->type, X64_RAX, 0);
+        break;
+    case EXPR_UNARY:
+        x64_gen_expr_unary(expr);
+        break;
+    case EXPR_BINARY:
+        x64_gen_expr_binary(expr);
+        break;
+    case EXPR_TERNARY:
+        x64_gen_expr_ternary(expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        x64_mov_imm(X64_RAX, type_sizeof(expr->sizeof_expr->type));
+        break;
+    case EXPR_SIZEOF_TYPE:
+        x64_mov_imm(X64_RAX, type_sizeof(expr->sizeof_type->type));
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+void x64_gen_init(int32_t offset, Type *type, Expr *expr) {
+    type = unqualify_type(type);
+    if (expr->kind != EXPR_COMPOUND) {
+        x64_gen_expr(expr);
+        x64_gen_convert(expr->type, type);
+        x64_store(type, X64_RBP, offset);
+        return;
+    }
+    x64_zero(offset, type_sizeof(type));
+    if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) {
+        int index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_NAME) {
+                index = aggregate_field_index(type, field.name);
+            }
+            TypeField type_field = type->aggregate.fields[index];
+            x64_gen_init(offset + (int32_t)type_field.offset, type_field.type, field.init);
+            index++;
+        }
+    } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR) {
+        long long index = 0;
+        for (size_t i = 0; i < expr->compound.num_fields; i++) {
+            CompoundField field = expr->compound.fields[i];
+            if (field.kind == FIELD_INDEX) {
+                index = x64_const_int(field.index);
+            }
+            x64_gen_init(offset + (int32_t)(index * type_sizeof(type->base)), type->base, field.init);
+            index++;
+        }
+    } else if (expr->compound.num_fields == 1) {
+        x64_gen_init(offset, type, expr->compound.fields[0].init);
+    }
+}
+
+// Statements
+
+void x64_gen_stmt(Stmt *stmt);
+
+void x64_gen_stmt_block(StmtList block) {
+    size_t num_locals = buf_len(x64_locals);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        x64_gen_stmt(block.stmts[i]);
+    }
+    x64_pop_locals(num_locals);
+}
+
+void x64_gen_return(Expr *expr) {
+    if (expr) {
+        Type *type = x64_ret_type;
+        x64_gen_expr(expr);
+        x64_gen_convert(expr->type, type);
+        X64ArgInfo ret = x64_classify(type);
+        if (ret.in_memory) {
+            x64_op_mem(0, true, 0x8B, X64_RDI, X64_RBP, x64_ret_ptr_offset);
+            x64_mov_rr(X64_RSI, X64_RAX);
+            x64_rep_movsb(type_sizeof(type));
+            x64_op_mem(0, true, 0x8B, X64_RAX, X64_RBP, x64_ret_ptr_offset);
+        } else if (ret.is_vector) {
+            x64_load_xmm(0, X64_RAX, 0, type_sizeof(type));
+        } else if (x64_is_mem_type(type)) {
+            x64_mov_rr(X64_RSI, X64_RAX);
+            int int_reg = X64_RAX, sse_reg = 0;
+            for (int i = 0; i < ret.num_parts; i++) {
+                size_t size = MIN(type_sizeof(type) - 8*i, 8);
+                if (ret.parts[i] == X64_CLASS_INT) {
+                    x64_load_int_part(int_reg, X64_RSI, 8*i, size);
+                    int_reg = X64_RDX;
+                } else {
+                    x64_load_xmm(sse_reg++, X64_RSI, 8*i, size > 4 ? 8 : 4);
+                }
+            }
+        }
+    }
+    x64_jmp(x64_ret_label);
+}
+
+void x64_gen_assign(Stmt *stmt) {
+    Expr *left = stmt->assign.left;
+    Type *type = unqualify_type(left->type);
+    x64_gen_addr(left);
+    x64_push(X64_RAX);
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        x64_gen_expr(stmt->assign.right);
+        x64_gen_convert(stmt->assign.right->type, type);
+    } else if (stmt->assign.op == TOKEN_INC || stmt->assign.op == TOKEN_DEC) {
+        x64_load(type, X64_RAX, 0);
+        int32_t delta = is_ptr_type(type) ? (int32_t)x64_elem_size(type) : 1;
+        x64_add_imm(X64_RAX, stmt->assign.op == TOKEN_INC ? delta : -delta);
+        x64_normalize(type);
+    } else {
+        x64_load(type, X64_RAX, 0);
+        Type *result = x64_gen_binary_rest(assign_token_to_binary_token[stmt->assign.op], type, stmt->assign.right);
+        x64_gen_convert(result, type);
+    }
+    x64_pop(X64_RDI);
+    x64_store(type, X64_RDI, 0);
+}
+
+void x64_gen_init_stmt(Stmt *stmt) {
+    Type *type;
+    if (stmt->init.type) {
+        type = stmt->init.type->type;
+        if (is_incomplete_array_type(type) && stmt->init.expr) {
+            type = stmt->init.expr->type;
+        }
+    } else {
+        type = stmt->init.expr->type;
+    }
+    type = unqualify_type(type);
+    int32_t offset = x64_alloc_slot(type_sizeof(type), type_alignof(type));
+    if (stmt->init.expr) {
+        x64_gen_init(offset, type, stmt->init.expr);
+    }
+    x64_push_local(stmt->init.name, type, offset);
+}
+
+// String switch cases are tested in order with calls to the C library's strcmp. The perfect hash dispatch is
+// only emitted by the C backend, which has the C compiler to turn it into a jump table.
+void x64_gen_strcmp_case(int32_t offset, const char *str, int label) {
+    x64_op_mem(0, true, 0x8B, X64_RDI, X64_RBP, offset);
+    x64_op_rip(0, true, 0x8D, X64_RSI, x64_str_sym(str), X64_RELOC_PC32);
+    int32_t pad = x64_depth % 16 ? 8 : 0;
+    x64_sub_rsp(pad);
+    x64_emit8(0xE8);
+    x64_add_reloc(X64_TEXT, x64_pos(), X64_RELOC_PLT32, x64_sym_index(str_intern("strcmp")), -4);
+    x64_emit32(0);
+    x64_add_rsp(pad);
+    x64_op_reg(0, false, 0x85, X64_RAX, X64_RAX);
+    x64_jcc(X64_E, label);
+}
+
+void x64_gen_switch(Stmt *stmt) {
+    Type *type = x64_decay(stmt->switch_stmt.expr->type);
+    if (!is_integer_type(type) && !is_ptr_type(type)) {
+        fatal_error(stmt->pos, "Switch on non-integer types is not supported by the x64 backend");
+    }
+    int32_t offset = x64_alloc_slot(8, 8);
+    x64_gen_expr(stmt->switch_stmt.expr);
+    x64_op_mem(0, true, 0x89, X64_RAX, X64_RBP, offset);
+    int end = x64_new_label(), default_label = end;
+    int *labels = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        buf_push(labels, x64_new_label());
+    }
+    // Constant cases are tested as ranges: value - lo <= hi - lo, unsigned.
+    for (size_t i = 0; i < stmt->switch_stmt.num_ranges; i++) {
+        SwitchRange range = stmt->switch_stmt.ranges[i];
+        x64_op_mem(0, true, 0x8B, X64_RAX, X64_RBP, offset);
+        x64_mov_imm(X64_RCX, switch_key_value(type, range.lo));
+        x64_op_reg(0, true, 0x29, X64_RCX, X64_RAX);
+        x64_mov_imm(X64_RCX, range.hi - range.lo);
+        x64_op_reg(0, true, 0x39, X64_RCX, X64_RAX);
+        x64_jcc(X64_BE, labels[range.case_index]);
+    }
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase switch_case = stmt->switch_stmt.cases[i];
+        int label = labels[i];
+        for (size_t j = 0; j < switch_case.num_exprs && !stmt->switch_stmt.ranges; j++) {
+            if (stmt->switch_stmt.str_switch) {
+                x64_gen_strcmp_case(offset, switch_case.exprs[j]->str_lit.val, label);
+                continue;
+            }
+            x64_gen_expr(switch_case.exprs[j]);
+            x64_gen_convert(switch_case.exprs[j]->type, type);
+            x64_op_mem(0, true, 0x3B, X64_RAX, X64_RBP, offset);
+            x64_jcc(X64_E, label);
+        }
+        if (switch_case.is_default) {
+            default_label = label;
+        }
+    }
+    x64_jmp(default_label);
+    buf_push(x64_break_labels, end);
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        x64_bind_label(labels[i]);
+        x64_gen_stmt_block(stmt->switch_stmt.cases[i].block);
+        x64_jmp(end);
+    }
+    buf__hdr(x64_break_labels)->len--;
+    x64_bind_label(end);
+    buf_free(labels);
+}
+
+void x64_gen_stmt(Stmt *stmt) {
+    assert(x64_depth == 0);
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        x64_gen_return(stmt->expr);
+        break;
+    case STMT_BREAK:
+        x64_jmp(x64_break_labels[buf_len(x64_break_labels) - 1]);
+        break;
+    case STMT_CONTINUE:
+        x64_jmp(x64_continue_labels[buf_len(x64_continue_labels) - 1]);
+        break;
+    case STMT_BLOCK:
+        x64_gen_stmt_block(stmt->block);
+        break;
+    case STMT_IF: {
+        int end = x64_new_label();
+        int next = x64_new_label();
+        x64_gen_cond_jump(stmt->if_stmt.cond, false, next);
+        x64_gen_stmt_block(stmt->if_stmt.then_block);
+        x64_jmp(end);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            ElseIf elseif = stmt->if_stmt.elseifs[i];
+            x64_bind_label(next);
+            next = x64_new_label();
+            x64_gen_cond_jump(elseif.cond, false, next);
+            x64_gen_stmt_block(elseif.block);
+            x64_jmp(end);
+        }
+        x64_bind_label(next);
+        x64_gen_stmt_block(stmt->if_stmt.else_block);
+        x64_bind_label(end);
+        break;
+    }
+    case STMT_WHILE:
+    case STMT_DO_WHILE: {
+        int top = x64_new_label(), cont = x64_new_label(), end = x64_new_label();
+        buf_push(x64_break_labels, end);
+        buf_push(x64_continue_labels, cont);
+        if (stmt->kind == STMT_WHILE) {
+            x64_jmp(cont);
+        }
+        x64_bind_label(top);
+        x64_gen_stmt_block(stmt->while_stmt.block);
+        x64_bind_label(cont);
+        x64_gen_cond_jump(stmt->while_stmt.cond, true, top);
+        x64_bind_label(end);
+        buf__hdr(x64_break_labels)->len--;
+        buf__hdr(x64_continue_labels)->len--;
+        break;
+    }
+    case STMT_FOR: {
+        size_t num_locals = buf_len(x64_locals);
+        int top = x64_new_label(), cont = x64_new_label(), end = x64_new_label();
+        if (stmt->for_stmt.init) {
+            x64_gen_stmt(stmt->for_stmt.init);
+        }
+        buf_push(x64_break_labels, end);
+        buf_push(x64_continue_labels, cont);
+        x64_bind_label(top);
+        if (stmt->for_stmt.cond) {
+            x64_gen_cond_jump(stmt->for_stmt.cond, false, end);
+        }
+        x64_gen_stmt_block(stmt->for_stmt.block);
+        x64_bind_label(cont);
+        if (stmt->for_stmt.next) {
+            x64_gen_stmt(stmt->for_stmt.next);
+        }
+        x64_jmp(top);
+        x64_bind_label(end);
+        buf__hdr(x64_break_labels)->len--;
+        buf__hdr(x64_continue_labels)->len--;
+        x64_pop_locals(num_locals);
+        break;
+    }
+    case STMT_SWITCH:
+        x64_gen_switch(stmt);
+        break;
+    case STMT_ASSIGN:
+        x64_gen_assign(stmt);
+        break;
+    case STMT_INIT:
+        x64_gen_init_stmt(stmt);
+        break;
+    case STMT_EXPR:
+        x64_gen_expr(stmt->expr);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+// A frame aligned beyond the 16 bytes the ABI guarantees keeps rbp aligned and saves the entry rsp in a slot,
+// so stack-passed parameters are copied into the frame instead of being addressed above rbp.
+void x64_gen_func_code(Sym *sym, size_t frame_align) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    bool realign = frame_align > 16;
+    buf_clear(x64_locals);
+    x64_depth = 0;
+    x64_frame_size = 0;
+    x64_frame_align = frame_align;
+    x64_max_slot_align = 1;
+    x64_ret_type = type->func.ret;
+    x64_ret_label = x64_new_label();
+    x64_push(X64_RBP);
+    if (realign) {
+        x64_mov_rr(X64_R11, X64_RSP);
+        x64_op_reg(0, true, 0x81, 4, X64_RSP);
+        x64_emit32((uint32_t)-(int32_t)frame_align);
+    }
+    x64_mov_rr(X64_RBP, X64_RSP);
+    x64_op_reg(0, true, 0x81, 5, X64_RSP);
+    size_t frame_patch = x64_pos();
+    x64_emit32(0);
+    x64_depth = 0;
+    if (realign) {
+        x64_saved_rsp_offset = x64_alloc_slot(8, 8);
+        x64_op_mem(0, true, 0x89, X64_R11, X64_RBP, x64_saved_rsp_offset);
+    }
+    X64ArgInfo ret = x64_classify(type->func.ret);
+    int num_int = 0, num_sse = 0;
+    if (ret.in_memory) {
+        x64_ret_ptr_offset = x64_alloc_slot(8, 8);
+        x64_op_mem(0, true, 0x89, X64_RDI, X64_RBP, x64_ret_ptr_offset);
+        num_int = 1;
+    }
+    int32_t stack_offset = 16;
+    for (size_t i = 0; i < type->func.num_params; i++) {
+        Type *param_type = x64_decay(type->func.params[i]);
+        X64ArgInfo info = x64_classify(param_type);
+        int int_index = num_int, sse_index = num_sse;
+        x64_assign_arg_regs(&info, &num_int, &num_sse);
+        int32_t offset;
+        if (info.in_memory) {
+            offset = stack_offset;
+            stack_offset += (int32_t)x64_arg_stack_size(&info);
+        } else {
+            offset = x64_alloc_slot(x64_arg_stack_size(&info), MAX(type_alignof(param_type), 8));
+            if (info.is_vector) {
+                x64_store_xmm(sse_index, X64_RBP, offset, type_sizeof(param_type));
+            }
+            for (int j = 0; j < info.num_parts; j++) {
+                if (info.parts[j] == X64_CLASS_INT) {
+                    x64_op_mem(0, true, 0x89, x64_int_arg_regs[int_index++], X64_RBP, offset + 8*j);
+                } else {
+                    x64_op_mem(0xF2, false, 0x0F11, sse_index++, X64_RBP, offset + 8*j);
+                }
+            }
+        }
+        x64_push_local(decl->func.params[i].name, param_type, offset);
+    }
+    if (realign) {
+        // Copying clobbers rdi, rsi and rcx, so it waits until the register parameters are saved.
+        for (X64Local *it = x64_locals; it != buf_end(x64_locals); it++) {
+            if (it->offset > 0) {
+                int32_t offset = x64_alloc_slot(type_sizeof(it->type), type_alignof(it->type));
+                x64_op_mem(0, true, 0x8B, X64_RAX, X64_RBP, x64_saved_rsp_offset);
+                x64_add_imm(X64_RAX, it->offset);
+                x64_copy(X64_RBP, offset, type_sizeof(it->type));
+                it->offset = offset;
+            }
+        }
+    }
+    x64_gen_stmt_block(decl->func.block);
+    x64_bind_label(x64_ret_label);
+    if (realign) {
+        x64_op_mem(0, true, 0x8B, X64_RSP, X64_RBP, x64_saved_rsp_offset);
+    } else {
+        x64_mov_rr(X64_RSP, X64_RBP);
+    }
+    x64_pop(X64_RBP);
+    x64_emit8(0xC3);
+    x64_patch32(frame_patch, (uint32_t)ALIGN_UP(x64_frame_size, 16));
+    x64_resolve_fixups();
+}
+
+void x64_gen_func(Sym *sym) {
+    size_t start = x64_pos();
+    size_t num_relocs = buf_len(x64_relocs);
+    x64_gen_func_code(sym, 16);
+    if (x64_max_slot_align > 16) {
+        // Throw away the first attempt. Anything it added to .rodata is left in place.
+        buf__hdr(x64_sections[X64_TEXT])->len = start;
+        if (x64_relocs) {
+            buf__hdr(x64_relocs)->len = num_relocs;
+        }
+        x64_gen_func_code(sym, x64_max_slot_align);
+    }
+    x64_define_sym(sym->name, X64_TEXT, start, x64_pos() - start, true);
+}
+
+// Static data
+
+double x64_eval_float(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_FLOAT:
+        return expr->float_lit.val;
+    case EXPR_INT:
+        return (double)expr->int_lit.val;
+    case EXPR_NAME: {
+        Sym *sym = sym_get(expr->name);
+        if (sym && sym->kind == SYM_CONST) {
+            if (is_floating_type(sym->type)) {
+                return x64_eval_float(sym->decl->const_decl.expr);
+            }
+            unsigned long long val = x64_const_val(sym->type, sym->val);
+            return x64_is_signed(sym->type) ? (double)(long long)val : (double)val;
+        }
+        break;
+    }
+    case EXPR_UNARY:
+        if (expr->unary.op == TOKEN_ADD) {
+            return x64_eval_float(expr->unary.expr);
+        } else if (expr->unary.op == TOKEN_SUB) {
+            return -x64_eval_float(expr->unary.expr);
+        }
+        break;
+    case EXPR_BINARY: {
+        double left = x64_eval_float(expr->binary.left);
+        double right = x64_eval_float(expr->binary.right);
+        switch (expr->binary.op) {
+        case TOKEN_ADD:
+            return left + right;
+        case TOKEN_SUB:
+            return left - right;
+        case TOKEN_MUL:
+            return left * right;
+        case TOKEN_DIV:
+            return left / right;
+        default:
+            break;
+        }
+        break;
+    }
+    case EXPR_CAST:
+        return x64_eval_float(expr->cast.expr);
+    case EXPR_CALL:
+        if (expr->call.folded_data) {
+            return folded_call_float(expr);
+        } else if (!expr->call.expr->type && !expr->call.builtin) {
+            return x64_eval_float(expr->call.args[0]);
+        }
+        break;
+    default:
+        break;
+    }
+    fatal_error(expr->pos, "Floating-point initializer is not supported by the x64 backend");
+    return 0;
+}
+
+// Returns the symbol an address constant such as a string, &global or a global array refers to.
+bool x64_static_addr(Expr *expr, size_t *sym, long long *addend);
+
+// Finds the symbol and byte offset of a global lvalue built from names, constant indexes and fields, for
+// initializers like &garr[2] or &gs.field. SoA elements aren't contiguous, so they have no single address.
+bool x64_static_lvalue(Expr *expr, size_t *sym, long long *addend) {
+    switch (expr->kind) {
+    case EXPR_NAME: {
+        Sym *name_sym = sym_get(expr->name);
+        if (name_sym && (name_sym->kind == SYM_VAR || name_sym->kind == SYM_FUNC)) {
+            *sym = x64_sym_index(expr->name);
+            return true;
+        }
+        return false;
+    }
+    case EXPR_INDEX: {
+        Type *type = unqualify_type(expr->index.expr->type);
+        if (is_soa_array_type(type)) {
+            return false;
+        }
+        if (is_array_type(type)) {
+            if (!x64_static_lvalue(expr->index.expr, sym, addend)) {
+                return false;
+            }
+        } else if (!is_ptr_type(type) || !x64_static_addr(expr->index.expr, sym, addend)) {
+            return false;
+        }
+        *addend += x64_const_int(expr->index.index) * (long long)type_sizeof(type->base);
+        return true;
+    }
+    case EXPR_FIELD: {
+        Type *type = unqualify_type(expr->field.expr->type);
+        if ((type->kind != TYPE_STRUCT && type->kind != TYPE_UNION) || !x64_static_lvalue(expr->field.expr, sym, addend)) {
+            return false;
+        }
+        *addend += type->aggregate.fields[aggregate_field_index(type, expr->field.name)].offset;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// Finds the relocation for a pointer initializer: a symbol plus a constant byte offset.
+bool x64_static_addr(Expr *expr, size_t *sym, long long *addend) {
+    switch (expr->kind) {
+    case EXPR_STR:
+        *sym = x64_str_sym(expr->str_lit.val);
+        return true;
+    case EXPR_CAST:
+        return x64_static_addr(expr->cast.expr, sym, addend);
+    case EXPR_UNARY:
+        return expr->unary.op == TOKEN_AND && x64_static_lvalue(expr->unary.expr, sym, addend);
+    case EXPR_NAME: {
+        Sym *name_sym = sym_get(expr->name);
+        if (name_sym && (name_sym->kind == SYM_FUNC || (name_sym->kind == SYM_VAR && is_array_type(unqualify_type(name_sym->type))))) {
+            *sym = x64_sym_index(expr->name);
+            return true;
+        }
+        return false;
+    }
+    case EXPR_BINARY: {
+        // Pointer plus or minus an integer constant, with the pointer on either side of a +.
+        TokenKind op = expr->binary.op;
+        Expr *base = expr->binary.left;
+        Expr *offset = expr->binary.right;
+        if (op == TOKEN_ADD && !is_ptr_type(x64_decay(base->type))) {
+            base = expr->binary.right;
+            offset = expr->binary.left;
+        }
+        Type *type = x64_decay(base->type);
+        if ((op != TOKEN_ADD && op != TOKEN_SUB) || !is_ptr_type(type) || !is_integer_type(unqualify_type(offset->type))) {
+            return false;
+        }
+        if (!x64_static_addr(base, sym, addend)) {
+            return false;
+        }
+        long long delta = x64_const_int(offset) * (long long)type_sizeof(type->base);
+        *addend += op == TOKEN_SUB ? -delta : delta;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void x64_gen_static(size_t offset, Type *type, Expr *expr) {
+    type = unqualify_type(type);
+    char *data = x64_sections[X64_DATA];
+    if (expr->kind == EXPR_COMPOUND) {
+        if (type->kind == TYPE_STRUCT || type->kind == TYPE_UNION) {
+            int index = 0;
+            for (size_t i = 0; i < expr->compound.num_fields; i++) {
+                CompoundField field = expr->compound.fields[i];
+                if (field.kind == FIELD_NAME) {
+                    index = aggregate_field_index(type, field.name);
+                }
+                TypeField type_field = type->aggregate.fields[index];
+                x64_gen_static(offset + type_field.offset, type_field.type, field.init);
+                index++;
+            }
+        } else if (type->kind == TYPE_ARRAY || type->kind == TYPE_VECTOR) {
+            long long index = 0;
+            for (size_t i = 0; i < expr->compound.num_fields; i++) {
+                CompoundField field = expr->compound.fields[i];
+                if (field.kind == FIELD_INDEX) {
+                    index = x64_const_int(field.index);
+                }
+                x64_gen_static(offset + index * type_sizeof(type->base), type->base, field.init);
+                index++;
+            }
+        } else if (expr->compound.num_fields == 1) {
+            x64_gen_static(offset, type, expr->compound.fields[0].init);
+        }
+        return;
+    }
+    size_t sym;
+    long long addend = 0;
+    if (is_floating_type(type)) {
+        double val = x64_eval_float(expr);
+        if (type->kind == TYPE_FLOAT) {
+            float f = (float)val;
+            memcpy(data + offset, &f, sizeof(f));
+        } else {
+            memcpy(data + offset, &val, sizeof(val));
+        }
+    } else if ((is_ptr_type(type) || type->kind == TYPE_FUNC) && x64_static_addr(expr, &sym, &addend)) {
+        x64_add_reloc(X64_DATA, offset, X64_RELOC_ABS64, sym, addend);
+    } else if (is_ptr_type(type) && expr->kind == EXPR_UNARY && expr->unary.op == TOKEN_AND) {
+        fatal_error(expr->pos, "Address initializer is not supported by the x64 backend");
+    } else if (is_integer_type(type) || is_ptr_type(type)) {
+        Operand operand = resolve_const_expr(expr);
+        cast_operand(&operand, type);
+        unsigned long long val = x64_const_val(operand.type, operand.val);
+        memcpy(data + offset, &val, type_sizeof(type));
+    } else {
+        fatal_error(expr->pos, "Initializer is not supported by the x64 backend");
+    }
+}
+
+void x64_gen_global_var(Sym *sym) {
+    Decl *decl = sym->decl;
+    Type *type = sym->type;
+    size_t size = type_sizeof(type);
+    size_t align = type_alignof(type);
+    Note *align_note = get_decl_note(decl, align_name);
+    if (align_note) {
+        align = MAX(align, (size_t)x64_const_int(align_note->args[0]));
+    }
+    if (decl->var.expr) {
+        size_t offset = x64_section_alloc(X64_DATA, size, align);
+        x64_gen_static(offset, type, decl->var.expr);
+        x64_define_sym(sym->name, X64_DATA, offset, size, false);
+    } else {
+        x64_define_sym(sym->name, X64_BSS, x64_section_alloc(X64_BSS, size, align), size, false);
+    }
+}
+
+void x64_gen_const_data(Sym *sym) {
+    size_t size = type_sizeof(sym->type);
+    size_t offset = x64_section_alloc(X64_RODATA, size, type_alignof(sym->type));
+    memcpy(x64_sections[X64_RODATA] + offset, sym->decl->const_decl.expr->call.folded_data, size);
+    x64_define_sym(sym->name, X64_RODATA, offset, size, false);
+}
+
+void x64_reset(void) {
+    for (int i = 0; i < NUM_X64_SECTIONS; i++) {
+        buf_free(x64_sections[i]);
+        x64_section_aligns[i] = 1;
+    }
+    x64_section_aligns[X64_TEXT] = 16;
+    x64_bss_size = 0;
+    buf_free(x64_syms);
+    buf_free(x64_relocs);
+    map_free(&x64_sym_map);
+    map_free(&x64_str_map);
+}
+
+void x64_gen_all(void) {
+    x64_reset();
+    for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
+        Sym *sym = *it;
+        if (sym->decl && sym->kind == SYM_VAR && !is_decl_foreign(sym->decl)) {
+            x64_gen_global_var(sym);
+        } else if (sym->decl && sym->kind == SYM_CONST && !is_scalar_type(sym->type)) {
+            x64_gen_const_data(sym);
+        }
+    }
+    for (Sym **it = global_syms_buf; it != buf_end(global_syms_buf); it++) {
+        Sym *sym = *it;
+        if (sym->decl && sym->decl->kind == DECL_FUNC && !is_decl_foreign(sym->decl) && sym->state == SYM_RESOLVED) {
+            x64_gen_func(sym);
+        }
+    }
+}